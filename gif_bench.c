@@ -0,0 +1,619 @@
+//
+// GIFLIB benchmark
+//
+// Generates a deterministic synthetic corpus (or uses the files given on the
+// command line) and measures DGifSlurp() and EGifSpew() on each file, once
+// with every LZW kernel variant the CPU supports. The results are written to
+// stdout as JSON lines, one object per measurement, so they can be compared
+// from release to release:
+//
+// {"file":"noise_256.gif","op":"decode","kernel":"avx2","width":1024,...}
+//
+// The "lzw_decode" and "lzw_encode" ops time only the LZW kernel calls of
+// DGifSlurp() and EGifSpew() (GIF_PHASE_DECODE and GIF_PHASE_ENCODE, on the
+// de-chunked data and the frames' pixels), without the file I/O, parsing,
+// chunking and deinterlacing around them. The string copy is inlined into the
+// decoder, so it's part of lzw_decode.
+//
+// mb_per_s is based on the compressed size (the file read by the decoder or
+// written by the encoder) and mpixels_per_s on the decoded pixels. Each measurement
+// runs in its own process, which makes peak_rss_kb the high water mark of
+// that measurement alone.
+//
+// usage: gif_bench [-n iterations] [-d corpus dir] [-q] [-k] [-t trace.json] [-b threads] [file.gif ...]
+//  -n  timed iterations per measurement (default 20)
+//  -d  directory for the generated corpus and the encoder's output
+//      (default: a new directory in /tmp which is removed at the end)
+//  -q  quick run; skip the huge canvases
+//  -k  only use the kernel variant picked for this CPU
+//  -t  after the timed iterations, run each measurement once more with
+//      GifSetTraceFunc() and write its phases to a Chrome trace JSON file
+//      (chrome://tracing or Perfetto), one process per measurement
+//  -b  also decode all of the files together with DGifDecodeBatch() on this
+//      many threads (0 = one per CPU), with each input backend, from the
+//      page cache ("cold":false) and with the files dropped from it before
+//      each iteration ("cold":true)
+//  files given on the command line are measured instead of the corpus
+//
+#define _POSIX_C_SOURCE 200809L // posix_fadvise()
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+
+#include "gif_lib.h"
+
+#define BENCH_SEED 0x2f6b1d3c
+
+typedef struct bench_case {
+    const char *szName;
+    int iWidth, iHeight;
+    int iColors; // palette size (2..256)
+    int iEntropy; // 0 = flat, 1 = gradient, 2 = noise
+    int iFrames;
+    bool bInterlace;
+    bool bHuge;
+} BENCH_CASE;
+
+static const BENCH_CASE benchCases[] = {
+    {"flat_2.gif", 1024, 768, 2, 0, 1, false, false},
+    {"flat_16.gif", 1024, 768, 16, 0, 1, false, false},
+    {"flat_256.gif", 1024, 768, 256, 0, 1, false, false},
+    {"gradient_2.gif", 1024, 768, 2, 1, 1, false, false},
+    {"gradient_16.gif", 1024, 768, 16, 1, 1, false, false},
+    {"gradient_256.gif", 1024, 768, 256, 1, 1, false, false},
+    {"gradient_256_i.gif", 1024, 768, 256, 1, 1, true, false},
+    {"noise_2.gif", 1024, 768, 2, 2, 1, false, false},
+    {"noise_16.gif", 1024, 768, 16, 2, 1, false, false},
+    {"noise_16_i.gif", 1024, 768, 16, 2, 1, true, false},
+    {"noise_256.gif", 1024, 768, 256, 2, 1, false, false},
+    {"noise_256_i.gif", 1024, 768, 256, 2, 1, true, false},
+    {"anim_16.gif", 320, 240, 16, 1, 300, false, false},
+    {"anim_256.gif", 480, 270, 256, 2, 120, false, false},
+    {"huge_flat_16.gif", 8192, 8192, 16, 0, 1, false, true},
+    {"huge_gradient_256.gif", 8192, 4096, 256, 1, 1, false, true},
+};
+#define BENCH_CASE_COUNT (int)(sizeof(benchCases) / sizeof(BENCH_CASE))
+
+static const char *szKernels[] = {"generic", "bmi2", "avx2"};
+static const char *szInputs[] = {"posix", "uring"};
+static const char *szTraceFile; // -t
+
+static uint32_t u32Random;
+//
+// BenchRandom
+//
+// xorshift32; the corpus only depends on BENCH_SEED
+//
+static uint32_t BenchRandom(void)
+{
+    u32Random ^= u32Random << 13;
+    u32Random ^= u32Random >> 17;
+    u32Random ^= u32Random << 5;
+    return u32Random;
+} /* BenchRandom() */
+//
+// BenchTime
+//
+// Monotonic time in nanoseconds
+//
+static uint64_t BenchTime(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+} /* BenchTime() */
+//
+// BenchTrace
+//
+// GifTraceFunc writing Chrome trace events (pUser is the trace file)
+//
+static void BenchTrace(GifFileType *gif, int iPhase, bool bBegin, int iFrame, uint64_t u64Time, void *pUser)
+{
+    (void)gif;
+    fprintf((FILE *)pUser, "{\"name\":\"%s\",\"cat\":\"gif\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%d,\"tid\":0,\"args\":{\"frame\":%d}},\n",
+            GifPhaseName(iPhase), bBegin ? 'B' : 'E', (double)u64Time / 1e3, (int)getpid(), iFrame);
+} /* BenchTrace() */
+//
+// BenchPhaseTime
+//
+// GifTraceFunc adding up the time spent in one phase (pUser is a BENCH_PHASE)
+//
+typedef struct bench_phase {
+    int iPhase; // GIF_PHASE_* to time
+    uint64_t u64Start, u64Time;
+} BENCH_PHASE;
+
+static void BenchPhaseTime(GifFileType *gif, int iPhase, bool bBegin, int iFrame, uint64_t u64Time, void *pUser)
+{
+    BENCH_PHASE *pPhase = (BENCH_PHASE *)pUser;
+
+    (void)gif;
+    (void)iFrame;
+    if (iPhase != pPhase->iPhase)
+        return;
+    if (bBegin)
+        pPhase->u64Start = u64Time;
+    else
+        pPhase->u64Time += u64Time - pPhase->u64Start;
+} /* BenchPhaseTime() */
+//
+// BenchTraceRun
+//
+// One more decode or encode of the file with the phases traced (-t)
+//
+static int BenchTraceRun(const char *szFile, const char *szOut, int iKernel, bool bEncode)
+{
+    GifFileType *gifIn, *gifOut;
+    FILE *f;
+    const char *szName, *szOp = bEncode ? "EGifSpew" : "DGifSlurp";
+    int iErr, rc = 0;
+
+    f = fopen(szTraceFile, "a");
+    if (f == NULL)
+        return 1;
+    szName = strrchr(szFile, '/');
+    szName = (szName != NULL) ? szName + 1 : szFile;
+    fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"%s %s %s\"}},\n",
+            (int)getpid(), bEncode ? "encode" : "decode", szName, szKernels[iKernel]);
+    gifIn = DGifOpenFileName(szFile, &iErr);
+    if (gifIn == NULL) {
+        fclose(f);
+        return 1;
+    }
+    if (!bEncode) {
+        GifSetTraceFunc(gifIn, BenchTrace, f);
+        fprintf(f, "{\"name\":\"%s\",\"cat\":\"gif\",\"ph\":\"B\",\"ts\":%.3f,\"pid\":%d,\"tid\":0},\n", szOp, BenchTime() / 1e3, (int)getpid());
+    }
+    if (DGifSlurp(gifIn) != GIF_OK)
+        rc = 1;
+    if (bEncode && rc == 0) {
+        gifOut = EGifOpenFileName(szOut, false, &iErr);
+        if (gifOut == NULL) {
+            DGifCloseFile(gifIn, &iErr);
+            fclose(f);
+            return 1;
+        }
+        gifOut->SWidth = gifIn->SWidth;
+        gifOut->SHeight = gifIn->SHeight;
+        gifOut->SColorResolution = gifIn->SColorResolution;
+        gifOut->SBackGroundColor = gifIn->SBackGroundColor;
+        GifMoveSavedImages(gifOut, gifIn);
+        GifSetTraceFunc(gifOut, BenchTrace, f);
+        fprintf(f, "{\"name\":\"%s\",\"cat\":\"gif\",\"ph\":\"B\",\"ts\":%.3f,\"pid\":%d,\"tid\":0},\n", szOp, BenchTime() / 1e3, (int)getpid());
+        if (EGifSpew(gifOut) != GIF_OK)
+            rc = 1;
+    }
+    fprintf(f, "{\"name\":\"%s\",\"cat\":\"gif\",\"ph\":\"E\",\"ts\":%.3f,\"pid\":%d,\"tid\":0},\n", szOp, BenchTime() / 1e3, (int)getpid());
+    DGifCloseFile(gifIn, &iErr);
+    fclose(f);
+    return rc;
+} /* BenchTraceRun() */
+//
+// BenchFillFrame
+//
+// Generate the pixels of one frame. Animation frames move the pattern so
+// that consecutive frames differ.
+//
+static void BenchFillFrame(uint8_t *pPixels, const BENCH_CASE *pCase, int iFrame)
+{
+    int x, y, iMask = pCase->iColors - 1;
+    uint8_t *d = pPixels;
+
+    for (y = 0; y < pCase->iHeight; y++)
+    {
+        for (x = 0; x < pCase->iWidth; x++)
+        {
+            switch (pCase->iEntropy) {
+            case 0: // large areas of a few colors
+                *d++ = (uint8_t)((((x + iFrame * 4) >> 7) + (y >> 7)) & 3 & iMask);
+                break;
+            case 1: // smooth ramps, occasional speckles
+                if ((BenchRandom() & 63) == 0)
+                    *d++ = (uint8_t)(BenchRandom() & iMask);
+                else
+                    *d++ = (uint8_t)(((x + iFrame) / 5 + y / 3) & iMask);
+                break;
+            default: // uniform noise
+                *d++ = (uint8_t)(BenchRandom() & iMask);
+                break;
+            }
+        }
+    }
+} /* BenchFillFrame() */
+//
+// BenchWriteCase
+//
+// Encode one corpus file with this library
+//
+static int BenchWriteCase(const BENCH_CASE *pCase, const char *szPath)
+{
+    GifFileType *gif;
+    GifColorType colors[256];
+    SavedImage *pImage;
+    int i, iErr, iBits;
+
+    gif = EGifOpenFileName(szPath, false, &iErr);
+    if (gif == NULL)
+        return GIF_ERROR;
+    for (i = 0; i < pCase->iColors; i++) {
+        colors[i].Red = (GifByteType)(i * 255 / (pCase->iColors - 1));
+        colors[i].Green = (GifByteType)(255 - colors[i].Red);
+        colors[i].Blue = (GifByteType)(i * 37);
+    }
+    for (iBits = 1; (1 << iBits) < pCase->iColors; iBits++)
+        ;
+    gif->SWidth = pCase->iWidth;
+    gif->SHeight = pCase->iHeight;
+    gif->SColorResolution = (iBits < 2) ? 2 : iBits; // also the LZW code size
+    gif->SBackGroundColor = 0;
+    gif->SColorMap = GifMakeMapObject(pCase->iColors, colors);
+    if (gif->SColorMap == NULL) {
+        EGifCloseFile(gif, &iErr);
+        return GIF_ERROR;
+    }
+    for (i = 0; i < pCase->iFrames; i++) {
+        pImage = GifMakeSavedImage(gif, NULL);
+        if (pImage == NULL) {
+            EGifCloseFile(gif, &iErr);
+            return GIF_ERROR;
+        }
+        pImage->ImageDesc.Width = pCase->iWidth;
+        pImage->ImageDesc.Height = pCase->iHeight;
+        pImage->ImageDesc.Interlace = pCase->bInterlace;
+        pImage->RasterBits = (GifByteType *)malloc((size_t)pCase->iWidth * pCase->iHeight);
+        if (pImage->RasterBits == NULL) {
+            EGifCloseFile(gif, &iErr);
+            return GIF_ERROR;
+        }
+        BenchFillFrame(pImage->RasterBits, pCase, i);
+    }
+    return (EGifSpew(gif) == GIF_OK) ? GIF_OK : GIF_ERROR;
+} /* BenchWriteCase() */
+//
+// BenchCompare
+//
+static int BenchCompare(const void *a, const void *b)
+{
+    uint64_t ua = *(const uint64_t *)a, ub = *(const uint64_t *)b;
+    return (ua > ub) - (ua < ub);
+} /* BenchCompare() */
+//
+// BenchRun
+//
+// Time iIterations decodes (bEncode == false) or encodes of a file and print
+// the JSON result. Encoding starts from frames decoded outside the timed
+// part. With bKernel only the LZW kernel calls are timed. Returns 0 for
+// success; a failed decode or encode fails the whole measurement.
+//
+static int BenchRun(const char *szFile, const char *szOut, int iKernel, bool bEncode, bool bKernel, int iIterations)
+{
+    GifFileType *gifIn, *gifOut;
+    uint64_t *pTimes, u64Start, u64Total = 0, u64Pixels = 0;
+    struct stat st;
+    struct rusage ru;
+    BENCH_PHASE phase;
+    int i, j, iErr, iWidth = 0, iHeight = 0, iFrames = 0;
+    double dSeconds;
+    const char *szName, *szOp;
+
+    pTimes = (uint64_t *)malloc(iIterations * sizeof(uint64_t));
+    if (pTimes == NULL)
+        return 1;
+    for (i = 0; i <= iIterations; i++) // the first pass warms up the caches
+    {
+        phase.iPhase = bEncode ? GIF_PHASE_ENCODE : GIF_PHASE_DECODE;
+        phase.u64Time = 0;
+        u64Start = BenchTime();
+        gifIn = DGifOpenFileName(szFile, &iErr);
+        if (gifIn != NULL && bKernel && !bEncode)
+            GifSetTraceFunc(gifIn, BenchPhaseTime, &phase);
+        if (gifIn == NULL || DGifSlurp(gifIn) != GIF_OK) {
+            fprintf(stderr, "gif_bench: can't decode %s\n", szFile);
+            return 1;
+        }
+        if (i == 0) {
+            iWidth = gifIn->SWidth;
+            iHeight = gifIn->SHeight;
+            iFrames = gifIn->ImageCount;
+            for (j = 0; j < gifIn->ImageCount; j++)
+                u64Pixels += (uint64_t)gifIn->SavedImages[j].ImageDesc.Width * gifIn->SavedImages[j].ImageDesc.Height;
+        }
+        if (bEncode) {
+            u64Start = BenchTime();
+            gifOut = EGifOpenFileName(szOut, false, &iErr);
+            if (gifOut == NULL) {
+                fprintf(stderr, "gif_bench: can't create %s\n", szOut);
+                return 1;
+            }
+            gifOut->SWidth = gifIn->SWidth;
+            gifOut->SHeight = gifIn->SHeight;
+            gifOut->SColorResolution = gifIn->SColorResolution;
+            gifOut->SBackGroundColor = gifIn->SBackGroundColor;
+            GifMoveSavedImages(gifOut, gifIn);
+            if (bKernel)
+                GifSetTraceFunc(gifOut, BenchPhaseTime, &phase);
+            if (EGifSpew(gifOut) != GIF_OK) {
+                fprintf(stderr, "gif_bench: can't encode %s\n", szFile);
+                return 1;
+            }
+            if (i > 0)
+                pTimes[i-1] = BenchTime() - u64Start;
+            DGifCloseFile(gifIn, &iErr);
+        } else {
+            DGifCloseFile(gifIn, &iErr);
+            if (i > 0)
+                pTimes[i-1] = BenchTime() - u64Start;
+        }
+        if (i > 0 && bKernel)
+            pTimes[i-1] = phase.u64Time;
+    }
+    for (i = 0; i < iIterations; i++)
+        u64Total += pTimes[i];
+    qsort(pTimes, iIterations, sizeof(uint64_t), BenchCompare);
+    getrusage(RUSAGE_SELF, &ru);
+    stat(bEncode ? szOut : szFile, &st);
+    dSeconds = (double)u64Total / 1e9;
+    szName = strrchr(szFile, '/');
+    szName = (szName != NULL) ? szName + 1 : szFile;
+    if (bKernel)
+        szOp = bEncode ? "lzw_encode" : "lzw_decode";
+    else
+        szOp = bEncode ? "encode" : "decode";
+    printf("{\"file\":\"%s\",\"op\":\"%s\",\"kernel\":\"%s\",\"width\":%d,\"height\":%d,\"frames\":%d,"
+           "\"pixels\":%llu,\"%s_bytes\":%lld,\"iterations\":%d,\"mb_per_s\":%.2f,\"mpixels_per_s\":%.2f,"
+           "\"mean_ms\":%.4f,\"p50_ms\":%.4f,\"p99_ms\":%.4f,\"peak_rss_kb\":%ld}\n",
+           szName, szOp, szKernels[iKernel], iWidth, iHeight, iFrames,
+           (unsigned long long)u64Pixels, bEncode ? "output" : "file", (long long)st.st_size, iIterations,
+           (double)st.st_size * iIterations / dSeconds / 1e6, (double)u64Pixels * iIterations / dSeconds / 1e6,
+           dSeconds * 1e3 / iIterations, pTimes[(iIterations - 1) / 2] / 1e6,
+           pTimes[(iIterations * 99 + 99) / 100 - 1] / 1e6, ru.ru_maxrss);
+    free(pTimes);
+    if (szTraceFile != NULL && !bKernel) { // untimed, so tracing doesn't affect the results
+        fflush(stdout);
+        return BenchTraceRun(szFile, szOut, iKernel, bEncode);
+    }
+    return 0;
+} /* BenchRun() */
+//
+// BenchBatchDone
+//
+// GifBatchFunc counting the decoded pixels of an item (-1 = failed)
+//
+static void BenchBatchDone(GifFileType *gif, int iItem, int iErr, void *pUser)
+{
+    int64_t *pPixels = (int64_t *)pUser;
+    int i;
+
+    (void)iItem;
+    *pPixels = -1;
+    if (iErr != GIF_OK)
+        return;
+    *pPixels = 0;
+    for (i = 0; i < gif->ImageCount; i++)
+        *pPixels += (int64_t)gif->SavedImages[i].ImageDesc.Width * gif->SavedImages[i].ImageDesc.Height;
+} /* BenchBatchDone() */
+//
+// BenchBatchRun
+//
+// Time iIterations DGifDecodeBatch() calls on all of the files and print the
+// JSON result. With bCold the files are dropped from the page cache before
+// each one. Returns 0 for success.
+//
+static int BenchBatchRun(char **pPaths, int iCount, int iThreads, int iInput, bool bCold, int iIterations)
+{
+    GifBatchItem *pItems;
+    int64_t *pPixels;
+    uint64_t *pTimes, u64Start, u64Total = 0, u64Pixels = 0, u64Bytes = 0;
+    struct stat st;
+    struct rusage ru;
+    double dSeconds;
+    int i, j, iHandle, rc = 0;
+
+    if (GifSetInputBackend(iInput) != GIF_OK)
+        return 1;
+    pItems = (GifBatchItem *)calloc(iCount, sizeof(GifBatchItem));
+    pPixels = (int64_t *)calloc(iCount, sizeof(int64_t));
+    pTimes = (uint64_t *)malloc(iIterations * sizeof(uint64_t));
+    if (pItems == NULL || pPixels == NULL || pTimes == NULL)
+        return 1;
+    for (i = 0; i < iCount; i++) {
+        pItems[i].FileName = pPaths[i];
+        pItems[i].UserData = &pPixels[i];
+        if (stat(pPaths[i], &st) == 0)
+            u64Bytes += st.st_size;
+    }
+    for (i = 0; i <= iIterations && rc == 0; i++) // the first pass warms up the caches
+    {
+        for (j = 0; j < iCount && bCold; j++) {
+            iHandle = open(pPaths[j], O_RDONLY);
+            if (iHandle >= 0) {
+                posix_fadvise(iHandle, 0, 0, POSIX_FADV_DONTNEED);
+                close(iHandle);
+            }
+        }
+        u64Start = BenchTime();
+        if (DGifDecodeBatch(pItems, iCount, iThreads, BenchBatchDone) != GIF_OK)
+            rc = 1;
+        if (i > 0)
+            pTimes[i-1] = BenchTime() - u64Start;
+        for (j = 0; j < iCount; j++) {
+            if (pPixels[j] < 0) {
+                fprintf(stderr, "gif_bench: can't decode %s\n", pPaths[j]);
+                rc = 1;
+            } else if (i == 0) {
+                u64Pixels += pPixels[j];
+            }
+        }
+    }
+    if (rc == 0) {
+        for (i = 0; i < iIterations; i++)
+            u64Total += pTimes[i];
+        qsort(pTimes, iIterations, sizeof(uint64_t), BenchCompare);
+        getrusage(RUSAGE_SELF, &ru);
+        dSeconds = (double)u64Total / 1e9;
+        printf("{\"file\":\"*\",\"op\":\"batch\",\"input\":\"%s\",\"threads\":%d,\"cold\":%s,\"files\":%d,"
+               "\"pixels\":%llu,\"file_bytes\":%llu,\"iterations\":%d,\"mb_per_s\":%.2f,\"mpixels_per_s\":%.2f,"
+               "\"mean_ms\":%.4f,\"p50_ms\":%.4f,\"p99_ms\":%.4f,\"peak_rss_kb\":%ld}\n",
+               szInputs[iInput], iThreads, bCold ? "true" : "false", iCount,
+               (unsigned long long)u64Pixels, (unsigned long long)u64Bytes, iIterations,
+               (double)u64Bytes * iIterations / dSeconds / 1e6, (double)u64Pixels * iIterations / dSeconds / 1e6,
+               dSeconds * 1e3 / iIterations, pTimes[(iIterations - 1) / 2] / 1e6,
+               pTimes[(iIterations * 99 + 99) / 100 - 1] / 1e6, ru.ru_maxrss);
+    }
+    free(pItems);
+    free(pPixels);
+    free(pTimes);
+    return rc;
+} /* BenchBatchRun() */
+//
+// BenchMeasure
+//
+// Run one measurement in a child process so that its peak RSS isn't mixed
+// with the others
+//
+static int BenchMeasure(const char *szFile, const char *szOut, int iKernel, bool bEncode, bool bKernel, int iIterations)
+{
+    pid_t pid;
+    int iStatus;
+
+    fflush(stdout);
+    pid = fork();
+    if (pid == 0) {
+        GifSetCpuVariant(iKernel);
+        exit(BenchRun(szFile, szOut, iKernel, bEncode, bKernel, iIterations));
+    }
+    if (pid < 0 || waitpid(pid, &iStatus, 0) != pid)
+        return 1;
+    return (WIFEXITED(iStatus) && WEXITSTATUS(iStatus) == 0) ? 0 : 1;
+} /* BenchMeasure() */
+
+int main(int argc, char **argv)
+{
+    char szDir[256], szPath[512], szOut[512];
+    const char *pFiles[BENCH_CASE_COUNT];
+    bool bQuick = false, bOneKernel = false, bTempDir = true;
+    FILE *fTrace;
+    char *pPaths[256];
+    int i, iKernel, iCount = 0, iIterations = 20, iFailed = 0, opt;
+    int iInput, iStatus, iBatchThreads = -1, iPaths = 0;
+    pid_t pid;
+
+    strcpy(szDir, "/tmp/gif_bench_XXXXXX");
+    while ((opt = getopt(argc, argv, "n:d:qkt:b:")) != -1) {
+        switch (opt) {
+        case 'n':
+            iIterations = atoi(optarg);
+            break;
+        case 'd':
+            snprintf(szDir, sizeof(szDir), "%s", optarg);
+            bTempDir = false;
+            break;
+        case 'q':
+            bQuick = true;
+            break;
+        case 'k':
+            bOneKernel = true;
+            break;
+        case 't':
+            szTraceFile = optarg;
+            break;
+        case 'b':
+            iBatchThreads = atoi(optarg);
+            if (iBatchThreads <= 0)
+                iBatchThreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+            break;
+        default:
+            fprintf(stderr, "usage: gif_bench [-n iterations] [-d corpus dir] [-q] [-k] [-t trace.json] [-b threads] [file.gif ...]\n");
+            return 2;
+        }
+    }
+    if (iIterations < 1)
+        iIterations = 1;
+    if (bTempDir) {
+        if (mkdtemp(szDir) == NULL) {
+            perror("gif_bench");
+            return 1;
+        }
+    } else {
+        mkdir(szDir, 0755);
+    }
+    snprintf(szOut, sizeof(szOut), "%s/encoded.gif", szDir);
+    if (szTraceFile != NULL && (fTrace = fopen(szTraceFile, "w")) != NULL) { // the measurements append their events
+        fprintf(fTrace, "{\"traceEvents\":[\n");
+        fclose(fTrace);
+    } else if (szTraceFile != NULL) {
+        perror("gif_bench");
+        return 1;
+    }
+    printf("{\"bench\":\"gif_bench\",\"giflib\":\"%d.%d.%d\",\"auto_kernel\":\"%s\",\"iterations\":%d,\"seed\":%u}\n",
+           GIFLIB_MAJOR, GIFLIB_MINOR, GIFLIB_RELEASE, szKernels[GifGetCpuVariant()], iIterations, BENCH_SEED);
+
+    if (optind >= argc) { // generate the corpus
+        u32Random = BENCH_SEED;
+        for (i = 0; i < BENCH_CASE_COUNT; i++) {
+            if (bQuick && benchCases[i].bHuge)
+                continue;
+            snprintf(szPath, sizeof(szPath), "%s/%s", szDir, benchCases[i].szName);
+            if (BenchWriteCase(&benchCases[i], szPath) != GIF_OK) {
+                fprintf(stderr, "gif_bench: can't create %s\n", szPath);
+                return 1;
+            }
+            pFiles[iCount++] = benchCases[i].szName;
+        }
+    }
+    for (i = 0; i < ((optind < argc) ? argc - optind : iCount); i++) {
+        if (optind < argc)
+            snprintf(szPath, sizeof(szPath), "%s", argv[optind + i]);
+        else
+            snprintf(szPath, sizeof(szPath), "%s/%s", szDir, pFiles[i]);
+        for (iKernel = GIF_CPU_GENERIC; iKernel <= GIF_CPU_AVX2; iKernel++) {
+            if (bOneKernel)
+                iKernel = GifGetCpuVariant();
+            else if (GifSetCpuVariant(iKernel) != GIF_OK)
+                continue; // not available on this CPU
+            iFailed += BenchMeasure(szPath, szOut, iKernel, false, false, iIterations);
+            iFailed += BenchMeasure(szPath, szOut, iKernel, true, false, iIterations);
+            iFailed += BenchMeasure(szPath, szOut, iKernel, false, true, iIterations);
+            iFailed += BenchMeasure(szPath, szOut, iKernel, true, true, iIterations);
+            if (bOneKernel)
+                break;
+        }
+        if (iBatchThreads > 0 && iPaths < 256)
+            pPaths[iPaths++] = strdup(szPath);
+    }
+    for (iInput = GIF_INPUT_POSIX; iInput <= GIF_INPUT_URING && iPaths > 0; iInput++) {
+        if (GifSetInputBackend(iInput) != GIF_OK)
+            continue; // not available here
+        for (i = 0; i < 2; i++) { // warm, then cold
+            fflush(stdout);
+            pid = fork(); // like BenchMeasure(), for the peak RSS
+            if (pid == 0)
+                exit(BenchBatchRun(pPaths, iPaths, iBatchThreads, iInput, i == 1, iIterations));
+            if (pid < 0 || waitpid(pid, &iStatus, 0) != pid || !WIFEXITED(iStatus) || WEXITSTATUS(iStatus) != 0)
+                iFailed++;
+        }
+    }
+    for (i = 0; i < iPaths; i++)
+        free(pPaths[i]);
+    if (szTraceFile != NULL && (fTrace = fopen(szTraceFile, "a")) != NULL) { // close the event list
+        fprintf(fTrace, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"gif_bench\"}}\n],\"displayTimeUnit\":\"ms\"}\n", (int)getpid());
+        fclose(fTrace);
+    }
+    if (bTempDir) { // remove the generated files
+        for (i = 0; i < iCount; i++) {
+            snprintf(szPath, sizeof(szPath), "%s/%s", szDir, pFiles[i]);
+            unlink(szPath);
+        }
+        unlink(szOut);
+        rmdir(szDir);
+    }
+    return (iFailed == 0) ? 0 : 1;
+} /* main() */
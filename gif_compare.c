@@ -0,0 +1,499 @@
+//
+// GIFLIB comparison harness
+//
+// Runs this library and the upstream giflib side by side on the same files.
+// Upstream giflib is loaded at run time with dlopen() so that both can live
+// in one process without their (identical) symbol names colliding. The same
+// headers describe both, which is the drop-in claim being checked.
+//
+// For each file:
+//  - both decoders' DGifSlurp() results must be identical: screen and frame
+//    descriptors, palettes, extension blocks and pixels
+//  - the frames are re-encoded with each library's EGifSpew() and the output
+//    of each encoder is decoded by the other library; the pixels must match
+//  - decode and encode are timed (median of the iterations) and their peak
+//    memory use is measured in a separate process per measurement
+//
+// One JSON line per file is written to stdout, the details of any mismatch to
+// stderr. Exit code 0 = all files match, 1 = mismatch or failure, 77 = the
+// upstream library couldn't be loaded (so a test runner can skip it).
+//
+// usage: gif_compare [-l libgif.so] [-n iterations] [-t tmp dir] file.gif ...
+//
+#define _GNU_SOURCE // RTLD_DEEPBIND
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <dlfcn.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "gif_lib.h"
+
+#ifndef RTLD_DEEPBIND
+#define RTLD_DEEPBIND 0
+#endif
+
+// The entry points used, for each library
+typedef struct gif_api {
+    const char *szName;
+    GifFileType *(*DOpen)(const char *, int *);
+    int (*DSlurp)(GifFileType *);
+    int (*DClose)(GifFileType *, int *);
+    GifFileType *(*EOpen)(const char *, const bool, int *);
+    int (*ESpew)(GifFileType *);
+    ColorMapObject *(*MakeMap)(int, const GifColorType *);
+    SavedImage *(*MakeImage)(GifFileType *, const SavedImage *);
+} GIF_API;
+
+typedef struct compare_result {
+    uint64_t u64Time; // median ns
+    long lMemory; // peak RSS growth in KB
+    long lBytes; // size of the encoded file
+    int iOK;
+} COMPARE_RESULT;
+
+typedef struct check_result {
+    int rc; // 0 = all match, 1 = mismatch, 2 = neither library can decode the file
+    int iFrames;
+    char szWhy[256]; // what didn't match
+} CHECK_RESULT;
+
+static const char *szUpstreamNames[] = {"libgif.so.7", "libgif.so", "libgif.7.dylib", "libgif.dylib"};
+//
+// CompareTime
+//
+// Monotonic time in nanoseconds
+//
+static uint64_t CompareTime(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+} /* CompareTime() */
+//
+// LoadUpstream
+//
+// Open the upstream library and look up the functions used. RTLD_DEEPBIND
+// keeps its internal calls from binding to this library's functions.
+//
+static int LoadUpstream(GIF_API *pApi, const char *szLib)
+{
+    void *h = NULL;
+    int i;
+
+    if (szLib != NULL) {
+        h = dlopen(szLib, RTLD_NOW | RTLD_LOCAL | RTLD_DEEPBIND);
+    } else {
+        for (i = 0; h == NULL && i < (int)(sizeof(szUpstreamNames) / sizeof(char *)); i++)
+            h = dlopen(szUpstreamNames[i], RTLD_NOW | RTLD_LOCAL | RTLD_DEEPBIND);
+    }
+    if (h == NULL)
+        return GIF_ERROR;
+    pApi->szName = "upstream";
+    *(void **)&pApi->DOpen = dlsym(h, "DGifOpenFileName");
+    *(void **)&pApi->DSlurp = dlsym(h, "DGifSlurp");
+    *(void **)&pApi->DClose = dlsym(h, "DGifCloseFile");
+    *(void **)&pApi->EOpen = dlsym(h, "EGifOpenFileName");
+    *(void **)&pApi->ESpew = dlsym(h, "EGifSpew");
+    *(void **)&pApi->MakeMap = dlsym(h, "GifMakeMapObject");
+    *(void **)&pApi->MakeImage = dlsym(h, "GifMakeSavedImage");
+    if (!pApi->DOpen || !pApi->DSlurp || !pApi->DClose || !pApi->EOpen || !pApi->ESpew || !pApi->MakeMap || !pApi->MakeImage)
+        return GIF_ERROR;
+    return GIF_OK;
+} /* LoadUpstream() */
+//
+// Decode
+//
+// Open and slurp a file; returns NULL if either step fails
+//
+static GifFileType *Decode(const GIF_API *pApi, const char *szFile)
+{
+    GifFileType *gif;
+    int iErr;
+
+    gif = (*pApi->DOpen)(szFile, &iErr);
+    if (gif == NULL)
+        return NULL;
+    if ((*pApi->DSlurp)(gif) != GIF_OK) {
+        (*pApi->DClose)(gif, &iErr);
+        return NULL;
+    }
+    return gif;
+} /* Decode() */
+//
+// CompareMaps
+//
+static int CompareMaps(const ColorMapObject *a, const ColorMapObject *b)
+{
+    if (a == NULL || b == NULL)
+        return (a == b) ? 0 : 1;
+    if (a->ColorCount != b->ColorCount)
+        return 1;
+    return memcmp(a->Colors, b->Colors, a->ColorCount * sizeof(GifColorType)) != 0;
+} /* CompareMaps() */
+//
+// CompareExtensions
+//
+static int CompareExtensions(int iCountA, const ExtensionBlock *a, int iCountB, const ExtensionBlock *b)
+{
+    int i;
+
+    if (iCountA != iCountB)
+        return 1;
+    for (i = 0; i < iCountA; i++) {
+        if (a[i].Function != b[i].Function || a[i].ByteCount != b[i].ByteCount)
+            return 1;
+        if (a[i].ByteCount > 0 && memcmp(a[i].Bytes, b[i].Bytes, a[i].ByteCount) != 0)
+            return 1;
+    }
+    return 0;
+} /* CompareExtensions() */
+//
+// CompareGifs
+//
+// Compare two decoded files; with bPixelsOnly only the frame sizes and
+// pixels are compared (for files that went through a different encoder).
+// Returns 0 if they match, else 1 with a description in szWhy.
+//
+static int CompareGifs(const GifFileType *a, const GifFileType *b, bool bPixelsOnly, char *szWhy, int iLen)
+{
+    const SavedImage *pA, *pB;
+    int i, y;
+
+    if (a->SWidth != b->SWidth || a->SHeight != b->SHeight || a->ImageCount != b->ImageCount) {
+        snprintf(szWhy, iLen, "screen %dx%d %d frames vs %dx%d %d frames", a->SWidth, a->SHeight, a->ImageCount, b->SWidth, b->SHeight, b->ImageCount);
+        return 1;
+    }
+    if (!bPixelsOnly) {
+        if (a->SColorResolution != b->SColorResolution || a->SBackGroundColor != b->SBackGroundColor || a->AspectByte != b->AspectByte) {
+            snprintf(szWhy, iLen, "screen descriptor");
+            return 1;
+        }
+        if (CompareMaps(a->SColorMap, b->SColorMap)) {
+            snprintf(szWhy, iLen, "global color map");
+            return 1;
+        }
+        if (CompareExtensions(a->ExtensionBlockCount, a->ExtensionBlocks, b->ExtensionBlockCount, b->ExtensionBlocks)) {
+            snprintf(szWhy, iLen, "trailing extension blocks");
+            return 1;
+        }
+    }
+    for (i = 0; i < a->ImageCount; i++) {
+        pA = &a->SavedImages[i];
+        pB = &b->SavedImages[i];
+        if (pA->ImageDesc.Left != pB->ImageDesc.Left || pA->ImageDesc.Top != pB->ImageDesc.Top ||
+            pA->ImageDesc.Width != pB->ImageDesc.Width || pA->ImageDesc.Height != pB->ImageDesc.Height) {
+            snprintf(szWhy, iLen, "frame %d descriptor", i);
+            return 1;
+        }
+        if (!bPixelsOnly) {
+            if (pA->ImageDesc.Interlace != pB->ImageDesc.Interlace || CompareMaps(pA->ImageDesc.ColorMap, pB->ImageDesc.ColorMap)) {
+                snprintf(szWhy, iLen, "frame %d interlace flag or color map", i);
+                return 1;
+            }
+            if (CompareExtensions(pA->ExtensionBlockCount, pA->ExtensionBlocks, pB->ExtensionBlockCount, pB->ExtensionBlocks)) {
+                snprintf(szWhy, iLen, "frame %d extension blocks", i);
+                return 1;
+            }
+        }
+        for (y = 0; y < pA->ImageDesc.Height; y++) {
+            if (memcmp(&pA->RasterBits[y * pA->ImageDesc.Width], &pB->RasterBits[y * pB->ImageDesc.Width], pA->ImageDesc.Width) != 0) {
+                snprintf(szWhy, iLen, "frame %d pixels differ in row %d", i, y);
+                return 1;
+            }
+        }
+    }
+    return 0;
+} /* CompareGifs() */
+//
+// Encode
+//
+// Write the frames of a decoded file (palettes and pixels, no extensions)
+// with a library's EGifSpew(). The frames are built with that library's own
+// allocation functions since its encoder frees them. If pTime is not NULL,
+// the time spent in EGifSpew() is stored there.
+//
+static int Encode(const GIF_API *pApi, const GifFileType *gifIn, const char *szOut, uint64_t *pTime)
+{
+    GifFileType *gif;
+    SavedImage *pImage;
+    const SavedImage *pSrc;
+    uint64_t u64Start;
+    size_t iSize;
+    int i, iErr;
+
+    gif = (*pApi->EOpen)(szOut, false, &iErr);
+    if (gif == NULL)
+        return GIF_ERROR;
+    gif->SWidth = gifIn->SWidth;
+    gif->SHeight = gifIn->SHeight;
+    gif->SColorResolution = gifIn->SColorResolution;
+    gif->SBackGroundColor = gifIn->SBackGroundColor;
+    if (gifIn->SColorMap != NULL)
+        gif->SColorMap = (*pApi->MakeMap)(gifIn->SColorMap->ColorCount, gifIn->SColorMap->Colors);
+    for (i = 0; i < gifIn->ImageCount; i++) {
+        pSrc = &gifIn->SavedImages[i];
+        pImage = (*pApi->MakeImage)(gif, NULL);
+        if (pImage == NULL)
+            return GIF_ERROR;
+        pImage->ImageDesc = pSrc->ImageDesc;
+        if (pSrc->ImageDesc.ColorMap != NULL)
+            pImage->ImageDesc.ColorMap = (*pApi->MakeMap)(pSrc->ImageDesc.ColorMap->ColorCount, pSrc->ImageDesc.ColorMap->Colors);
+        iSize = (size_t)pSrc->ImageDesc.Width * pSrc->ImageDesc.Height;
+        pImage->RasterBits = (GifByteType *)malloc(iSize + 1);
+        if (pImage->RasterBits == NULL)
+            return GIF_ERROR;
+        memcpy(pImage->RasterBits, pSrc->RasterBits, iSize);
+    }
+    u64Start = CompareTime();
+    iErr = (*pApi->ESpew)(gif); // closes the file and frees the handle
+    if (pTime != NULL)
+        *pTime = CompareTime() - u64Start;
+    return (iErr == GIF_OK) ? GIF_OK : GIF_ERROR;
+} /* Encode() */
+//
+// CompareSort
+//
+static int CompareSort(const void *a, const void *b)
+{
+    uint64_t ua = *(const uint64_t *)a, ub = *(const uint64_t *)b;
+    return (ua > ub) - (ua < ub);
+} /* CompareSort() */
+//
+// Measure
+//
+// Time iIterations decodes (or encodes) with one library in a child process
+// and return the median time and the growth of the peak RSS
+//
+static void Measure(const GIF_API *pApi, const char *szFile, const char *szOut, bool bEncode, int iIterations, COMPARE_RESULT *pResult)
+{
+    int fd[2], i, iErr, iStatus;
+    uint64_t *pTimes, u64Start;
+    struct rusage ru;
+    struct stat st;
+    long lBase;
+    GifFileType *gif;
+    pid_t pid;
+
+    memset(pResult, 0, sizeof(COMPARE_RESULT));
+    if (pipe(fd) != 0)
+        return;
+    fflush(stdout);
+    pid = fork();
+    if (pid == 0) {
+        close(fd[0]);
+        pTimes = (uint64_t *)malloc(iIterations * sizeof(uint64_t));
+        gif = (bEncode) ? Decode(pApi, szFile) : NULL; // the frames to encode
+        getrusage(RUSAGE_SELF, &ru);
+        lBase = ru.ru_maxrss;
+        pResult->iOK = (pTimes != NULL && (gif != NULL || !bEncode));
+        for (i = 0; pResult->iOK && i < iIterations; i++) {
+            if (bEncode) {
+                pResult->iOK = (Encode(pApi, gif, szOut, &pTimes[i]) == GIF_OK);
+            } else {
+                u64Start = CompareTime();
+                gif = Decode(pApi, szFile);
+                pResult->iOK = (gif != NULL);
+                if (gif != NULL)
+                    (*pApi->DClose)(gif, &iErr);
+                pTimes[i] = CompareTime() - u64Start;
+            }
+        }
+        if (pResult->iOK) {
+            qsort(pTimes, iIterations, sizeof(uint64_t), CompareSort);
+            pResult->u64Time = pTimes[iIterations / 2];
+            getrusage(RUSAGE_SELF, &ru);
+            pResult->lMemory = ru.ru_maxrss - lBase;
+            if (bEncode && stat(szOut, &st) == 0)
+                pResult->lBytes = (long)st.st_size;
+        }
+        i = (int)write(fd[1], pResult, sizeof(COMPARE_RESULT));
+        _exit(0);
+    }
+    close(fd[1]);
+    if (pid > 0) {
+        if (read(fd[0], pResult, sizeof(COMPARE_RESULT)) != sizeof(COMPARE_RESULT))
+            memset(pResult, 0, sizeof(COMPARE_RESULT)); // the child crashed
+        waitpid(pid, &iStatus, 0);
+    }
+    close(fd[0]);
+} /* Measure() */
+//
+// CrossCheck
+//
+// Encode the frames decoded by pEncoder with it and decode the result with
+// pDecoder; the pixels must match gifRef
+//
+static int CrossCheck(const GIF_API *pEncoder, const GIF_API *pDecoder, const GifFileType *gifSrc, const GifFileType *gifRef, const char *szOut, char *szWhy, int iLen)
+{
+    GifFileType *gif;
+    int iErr, rc;
+
+    if (Encode(pEncoder, gifSrc, szOut, NULL) != GIF_OK) {
+        snprintf(szWhy, iLen, "%s encoder failed", pEncoder->szName);
+        return 1;
+    }
+    gif = Decode(pDecoder, szOut);
+    if (gif == NULL) {
+        snprintf(szWhy, iLen, "%s can't decode the %s encoder's output", pDecoder->szName, pEncoder->szName);
+        return 1;
+    }
+    rc = CompareGifs(gifRef, gif, true, szWhy, iLen);
+    (*pDecoder->DClose)(gif, &iErr);
+    if (rc) { // say which way round it failed
+        char szTemp[256];
+        snprintf(szTemp, sizeof(szTemp), "%s encoder -> %s decoder: %s", pEncoder->szName, pDecoder->szName, szWhy);
+        snprintf(szWhy, iLen, "%s", szTemp);
+    }
+    return rc;
+} /* CrossCheck() */
+//
+// CheckFile
+//
+// Decode a file with both libraries, compare the results and cross check
+// the encoders. Runs in a child process so that a library crashing on a
+// (corrupt) file is reported like any other mismatch.
+//
+static void CheckFile(const GIF_API *pApis, const char *szFile, const char *szOut, CHECK_RESULT *pResult)
+{
+    GifFileType *gifs[2];
+    int fd[2], j, iErr, iStatus;
+    pid_t pid;
+
+    memset(pResult, 0, sizeof(CHECK_RESULT));
+    pResult->rc = 1;
+    if (pipe(fd) != 0)
+        return;
+    fflush(stdout);
+    pid = fork();
+    if (pid == 0) {
+        close(fd[0]);
+        for (j = 0; j < 2; j++)
+            gifs[j] = Decode(&pApis[j], szFile);
+        if (gifs[0] == NULL || gifs[1] == NULL) {
+            pResult->rc = (gifs[0] != gifs[1]) ? 1 : 2; // both rejecting a file is a match
+            snprintf(pResult->szWhy, sizeof(pResult->szWhy), "only %s can decode it", (gifs[0] != NULL) ? "upstream" : "turbo");
+        } else {
+            pResult->iFrames = gifs[1]->ImageCount;
+            pResult->rc = CompareGifs(gifs[0], gifs[1], false, pResult->szWhy, sizeof(pResult->szWhy));
+            if (pResult->rc) {
+                memmove(&pResult->szWhy[10], pResult->szWhy, sizeof(pResult->szWhy) - 10);
+                memcpy(pResult->szWhy, "decoders: ", 10);
+                pResult->szWhy[sizeof(pResult->szWhy) - 1] = 0;
+            }
+            if (!pResult->rc)
+                pResult->rc = CrossCheck(&pApis[1], &pApis[0], gifs[1], gifs[0], szOut, pResult->szWhy, sizeof(pResult->szWhy));
+            if (!pResult->rc)
+                pResult->rc = CrossCheck(&pApis[0], &pApis[1], gifs[0], gifs[1], szOut, pResult->szWhy, sizeof(pResult->szWhy));
+        }
+        for (j = 0; j < 2; j++)
+            if (gifs[j] != NULL)
+                (*pApis[j].DClose)(gifs[j], &iErr);
+        j = (int)write(fd[1], pResult, sizeof(CHECK_RESULT));
+        _exit(0);
+    }
+    close(fd[1]);
+    if (pid > 0) {
+        if (read(fd[0], pResult, sizeof(CHECK_RESULT)) != sizeof(CHECK_RESULT)) {
+            memset(pResult, 0, sizeof(CHECK_RESULT));
+            pResult->rc = 1;
+        }
+        waitpid(pid, &iStatus, 0);
+        if (WIFSIGNALED(iStatus))
+            snprintf(pResult->szWhy, sizeof(pResult->szWhy), "crashed with signal %d", WTERMSIG(iStatus));
+    }
+    close(fd[0]);
+} /* CheckFile() */
+//
+// PrintRatio
+//
+static void PrintRatio(const char *szName, double dNum, double dDen)
+{
+    if (dNum > 0.0 && dDen > 0.0)
+        printf(",\"%s\":%.3f", szName, dNum / dDen);
+    else
+        printf(",\"%s\":null", szName);
+} /* PrintRatio() */
+
+int main(int argc, char **argv)
+{
+    GIF_API apis[2] = {{0}, {"turbo", DGifOpenFileName, DGifSlurp, DGifCloseFile, EGifOpenFileName, EGifSpew, GifMakeMapObject, GifMakeSavedImage}};
+    COMPARE_RESULT dec[2], enc[2];
+    CHECK_RESULT check;
+    char szOut[512];
+    const char *szLib = NULL, *szTmp = "/tmp", *szName;
+    int i, j, iIterations = 10, iFailed = 0, opt;
+
+    while ((opt = getopt(argc, argv, "l:n:t:")) != -1) {
+        switch (opt) {
+        case 'l':
+            szLib = optarg;
+            break;
+        case 'n':
+            iIterations = atoi(optarg);
+            break;
+        case 't':
+            szTmp = optarg;
+            break;
+        default:
+            optind = argc + 1;
+            break;
+        }
+    }
+    if (optind >= argc) {
+        fprintf(stderr, "usage: gif_compare [-l libgif.so] [-n iterations] [-t tmp dir] file.gif ...\n");
+        return 2;
+    }
+    if (iIterations < 1)
+        iIterations = 1;
+    if (LoadUpstream(&apis[0], szLib) != GIF_OK) {
+        fprintf(stderr, "gif_compare: upstream giflib not found (%s)\n", (szLib != NULL) ? szLib : "libgif.so.7");
+        return 77;
+    }
+    snprintf(szOut, sizeof(szOut), "%s/gif_compare_%d.gif", szTmp, (int)getpid());
+
+    for (i = optind; i < argc; i++) {
+        szName = strrchr(argv[i], '/');
+        szName = (szName != NULL) ? szName + 1 : argv[i];
+        if (access(argv[i], R_OK) != 0) {
+            fprintf(stderr, "gif_compare: can't read %s\n", argv[i]);
+            iFailed++;
+            continue;
+        }
+        CheckFile(apis, argv[i], szOut, &check);
+        if (check.rc == 2 || check.iFrames == 0) { // nothing to measure
+            printf("{\"file\":\"%s\",\"equal\":%s,\"frames\":0,\"decoded\":%s}\n", szName, (check.rc == 1) ? "false" : "true", (check.rc == 2) ? "false" : "true");
+        } else {
+            for (j = 0; j < 2; j++) {
+                Measure(&apis[j], argv[i], szOut, false, iIterations, &dec[j]);
+                Measure(&apis[j], argv[i], szOut, true, iIterations, &enc[j]);
+            }
+            printf("{\"file\":\"%s\",\"equal\":%s,\"frames\":%d", szName, check.rc ? "false" : "true", check.iFrames);
+            printf(",\"upstream_decode_ms\":%.4f,\"turbo_decode_ms\":%.4f", dec[0].u64Time / 1e6, dec[1].u64Time / 1e6);
+            PrintRatio("decode_speedup", dec[0].u64Time, dec[1].u64Time);
+            printf(",\"upstream_decode_kb\":%ld,\"turbo_decode_kb\":%ld", dec[0].lMemory, dec[1].lMemory);
+            PrintRatio("decode_memory_ratio", dec[1].lMemory, dec[0].lMemory);
+            printf(",\"upstream_encode_ms\":%.4f,\"turbo_encode_ms\":%.4f", enc[0].u64Time / 1e6, enc[1].u64Time / 1e6);
+            PrintRatio("encode_speedup", enc[0].u64Time, enc[1].u64Time);
+            printf(",\"upstream_encode_kb\":%ld,\"turbo_encode_kb\":%ld", enc[0].lMemory, enc[1].lMemory);
+            PrintRatio("encode_memory_ratio", enc[1].lMemory, enc[0].lMemory);
+            printf(",\"upstream_bytes\":%ld,\"turbo_bytes\":%ld}\n", enc[0].lBytes, enc[1].lBytes);
+            if (!check.rc && (!dec[0].iOK || !dec[1].iOK || !enc[0].iOK || !enc[1].iOK)) {
+                snprintf(check.szWhy, sizeof(check.szWhy), "a measurement failed");
+                check.rc = 1;
+            }
+        }
+        if (check.rc == 1) {
+            fprintf(stderr, "gif_compare: %s: %s\n", argv[i], check.szWhy);
+            iFailed++;
+        }
+    }
+    unlink(szOut);
+    return (iFailed == 0) ? 0 : 1;
+} /* main() */
@@ -0,0 +1,361 @@
+//
+// gif_lib.hpp tests
+//
+// Compiles the C++17 wrapper and runs its decoder, lazy frame range and
+// encoder against the C functions. Prints "ok <name>" or
+// "FAIL <name>: <reason>" for each test; the exit code is the number of
+// failed tests, like gif_regress.
+//
+// usage: gif_hpp_test [test name ...]
+//  with names, only those tests are run
+//
+#include "gif_lib.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <dirent.h>
+
+namespace {
+
+std::string sTempDir;
+
+// thrown by a test to report its failure
+struct Failure {
+    const char *szReason;
+};
+
+void Check(bool bOK, const char *szReason)
+{
+    if (!bOK)
+        throw Failure{szReason};
+} /* Check() */
+
+std::string TempPath(const char *szName)
+{
+    return sTempDir + "/" + szName;
+} /* TempPath() */
+
+// Pixels of frame i of the test animation, in row order
+std::vector<std::uint8_t> FramePixels(int i, int iWidth, int iHeight)
+{
+    std::vector<std::uint8_t> pixels((std::size_t)iWidth * iHeight);
+
+    for (int y = 0; y < iHeight; y++)
+        for (int x = 0; x < iWidth; x++)
+            pixels[(std::size_t)y * iWidth + x] = (std::uint8_t)((x * 3 + y * 5 + i * 7) & 15);
+    return pixels;
+} /* FramePixels() */
+
+// Sizes of the frames of the test animation on its 24x13 screen; the
+// third one is interlaced and the second one has a local palette
+const struct {
+    int iLeft, iTop, iWidth, iHeight;
+    bool bInterlace;
+} frames[3] = {{0, 0, 24, 13, false}, {5, 2, 9, 7, false}, {0, 0, 24, 13, true}};
+
+const std::uint8_t ucComment[] = "written by gif_hpp_test";
+
+// 16 colors; the local palette has the first and last one swapped
+ColorMapObject *MakePalette(bool bLocal)
+{
+    GifColorType colors[16];
+
+    for (int i = 0; i < 16; i++)
+        colors[i] = GifColorType{(GifByteType)(i * 16), (GifByteType)(255 - i * 16), (GifByteType)(i * 7)};
+    if (bLocal)
+        std::swap(colors[0], colors[15]);
+    ColorMapObject *pMap = GifMakeMapObject(16, colors);
+    Check(pMap != nullptr, "GifMakeMapObject() failed");
+    return pMap;
+} /* MakePalette() */
+
+// Write the test animation with gif::Encoder: the frames are added with
+// GifMakeSavedImage() and written by spew(), the first one with a comment
+void WriteAnimation(const std::string &sPath)
+{
+    ColorMapObject *pGlobal = MakePalette(false), *pLocal = MakePalette(true);
+
+    try {
+        gif::Encoder enc(sPath.c_str());
+        enc.putScreenDesc(24, 13, 8, 0, pGlobal); // the color resolution is the LZW code size
+        for (int i = 0; i < 3; i++) {
+            std::vector<std::uint8_t> pixels = FramePixels(i, frames[i].iWidth, frames[i].iHeight);
+            SavedImage image = {};
+            image.ImageDesc = GifImageDesc{frames[i].iLeft, frames[i].iTop, frames[i].iWidth, frames[i].iHeight, frames[i].bInterlace, (i == 1) ? pLocal : nullptr};
+            image.RasterBits = pixels.data();
+            Check(GifMakeSavedImage(enc.get(), &image) != nullptr, "GifMakeSavedImage() failed");
+            if (i == 0) // goes with the frame just added
+                enc.putExtension(COMMENT_EXT_FUNC_CODE, gif::Span<const std::uint8_t>(ucComment, sizeof(ucComment) - 1));
+        }
+        enc.spew();
+    } catch (...) {
+        GifFreeMapObject(pGlobal);
+        GifFreeMapObject(pLocal);
+        throw;
+    }
+    GifFreeMapObject(pGlobal);
+    GifFreeMapObject(pLocal);
+} /* WriteAnimation() */
+
+// A frame must match frame i of the test animation
+void CheckFrame(const gif::Frame &frame, int i)
+{
+    Check(frame.left() == frames[i].iLeft && frame.top() == frames[i].iTop && frame.width() == frames[i].iWidth &&
+          frame.height() == frames[i].iHeight && frame.interlaced() == frames[i].bInterlace, "a frame descriptor differs");
+    Check((frame.colorMap() != nullptr) == (i == 1), "a local palette is wrong");
+    Check(frame.bits() == 8 && frame.pitch() == frame.width(), "an 8-bit frame has the wrong pitch");
+    std::vector<std::uint8_t> pixels = FramePixels(i, frames[i].iWidth, frames[i].iHeight);
+    Check(frame.pixels().size() == pixels.size() && std::equal(pixels.begin(), pixels.end(), frame.pixels().begin()), "the pixels differ");
+    Check(frame.row(1).size() == (std::size_t)frame.width() && frame.row(1)[0] == pixels[frame.width()], "row() is wrong");
+} /* CheckFrame() */
+
+//
+// TestSlurp
+//
+// Decoder::slurp() and the frames() range over what gif::Encoder wrote
+//
+void TestSlurp()
+{
+    WriteAnimation(TempPath("slurp.gif"));
+    gif::Decoder dec(TempPath("slurp.gif").c_str());
+    dec.slurp();
+    Check(dec.width() == 24 && dec.height() == 13 && dec.colorMap() != nullptr, "the screen is wrong");
+    Check(dec.frameCount() == 3 && dec.frames().size() == 3, "the frame count is wrong");
+    int i = 0;
+    for (gif::Frame frame : dec.frames())
+        CheckFrame(frame, i++);
+    Check(dec.frames().end() - dec.frames().begin() == 3, "the frame range has the wrong length");
+    Check(dec.frame(0).extensions().size() == 1 && dec.frame(0).extensions()[0].Function == COMMENT_EXT_FUNC_CODE, "the comment is missing");
+    Check(dec.frame(1).extensions().empty(), "an extension appeared");
+} /* TestSlurp() */
+
+//
+// TestLazyFrames
+//
+// Decoder::lazyFrames() gives the same frames one at a time, and a broken
+// file throws from the iterator
+//
+void TestLazyFrames()
+{
+    WriteAnimation(TempPath("lazy.gif"));
+    gif::Decoder dec(TempPath("lazy.gif").c_str());
+    int i = 0;
+    for (gif::Frame frame : dec.lazyFrames()) {
+        Check(i < 3, "too many frames");
+        CheckFrame(frame, i++);
+    }
+    Check(i == 3, "frames are missing");
+
+    // cut the file in the middle of the second frame
+    FILE *f = std::fopen(TempPath("lazy.gif").c_str(), "rb");
+    Check(f != nullptr, "can't read the file back");
+    std::vector<std::uint8_t> data(65536);
+    data.resize(std::fread(data.data(), 1, data.size(), f));
+    std::fclose(f);
+    f = std::fopen(TempPath("lazy_cut.gif").c_str(), "wb");
+    Check(f != nullptr && std::fwrite(data.data(), 1, data.size() * 2 / 3, f) == data.size() * 2 / 3, "can't write the cut file");
+    std::fclose(f);
+    dec.reopen(TempPath("lazy_cut.gif").c_str());
+    bool bThrown = false;
+    i = 0;
+    try {
+        for (gif::Frame frame : dec.lazyFrames()) {
+            (void)frame;
+            i++;
+        }
+    } catch (const gif::Error &e) {
+        bThrown = (e.code() != D_GIF_SUCCEEDED);
+    }
+    Check(bThrown && i < 3, "the cut file didn't throw gif::Error");
+} /* TestLazyFrames() */
+
+//
+// TestSpew
+//
+// Encoder::takeFrames() and spew() write the slurped frames again, and the
+// result decodes to the same animation; the encoder handle is reused for a
+// second file
+//
+void TestSpew()
+{
+    WriteAnimation(TempPath("spew_in.gif"));
+    gif::Encoder enc(TempPath("spew_out1.gif").c_str());
+    for (int iPass = 0; iPass < 2; iPass++) {
+        gif::Decoder dec(TempPath("spew_in.gif").c_str());
+        dec.slurp();
+        if (iPass == 1) { // the second file on the same encoder handle
+            FILE *f = std::fopen(TempPath("spew_out2.gif").c_str(), "wb");
+            Check(f != nullptr, "can't create the second output");
+            enc.reopen(dup(fileno(f)));
+            std::fclose(f);
+        }
+        GifFileType *pOut = enc.get();
+        pOut->SWidth = dec.width();
+        pOut->SHeight = dec.height();
+        pOut->SColorResolution = dec.get()->SColorResolution;
+        pOut->SBackGroundColor = dec.get()->SBackGroundColor;
+        enc.takeFrames(dec);
+        Check(dec.frameCount() == 0, "takeFrames() left frames behind");
+        enc.spew();
+    }
+    enc.close();
+    Check(!enc, "close() kept the handle");
+    for (const char *szOut : {"spew_out1.gif", "spew_out2.gif"}) {
+        gif::Decoder dec(TempPath(szOut).c_str());
+        dec.slurp();
+        Check(dec.frameCount() == 3, "the written file has the wrong frame count");
+        for (int i = 0; i < 3; i++)
+            CheckFrame(dec.frame(i), i);
+    }
+} /* TestSpew() */
+
+//
+// TestPutLine
+//
+// The line API writes one frame: an extension given before putImageDesc()
+// is written ahead of it (a two-block one through the C functions too), and
+// the rows of an interlaced frame go in pass order
+//
+void TestPutLine()
+{
+    static const int iPassStart[4] = {0, 4, 2, 1}, iPassStep[4] = {8, 8, 4, 2};
+    const std::uint8_t ucMore[] = "second block";
+    ColorMapObject *pGlobal = MakePalette(false);
+    std::vector<std::uint8_t> pixels = FramePixels(2, 24, 13);
+
+    try {
+        gif::Encoder enc(TempPath("put_line.gif").c_str());
+        enc.putScreenDesc(24, 13, 8, 0, pGlobal);
+        enc.putExtension(COMMENT_EXT_FUNC_CODE, gif::Span<const std::uint8_t>(ucComment, sizeof(ucComment) - 1));
+        Check(EGifPutExtensionLeader(enc.get(), COMMENT_EXT_FUNC_CODE) == GIF_OK &&
+              EGifPutExtensionBlock(enc.get(), 4, "abcd") == GIF_OK &&
+              EGifPutExtensionBlock(enc.get(), sizeof(ucMore) - 1, ucMore) == GIF_OK &&
+              EGifPutExtensionTrailer(enc.get()) == GIF_OK, "the extension functions failed");
+        enc.putImageDesc(0, 0, 24, 13, true);
+        for (int iPass = 0; iPass < 4; iPass++)
+            for (int y = iPassStart[iPass]; y < 13; y += iPassStep[iPass])
+                enc.putLine(gif::Span<const GifPixelType>(&pixels[(std::size_t)y * 24], 24));
+        enc.close();
+    } catch (...) {
+        GifFreeMapObject(pGlobal);
+        throw;
+    }
+    GifFreeMapObject(pGlobal);
+
+    gif::Decoder dec(TempPath("put_line.gif").c_str());
+    dec.slurp();
+    Check(dec.frameCount() == 1, "the frame count is wrong");
+    gif::Frame frame = dec.frame(0);
+    Check(frame.interlaced() && std::equal(pixels.begin(), pixels.end(), frame.pixels().begin()), "the pixels differ");
+    gif::Span<const ExtensionBlock> ext = frame.extensions();
+    Check(ext.size() == 3 && ext[0].Function == COMMENT_EXT_FUNC_CODE && ext[0].ByteCount == (int)sizeof(ucComment) - 1 &&
+          ext[1].Function == COMMENT_EXT_FUNC_CODE && ext[1].ByteCount == 4 && std::memcmp(ext[1].Bytes, "abcd", 4) == 0 &&
+          ext[2].Function == CONTINUE_EXT_FUNC_CODE && ext[2].ByteCount == (int)sizeof(ucMore) - 1, "the extensions differ");
+} /* TestPutLine() */
+
+//
+// TestMove
+//
+// The handles move, close once, release and adopt; failures throw
+// gif::Error with the library's code
+//
+void TestMove()
+{
+    WriteAnimation(TempPath("move.gif"));
+    gif::Decoder dec1(TempPath("move.gif").c_str());
+    GifFileType *pGif = dec1.get();
+    gif::Decoder dec2(std::move(dec1));
+    Check(!dec1 && dec2 && dec2.get() == pGif, "the move constructor didn't move the handle");
+    gif::Decoder dec3(TempPath("move.gif").c_str());
+    dec3 = std::move(dec2); // closes dec3's own handle
+    Check(!dec2 && dec3.get() == pGif, "move assignment didn't move the handle");
+    dec3.slurp();
+    Check(dec3.frameCount() == 3, "the moved handle doesn't decode");
+    gif::Decoder dec4 = gif::Decoder::adopt(dec3.release());
+    Check(!dec3 && dec4.get() == pGif && dec4.frames().size() == 3, "release() and adopt() lost the handle");
+
+    gif::Encoder enc1(TempPath("move_out.gif").c_str());
+    gif::Encoder enc2;
+    enc2 = std::move(enc1);
+    Check(!enc1 && enc2, "the encoder didn't move");
+    enc2.putScreenDesc(4, 2, 8, 0, dec4.colorMap());
+    enc2.putImageDesc(0, 0, 4, 2);
+    const GifPixelType ucLine[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+    enc2.putLine(gif::Span<const GifPixelType>(ucLine, 8));
+    gif::Encoder enc3(std::move(enc2));
+    enc3.close();
+    gif::Decoder dec5(TempPath("move_out.gif").c_str());
+    dec5.slurp();
+    Check(dec5.frameCount() == 1 && dec5.frame(0).pixels()[7] == 8, "the moved encoder wrote a bad file");
+
+    int iCode = 0;
+    try {
+        gif::Decoder missing(TempPath("missing.gif").c_str());
+    } catch (const gif::Error &e) {
+        iCode = e.code();
+    }
+    Check(iCode == D_GIF_ERR_OPEN_FAILED, "a missing file didn't throw D_GIF_ERR_OPEN_FAILED");
+} /* TestMove() */
+
+const struct {
+    const char *szName;
+    void (*pfnTest)();
+} tests[] = {
+    {"slurp", TestSlurp},
+    {"lazy_frames", TestLazyFrames},
+    {"spew", TestSpew},
+    {"put_line", TestPutLine},
+    {"move", TestMove},
+};
+
+void RemoveTempDir()
+{
+    DIR *pDir = opendir(sTempDir.c_str());
+    struct dirent *pEntry;
+
+    if (pDir != nullptr) {
+        while ((pEntry = readdir(pDir)) != nullptr) {
+            if (pEntry->d_name[0] != '.')
+                unlink(TempPath(pEntry->d_name).c_str());
+        }
+        closedir(pDir);
+    }
+    rmdir(sTempDir.c_str());
+} /* RemoveTempDir() */
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    char szTemplate[] = "/tmp/gif_hpp_test_XXXXXX";
+    int iFailed = 0;
+
+    if (mkdtemp(szTemplate) == nullptr) {
+        std::printf("can't create a temporary directory\n");
+        return EXIT_FAILURE;
+    }
+    sTempDir = szTemplate;
+    for (const auto &test : tests) {
+        bool bRun = (argc < 2);
+        for (int j = 1; j < argc; j++)
+            bRun |= (std::strcmp(argv[j], test.szName) == 0);
+        if (!bRun)
+            continue;
+        try {
+            test.pfnTest();
+            std::printf("ok %s\n", test.szName);
+        } catch (const Failure &f) {
+            std::printf("FAIL %s: %s\n", test.szName, f.szReason);
+            iFailed++;
+        } catch (const gif::Error &e) {
+            std::printf("FAIL %s: gif::Error %d (%s)\n", test.szName, e.code(), e.what());
+            iFailed++;
+        }
+        std::fflush(stdout);
+    }
+    RemoveTempDir();
+    return iFailed;
+} /* main() */
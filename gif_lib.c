@@ -15,6 +15,14 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 //
+// clock_gettime() (see GIFTrace) is POSIX and syscall() (see GIFURingSetup)
+// is one of glibc's defaults, also build them with -std=c99
+#if !defined(_POSIX_C_SOURCE) && !defined(__APPLE__)
+#define _POSIX_C_SOURCE 200809L
+#endif
+#if defined(__linux__) && !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE
+#endif
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -22,16 +30,275 @@
 // Use POSIX I/O for compatibility with Linux/MacOS/Windows
 #include <unistd.h>
 #include <stdarg.h>
+#include <time.h>
+#ifndef GIF_NO_THREADS
+#include <pthread.h> // DGifDecodeBatch() workers
+#endif
+// DGifDecodeBatch() can read files through io_uring (see GIFURingSetup),
+// using the system calls directly rather than liburing
+#if defined(__linux__) && defined(__GNUC__) && !defined(GIF_NO_URING) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define GIF_URING
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+#endif
 
 #include <sys/fcntl.h>
 #include <sys/stat.h>
 
 #include "gif_lib.h"
 
+// The LZW kernels (DecodeLZW, EncodeLZW and the string copy) are compiled
+// once per CPU variant and the fastest one the CPU supports is picked at load
+// time (see GIFSelectKernels). Their bodies are always inlined into each
+// variant's entry point so the compiler can use that variant's instructions,
+// e.g. shrx/shlx for the bit buffer with BMI2 and 32-byte copies with AVX2.
+#if defined(__GNUC__) || defined(__clang__)
+#define GIF_INLINE static inline __attribute__((always_inline))
+#define GIFPrefetch(p) __builtin_prefetch(p)
+#if defined(__x86_64__) && !defined(GIF_NO_DISPATCH)
+#define GIF_DISPATCH
+#define GIF_TARGET_BMI2 __attribute__((target("sse4.2,popcnt,bmi,bmi2")))
+#define GIF_TARGET_AVX2 __attribute__((target("avx2,bmi,bmi2")))
+#endif
+// Generic vectors become the registers of whichever variant they're built for
+typedef uint8_t GIFVector16 __attribute__((vector_size(16), aligned(1), may_alias));
+typedef uint8_t GIFVector32 __attribute__((vector_size(32), aligned(1), may_alias));
+#define GIFCopyVector(d, s, w) do { if ((w) == 32) *(GIFVector32 *)(d) = *(const GIFVector32 *)(s); \
+    else *(GIFVector16 *)(d) = *(const GIFVector16 *)(s); } while (0)
+#else
+#ifdef _MSC_VER
+#define GIF_INLINE static __forceinline
+#else
+#define GIF_INLINE static inline
+#endif
+#define GIFPrefetch(p)
+#if defined(_M_X64)
+#include <emmintrin.h>
+#define GIFCopyVector(d, s, w) _mm_storeu_si128((__m128i *)(d), _mm_loadu_si128((const __m128i *)(s)))
+#elif defined(_M_ARM64)
+#include <arm_neon.h>
+#define GIFCopyVector(d, s, w) vst1q_u8((uint8_t *)(d), vld1q_u8((const uint8_t *)(s)))
+#else
+#define GIFCopyVector(d, s, w) memcpy(d, s, 16)
+#endif
+#endif // __GNUC__
+
+// Counters for GifGetStats() cost a little in the kernels, so they are only
+// compiled in when GIF_STATS is defined
+#ifdef GIF_STATS
+#define GIF_COUNT(x) x
+#define GIF_COUNTERS(pPrivate) (&(pPrivate)->Stats)
+#else
+#define GIF_COUNT(x)
+#define GIF_COUNTERS(pPrivate) NULL
+#endif
+// Phase tracing (see GifSetTraceFunc) costs one test when it's off
+#define GIF_TRACE(pPrivate, gif, iPhase, bBegin, iFrame) \
+    do { if ((pPrivate)->pfnTrace != NULL) GIFTrace(gif, iPhase, bBegin, iFrame); } while (0)
+
+// Largest screen header (signature, descriptor and a 256 entry palette) and
+// also the most an image descriptor and its local palette take
+#define GIF_HEADER_BYTES (13 + 256 * 3 + 16)
+
 bool GifNoisyPrint = false;
 
 static const uint8_t cGIFPass[8] = {8,0,8,4,4,2,2,1}; // GIF interlaced y delta
-int EncodeLZW(SavedImage *pImage, uint32_t *pSymbols, uint8_t *pOutput, uint8_t ucCodeStart);
+int EncodeLZW(SavedImage *pImage, uint32_t *pSymbols, uint8_t *pOutput, uint8_t ucCodeStart, int iBits, uint8_t *pRowBuf, GifCodecStats *pCounters);
+void GifFreeImages(GifFileType *gif);
+static void GIFTrace(GifFileType *gif, int iPhase, bool bBegin, int iFrame);
+// Progress of the frame being decoded (see DGifSetProgressFunc)
+typedef struct gif_progress_tag {
+    GifFileType *gif;
+    SavedImage *pPage;
+    GifFrameStats *pStats; // frame statistics to collect (GIF_OPT_STATS)
+    int iInterval; // rows between reports
+    int iRowsDone; // rows (in stored order) reported so far
+} GIFPROGRESS;
+static int GIFReportProgress(GIFPROGRESS *pProgress, int iOffset);
+// LZW kernels of the selected CPU variant (see GIFSelectKernels)
+typedef int (*GIFDecodeKernel)(uint8_t *buf, int iUncompressedLen, uint32_t *pSymbols, uint8_t ucCodeStart, uint8_t *pLZW, int iLZWSize, GIFPROGRESS *pProgress, GifCodecStats *pCounters);
+typedef int (*GIFEncodeKernel)(SavedImage *pImage, uint32_t *pSymbols, uint8_t *pOutput, uint8_t ucCodeStart, int iBits, uint8_t *pRowBuf, GifCodecStats *pCounters);
+static GIFDecodeKernel pfnGIFDecodeLZW;
+static GIFEncodeKernel pfnGIFEncodeLZW;
+static int iGIFCpuVariant = -1; // GIF_CPU_* of the kernels above
+static int iGIFInputBackend = -1; // GIF_INPUT_* of DGifDecodeBatch(), -1 = not probed yet
+static void GIFSelectKernels(void);
+static void GIFForgetFile(GifFileType *gif);
+void FreeLastSavedImage(GifFileType *GifFile);
+static ColorMapObject *GIFMakeMapObject(const GifAllocator *pAlloc, int ColorCount, const GifColorType *ColorMap);
+static void GIFFreeMapObject(const GifAllocator *pAlloc, ColorMapObject *Object);
+static void GIFFreeExtensions(const GifAllocator *pAlloc, int *ExtensionBlockCount, ExtensionBlock **ExtensionBlocks);
+//
+// Memory management
+// Everything goes through a GifAllocator. A handle copies the default one
+// when it's opened (or gets its own) and uses it for all of its memory.
+//
+static void *GIFLibcMalloc(size_t iSize, void *pUser)
+{
+    (void)pUser;
+    return malloc(iSize);
+}
+static void *GIFLibcRealloc(void *p, size_t iSize, void *pUser)
+{
+    (void)pUser;
+    return realloc(p, iSize);
+}
+static void GIFLibcFree(void *p, void *pUser)
+{
+    (void)pUser;
+    free(p);
+}
+static GifAllocator GIFDefaultAllocator = {GIFLibcMalloc, GIFLibcRealloc, GIFLibcFree, NULL};
+
+static void *GIFMalloc(const GifAllocator *pAlloc, size_t iSize)
+{
+    return (*pAlloc->Malloc)(iSize, pAlloc->UserData);
+}
+static void *GIFCalloc(const GifAllocator *pAlloc, size_t iSize)
+{
+    void *p = (*pAlloc->Malloc)(iSize, pAlloc->UserData);
+    if (p != NULL)
+        memset(p, 0, iSize);
+    return p;
+}
+static void *GIFRealloc(const GifAllocator *pAlloc, void *p, size_t iSize)
+{
+    return (*pAlloc->Realloc)(p, iSize, pAlloc->UserData);
+}
+static void GIFFree(const GifAllocator *pAlloc, void *p)
+{
+    if (p != NULL)
+        (*pAlloc->Free)(p, pAlloc->UserData);
+}
+//
+// GIFGetAllocator
+//
+// The allocator owning a handle's memory (or the default one)
+//
+static const GifAllocator *GIFGetAllocator(const GifFileType *gif)
+{
+    if (gif != NULL && gif->Private != NULL)
+        return &((GIFPRIVATE *)gif->Private)->Allocator;
+    return &GIFDefaultAllocator;
+} /* GIFGetAllocator() */
+//
+// GIFOverMemory
+//
+// Account for an allocation of iSize bytes by a handle; refuses it when it
+// would take the handle past Limits.MaxMemory
+//
+static int GIFOverMemory(GIFPRIVATE *pPrivate, size_t iSize)
+{
+    if (pPrivate->Limits.MaxMemory && pPrivate->u64Allocated + iSize > pPrivate->Limits.MaxMemory) {
+        pPrivate->bOverLimit = 1;
+        return 1;
+    }
+    pPrivate->u64Allocated += iSize;
+    return 0;
+} /* GIFOverMemory() */
+//
+// GIFHandleMalloc / GIFHandleCalloc / GIFHandleRealloc
+//
+// Allocate memory owned by a handle (pPrivate may be NULL, like in
+// GIFGetAllocator) and count it in the handle's statistics and limits
+//
+static void *GIFHandleMalloc(GIFPRIVATE *pPrivate, size_t iSize)
+{
+    if (pPrivate == NULL)
+        return GIFMalloc(&GIFDefaultAllocator, iSize);
+    if (GIFOverMemory(pPrivate, iSize))
+        return NULL;
+    GIF_COUNT(pPrivate->Stats.Allocations++; pPrivate->Stats.AllocatedBytes += iSize;)
+    return GIFMalloc(&pPrivate->Allocator, iSize);
+}
+static void *GIFHandleCalloc(GIFPRIVATE *pPrivate, size_t iSize)
+{
+    if (pPrivate == NULL)
+        return GIFCalloc(&GIFDefaultAllocator, iSize);
+    if (GIFOverMemory(pPrivate, iSize))
+        return NULL;
+    GIF_COUNT(pPrivate->Stats.Allocations++; pPrivate->Stats.AllocatedBytes += iSize;)
+    return GIFCalloc(&pPrivate->Allocator, iSize);
+}
+static void *GIFHandleRealloc(GIFPRIVATE *pPrivate, void *p, size_t iSize)
+{
+    if (pPrivate == NULL)
+        return GIFRealloc(&GIFDefaultAllocator, p, iSize);
+    if (GIFOverMemory(pPrivate, iSize))
+        return NULL;
+    GIF_COUNT(pPrivate->Stats.Allocations++; pPrivate->Stats.AllocatedBytes += iSize;)
+    return GIFRealloc(&pPrivate->Allocator, p, iSize);
+}
+//
+// GIFMemError
+//
+// The error for a failed allocation of a handle
+//
+static int GIFMemError(const GIFPRIVATE *pPrivate)
+{
+    return (pPrivate->bOverLimit) ? D_GIF_ERR_LIMIT_EXCEEDED : D_GIF_ERR_NOT_ENOUGH_MEM;
+} /* GIFMemError() */
+//
+// GIFTrace
+//
+// Report the beginning or end of a phase to the handle's trace function
+// (use GIF_TRACE, which only calls this when there is one)
+//
+static void GIFTrace(GifFileType *gif, int iPhase, bool bBegin, int iFrame)
+{
+    GIFPRIVATE *pPrivate = (GIFPRIVATE *)gif->Private;
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    (*pPrivate->pfnTrace)(gif, iPhase, bBegin, iFrame, (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec, pPrivate->pTraceUser);
+} /* GIFTrace() */
+// Arena blocks are kept 16-byte aligned
+#define GIF_ARENA_ALIGN(n) (((size_t)(n) + 15) & ~(size_t)15)
+// Largest frame which is decoded as a whole: its 8-bit pixels, the
+// decoder's padding and GIFRasterSize()'s rounding have to fit an int.
+// Descriptors allow up to 65535 x 65535; bigger frames can only be
+// decoded with DGifSlurpScanlines().
+#define GIF_MAX_FRAME_PIXELS ((int64_t)INT32_MAX - GIF_DECODE_PADDING - 0xffff)
+#define GIF_FRAME_TOO_BIG(width, height) ((int64_t)(width) * (height) > GIF_MAX_FRAME_PIXELS)
+//
+// GIFArenaAlloc
+//
+// Take the next block from the frame arena (see GIFSlurpArena())
+//
+static void *GIFArenaAlloc(GIFPRIVATE *pPrivate, size_t iSize)
+{
+    uint8_t *p = pPrivate->pArenaNext;
+
+    iSize = GIF_ARENA_ALIGN(iSize);
+    if (iSize > pPrivate->iArenaLeft)
+        return NULL;
+    pPrivate->pArenaNext += iSize;
+    pPrivate->iArenaLeft -= iSize;
+    return p;
+} /* GIFArenaAlloc() */
+//
+// GifSetAllocator
+//
+// Set the default allocator (NULL = the C library's)
+//
+int GifSetAllocator(const GifAllocator *Allocator)
+{
+    if (Allocator == NULL) {
+        GIFDefaultAllocator.Malloc = GIFLibcMalloc;
+        GIFDefaultAllocator.Realloc = GIFLibcRealloc;
+        GIFDefaultAllocator.Free = GIFLibcFree;
+        GIFDefaultAllocator.UserData = NULL;
+        return GIF_OK;
+    }
+    if (Allocator->Malloc == NULL || Allocator->Realloc == NULL || Allocator->Free == NULL)
+        return GIF_ERROR;
+    GIFDefaultAllocator = *Allocator;
+    return GIF_OK;
+} /* GifSetAllocator() */
 //
 // Macro to write a variable length code to the output buffer
 //
@@ -123,6 +390,9 @@ const char *GifErrorString(int ErrorCode)
       case D_GIF_ERR_EOF_TOO_SOON:
         Err = "Image EOF detected before image complete";
         break;
+      case D_GIF_ERR_LIMIT_EXCEEDED:
+        Err = "Image exceeds the limits set for the handle";
+        break;
       default:
         Err = NULL;
         break;
@@ -154,28 +424,101 @@ void PrintGifError(int ErrorCode) {
 } /* PrintGifError() */
 
 //
-// EGifSpew
+// GIFGrowBuffer
 //
-// Create a multi-frame GIF output file
+// Make sure a reusable work buffer holds at least iSize bytes
+// (the old contents are not preserved)
 //
-int EGifSpew(GifFileType * gif)
+static int GIFGrowBuffer(GIFPRIVATE *pPrivate, uint8_t **ppBuf, int *piBufSize, int iSize)
+{
+    if (iSize <= *piBufSize && *ppBuf != NULL)
+        return GIF_OK;
+    GIFFree(&pPrivate->Allocator, *ppBuf);
+    *ppBuf = (uint8_t *)GIFHandleMalloc(pPrivate, iSize);
+    *piBufSize = (*ppBuf != NULL) ? iSize : 0;
+    return (*ppBuf != NULL) ? GIF_OK : GIF_ERROR;
+} /* GIFGrowBuffer() */
+//
+// GIFPutSubBlocks
+//
+// Store extension data as sub-blocks of up to 255 bytes, each after its
+// length byte (without the terminator); returns the bytes written
+//
+static int GIFPutSubBlocks(uint8_t *pDest, const uint8_t *pData, int iLen)
+{
+    int iChunk, iOut = 0;
+
+    while (iLen > 0) {
+        iChunk = (iLen > 255) ? 255 : iLen;
+        pDest[iOut++] = (uint8_t)iChunk;
+        memcpy(&pDest[iOut], pData, iChunk);
+        iOut += iChunk;
+        pData += iChunk;
+        iLen -= iChunk;
+    }
+    return iOut;
+} /* GIFPutSubBlocks() */
+//
+// GIFReleaseFrames
+//
+// Free the frames and color maps an encoder handle collected for one file
+//
+static void GIFReleaseFrames(GifFileType *gif)
+{
+    GIFPRIVATE *pPrivate = (GIFPRIVATE *)gif->Private;
+    const GifAllocator *pAlloc = GIFGetAllocator(gif);
+
+    if (pPrivate != NULL && pPrivate->pFileData != NULL) {
+        // frames were moved from a decoder (see GifMoveSavedImages), so
+        // they follow the decoder's free rules
+        if (gif->SavedImages)
+            GifFreeImages(gif);
+        GIFFree(pAlloc, pPrivate->pFileData);
+        pPrivate->pFileData = NULL;
+        pPrivate->iFileSize = 0;
+    } else {
+        if (gif->SavedImages != NULL) {
+            // free any saved images
+            while (gif->ImageCount) {
+                FreeLastSavedImage(gif);
+            }
+            GIFFree(pAlloc, gif->SavedImages);
+        }
+        GIFFreeExtensions(pAlloc, &gif->ExtensionBlockCount, &gif->ExtensionBlocks); // never taken by a frame
+    }
+    gif->SavedImages = NULL;
+    gif->ImageCount = 0;
+    if (gif->Image.ColorMap) {
+        GIFFreeMapObject(pAlloc, gif->Image.ColorMap);
+        gif->Image.ColorMap = NULL;
+    }
+    if (gif->SColorMap) {
+        GIFFreeMapObject(pAlloc, gif->SColorMap);
+        gif->SColorMap = NULL;
+    }
+} /* GIFReleaseFrames() */
+//
+// EGifSpewKeep
+//
+// Create a multi-frame GIF output file, then close the file and release the
+// frames but keep the handle and its work buffers so that it can be pointed
+// at the next output file with EGifReopenFileHandle()
+//
+int EGifSpewKeep(GifFileType * gif)
 {
     int rc = GIF_OK;
-    int i, iChunk, iFrame, iSize;
-    uint8_t c, *p, *pLZW = NULL; // buffer holding the compressed data for each frame
-    uint8_t *pChunked = NULL; // temp area for preparing chunked data
+    int i, iChunk, iFrame, iSize, iBits;
+    int64_t i64Pixels, i64LZW, i64Need;
+    uint8_t c, *p, *pLZW; // buffer holding the compressed data for each frame
+    uint8_t *pChunked; // temp area for preparing chunked data
     int iLen;
     GIFPRIVATE *pPrivate = (GIFPRIVATE *)gif->Private;
     
-    pLZW = (uint8_t *)malloc((gif->SWidth * gif->SHeight * 3)/2); // allow for worst case
-    if (pLZW == NULL) {
+    // the work buffers stay with the handle and only grow; they're sized
+    // for each frame below, this is enough for the header
+    if (GIFGrowBuffer(pPrivate, &pPrivate->pChunkBuf, &pPrivate->iChunkBufSize, GIF_HEADER_BYTES) != GIF_OK)
         return E_GIF_ERR_NOT_ENOUGH_MEM;
-    }
-    pChunked = (uint8_t *)malloc(gif->SWidth * gif->SHeight * 2);
-    if (pChunked == NULL) {
-        free(pLZW);
-        return E_GIF_ERR_NOT_ENOUGH_MEM;
-    }
+    pChunked = pPrivate->pChunkBuf;
     // Prepare GIF header
     pChunked[0] = 'G';
     pChunked[1] = 'I';
@@ -224,24 +567,43 @@ int EGifSpew(GifFileType * gif)
         pChunked[iLen++] = 0; // length terminator
     }
 #endif // FUTURE
+    GIF_TRACE(pPrivate, gif, GIF_PHASE_WRITE, true, -1);
+    write(pPrivate->iHandle, pChunked, iLen); // the frames get the whole buffer
+    GIF_TRACE(pPrivate, gif, GIF_PHASE_WRITE, false, -1);
+    iLen = 0;
     // Do the rest of the frames as deltas from the first
     for (iFrame=0; iFrame < gif->ImageCount; iFrame++) // for each frame after initial
     {
         SavedImage *pSI = &gif->SavedImages[iFrame];
+        // the frame's extensions (which may come from a decoded file), its
+        // descriptor and palette and the worst case LZW data: 12-bit codes
+        // plus clear codes, the end code and the 8-byte store of the last ones
+        i64Pixels = (int64_t)pSI->ImageDesc.Width * pSI->ImageDesc.Height;
+        i64LZW = ((i64Pixels + i64Pixels / 256) * 3) / 2 + 64;
+        i64Need = GIF_HEADER_BYTES + i64LZW + i64LZW / 255 + 1;
+        for (int iExt=0; iExt < pSI->ExtensionBlockCount; iExt++)
+            i64Need += 4 + pSI->ExtensionBlocks[iExt].ByteCount + pSI->ExtensionBlocks[iExt].ByteCount / 255;
+        if (i64Need > INT32_MAX) {
+            rc = E_GIF_ERR_DATA_TOO_BIG;
+            break;
+        }
+        if (GIFGrowBuffer(pPrivate, &pPrivate->pLZWBuf, &pPrivate->iLZWBufSize, (int)i64LZW) != GIF_OK ||
+            GIFGrowBuffer(pPrivate, &pPrivate->pChunkBuf, &pPrivate->iChunkBufSize, (int)i64Need) != GIF_OK) {
+            rc = E_GIF_ERR_NOT_ENOUGH_MEM;
+            break;
+        }
+        pLZW = pPrivate->pLZWBuf;
+        pChunked = pPrivate->pChunkBuf;
         for (int iExt=0; iExt < pSI->ExtensionBlockCount; iExt++) { // add extension(s)
             ExtensionBlock *pEB = &pSI->ExtensionBlocks[iExt];
             pChunked[iLen++] = '!';
             pChunked[iLen++] = pEB->Function; // e.g. 0xf9;
-            pChunked[iLen++] = pEB->ByteCount;
-            memcpy(&pChunked[iLen], pEB->Bytes, pEB->ByteCount);
-            iLen += pEB->ByteCount;
+            iLen += GIFPutSubBlocks(&pChunked[iLen], pEB->Bytes, pEB->ByteCount);
             // write any continuation blocks
-            while (iExt < pSI->ExtensionBlockCount && gif->SavedImages[iFrame].ExtensionBlocks[iExt+1].Function == 0 && gif->SavedImages[iFrame].ExtensionBlocks[iExt+1].ByteCount > 0) {
+            while (iExt + 1 < pSI->ExtensionBlockCount && pSI->ExtensionBlocks[iExt+1].Function == CONTINUE_EXT_FUNC_CODE && pSI->ExtensionBlocks[iExt+1].ByteCount > 0) {
                 iExt++;
                 ExtensionBlock *pEB = &pSI->ExtensionBlocks[iExt];
-                pChunked[iLen++] = pEB->ByteCount;
-                memcpy(&pChunked[iLen], pEB->Bytes, pEB->ByteCount);
-                iLen += pEB->ByteCount;
+                iLen += GIFPutSubBlocks(&pChunked[iLen], pEB->Bytes, pEB->ByteCount);
             }
             pChunked[iLen++] = 0; // terminating 0
         } // for each extension block
@@ -254,23 +616,32 @@ int EGifSpew(GifFileType * gif)
         pChunked[iLen++] = (uint8_t)(gif->SavedImages[iFrame].ImageDesc.Width >> 8);
         pChunked[iLen++] = (uint8_t)gif->SavedImages[iFrame].ImageDesc.Height;
         pChunked[iLen++] = (uint8_t)(gif->SavedImages[iFrame].ImageDesc.Height >> 8);
+        c = (gif->SavedImages[iFrame].ImageDesc.Interlace) ? 0x40 : 0; // EncodeLZW() writes the rows in pass order
         if (gif->SavedImages[iFrame].ImageDesc.ColorMap) { // local color table?
-            c = 0x80 | (gif->SavedImages[iFrame].ImageDesc.ColorMap->BitsPerPixel - 1);
+            c |= 0x80 | (gif->SavedImages[iFrame].ImageDesc.ColorMap->BitsPerPixel - 1);
             pChunked[iLen++] = c;
             i = gif->SavedImages[iFrame].ImageDesc.ColorMap->ColorCount; // palette size
             memcpy(&pChunked[iLen], gif->SavedImages[iFrame].ImageDesc.ColorMap->Colors, i * 3);
             iLen += i * 3; // RGB palette entries
         } else {
-            pChunked[iLen++] = 0; // no local color table
+            pChunked[iLen++] = c; // no local color table
         }
         pChunked[iLen++] = gif->SColorResolution;
-        iSize = EncodeLZW(&gif->SavedImages[iFrame], pPrivate->pSymbols, pLZW, gif->SColorResolution);
+        iBits = GifPixelBits(gif, pSI);
+        if (iBits != 8 && GIFGrowBuffer(pPrivate, &pPrivate->pScratch, &pPrivate->iScratchSize, pSI->ImageDesc.Width) != GIF_OK) { // row to unpack into
+            rc = E_GIF_ERR_NOT_ENOUGH_MEM;
+            break;
+        }
+        GIF_TRACE(pPrivate, gif, GIF_PHASE_ENCODE, true, iFrame);
+        iSize = EncodeLZW(pSI, pPrivate->pSymbols, pLZW, gif->SColorResolution, iBits, pPrivate->pScratch, GIF_COUNTERS(pPrivate));
+        GIF_TRACE(pPrivate, gif, GIF_PHASE_ENCODE, false, iFrame);
 //        if (iSize <= 0) { // something went wrong
 //            rc = GIF_ENCODE_ERROR;
 //            goto gif_create_exit;
 //        }
         p = pLZW;
         // Now starts the chunked data for this frame
+        GIF_TRACE(pPrivate, gif, GIF_PHASE_CHUNK, true, iFrame);
         i = 0; // offset to compressed data
         while (i < iSize) { // chunk it
             iChunk = 255; // max 255 bytes per chunk
@@ -282,44 +653,166 @@ int EGifSpew(GifFileType * gif)
         }
         // all compressed data from the frame it done
         pChunked[iLen++] = 0; // no more data
+        GIF_TRACE(pPrivate, gif, GIF_PHASE_CHUNK, false, iFrame);
+        GIF_TRACE(pPrivate, gif, GIF_PHASE_WRITE, true, iFrame);
         write(pPrivate->iHandle, pChunked, iLen);
+        GIF_TRACE(pPrivate, gif, GIF_PHASE_WRITE, false, iFrame);
         iLen = 0;
     } // for each frame
 
+    GIF_TRACE(pPrivate, gif, GIF_PHASE_WRITE, true, -1);
     write(pPrivate->iHandle, ";", 1); // finish the file here
+    GIF_TRACE(pPrivate, gif, GIF_PHASE_WRITE, false, -1);
     close(pPrivate->iHandle);
-    if (pLZW) free(pLZW);
-    if (pChunked) free(pChunked);
-    EGifCloseFile(gif, &rc);
+    pPrivate->iHandle = 0;
+    GIFReleaseFrames(gif);
+    return rc;
+} /* EGifSpewKeep() */
+//
+// EGifSpew
+//
+// Create a multi-frame GIF output file and free the handle
+//
+int EGifSpew(GifFileType * gif)
+{
+    int rc = EGifSpewKeep(gif);
+
+    EGifCloseFile(gif, NULL);
     return rc;
 } /* EGifSpew() */
 //
-// GIFInterlace
+// GIFInterlacedRow
+//
+// Return the display row of the i'th row stored in an interlaced frame
+// (the rows of pass 1, then pass 2...)
 //
-void GIFInterlace(uint8_t *pSrc, int iWidth, int iHeight)
+static int GIFInterlacedRow(int i, int iHeight)
 {
-    int iGifPass = 0;
-    int i, y;
-    uint8_t *d, *s;
-    uint8_t *pTemp = malloc(iWidth * iHeight);
-    
-    y = 0;
-    for (i = 0; i < iHeight; i++)
+    int n;
+
+    n = (iHeight + 7) >> 3; // pass 1: rows 0, 8, 16...
+    if (i < n)
+        return i << 3;
+    i -= n;
+    n = (iHeight + 3) >> 3; // pass 2: rows 4, 12, 20...
+    if (i < n)
+        return (i << 3) + 4;
+    i -= n;
+    n = (iHeight + 1) >> 2; // pass 3: rows 2, 6, 10...
+    if (i < n)
+        return (i << 2) + 2;
+    i -= n;
+    return (i << 1) + 1; // pass 4: the odd rows
+} /* GIFInterlacedRow() */
+//
+// GIFStoredRow
+//
+// Return where display row y is stored in an interlaced frame
+// (the inverse of GIFInterlacedRow)
+//
+static int GIFStoredRow(int y, int iHeight)
+{
+    int iBase;
+
+    if ((y & 7) == 0)
+        return y >> 3;
+    iBase = (iHeight + 7) >> 3;
+    if ((y & 7) == 4)
+        return iBase + (y >> 3);
+    iBase += (iHeight + 3) >> 3;
+    if ((y & 3) == 2)
+        return iBase + (y >> 2);
+    iBase += (iHeight + 1) >> 2;
+    return iBase + (y >> 1);
+} /* GIFStoredRow() */
+//
+// GifPixelBits
+//
+// Number of bits per pixel in the RasterBits of a frame. With GIF_OPT_PACKED
+// set on the handle, frames whose palette (local or global) has at most 2, 4
+// or 16 colors hold 1, 2 or 4 bits per pixel, otherwise 8.
+//
+static int GIFDepthBits(int iOptions, int iBitsPerPixel)
+{
+    if (!(iOptions & GIF_OPT_PACKED) || iBitsPerPixel > 4)
+        return 8;
+    if (iBitsPerPixel <= 2)
+        return (iBitsPerPixel <= 1) ? 1 : 2;
+    return 4;
+} /* GIFDepthBits() */
+int GifPixelBits(const GifFileType *gif, const SavedImage *pImage)
+{
+    const ColorMapObject *pMap;
+
+    if (gif == NULL || gif->Private == NULL || pImage == NULL)
+        return 8;
+    pMap = (pImage->ImageDesc.ColorMap != NULL) ? pImage->ImageDesc.ColorMap : gif->SColorMap;
+    if (pMap == NULL)
+        return 8;
+    return GIFDepthBits(((GIFPRIVATE *)gif->Private)->iOptions, pMap->BitsPerPixel);
+} /* GifPixelBits() */
+//
+// GIFPackRows
+//
+// Pack rows of 8-bit pixels (pitch = width) to iBits per pixel, MSB first.
+// Values are masked to the bit depth. pDst may be the same buffer as pSrc
+// when iDstPitch is the packed pitch: no byte is written before the pixels
+// it replaces have been read.
+//
+GIF_INLINE void GIFPackRowsCore(uint8_t *pDst, int iDstPitch, const uint8_t *pSrc, int iWidth, int iHeight, int iBits)
+{
+    const int iPer = 8 / iBits; // pixels per byte
+    const uint8_t ucMask = (uint8_t)((1 << iBits) - 1);
+    int x, y, i;
+    uint8_t c, *d;
+
+    for (y = 0; y < iHeight; y++, pSrc += iWidth)
     {
-        s = &pSrc[y * iWidth];
-        d = &pTemp[i * iWidth];
-        memcpy(d, s, iWidth);
-        y += cGIFPass[iGifPass * 2];
-        if (y >= iHeight)
+        d = &pDst[y * iDstPitch];
+        for (x = 0; x + iPer <= iWidth; x += iPer)
         {
-            iGifPass++;
-            y = cGIFPass[iGifPass * 2 + 1];
+            c = 0;
+            for (i = 0; i < iPer; i++)
+                c = (uint8_t)((c << iBits) | (pSrc[x + i] & ucMask));
+            *d++ = c;
+        }
+        if (x < iWidth) // partial last byte, unused pixels are 0
+        {
+            c = 0;
+            for (i = 0; i < iPer; i++)
+                c = (uint8_t)((c << iBits) | ((x + i < iWidth) ? (pSrc[x + i] & ucMask) : 0));
+            *d = c;
         }
     }
-    memcpy(pSrc, pTemp, iWidth * iHeight); // copy it back over source image
-    free(pTemp);
+} /* GIFPackRowsCore() */
+static void GIFPackRows(uint8_t *pDst, int iDstPitch, const uint8_t *pSrc, int iWidth, int iHeight, int iBits)
+{
+    if (iBits == 1)
+        GIFPackRowsCore(pDst, iDstPitch, pSrc, iWidth, iHeight, 1);
+    else if (iBits == 2)
+        GIFPackRowsCore(pDst, iDstPitch, pSrc, iWidth, iHeight, 2);
+    else
+        GIFPackRowsCore(pDst, iDstPitch, pSrc, iWidth, iHeight, 4);
+} /* GIFPackRows() */
+//
+// GIFUnpackRow
+//
+// Expand one packed row of iBits per pixel to 8-bit pixels
+//
+static void GIFUnpackRow(uint8_t *pDst, const uint8_t *pSrc, int iWidth, int iBits)
+{
+    const int iPer = 8 / iBits;
+    int x;
+    uint8_t c = 0;
 
-} /* GIFInterlace() */
+    for (x = 0; x < iWidth; x++)
+    {
+        if ((x & (iPer - 1)) == 0)
+            c = *pSrc++;
+        pDst[x] = c >> (8 - iBits);
+        c <<= iBits;
+    }
+} /* GIFUnpackRow() */
 //
 // GifBitSize
 //
@@ -336,12 +829,16 @@ int GifBitSize(int n)
 // GifFreeMapObject
 //
 void GifFreeMapObject(ColorMapObject *Object)
+{
+    GIFFreeMapObject(&GIFDefaultAllocator, Object);
+} /* GifFreeMapObject() */
+static void GIFFreeMapObject(const GifAllocator *pAlloc, ColorMapObject *Object)
 {
     if (Object != NULL) {
-        (void)free(Object->Colors);
-        (void)free(Object);
+        GIFFree(pAlloc, Object->Colors);
+        GIFFree(pAlloc, Object);
     }
-} /* GifFreeMapObject() */
+} /* GIFFreeMapObject() */
 //
 // GifUnionColorMap
 //
@@ -427,7 +924,7 @@ ColorMapObject *GifUnionColorMap(const ColorMapObject *ColorIn1, const ColorMapO
 
         /* perhaps we can shrink the map? */
         if (RoundUpTo < ColorUnion->ColorCount) {
-            GifColorType *new_map = (GifColorType *)realloc(Map,
+            GifColorType *new_map = (GifColorType *)GIFRealloc(&GIFDefaultAllocator, Map,
                                  RoundUpTo * sizeof(GifColorType));
             if( new_map == NULL ) {
                 GifFreeMapObject(ColorUnion);
@@ -447,6 +944,10 @@ ColorMapObject *GifUnionColorMap(const ColorMapObject *ColorIn1, const ColorMapO
 // GifMakeMapObject
 //
 ColorMapObject *GifMakeMapObject(int ColorCount, const GifColorType *ColorMap)
+{
+    return GIFMakeMapObject(&GIFDefaultAllocator, ColorCount, ColorMap);
+} /* GifMakeMapObject() */
+static ColorMapObject *GIFMakeMapObject(const GifAllocator *pAlloc, int ColorCount, const GifColorType *ColorMap)
 {
     ColorMapObject *Object;
 
@@ -454,14 +955,14 @@ ColorMapObject *GifMakeMapObject(int ColorCount, const GifColorType *ColorMap)
         return ((ColorMapObject *) NULL);
     }
 
-    Object = (ColorMapObject *)malloc(sizeof(ColorMapObject));
+    Object = (ColorMapObject *)GIFMalloc(pAlloc, sizeof(ColorMapObject));
     if (Object == (ColorMapObject *) NULL) {
         return ((ColorMapObject *) NULL);
     }
 
-    Object->Colors = (GifColorType *)calloc(ColorCount, sizeof(GifColorType));
+    Object->Colors = (GifColorType *)GIFCalloc(pAlloc, ColorCount * sizeof(GifColorType));
     if (Object->Colors == (GifColorType *) NULL) {
-        free(Object);
+        GIFFree(pAlloc, Object);
         return ((ColorMapObject *) NULL);
     }
 
@@ -475,11 +976,15 @@ ColorMapObject *GifMakeMapObject(int ColorCount, const GifColorType *ColorMap)
     }
 
     return (Object);
-} /* GifMakeMapObject() */
+} /* GIFMakeMapObject() */
 //
 // GifFreeExtensions
 //
 void GifFreeExtensions(int *ExtensionBlockCount, ExtensionBlock **ExtensionBlocks)
+{
+    GIFFreeExtensions(&GIFDefaultAllocator, ExtensionBlockCount, ExtensionBlocks);
+} /* GifFreeExtensions() */
+static void GIFFreeExtensions(const GifAllocator *pAlloc, int *ExtensionBlockCount, ExtensionBlock **ExtensionBlocks)
 {
     ExtensionBlock *ep;
 
@@ -489,17 +994,18 @@ void GifFreeExtensions(int *ExtensionBlockCount, ExtensionBlock **ExtensionBlock
     for (ep = *ExtensionBlocks;
          ep < (*ExtensionBlocks + *ExtensionBlockCount);
          ep++)
-        (void)free((char *)ep->Bytes);
-    (void)free((char *)*ExtensionBlocks);
+        GIFFree(pAlloc, ep->Bytes);
+    GIFFree(pAlloc, *ExtensionBlocks);
     *ExtensionBlocks = NULL;
     *ExtensionBlockCount = 0;
-} /* GifFreeExtensions() */
+} /* GIFFreeExtensions() */
 //
 // FreeLastSavedImage
 //
 void FreeLastSavedImage(GifFileType *GifFile)
 {
     SavedImage *sp;
+    const GifAllocator *pAlloc = GIFGetAllocator(GifFile);
 
     if ((GifFile == NULL) || (GifFile->SavedImages == NULL))
         return;
@@ -510,16 +1016,16 @@ void FreeLastSavedImage(GifFileType *GifFile)
 
     /* Deallocate its Colormap */
     if (sp->ImageDesc.ColorMap != NULL) {
-        GifFreeMapObject(sp->ImageDesc.ColorMap);
+        GIFFreeMapObject(pAlloc, sp->ImageDesc.ColorMap);
         sp->ImageDesc.ColorMap = NULL;
     }
 
     /* Deallocate the image data */
     if (sp->RasterBits != NULL)
-        free((char *)sp->RasterBits);
+        GIFFree(pAlloc, sp->RasterBits);
 
     /* Deallocate any extensions */
-    GifFreeExtensions(&sp->ExtensionBlockCount, &sp->ExtensionBlocks);
+    GIFFreeExtensions(pAlloc, &sp->ExtensionBlockCount, &sp->ExtensionBlocks);
 
     /*** FIXME: We could realloc the GifFile->SavedImages structure but is
      * there a point to it? Saves some memory but we'd have to do it every
@@ -533,10 +1039,13 @@ void FreeLastSavedImage(GifFileType *GifFile)
  */
 SavedImage *GifMakeSavedImage(GifFileType *GifFile, const SavedImage *CopyFrom)
 {
+    const GifAllocator *pAlloc = GIFGetAllocator(GifFile);
+    size_t iSize;
+
     if (GifFile->SavedImages == NULL)
-        GifFile->SavedImages = (SavedImage *)malloc(sizeof(SavedImage));
+        GifFile->SavedImages = (SavedImage *)GIFHandleMalloc(GifFile->Private, sizeof(SavedImage));
     else {
-        SavedImage* newSavedImages = (SavedImage *)realloc(GifFile->SavedImages,
+        SavedImage* newSavedImages = (SavedImage *)GIFHandleRealloc(GifFile->Private, GifFile->SavedImages,
                                (GifFile->ImageCount + 1) * sizeof(SavedImage));
         if( newSavedImages == NULL)
             return ((SavedImage *)NULL);
@@ -558,7 +1067,7 @@ SavedImage *GifMakeSavedImage(GifFileType *GifFile, const SavedImage *CopyFrom)
 
             /* first, the local color map */
             if (CopyFrom->ImageDesc.ColorMap != NULL) {
-                sp->ImageDesc.ColorMap = GifMakeMapObject(
+                sp->ImageDesc.ColorMap = GIFMakeMapObject(pAlloc,
                                          CopyFrom->ImageDesc.ColorMap->ColorCount,
                                          CopyFrom->ImageDesc.ColorMap->Colors);
                 if (sp->ImageDesc.ColorMap == NULL) {
@@ -567,19 +1076,18 @@ SavedImage *GifMakeSavedImage(GifFileType *GifFile, const SavedImage *CopyFrom)
                 }
             }
 
-            /* next, the raster */
-            sp->RasterBits = (unsigned char *)malloc(                             (CopyFrom->ImageDesc.Height *                                           CopyFrom->ImageDesc.Width) *                                          sizeof(GifPixelType));
+            /* next, the raster (which may be packed, see GifPixelBits) */
+            iSize = GIF_PACKED_PITCH(CopyFrom->ImageDesc.Width, GifPixelBits(GifFile, CopyFrom)) * CopyFrom->ImageDesc.Height;
+            sp->RasterBits = (unsigned char *)GIFHandleMalloc(GifFile->Private, iSize);
             if (sp->RasterBits == NULL) {
                 FreeLastSavedImage(GifFile);
                 return (SavedImage *)(NULL);
             }
-            memcpy(sp->RasterBits, CopyFrom->RasterBits,
-                   sizeof(GifPixelType) * CopyFrom->ImageDesc.Height *
-                   CopyFrom->ImageDesc.Width);
+            memcpy(sp->RasterBits, CopyFrom->RasterBits, iSize);
 
             /* finally, the extension blocks */
             if (CopyFrom->ExtensionBlocks != NULL) {
-                sp->ExtensionBlocks = (ExtensionBlock *)calloc(1,                                MAX_EXTENSIONS *                                  sizeof(ExtensionBlock));
+                sp->ExtensionBlocks = (ExtensionBlock *)GIFHandleCalloc(GifFile->Private,                                MAX_EXTENSIONS *                                  sizeof(ExtensionBlock));
                 if (sp->ExtensionBlocks == NULL) {
                     FreeLastSavedImage(GifFile);
                     return (SavedImage *)(NULL);
@@ -595,21 +1103,138 @@ SavedImage *GifMakeSavedImage(GifFileType *GifFile, const SavedImage *CopyFrom)
         return (sp);
     }
 } /* GifMakeSavedImage() */
+//
+// GifMoveSavedImages
+//
+// Transfer the decoded frames of GifIn to the (empty) encoder handle GifOut
+// without copying any pixels. The local palettes and extension bytes of
+// decoded frames point into the decoder's file buffer, so ownership of that
+// buffer moves along with them and it is freed by EGifCloseFile()/EGifSpew().
+// The global color map is moved too if GifOut doesn't have one yet (with
+// GIF_OPT_PACKED, frames without a local palette must keep their bit depth
+// under the encoder's global map).
+// GifIn is left with no images and can be closed normally.
+//
+int GifMoveSavedImages(GifFileType *GifOut, GifFileType *GifIn)
+{
+    GIFPRIVATE *pIn, *pOut;
+    int i;
+
+    if (GifOut == NULL || GifIn == NULL || GifOut->Private == NULL || GifIn->Private == NULL)
+        return GIF_ERROR;
+    pIn = (GIFPRIVATE *)GifIn->Private;
+    pOut = (GIFPRIVATE *)GifOut->Private;
+    if (GifOut->ImageCount != 0 || pOut->pFileData != NULL) {
+        GifOut->Error = E_GIF_ERR_HAS_IMAG_DSCR;
+        return GIF_ERROR;
+    }
+    if (memcmp(&pIn->Allocator, &pOut->Allocator, sizeof(GifAllocator)) != 0) {
+        // the encoder would free the frames with the wrong allocator
+        GifOut->Error = E_GIF_ERR_NOT_WRITEABLE;
+        return GIF_ERROR;
+    }
+    // drop any empty frame array left by EGifPutScreenDesc()
+    if (GifOut->SavedImages != NULL)
+        GIFFree(&pOut->Allocator, GifOut->SavedImages);
+    // the decoder's spare slots from earlier files don't travel
+    for (i = GifIn->ImageCount; i < pIn->iFrameSlots; i++) {
+        GIFFree(&pIn->Allocator, GifIn->SavedImages[i].RasterBits);
+        GIFFree(&pIn->Allocator, GifIn->SavedImages[i].ExtensionBlocks);
+    }
+    pIn->iFrameSlots = pIn->iFrameMemCount = 0;
+    GifOut->SavedImages = GifIn->SavedImages;
+    GifOut->ImageCount = GifIn->ImageCount;
+    GifOut->ExtensionBlocks = GifIn->ExtensionBlocks;
+    GifOut->ExtensionBlockCount = GifIn->ExtensionBlockCount;
+    if (GifOut->SColorMap == NULL) {
+        GifOut->SColorMap = GifIn->SColorMap;
+        if (GifIn->SColorMap == pIn->pSColorMap)
+            pIn->pSColorMap = NULL;
+        GifIn->SColorMap = NULL;
+    }
+    pOut->pFileData = pIn->pFileData;
+    pOut->iFileSize = pIn->iFileSize;
+    pOut->iOptions |= (pIn->iOptions & GIF_OPT_PACKED); // the encoder has to read the frames the same way
+    if (GifIn->SavedImages != NULL && GifIn->SavedImages == (SavedImage *)pIn->pArena) {
+        pOut->pArena = pIn->pArena; // GIF_OPT_ARENA frames
+        pOut->iArenaSize = pIn->iArenaSize;
+        pIn->pArena = NULL;
+        pIn->iArenaSize = 0;
+    }
+
+    GifIn->SavedImages = NULL;
+    GifIn->ImageCount = 0;
+    GifIn->ExtensionBlocks = NULL;
+    GifIn->ExtensionBlockCount = 0;
+    pIn->pFileData = NULL;
+    pIn->iFileSize = pIn->iFileDataSize = 0;
+    return GIF_OK;
+} /* GifMoveSavedImages() */
 
+#ifdef GIF_STATS
+//
+// GIFCountString / GIFCountProbe / GIFAddCounters
+//
+// The kernels count in a local GifCodecStats and add it to the handle's
+// (pCounters, if any) when they're done
+//
+GIF_INLINE void GIFCountString(GifCodecStats *pCounts, int iLen)
+{
+    pCounts->Strings++;
+    pCounts->BytesCopied += iLen;
+    if (iLen > pCounts->MaxStringLength)
+        pCounts->MaxStringLength = iLen;
+}
+GIF_INLINE void GIFCountProbe(GifCodecStats *pCounts, int iProbes)
+{
+    pCounts->HashProbes += iProbes;
+    if (iProbes > pCounts->MaxHashProbe)
+        pCounts->MaxHashProbe = iProbes;
+}
+static void GIFAddCounters(GifCodecStats *pCounters, const GifCodecStats *pCounts)
+{
+    if (pCounters == NULL)
+        return;
+    pCounters->Codes += pCounts->Codes;
+    pCounters->ClearCodes += pCounts->ClearCodes;
+    pCounters->DeferredClears += pCounts->DeferredClears;
+    pCounters->Strings += pCounts->Strings;
+    pCounters->BytesCopied += pCounts->BytesCopied;
+    if (pCounts->MaxStringLength > pCounters->MaxStringLength)
+        pCounters->MaxStringLength = pCounts->MaxStringLength;
+    pCounters->EncodeCodes += pCounts->EncodeCodes;
+    pCounters->EncodeClears += pCounts->EncodeClears;
+    pCounters->HashLookups += pCounts->HashLookups;
+    pCounters->HashProbes += pCounts->HashProbes;
+    if (pCounts->MaxHashProbe > pCounters->MaxHashProbe)
+        pCounters->MaxHashProbe = pCounts->MaxHashProbe;
+} /* GIFAddCounters() */
+#endif // GIF_STATS
 //
 // Compress a GIF image with LZW
+// The rows of an interlaced image are read in pass order, straight from
+// the (display order) RasterBits. Packed rows (iBits < 8, see GifPixelBits)
+// are expanded one at a time into pRowBuf (Width bytes). With GIF_STATS the
+// codes and hash probes are added to pCounters (if not NULL).
 //
-int EncodeLZW(SavedImage *pImage, uint32_t *pSymbols, uint8_t *pOutput, uint8_t ucCodeStart)
+GIF_INLINE int EncodeLZWCore(SavedImage *pImage, uint32_t *pSymbols, uint8_t *pOutput, uint8_t ucCodeStart, int iBits, uint8_t *pRowBuf, GifCodecStats *pCounters)
 {
 int i, iMAXMAX;
 int init_bits, nbits, bitoff, byteoff;
-unsigned char *p;
+unsigned char *p, *pRowEnd;
 BIGUINT u64Out;
 short *codetab, disp, code, maxcode, cc, free_ent, eoi;
 BIGINT lastentry;
 int32_t hashcode, cvar, *hashtab;
 int iRemainingPixels = pImage->ImageDesc.Height * pImage->ImageDesc.Width;
+int y, iGifPass, iPitch;
+#ifdef GIF_STATS
+GifCodecStats cs;
+int iProbes = 0;
+#endif
     
+    (void)pCounters;
+    GIF_COUNT(memset(&cs, 0, sizeof(cs));)
     u64Out = 0;
     bitoff = byteoff = 0;
     init_bits = ucCodeStart + 1;
@@ -628,15 +1253,45 @@ int iRemainingPixels = pImage->ImageDesc.Height * pImage->ImageDesc.Width;
   for (i=0; i<MAX_HASH; i++)
      hashtab[i] = -1;
   GIFOUTPUT(cc, nbits); /* Start by encoding a cc */
+  GIF_COUNT(cs.EncodeCodes++;)
   p = pImage->RasterBits;
+  iPitch = pImage->ImageDesc.Width;
+  if (iBits != 8) {
+      iPitch = GIF_PACKED_PITCH(iPitch, iBits);
+      GIFUnpackRow(pRowBuf, p, pImage->ImageDesc.Width, iBits);
+      p = pRowBuf;
+  }
+  // a non-interlaced 8-bit image is read as one long row
+  pRowEnd = p + ((pImage->ImageDesc.Interlace || iBits != 8) ? pImage->ImageDesc.Width : iRemainingPixels);
+  y = iGifPass = 0;
   lastentry = *p++; /* Get first pixel to start */
     iRemainingPixels--;
   while (iRemainingPixels)
   {
+      if (p == pRowEnd) // next row of an interlaced or packed image
+      {
+          if (pImage->ImageDesc.Interlace) {
+              y += cGIFPass[iGifPass * 2];
+              while (y >= pImage->ImageDesc.Height && iGifPass < 3) // short images can skip whole passes
+              {
+                  iGifPass++;
+                  y = cGIFPass[iGifPass * 2 + 1];
+              }
+          } else {
+              y++;
+          }
+          p = &pImage->RasterBits[y * iPitch];
+          if (iBits != 8) {
+              GIFUnpackRow(pRowBuf, p, pImage->ImageDesc.Width, iBits);
+              p = pRowBuf;
+          }
+          pRowEnd = p + pImage->ImageDesc.Width;
+      }
       cvar = *p++; /* Grab a character to compress */
       iRemainingPixels--;
       hashcode = (cvar << 12) + (int32_t)lastentry;
       code = (short)((cvar << 4) ^ lastentry);
+      GIF_COUNT(cs.HashLookups++; iProbes = 0;)
       if (hashcode == hashtab[code])
       {
           lastentry = codetab[code];
@@ -650,17 +1305,20 @@ int iRemainingPixels = pImage->ImageDesc.Height * pImage->ImageDesc.Width;
          if (code == 0)
              disp = 1;
 gif_probe:
+          GIF_COUNT(iProbes++;)
           code -= disp;
           if (code < 0)
              code += MAX_HASH;
           if (hashtab[code] == hashcode)
           {
+              GIF_COUNT(GIFCountProbe(&cs, iProbes);)
               lastentry = codetab[code];
               continue;
           }
           if (hashtab[code] > 0)
               goto gif_probe;
 gif_nomatch:
+          GIF_COUNT(GIFCountProbe(&cs, iProbes); cs.EncodeCodes++;)
           GIFOUTPUT(lastentry, nbits); /* encode this one */
           lastentry = (short)cvar;
           /* Check for code size increase/clear flag */
@@ -680,6 +1338,7 @@ gif_nomatch:
              if (nbits == 13)
                  nbits--; /* Bit count is wrong */
              GIFOUTPUT(cc, nbits); /* encode this one */
+             GIF_COUNT(cs.EncodeCodes++; cs.EncodeClears++;)
              memset(hashtab, 0xff, MAX_HASH * sizeof(int32_t));
              nbits = init_bits;
              maxcode = (1 << nbits) - 1;
@@ -689,12 +1348,45 @@ gif_nomatch:
     /* Output the final code */
     GIFOUTPUT(lastentry, nbits); /* encode this one */
     GIFOUTPUT(eoi, nbits); /* End of image */
+    GIF_COUNT(cs.EncodeCodes += 2; GIFAddCounters(pCounters, &cs);)
     p = pOutput + byteoff;
     *(BIGUINT *)p = u64Out; // store final code(s)
     byteoff += (bitoff >> 3);
     if (bitoff & 7)
         byteoff++; // partial byte
     return byteoff; // data size
+} /* EncodeLZWCore() */
+//
+// EncodeLZW variants
+//
+// One per CPU variant (see GIFSelectKernels), each with a copy specialized
+// for the common 8-bit code start (256 color palettes).
+//
+static int EncodeLZWGeneric(SavedImage *pImage, uint32_t *pSymbols, uint8_t *pOutput, uint8_t ucCodeStart, int iBits, uint8_t *pRowBuf, GifCodecStats *pCounters)
+{
+    if (ucCodeStart == 8)
+        return EncodeLZWCore(pImage, pSymbols, pOutput, 8, iBits, pRowBuf, pCounters);
+    return EncodeLZWCore(pImage, pSymbols, pOutput, ucCodeStart, iBits, pRowBuf, pCounters);
+}
+#ifdef GIF_DISPATCH
+GIF_TARGET_BMI2 static int EncodeLZWBMI2(SavedImage *pImage, uint32_t *pSymbols, uint8_t *pOutput, uint8_t ucCodeStart, int iBits, uint8_t *pRowBuf, GifCodecStats *pCounters)
+{
+    if (ucCodeStart == 8)
+        return EncodeLZWCore(pImage, pSymbols, pOutput, 8, iBits, pRowBuf, pCounters);
+    return EncodeLZWCore(pImage, pSymbols, pOutput, ucCodeStart, iBits, pRowBuf, pCounters);
+}
+GIF_TARGET_AVX2 static int EncodeLZWAVX2(SavedImage *pImage, uint32_t *pSymbols, uint8_t *pOutput, uint8_t ucCodeStart, int iBits, uint8_t *pRowBuf, GifCodecStats *pCounters)
+{
+    if (ucCodeStart == 8)
+        return EncodeLZWCore(pImage, pSymbols, pOutput, 8, iBits, pRowBuf, pCounters);
+    return EncodeLZWCore(pImage, pSymbols, pOutput, ucCodeStart, iBits, pRowBuf, pCounters);
+}
+#endif // GIF_DISPATCH
+int EncodeLZW(SavedImage *pImage, uint32_t *pSymbols, uint8_t *pOutput, uint8_t ucCodeStart, int iBits, uint8_t *pRowBuf, GifCodecStats *pCounters)
+{
+    if (pfnGIFEncodeLZW == NULL)
+        GIFSelectKernels();
+    return (*pfnGIFEncodeLZW)(pImage, pSymbols, pOutput, ucCodeStart, iBits, pRowBuf, pCounters);
 } /* EncodeLZW() */
 //
 // EGifSetGifVersion
@@ -706,76 +1398,101 @@ void EGifSetGifVersion(GifFileType *GifFile, const bool gif89)
     (void)gif89;
 } /* EGifSetGifVersion() */
 
+//
+// GIFNextExtension
+//
+// Append an extension block to the current frame; before the first frame
+// they're kept in the handle until EGifPutImageDesc() takes them
+//
+static ExtensionBlock *GIFNextExtension(GifFileType *gif)
+{
+    int *pCount;
+    ExtensionBlock **ppBlocks;
+
+    if (gif->ImageCount > 0) {
+        pCount = &gif->SavedImages[gif->ImageCount-1].ExtensionBlockCount;
+        ppBlocks = &gif->SavedImages[gif->ImageCount-1].ExtensionBlocks;
+    } else {
+        pCount = &gif->ExtensionBlockCount;
+        ppBlocks = &gif->ExtensionBlocks;
+    }
+    if (*ppBlocks == NULL) {
+        // allocate some extension block structures
+        *ppBlocks = GIFHandleCalloc(gif->Private, MAX_EXTENSIONS * sizeof(ExtensionBlock));
+        *pCount = 0;
+        if (*ppBlocks == NULL)
+            return NULL;
+    }
+    if (*pCount >= MAX_EXTENSIONS)
+        return NULL;
+    return &(*ppBlocks)[(*pCount)++];
+} /* GIFNextExtension() */
+
+//
+// GIFLastExtension
+//
+// The block the last EGifPutExtensionLeader() started, or NULL
+//
+static ExtensionBlock *GIFLastExtension(GifFileType *gif)
+{
+    if (gif->ImageCount > 0) {
+        SavedImage *pImage = &gif->SavedImages[gif->ImageCount-1];
+        return pImage->ExtensionBlockCount ? &pImage->ExtensionBlocks[pImage->ExtensionBlockCount-1] : NULL;
+    }
+    return gif->ExtensionBlockCount ? &gif->ExtensionBlocks[gif->ExtensionBlockCount-1] : NULL;
+} /* GIFLastExtension() */
+
 //
 // EGifPutExtensionLeader
 //
+// Start an extension of the frame being written; its data follows with
+// EGifPutExtensionBlock()
+//
 int EGifPutExtensionLeader(GifFileType *gif, const int ExtCode)
 {
-    SavedImage *pImage;
-    
-  // put it in the last/current page of the current file
+    ExtensionBlock *pEB;
+
     if (gif == NULL)
         return E_GIF_ERR_NOT_WRITEABLE;
-    if (gif->ImageCount > 0) {
-        // put it in a saved image
-        pImage = &gif->SavedImages[gif->ImageCount-1];
-        if (pImage->ExtensionBlockCount == 0) {
-            // allocate some extension block structures
-            pImage->ExtensionBlocks = calloc(1, MAX_EXTENSIONS * sizeof(ExtensionBlock));
-            if (pImage->ExtensionBlocks == NULL)
-                return E_GIF_ERR_NOT_ENOUGH_MEM;
-            pImage->ExtensionBlockCount = 1;
-        }
-        pImage->ExtensionBlocks[pImage->ExtensionBlockCount-1].Function = ExtCode;
-    } else  { // put it in the main image
-        if (gif->ExtensionBlockCount == 0) {
-            // allocate some extension block structures
-            gif->ExtensionBlocks = calloc(1, MAX_EXTENSIONS * sizeof(ExtensionBlock));
-            if (gif->ExtensionBlocks == NULL)
-                return E_GIF_ERR_NOT_ENOUGH_MEM;
-            gif->ExtensionBlockCount = 1;
-        }
-        gif->ExtensionBlocks[gif->ExtensionBlockCount-1].Function = ExtCode;
-    }
+    pEB = GIFNextExtension(gif);
+    if (pEB == NULL)
+        return E_GIF_ERR_NOT_ENOUGH_MEM;
+    pEB->Function = ExtCode;
+    pEB->ByteCount = 0;
+    pEB->Bytes = NULL;
     return GIF_OK;
 } /* EGifPutExtensionLeader() */
 
 //
 // EGifPutExtensionBlock
 //
+// Add a data block (a copy of it) to the extension started last; the blocks
+// after the first one are kept as CONTINUE_EXT_FUNC_CODE blocks
+//
 int EGifPutExtensionBlock(GifFileType *gif, const int ExtLen, const void *Extension)
 {
-    SavedImage *pImage;
-    
-  // put it in the last/current page of the current file
+    ExtensionBlock *pEB;
+
     if (gif == NULL)
         return E_GIF_ERR_NOT_WRITEABLE;
-    if (gif->ImageCount > 0) {
-        // put it in a saved image
-        pImage = &gif->SavedImages[gif->ImageCount-1];
-        if (pImage->ExtensionBlockCount == 0) {
-            // allocate some extension block structures
-            pImage->ExtensionBlocks = calloc(1, MAX_EXTENSIONS * sizeof(ExtensionBlock));
-            if (pImage->ExtensionBlocks == NULL)
-                return E_GIF_ERR_NOT_ENOUGH_MEM;
-            pImage->ExtensionBlockCount = 1;
-        }
-        pImage->ExtensionBlocks[pImage->ExtensionBlockCount-1].ByteCount = ExtLen;
-        pImage->ExtensionBlocks[pImage->ExtensionBlockCount-1].Bytes = malloc(ExtLen);
-        memcpy(pImage->ExtensionBlocks[pImage->ExtensionBlockCount-1].Bytes, Extension, ExtLen);
-    } else  { // put it in the main image
-        if (gif->ExtensionBlockCount == 0) {
-            // allocate some extension block structures
-            gif->ExtensionBlocks = calloc(1, MAX_EXTENSIONS * sizeof(ExtensionBlock));
-            if (gif->ExtensionBlocks == NULL)
-                return E_GIF_ERR_NOT_ENOUGH_MEM;
-            gif->ExtensionBlockCount = 1;
-        }
-        gif->ExtensionBlocks[gif->ExtensionBlockCount-1].ByteCount = ExtLen;
-        gif->ExtensionBlocks[gif->ExtensionBlockCount-1].Bytes = malloc(ExtLen);
-        memcpy(gif->ExtensionBlocks[gif->ExtensionBlockCount-1].Bytes, Extension, ExtLen);
-    }
-    return GIF_OK;}
+    pEB = GIFLastExtension(gif);
+    if (pEB == NULL || ExtLen <= 0 || ExtLen > 255 || Extension == NULL)
+        return E_GIF_ERR_DATA_TOO_BIG;
+    if (pEB->Bytes != NULL) { // a continuation of it
+        pEB = GIFNextExtension(gif);
+        if (pEB == NULL)
+            return E_GIF_ERR_NOT_ENOUGH_MEM;
+        pEB->Function = CONTINUE_EXT_FUNC_CODE;
+    }
+    pEB->Bytes = GIFHandleMalloc(gif->Private, ExtLen);
+    if (pEB->Bytes == NULL) {
+        pEB->ByteCount = 0;
+        return E_GIF_ERR_NOT_ENOUGH_MEM;
+    }
+    memcpy(pEB->Bytes, Extension, ExtLen);
+    pEB->ByteCount = ExtLen;
+    return GIF_OK;
+} /* EGifPutExtensionBlock() */
 //
 // EGifPutExtensionTrailer
 //
@@ -786,6 +1503,29 @@ int EGifPutExtensionTrailer(GifFileType *GifFile)
     return GIF_OK;
 } /* EGifPutExtensionsTrailer() */
 //
+// EGifPutExtension
+//
+// An extension with one data block of 1-255 bytes (see
+// EGifPutExtensionLeader)
+//
+int EGifPutExtension(GifFileType *gif, const int ExtCode, const int ExtLen, const void *Extension)
+{
+    int rc;
+
+    if (gif == NULL)
+        return GIF_ERROR;
+    rc = EGifPutExtensionLeader(gif, ExtCode);
+    if (rc == GIF_OK)
+        rc = EGifPutExtensionBlock(gif, ExtLen, Extension);
+    if (rc == GIF_OK)
+        rc = EGifPutExtensionTrailer(gif);
+    if (rc != GIF_OK) {
+        gif->Error = rc;
+        return GIF_ERROR;
+    }
+    return GIF_OK;
+} /* EGifPutExtension() */
+//
 // EGifPutScreenDesc
 //
 int EGifPutScreenDesc(GifFileType *GifFile,
@@ -808,7 +1548,7 @@ int EGifPutScreenDesc(GifFileType *GifFile,
     GifFile->SColorResolution = ColorRes;
     GifFile->SBackGroundColor = BackGround;
     if (ColorMap) {
-        GifFile->SColorMap = GifMakeMapObject(ColorMap->ColorCount,
+        GifFile->SColorMap = GIFMakeMapObject(GIFGetAllocator(GifFile), ColorMap->ColorCount,
                                            ColorMap->Colors);
         if (GifFile->SColorMap == NULL) {
             GifFile->Error = E_GIF_ERR_NOT_ENOUGH_MEM;
@@ -820,7 +1560,7 @@ int EGifPutScreenDesc(GifFileType *GifFile,
     // Mark this file as having a screen descriptor, and no pixel data yet
     // Allocate memory for the image data
     GifFile->ImageCount = 0;
-    GifFile->SavedImages = calloc(1, sizeof(SavedImage) * GIF_IMAGE_INCREMENT); // allocate N image structures
+    GifFile->SavedImages = GIFHandleCalloc(GifFile->Private, sizeof(SavedImage) * GIF_IMAGE_INCREMENT); // allocate N image structures
     if (GifFile->SavedImages == NULL) {
         GifFile->Error = E_GIF_ERR_NOT_ENOUGH_MEM;
         return GIF_ERROR;
@@ -846,6 +1586,10 @@ int EGifPutImageDesc(GifFileType *GifFile,
         GifFile->Error = E_GIF_ERR_HAS_IMAG_DSCR;
         return GIF_ERROR;
     }
+    if ((int64_t)Width * Height > INT32_MAX) { // the pixels are counted in an int
+        GifFile->Error = E_GIF_ERR_DATA_TOO_BIG;
+        return GIF_ERROR;
+    }
     GifFile->Image.Left = Left;
     GifFile->Image.Top = Top;
     GifFile->Image.Width = Width;
@@ -854,10 +1598,10 @@ int EGifPutImageDesc(GifFileType *GifFile,
     if (ColorMap != GifFile->Image.ColorMap) {
         if (ColorMap) {
             if (GifFile->Image.ColorMap != NULL) {
-            GifFreeMapObject(GifFile->Image.ColorMap);
+            GIFFreeMapObject(GIFGetAllocator(GifFile), GifFile->Image.ColorMap);
             GifFile->Image.ColorMap = NULL;
             }
-            GifFile->Image.ColorMap = GifMakeMapObject(ColorMap->ColorCount,
+            GifFile->Image.ColorMap = GIFMakeMapObject(GIFGetAllocator(GifFile), ColorMap->ColorCount,
                                 ColorMap->Colors);
             if (GifFile->Image.ColorMap == NULL) {
             GifFile->Error = E_GIF_ERR_NOT_ENOUGH_MEM;
@@ -878,7 +1622,30 @@ int EGifPutImageDesc(GifFileType *GifFile,
     GifFile->SavedImages[0].ImageDesc.Left = Left;
     GifFile->SavedImages[0].ImageDesc.Width = Width;
     GifFile->SavedImages[0].ImageDesc.Height = Height;
-    GifFile->SavedImages[0].RasterBits = malloc(Width * Height);
+    GifFile->SavedImages[0].ImageDesc.Interlace = Interlace;
+    // the frame gets its own copy of the local palette; EGifSpew() writes it
+    // and GifPixelBits() takes the packed depth from it
+    if (GifFile->SavedImages[0].ImageDesc.ColorMap != NULL) {
+        GIFFreeMapObject(GIFGetAllocator(GifFile), GifFile->SavedImages[0].ImageDesc.ColorMap);
+        GifFile->SavedImages[0].ImageDesc.ColorMap = NULL;
+    }
+    if (GifFile->Image.ColorMap != NULL) {
+        GifFile->SavedImages[0].ImageDesc.ColorMap = GIFMakeMapObject(GIFGetAllocator(GifFile), GifFile->Image.ColorMap->ColorCount,
+                                GifFile->Image.ColorMap->Colors);
+        if (GifFile->SavedImages[0].ImageDesc.ColorMap == NULL) {
+            GifFile->Error = E_GIF_ERR_NOT_ENOUGH_MEM;
+            return GIF_ERROR;
+        }
+    }
+    // extensions put before the descriptor are written ahead of this frame
+    if (GifFile->ExtensionBlocks != NULL && GifFile->SavedImages[0].ExtensionBlocks == NULL) {
+        GifFile->SavedImages[0].ExtensionBlocks = GifFile->ExtensionBlocks;
+        GifFile->SavedImages[0].ExtensionBlockCount = GifFile->ExtensionBlockCount;
+        GifFile->ExtensionBlocks = NULL;
+        GifFile->ExtensionBlockCount = 0;
+    }
+    // zeroed so that EGifPutLine() can OR packed pixels in
+    GifFile->SavedImages[0].RasterBits = GIFHandleCalloc(GifFile->Private, GIF_PACKED_PITCH(Width, GifPixelBits(GifFile, &GifFile->SavedImages[0])) * Height);
     if (GifFile->SavedImages[0].RasterBits == NULL) {
         GifFile->Error = E_GIF_ERR_NOT_ENOUGH_MEM;
         return GIF_ERROR;
@@ -888,7 +1655,6 @@ int EGifPutImageDesc(GifFileType *GifFile,
     else if (GifFile->SColorMap)
         pPrivate->iBitsPerPixel = GifFile->SColorMap->BitsPerPixel;
 
-    printf("allocated rasterbits, cx =%d, cy = %d\n", Width, Height);
     /* Mark this file as being ready to receive pixel data */
     pPrivate->iPixelCount = Width * Height;
 
@@ -902,7 +1668,7 @@ int EGifPutLine(GifFileType *gif, GifPixelType *pLine,
                 int LineLen)
 {
     GIFPRIVATE *pPrivate;
-    int i;
+    int i, iPos, iRow, iLen, iBits, iCol;
     uint8_t *d, ucMask;
     SavedImage *pSI;
     
@@ -926,18 +1692,34 @@ int EGifPutLine(GifFileType *gif, GifPixelType *pLine,
     // wrong code (because of overflow when we combine them) in this case
     ucMask = (1 << pPrivate->iBitsPerPixel) - 1;
     pSI = &gif->SavedImages[gif->ImageCount-1];
-    d = pSI->RasterBits;
-    i = (pSI->ImageDesc.Width * pSI->ImageDesc.Height) - pPrivate->iPixelCount; // current output pointer
-    printf("image writing offset = %d\n", i);
-    d += i;
-    for (i = 0; i < LineLen; i++)
-        *d++ = (pLine[i] &= ucMask);
+    iBits = GifPixelBits(gif, pSI);
+    iPos = (pSI->ImageDesc.Width * pSI->ImageDesc.Height) - pPrivate->iPixelCount; // current output pointer
+    // Lines of an interlaced image arrive in pass order; store each one at
+    // its display row, which is where EncodeLZW() expects it
+    for (i = 0; i < LineLen; i += iLen, iPos += iLen) {
+        iRow = iPos / pSI->ImageDesc.Width;
+        iLen = pSI->ImageDesc.Width - (iPos - iRow * pSI->ImageDesc.Width); // rest of this row
+        if (iLen > LineLen - i)
+            iLen = LineLen - i;
+        if (pSI->ImageDesc.Interlace)
+            iRow = GIFInterlacedRow(iRow, pSI->ImageDesc.Height);
+        iCol = iPos % pSI->ImageDesc.Width;
+        if (iBits == 8) {
+            d = &pSI->RasterBits[iRow * pSI->ImageDesc.Width + iCol];
+            for (int x = 0; x < iLen; x++)
+                d[x] = (pLine[i + x] &= ucMask);
+        } else { // GIF_OPT_PACKED
+            d = &pSI->RasterBits[iRow * GIF_PACKED_PITCH(pSI->ImageDesc.Width, iBits)];
+            for (int x = iCol; x < iCol + iLen; x++)
+                d[(x * iBits) >> 3] |= (uint8_t)((pLine[i + x - iCol] &= ucMask) << (8 - iBits - ((x * iBits) & 7)));
+        }
+    }
 
     pPrivate->iPixelCount -= LineLen;
     if (pPrivate->iPixelCount == 0) { // image finished!
         // Need to hack things a bit to not free the outer gif
         // structure here because the old API freed it explicitly
-        GifFileType *pTempGif = malloc(sizeof(GifFileType));
+        GifFileType *pTempGif = GIFHandleMalloc(gif->Private, sizeof(GifFileType));
         int err;
         memcpy(pTempGif, gif, sizeof(GifFileType));
         err = EGifSpew(pTempGif);
@@ -989,27 +1771,39 @@ GifFileType *EGifOpenFileName(const char *fname, const bool TestExistence, int *
 // EGifOpenFileHandle
 //
 GifFileType *EGifOpenFileHandle(const int FileHandle, int *pError)
+{
+    return EGifOpenFileHandleAlloc(FileHandle, NULL, pError);
+} /* EGifOpenFileHandle() */
+//
+// EGifOpenFileHandleAlloc
+//
+// Open an encoder which uses the given allocator (NULL = the default one)
+//
+GifFileType *EGifOpenFileHandleAlloc(const int FileHandle, const GifAllocator *pAlloc, int *pError)
 {
     GifFileType *gif;
     GIFPRIVATE *pPrivate;
 
-    gif = (GifFileType *) calloc(1, sizeof(GifFileType));
+    if (pAlloc == NULL)
+        pAlloc = &GIFDefaultAllocator;
+    gif = (GifFileType *) GIFCalloc(pAlloc, sizeof(GifFileType));
     if (gif == NULL) {
         return NULL;
     }
 
-    pPrivate = (GIFPRIVATE *)calloc(1, sizeof(GIFPRIVATE));
+    pPrivate = (GIFPRIVATE *)GIFCalloc(pAlloc, sizeof(GIFPRIVATE));
     if (pPrivate == NULL) {
-        free(gif);
+        GIFFree(pAlloc, gif);
         if (pError != NULL)
         *pError = E_GIF_ERR_NOT_ENOUGH_MEM;
         return NULL;
     }
+    pPrivate->Allocator = *pAlloc;
     pPrivate->iPixelCount = -1;
-    pPrivate->pSymbols = malloc(3 * 4096 * sizeof(uint32_t));
+    pPrivate->pSymbols = GIFHandleMalloc(pPrivate, 3 * 4096 * sizeof(uint32_t));
     if (pPrivate->pSymbols == NULL) {
-        free(gif);
-        free(pPrivate);
+        GIFFree(pAlloc, gif);
+        GIFFree(pAlloc, pPrivate);
         if (pError != NULL)
         *pError = E_GIF_ERR_NOT_ENOUGH_MEM;
         return NULL;
@@ -1025,7 +1819,37 @@ GifFileType *EGifOpenFileHandle(const int FileHandle, int *pError)
     gif->Error = 0;
 
     return gif;
-} /* EGifOpenFileHandle() */
+} /* EGifOpenFileHandleAlloc() */
+//
+// EGifReopenFileHandle
+//
+// Point an encoder handle at a new output file. The symbol table and work
+// buffers are kept; any frames left from the previous file are freed.
+//
+int EGifReopenFileHandle(GifFileType *gif, const int FileHandle, int *pError)
+{
+    GIFPRIVATE *pPrivate;
+
+    if (gif == NULL || gif->Private == NULL) {
+        if (pError != NULL)
+            *pError = E_GIF_ERR_NOT_WRITEABLE;
+        return GIF_ERROR;
+    }
+    pPrivate = (GIFPRIVATE *)gif->Private;
+    if (pPrivate->iHandle) {
+        close(pPrivate->iHandle);
+    }
+    GIFReleaseFrames(gif);
+
+#ifdef _WIN32
+    _setmode(FileHandle, O_BINARY);    /* Make sure it is in binary mode. */
+#endif /* _WIN32 */
+
+    pPrivate->iHandle = FileHandle;
+    pPrivate->iPixelCount = -1;
+    gif->Error = 0;
+    return GIF_OK;
+} /* EGifReopenFileHandle() */
 //
 // EGifOpen
 //
@@ -1043,33 +1867,22 @@ const char *EGifGetGifVersion(GifFileType *GifFile)
 int EGifCloseFile(GifFileType *gif, int *ErrorCode)
 {
     int err = GIF_OK;
+    GifAllocator Alloc = *GIFGetAllocator(gif); // the handle itself is freed with it too
+
+    GIFReleaseFrames(gif);
     if (gif->Private) {
         GIFPRIVATE *pPrivate = (GIFPRIVATE *)gif->Private;
         if (pPrivate->iHandle) {
             close(pPrivate->iHandle);
         }
-        if (pPrivate->pSymbols)
-            free(pPrivate->pSymbols);
-        free(pPrivate);
+        GIFFree(&Alloc, pPrivate->pSymbols);
+        GIFFree(&Alloc, pPrivate->pLZWBuf);
+        GIFFree(&Alloc, pPrivate->pChunkBuf);
+        GIFFree(&Alloc, pPrivate->pScratch);
+        GIFFree(&Alloc, pPrivate);
         gif->Private = NULL;
     }
-    if (gif->Image.ColorMap) {
-        GifFreeMapObject(gif->Image.ColorMap);
-        gif->Image.ColorMap = NULL;
-    }
-    if (gif->SColorMap) {
-        GifFreeMapObject(gif->SColorMap);
-        gif->SColorMap = NULL;
-    }
-    if (gif->ImageCount && gif->SavedImages != NULL) {
-        // free any saved images
-        while (gif->ImageCount) {
-            FreeLastSavedImage(gif);
-        }
-        free(gif->SavedImages);
-        gif->SavedImages = NULL;
-    }
-    free(gif);
+    GIFFree(&Alloc, gif);
     return err;
 } /* EGifCloseFile() */
 
@@ -1077,8 +1890,9 @@ int EGifCloseFile(GifFileType *gif, int *ErrorCode)
 // LZWCopyBytes
 //
 // Output the bytes for a single code (checks for buffer len)
+// iVector is the block size of the variant's copies (16 or 32)
 //
-static int LZWCopyBytes(unsigned char *buf, int iOffset, int iUncompressedLen, uint32_t *pSymbols)
+GIF_INLINE int LZWCopyBytes(unsigned char *buf, int iOffset, int iUncompressedLen, uint32_t *pSymbols, int iVector)
 {
 int iLen;
 uint8_t *s, *d;
@@ -1093,22 +1907,35 @@ uint32_t u32Offset;
     s = &buf[pSymbols[SYM_OFFSETS]];
     d = &buf[iOffset];
     iTempLen = iLen;
-    while (iTempLen > 0) // most frequent are 1-8 bytes in length, copy 8 bytes in these cases too
-    {
+    // A string always ends at or before the place it's copied to (even for
+    // KwKwK codes, the extra pixel is added below), so the source never
+    // overlaps the bytes we need. A block copy may read past the end of the
+    // source, but only when the whole string fits in that one block, which
+    // is loaded before anything is stored. Stores may run up to
+    // GIF_COPY_WIDTH-1 bytes past the string (see GIF_DECODE_PADDING).
 #if REGISTER_WIDTH == 64
-        BIGUINT tmp = *(BIGUINT *) s;
-        s += sizeof(BIGUINT);
-        iTempLen -= sizeof(BIGUINT);
-        *(BIGUINT *)d = tmp;
-        d += sizeof(BIGUINT);
+    if (iTempLen <= (int)sizeof(BIGUINT)) // most frequent are 1-8 bytes in length, copy 8 bytes in these cases too
+    {
+        *(BIGUINT *)d = *(BIGUINT *)s;
+        d += iTempLen;
+    }
+    else
+    {
+        while (iTempLen > 0) // long strings (flat areas of well compressed images)
+        {
+            GIFCopyVector(d, s, iVector);
+            s += iVector;
+            d += iVector;
+            iTempLen -= iVector;
+        }
+        d += iTempLen; // in case we overshot
+    }
 #else
 // 32-bit CPUs might enforce unaligned address exceptions
-// Many Linux ARM systems do this
-        *d++ = *s++;
-        iTempLen--;
+// Many Linux ARM systems do this; memcpy knows how to handle it
+    memcpy(d, s, iTempLen);
+    d += iTempLen;
 #endif
-    }
-    d += iTempLen; // in case we overshot
     if (u32Offset != 0xffffffff) // was a newly used code
     {
         s = &buf[u32Offset];
@@ -1122,7 +1949,37 @@ uint32_t u32Offset;
     return iLen;
 } /* LZWCopyBytes() */
 //
-// DecodeLZW
+// LZWAddCode
+//
+// Output the string of a (non-root or root) code which follows oldcode and
+// add the new dictionary entry nextcode for it. Returns the new output offset.
+//
+GIF_INLINE int LZWAddCode(unsigned char *buf, int iOffset, int iUncompressedLen, uint32_t *pSymbols, uint32_t code, uint32_t oldcode, uint32_t nextcode, int iVector)
+{
+    unsigned char c;
+    int iLen;
+
+    if (pSymbols[code] == 0xffffffff) // new code
+    {
+        pSymbols[nextcode + SYM_LENGTHS] = LZWCopyBytes(buf, iOffset, iUncompressedLen, &pSymbols[oldcode], iVector);
+        pSymbols[nextcode+SYM_OFFSETS] = iOffset;
+        c = buf[iOffset];
+        iOffset += pSymbols[nextcode+SYM_LENGTHS];
+        buf[iOffset++] = c; // repeat first character of old code on the end
+        pSymbols[nextcode+SYM_LENGTHS]++; // add to the length
+    }
+    else
+    {
+        iLen = LZWCopyBytes(buf, iOffset, iUncompressedLen, &pSymbols[code], iVector);
+        pSymbols[nextcode+SYM_OFFSETS] = pSymbols[oldcode+SYM_OFFSETS];
+        pSymbols[nextcode+SYM_EXTRAS] = iOffset;
+        pSymbols[nextcode+SYM_LENGTHS] = pSymbols[oldcode+SYM_LENGTHS];
+        iOffset += iLen;
+    }
+    return iOffset;
+} /* LZWAddCode() */
+//
+// DecodeLZWCore
 //
 // Theory of operation:
 //
@@ -1146,22 +2003,32 @@ uint32_t u32Offset;
 // backwards through the linked list of codes when outputting pixels. It also doesn't
 // have to copy pixels in reverse order, then unwind them.
 //
-int DecodeLZW(GifFileType *gif, SavedImage *pPage, uint8_t ucCodeStart, uint8_t *pLZW, int iLZWSize)
+// The kernel decodes iUncompressedLen pixels into buf, which needs
+// GIF_DECODE_PADDING bytes of slack. iVector is as in LZWCopyBytes().
+// With pProgress, finished rows are reported whenever the output passes
+// iReportAt, which is only checked when the bit buffer is refilled. With
+// GIF_STATS the codes and string copies are added to pCounters (if not NULL).
+//
+GIF_INLINE int DecodeLZWCore(uint8_t *buf, int iUncompressedLen, uint32_t *pSymbols, uint8_t ucCodeStart, uint8_t *pLZW, int iLZWSize, int iVector, GIFPROGRESS *pProgress, GifCodecStats *pCounters)
 {
-int i, bitnum;
-int iUncompressedLen;
+int i, bitnum, iReportAt;
 uint32_t code, oldcode, codesize, nextcode, nextlim;
 uint32_t cc, eoi;
 uint32_t sMask;
-unsigned char c, *p, *buf, codestart;
+unsigned char *p, *pEnd, codestart;
 BIGUINT ulBits;
-int iLen, iColors;
+int iLen, iColors, iCount;
 int iErr = GIF_OK;
 int iOffset;
-GIFPRIVATE *pPrivate = gif->Private;
-uint32_t *pSymbols;
+#ifdef GIF_STATS
+GifCodecStats cs;
+int iStart;
+#endif
 
+    (void)pCounters;
+    GIF_COUNT(memset(&cs, 0, sizeof(cs));)
     p = pLZW;
+    pEnd = pLZW + iLZWSize;
     ulBits = *(BIGUINT *)p;
     bitnum = 0;
     codestart = ucCodeStart;
@@ -1170,17 +2037,17 @@ uint32_t *pSymbols;
     sMask = 0xffffffff - sMask;
     cc = (sMask >> 1) + 1; /* Clear code */
     eoi = cc + 1;
-    pSymbols = pPrivate->pSymbols;
-    iUncompressedLen = (pPage->ImageDesc.Width * pPage->ImageDesc.Height);
-    buf = pPage->RasterBits;
     iOffset = 0; // output data offset
+    iReportAt = (pProgress) ? GIFReportProgress(pProgress, 0) : 0x7fffffff;
 
 init_codetable:
    for (i = 0; i<iColors; i++)
    {
-       pSymbols[i+SYM_OFFSETS] = iUncompressedLen + i; // root symbols
+       // root symbols live past the end of the image, out of reach of the
+       // overshoot of the last strings (see GIF_DECODE_PADDING)
+       pSymbols[i+SYM_OFFSETS] = iUncompressedLen + GIF_COPY_WIDTH + i;
        pSymbols[i+SYM_LENGTHS] = 1;
-       buf[iUncompressedLen + i] = (unsigned char) i;
+       buf[iUncompressedLen + GIF_COPY_WIDTH + i] = (unsigned char) i;
    }
    memset(&pSymbols[iColors + SYM_LENGTHS], 0, (4096 - iColors) * sizeof(uint32_t));
    memset(&pSymbols[iColors + SYM_OFFSETS], 0xff, (4096-iColors) * sizeof(uint32_t));
@@ -1195,17 +2062,65 @@ init_codetable:
    {
        if (bitnum > (REGISTER_WIDTH - MAX_CODE_LEN)) // need to read more data
        {
+           if (iOffset >= iReportAt) // more rows finished
+           {
+               iReportAt = GIFReportProgress(pProgress, iOffset);
+               if (iReportAt < 0) // stopped by the callback
+               {
+                   iErr = GIF_ERROR;
+                   break;
+               }
+           }
            p += (bitnum >> 3);
+           if (p >= pEnd) // out of data (truncated or missing EOI)
+               break;
            ulBits = INTELLONG(p); /* Read the next N-bit chunk */
            bitnum &= 7;
            ulBits >>= bitnum;
        }
+       if (oldcode != 0xffffffff && nextcode < nextlim)
+       {
+           // Batch: the code size can't change for the next (nextlim - nextcode)
+           // codes, so decode as many of those as ulBits holds without the
+           // refill and code size checks. Clear/EOI ends the batch and is
+           // handled below.
+           iCount = (REGISTER_WIDTH - bitnum) / codesize;
+           if (iCount > (int)(nextlim - nextcode))
+               iCount = (int)(nextlim - nextcode);
+           while (iCount > 0 && iOffset < iUncompressedLen)
+           {
+               code = ulBits & sMask;
+               if (code - cc <= 1 || code > nextcode) // clear, EOI or bad code
+                   break;
+               ulBits >>= codesize;
+               bitnum += codesize;
+               iCount--;
+               i = pSymbols[(ulBits & sMask) + SYM_OFFSETS]; // start the next string's fetch early
+               if ((unsigned)i < (unsigned)iUncompressedLen)
+                   GIFPrefetch(&buf[i]);
+               GIF_COUNT(cs.Codes++; iStart = iOffset;)
+               iOffset = LZWAddCode(buf, iOffset, iUncompressedLen, pSymbols, code, oldcode, nextcode, iVector);
+               GIF_COUNT(GIFCountString(&cs, iOffset - iStart);)
+               nextcode++;
+               oldcode = code;
+           }
+           if (nextcode >= nextlim && codesize < MAX_CODE_LEN)
+           {
+               codesize++;
+               nextlim <<= 1;
+               sMask = (sMask << 1) | 1;
+           }
+           if (iCount == 0 || iOffset >= iUncompressedLen)
+               continue; // batch done, refill
+       }
        code = ulBits & sMask;
        ulBits >>= codesize;
        bitnum += codesize;
+       GIF_COUNT(cs.Codes++;)
        
        if (code == cc) /* Clear code? */
        {
+           GIF_COUNT(cs.ClearCodes++;)
            if (oldcode == 0xffffffff) // no need to reset code table
                continue;
            else
@@ -1213,33 +2128,25 @@ init_codetable:
        }
        if (code != eoi)
        {
+           if (code > nextcode || (oldcode == 0xffffffff && code > eoi)) // corrupt data
+           {
+               iErr = D_GIF_ERR_IMAGE_DEFECT;
+               break;
+           }
            if (oldcode != -1)
            {
+               GIF_COUNT(iStart = iOffset;)
                if (nextcode < nextlim) // for deferred cc case, don't let it overwrite the last entry (fff)
                {
-                   if (pSymbols[code] == -1) // new code
-                   {
-                       pSymbols[nextcode + SYM_LENGTHS] = LZWCopyBytes(buf, iOffset, iUncompressedLen, &pSymbols[oldcode]);
-                       pSymbols[nextcode+SYM_OFFSETS] = iOffset;
-                       c = buf[iOffset];
-                       iOffset += pSymbols[nextcode+SYM_LENGTHS];
-                       buf[iOffset++] = c; // repeat first character of old code on the end
-                       pSymbols[nextcode+SYM_LENGTHS]++; // add to the length
-                   }
-                   else
-                   {
-                       iLen = LZWCopyBytes(buf, iOffset, iUncompressedLen, &pSymbols[code]);
-                       pSymbols[nextcode+SYM_OFFSETS] = pSymbols[oldcode+SYM_OFFSETS];
-                       pSymbols[nextcode+SYM_EXTRAS] = iOffset;
-                       pSymbols[nextcode+SYM_LENGTHS] = pSymbols[oldcode+SYM_LENGTHS];
-                       iOffset += iLen;
-                   }
+                   iOffset = LZWAddCode(buf, iOffset, iUncompressedLen, pSymbols, code, oldcode, nextcode, iVector);
                }
                else // Deferred CC case - continue to use codes, but don't generate new ones
                {
-                   iLen = LZWCopyBytes(buf, iOffset, iUncompressedLen, &pSymbols[code]);
+                   GIF_COUNT(if (nextcode == nextlim) cs.DeferredClears++;) // the table just filled up
+                   iLen = LZWCopyBytes(buf, iOffset, iUncompressedLen, &pSymbols[code], iVector);
                    iOffset += iLen;
                }
+               GIF_COUNT(GIFCountString(&cs, iOffset - iStart);)
                nextcode++;
                if (nextcode >= nextlim && codesize < MAX_CODE_LEN)
                {
@@ -1255,366 +2162,3070 @@ init_codetable:
            oldcode = code;
        } /* while not end of LZW code stream */
    }
+    if (iOffset < iUncompressedLen) // pixels the data didn't cover are color 0
+        memset(&buf[iOffset], 0, iUncompressedLen - iOffset);
+    GIF_COUNT(GIFAddCounters(pCounters, &cs);)
     return iErr;
-} /* DecodeLZW() */
+} /* DecodeLZWCore() */
 //
-// GifDeInterlace
+// DecodeLZW variants
 //
-void GifDeInterlace(SavedImage *pPage)
+// One per CPU variant (see GIFSelectKernels), each with a copy specialized
+// for the common 8-bit code start (256 color palettes).
+//
+static int DecodeLZWGeneric(uint8_t *buf, int iUncompressedLen, uint32_t *pSymbols, uint8_t ucCodeStart, uint8_t *pLZW, int iLZWSize, GIFPROGRESS *pProgress, GifCodecStats *pCounters)
 {
-    int iGifPass = 0;
-    int i, y;
-    uint8_t *d, *s;
-    uint8_t *pTemp = malloc(pPage->ImageDesc.Width * pPage->ImageDesc.Height);
-    
-    y = 0;
-    for (i = 0; i < pPage->ImageDesc.Height; i++)
-    {
-        s = &pPage->RasterBits[i * pPage->ImageDesc.Width];
-        d = &pTemp[y * pPage->ImageDesc.Width];
-        memcpy(d, s, pPage->ImageDesc.Width);
-        y += cGIFPass[iGifPass * 2];
-        if (y >= pPage->ImageDesc.Height)
-        {
-            iGifPass++;
-            y = cGIFPass[iGifPass * 2 + 1];
-        }
-    }
-    memcpy(pPage->RasterBits, pTemp, pPage->ImageDesc.Width * pPage->ImageDesc.Height); // copy it back over source image
-    free(pTemp);
-} /* GIFDeInterlace() */
+    if (ucCodeStart == 8)
+        return DecodeLZWCore(buf, iUncompressedLen, pSymbols, 8, pLZW, iLZWSize, 16, pProgress, pCounters);
+    return DecodeLZWCore(buf, iUncompressedLen, pSymbols, ucCodeStart, pLZW, iLZWSize, 16, pProgress, pCounters);
+}
+#ifdef GIF_DISPATCH
+GIF_TARGET_BMI2 static int DecodeLZWBMI2(uint8_t *buf, int iUncompressedLen, uint32_t *pSymbols, uint8_t ucCodeStart, uint8_t *pLZW, int iLZWSize, GIFPROGRESS *pProgress, GifCodecStats *pCounters)
+{
+    if (ucCodeStart == 8)
+        return DecodeLZWCore(buf, iUncompressedLen, pSymbols, 8, pLZW, iLZWSize, 16, pProgress, pCounters);
+    return DecodeLZWCore(buf, iUncompressedLen, pSymbols, ucCodeStart, pLZW, iLZWSize, 16, pProgress, pCounters);
+}
+GIF_TARGET_AVX2 static int DecodeLZWAVX2(uint8_t *buf, int iUncompressedLen, uint32_t *pSymbols, uint8_t ucCodeStart, uint8_t *pLZW, int iLZWSize, GIFPROGRESS *pProgress, GifCodecStats *pCounters)
+{
+    if (ucCodeStart == 8)
+        return DecodeLZWCore(buf, iUncompressedLen, pSymbols, 8, pLZW, iLZWSize, 32, pProgress, pCounters);
+    return DecodeLZWCore(buf, iUncompressedLen, pSymbols, ucCodeStart, pLZW, iLZWSize, 32, pProgress, pCounters);
+}
+#endif // GIF_DISPATCH
+//
+// GIFSelectKernels
+//
+// Pick the fastest LZW kernels the running CPU supports. This happens once
+// when the library is loaded (or on first use where load time constructors
+// aren't available), so a single build runs well on every CPU generation.
+//
+#if defined(__GNUC__) || defined(__clang__)
+__attribute__((constructor))
+#endif
+static void GIFSelectKernels(void)
+{
+int iVariant = GIF_CPU_GENERIC;
 
+#ifdef GIF_DISPATCH
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi2"))
+        iVariant = GIF_CPU_AVX2;
+    else if (__builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("bmi2"))
+        iVariant = GIF_CPU_BMI2;
+#endif
+    GifSetCpuVariant(iVariant);
+} /* GIFSelectKernels() */
 //
-// GIFPreprocess
+// GifSetCpuVariant
 //
-int GIFPreprocess(GifFileType *gif)
+// Force the LZW kernels of one CPU variant (GIF_CPU_*), e.g. to compare them.
+// Returns GIF_ERROR if the build or the running CPU can't use it.
+//
+int GifSetCpuVariant(int iVariant)
 {
-    int iOff;
-//    int iDelay, iMaxDelay, iMinDelay, iTotalDelay;
-    int iDataAvailable = 0;
-    int bDone = 0;
-    int bExt;
-    uint8_t ucCodeStart, *pLZW;
-    int iLZWSize;
-    int i, iFrameMemCount;
-    uint8_t c, *d, *cBuf, *pStart;
-    SavedImage *pPage;
-    GIFPRIVATE *pPrivate = gif->Private;
-    ExtensionBlock *pExtensions;
-    
-//    iMaxDelay = iTotalDelay = 0;
-//    iMinDelay = 10000;
-    gif->ImageCount = 1;
-    iFrameMemCount = GIF_IMAGE_INCREMENT; // how much memory we allocated
-    pPage = gif->SavedImages = malloc(sizeof(SavedImage) * GIF_IMAGE_INCREMENT); // start by allocating N image structures
-    cBuf = (uint8_t *) pPrivate->pFileData;
-    iDataAvailable = pPrivate->iFileSize;
-    iOff = 10;
-    pPage->RasterBits = NULL; // no image data (yet)
-    pPage->ImageDesc.ColorMap = NULL; // assume no palette (yet)
-    c = cBuf[iOff];
-    iOff += 3;   /* Skip flags, background color & aspect ratio */
-    if (c & 0x80) /* Deal with global color table */
-    {
-        c &= 7;  /* Get the number of colors defined */
-        iOff += (2<<c)*3; /* skip the global color table (we already got it) */
+    switch (iVariant) {
+    case GIF_CPU_GENERIC:
+        pfnGIFDecodeLZW = DecodeLZWGeneric;
+        pfnGIFEncodeLZW = EncodeLZWGeneric;
+        break;
+#ifdef GIF_DISPATCH
+    case GIF_CPU_BMI2:
+        __builtin_cpu_init();
+        if (!__builtin_cpu_supports("sse4.2") || !__builtin_cpu_supports("bmi2"))
+            return GIF_ERROR;
+        pfnGIFDecodeLZW = DecodeLZWBMI2;
+        pfnGIFEncodeLZW = EncodeLZWBMI2;
+        break;
+    case GIF_CPU_AVX2:
+        __builtin_cpu_init();
+        if (!__builtin_cpu_supports("avx2") || !__builtin_cpu_supports("bmi2"))
+            return GIF_ERROR;
+        pfnGIFDecodeLZW = DecodeLZWAVX2;
+        pfnGIFEncodeLZW = EncodeLZWAVX2;
+        break;
+#endif // GIF_DISPATCH
+    default:
+        return GIF_ERROR;
     }
-    while (!bDone && gif->ImageCount < GIF_MAX_FRAMES)
-    {
-//        printf("DGifSlurp - frame %d\n", gif->ImageCount - 1);
-        bExt = 1; // check for extension blocks
-        pPage->ExtensionBlockCount = 0;
-        // pre-allocate the max # of blocks since they're just a list of pointers/counts
-        pPage->ExtensionBlocks = calloc(1, MAX_EXTENSIONS * sizeof(ExtensionBlock));
-        pExtensions = pPage->ExtensionBlocks;
-        while (bExt && iOff < iDataAvailable)
-        {
-            switch(cBuf[iOff])
-            {
-                case 0x3b: /* End of file */
-                    /* we were fooled into thinking there were more pages */
-                    gif->ImageCount--;
-                    goto gifpagesz;
-    // F9 = Graphic Control Extension (fixed length of 4 bytes)
-    // FE = Comment Extension
-    // FF = Application Extension
-    // 01 = Plain Text Extension
-                case 0x21: /* Extension block */
-                    if (pPage->ExtensionBlockCount < MAX_EXTENSIONS) {
-                        pExtensions[pPage->ExtensionBlockCount].Function = cBuf[iOff+1];
-                        pExtensions[pPage->ExtensionBlockCount].ByteCount = cBuf[iOff+2];
-                        pExtensions[pPage->ExtensionBlockCount].Bytes = &cBuf[iOff+3];
-                        pPage->ExtensionBlockCount++;
-                    }
-#ifdef FUTURE
-                    if (cBuf[iOff+1] == 0xf9 && cBuf[iOff+2] == 4) // Graphic Control Extension
-                    {
-                        // DEBUG!!!
-                        pPage->ucHasExtension = 1;
-                        pPage->ucGIFBits = cBuf[iOff+3]; // page disposition flags
-                        pPage->iFrameDelay = cBuf[iOff+4]; // delay low byte
-                        pPage->iFrameDelay |= (cBuf[iOff+5] << 8); // delay high byte
-                        iDelay = pPage->iFrameDelay;
-                        if (iDelay < 2) // too fast, provide a default
-                            iDelay = 2;
-                        iDelay *= 10; // turn JIFFIES into milliseconds
-                        iTotalDelay += iDelay;
-                        if (iDelay > iMaxDelay) iMaxDelay = iDelay;
-                        else if (iDelay < iMinDelay) iMinDelay = iDelay;
-                        pPage->ucTransparent = cBuf[iOff+6]; // transparent color index
-                        printf("ucGIFBits: 0x%02x, ucTrans: 0x%02x\n", pPage->ucGIFBits, pPage->ucTransparent);
-                    }
-#endif
-                    iOff += 2; /* skip to length */
-                    iOff += (int)cBuf[iOff]; /* Skip the data block */
-                    iOff++;
-                   // block terminator or optional sub blocks
-                    c = cBuf[iOff++]; /* Skip any sub-blocks */
-                    while (c && iOff < (iDataAvailable - c))
-                    {
-                        if (pPage->ExtensionBlockCount < MAX_EXTENSIONS) {
-                            pExtensions[pPage->ExtensionBlockCount].Function = 0; // 0 indicates more data for the previously defined extension
-                            pExtensions[pPage->ExtensionBlockCount].ByteCount = c;
-                            pExtensions[pPage->ExtensionBlockCount].Bytes = &cBuf[iOff];
-                            pPage->ExtensionBlockCount++;
-                        }
-                        iOff += (int)c;
-                        c = cBuf[iOff++];
-                    }
-                    if (c != 0) // problem, we went past the end
-                    {
-                        gif->ImageCount--; // possible corrupt data; stop
-                        goto gifpagesz;
-                    }
-                    break;
-                case 0x2c: /* Start of image data */
-                    bExt = 0; /* Stop doing extension blocks */
-                    break;
-                default:
-                   /* Corrupt data, stop here */
-                    gif->ImageCount--;
-                    goto gifpagesz;
-            } // switch
-        } // while
-        if (cBuf[iOff] == ',')
-            iOff++;
-        if (iOff >= iDataAvailable) // problem
-        {
-             gif->ImageCount--; // possible corrupt data; stop
-             goto gifpagesz;
-        }
-        /* Start of image data */
-    // This particular frame's size and position on the main frame (if animated)
-        pPage->ImageDesc.Left = INTELSHORT(&cBuf[iOff]);
-        pPage->ImageDesc.Top = INTELSHORT(&cBuf[iOff+2]);
-        pPage->ImageDesc.Width = INTELSHORT(&cBuf[iOff+4]);
-        pPage->ImageDesc.Height = INTELSHORT(&cBuf[iOff+6]);
-        iOff += 8;
-        /* Image descriptor
-         7 6 5 4 3 2 1 0    M=0 - use global color map, ignore pixel
-         M I 0 0 0 pixel    M=1 - local color map follows, use pixel
-         I=0 - Image in sequential order
-         I=1 - Image in interlaced order
-         pixel+1 = # bits per pixel for this image
-         */
-        c = cBuf[iOff++]; /* Get the flags byte */
-        pPage->ImageDesc.Interlace = c & 0x40;
-        if (c & 0x80) /* Local color table */
-        {
-            pPage->ImageDesc.ColorMap = (ColorMapObject *)malloc(sizeof(ColorMapObject));
-            pPage->ImageDesc.ColorMap->ColorCount = (2<<(c & 7));
-            pPage->ImageDesc.ColorMap->Colors = (GifColorType *)&cBuf[iOff];
-            iOff += pPage->ImageDesc.ColorMap->ColorCount*3;
-        }
-        ucCodeStart = cBuf[iOff++]; /* LZW code size byte */
-        c = cBuf[iOff++]; // first chunk length
-        pLZW = &cBuf[iOff-1]; // start of compressed data
-        // remove the chunk markers to make contiguous data
-        d = &cBuf[iOff-1];
-        pStart = d;
-        while (c) /* While there are more data blocks */
-        {
-            memmove(d, &cBuf[iOff], c);
-            d += c;
-            iOff += c;
-            c = cBuf[iOff++]; /* Get length of next */
-        }
-        iLZWSize = (int)(d - pStart);
-//        printf(" - compressed size: %d\n", iLZWSize);
-        /* End of image data, decode it */
-        i = (pPage->ImageDesc.Width * pPage->ImageDesc.Height) + 8;
-        i += 0xffff; // memory seems to fragment if we allocate many blocks
-        i &= 0xffff0000; // of odd sizes, so round them to 64K
-        pPage->RasterBits = malloc(i);
-        // DEBUG - check for null
-        if (DecodeLZW(gif, pPage, ucCodeStart, pLZW, iLZWSize) != GIF_OK) {
-            // ERROR
-        }
-        if (pPage->ImageDesc.Interlace)
-            GifDeInterlace(pPage);
-        /* Check for more frames... */
-        if (iOff >= pPrivate->iFileSize || cBuf[iOff] == 0x3b)
-        {
-            bDone = 1; /* End of file has been reached */
-        }
-        else /* More pages to scan */
-        {
-            gif->ImageCount++;
-            if (gif->ImageCount >= iFrameMemCount) { // need to allocate more memory
-                iFrameMemCount += GIF_IMAGE_INCREMENT;
-                gif->SavedImages = realloc(gif->SavedImages, iFrameMemCount * sizeof(SavedImage));
-            }
-            pPage = &gif->SavedImages[gif->ImageCount-1];
-            memset(pPage, 0, sizeof(SavedImage));
-        }
-    } /* while !bDone */
-gifpagesz:
-//    pPage = &gif->SavedImages[gif->ImageCount];
-//    if (pPage->ExtensionBlocks)
-//        free(pPage->ExtensionBlocks); // we allocated one too many
+    iGIFCpuVariant = iVariant;
     return GIF_OK;
-} /* GIFPreProcess() */
-
+} /* GifSetCpuVariant() */
 //
-// DGifOpenFileHandle
+// GifGetCpuVariant
 //
-GifFileType *DGifOpenFileHandle(int iHandle, int *pError)
+// Return the GIF_CPU_* variant of the LZW kernels in use
+//
+int GifGetCpuVariant(void)
 {
-GifFileType *gif;
-GIFPRIVATE *pPrivate = NULL;
-unsigned char ucTemp[32], SortFlag, BitsPerPixel;
-int i;
-    
-    gif = (GifFileType *)calloc(1, sizeof(GifFileType));
-    if (gif == NULL) {
-        if (pError != NULL)
-            *pError = D_GIF_ERR_NOT_ENOUGH_MEM;
-        goto open_error;
-        return NULL;
-    }
-    
-    pPrivate = gif->Private = calloc(1, sizeof(GIFPRIVATE));
-    if (gif->Private == NULL) {
-        if (pError) {
-            *pError = D_GIF_ERR_NOT_ENOUGH_MEM;
-            goto open_error;
-        }
-    }
-    pPrivate->iHandle = iHandle; // save for later
-    
-    // Read a bit of the file to get the signature and image descriptor
-    i = (int)read(iHandle, ucTemp, 13);
-    if (i != 13) {
-        if (pError != NULL)
-            *pError = D_GIF_ERR_READ_FAILED;
-        goto open_error;
-    }
-    // See if it's a GIF file
-    if (memcmp(ucTemp, GIF87_STAMP, GIF_STAMP_LEN) != 0 && memcmp(ucTemp, GIF89_STAMP, GIF_STAMP_LEN) != 0) {
-        // not a GIF file
-        if (pError != NULL)
-            *pError = D_GIF_ERR_NOT_GIF_FILE;
-        goto open_error;
+    if (pfnGIFDecodeLZW == NULL)
+        GIFSelectKernels();
+    return iGIFCpuVariant;
+} /* GifGetCpuVariant() */
+//
+// GIFTransparentColor
+//
+// Return the transparent color index from a frame's graphics control
+// extension, or NO_TRANSPARENT_COLOR
+//
+static int GIFTransparentColor(const SavedImage *pPage)
+{
+    const ExtensionBlock *pEB;
+    int i;
+
+    for (i = 0; i < pPage->ExtensionBlockCount; i++) {
+        pEB = &pPage->ExtensionBlocks[i];
+        if (pEB->Function == GRAPHICS_EXT_FUNC_CODE && pEB->ByteCount >= 4)
+            return (pEB->Bytes[0] & 1) ? pEB->Bytes[3] : NO_TRANSPARENT_COLOR;
     }
-    // Get logical screen descriptor
-    gif->SWidth = INTELSHORT(&ucTemp[6]);
-    gif->SHeight = INTELSHORT(&ucTemp[8]);
-    gif->SColorResolution = (((ucTemp[10] & 0x70) + 1) >> 4) + 1;
-    SortFlag = ucTemp[10] & 0x8;
-    BitsPerPixel = (ucTemp[10] & 7) + 1;
-    gif->SBackGroundColor = ucTemp[11];
-    gif->AspectByte = ucTemp[12];
-    gif->SColorMap = NULL;
-    if (ucTemp[10] & 0x80) { // global color table
-        gif->SColorMap = GifMakeMapObject(1 << BitsPerPixel, NULL);
-        if (gif->SColorMap == NULL) {
-            if (pError != NULL)
-                *pError = D_GIF_ERR_NOT_ENOUGH_MEM;
-            goto open_error;
+    return NO_TRANSPARENT_COLOR;
+} /* GIFTransparentColor() */
+//
+// GIFStatsStart
+//
+// Prepare pStats for the rows of pPage. Until GIFStatsFinish(), Width and
+// Height hold the right and bottom edges of the box (exclusive).
+//
+static void GIFStatsStart(GifFrameStats *pStats, const SavedImage *pPage)
+{
+    memset(pStats, 0, sizeof(GifFrameStats));
+    pStats->TransparentColor = GIFTransparentColor(pPage);
+    pStats->Left = pPage->ImageDesc.Width;
+    pStats->Top = pPage->ImageDesc.Height;
+} /* GIFStatsStart() */
+//
+// GIFStatsAddRows
+//
+// Add iCount rows of pixels (stored one after the other) to the
+// statistics; they are rows y, y+iStep... of the frame. The histogram is
+// counted in 4 tables so that runs of one color don't wait on the same
+// counter, and the box edges are only searched as far as they could move.
+//
+static void GIFStatsAddRows(GifFrameStats *pStats, const uint8_t *pRows, int iWidth, int y, int iCount, int iStep)
+{
+    uint32_t u32Hist[4][256];
+    const uint8_t *s;
+    int i, x, iRight = pStats->Width, iBottom = pStats->Height;
+    int t = pStats->TransparentColor;
+    uint32_t u32Clear = 0; // transparent pixels counted so far
+
+    memset(u32Hist, 0, sizeof(u32Hist));
+    for (i = 0; i < iCount; i++, y += iStep)
+    {
+        s = &pRows[i * iWidth];
+        for (x = 0; x + 4 <= iWidth; x += 4)
+        {
+            u32Hist[0][s[x]]++;
+            u32Hist[1][s[x+1]]++;
+            u32Hist[2][s[x+2]]++;
+            u32Hist[3][s[x+3]]++;
         }
-        gif->SColorMap->SortFlag = SortFlag;
-        // Read the palette entries
-        i = (int)read(iHandle, gif->SColorMap->Colors, (1 << BitsPerPixel) * 3);
-        if (i != (1 << BitsPerPixel) * 3) {
-            if (pError != NULL)
-                *pError = D_GIF_ERR_READ_FAILED;
-            goto open_error;
+        for (; x < iWidth; x++)
+            u32Hist[0][s[x]]++;
+        if (t >= 0)
+        {
+            uint32_t u32Total = u32Hist[0][t] + u32Hist[1][t] + u32Hist[2][t] + u32Hist[3][t];
+            if (u32Total - u32Clear == (uint32_t)iWidth) // nothing visible in this row
+            {
+                u32Clear = u32Total;
+                continue;
+            }
+            u32Clear = u32Total;
+            for (x = 0; x < pStats->Left && s[x] == t; x++) {}
+            if (x < pStats->Left)
+                pStats->Left = x;
+            for (x = iWidth; x > iRight && s[x-1] == t; x--) {}
+            if (x > iRight)
+                iRight = x;
         }
-    }
-    return gif;
-    
-open_error:
-    (void)close(iHandle);
-    if (gif) {
-        if (gif->Private)
-            free(gif->Private);
-        if (gif->SColorMap) {
-            GifFreeMapObject(gif->SColorMap);
+        else if (iWidth > 0)
+        {
+            pStats->Left = 0;
+            iRight = iWidth;
         }
-        free(gif);
+        if (y < pStats->Top)
+            pStats->Top = y;
+        if (y >= iBottom)
+            iBottom = y + 1;
     }
-    return NULL;
-} /* DGifOpenFileHandle() */
+    for (x = 0; x < 256; x++)
+        pStats->Histogram[x] += u32Hist[0][x] + u32Hist[1][x] + u32Hist[2][x] + u32Hist[3][x];
+    pStats->Width = iRight;
+    pStats->Height = iBottom;
+} /* GIFStatsAddRows() */
+//
+// GIFStatsFinish
+//
+static void GIFStatsFinish(GifFrameStats *pStats)
+{
+    int i;
 
+    for (i = 0; i < 256; i++)
+        pStats->ColorsUsed += (pStats->Histogram[i] != 0);
+    if (pStats->TransparentColor >= 0)
+        pStats->TransparentUsed = (pStats->Histogram[pStats->TransparentColor] != 0);
+    if (pStats->Width > pStats->Left && pStats->Height > pStats->Top) {
+        pStats->Width -= pStats->Left;
+        pStats->Height -= pStats->Top;
+    } else { // no visible pixels
+        pStats->Left = pStats->Top = pStats->Width = pStats->Height = 0;
+    }
+} /* GIFStatsFinish() */
 //
-// DGifOpenFileName
+// GIFPassEnd
 //
-GifFileType *DGifOpenFileName(const char *fname, int *pError)
+// Return the stored row where the pass of an interlaced frame containing
+// stored row iRow ends, and the pass number (0-3)
+//
+static int GIFPassEnd(int iRow, int iHeight, int *piPass)
 {
-int iHandle;
+    int iEnd;
 
-   iHandle = open(fname, O_RDONLY);
-   if (iHandle == -1) {
-       if (pError != NULL)
-           *pError = D_GIF_ERR_OPEN_FAILED;
-       return NULL;
-   }
-   return DGifOpenFileHandle(iHandle, pError);
-} /* DGifOpenFileName() */
+    iEnd = (iHeight + 7) >> 3;
+    *piPass = 0;
+    if (iRow < iEnd)
+        return iEnd;
+    iEnd += (iHeight + 3) >> 3;
+    *piPass = 1;
+    if (iRow < iEnd)
+        return iEnd;
+    iEnd += (iHeight + 1) >> 2;
+    *piPass = 2;
+    if (iRow < iEnd)
+        return iEnd;
+    *piPass = 3;
+    return iHeight;
+} /* GIFPassEnd() */
 //
-// DGifSlurp
+// GIFReportProgress
 //
-// Read every frame of a GIF file into a list of SavedImage structures
+// Pass the rows finished below output offset iOffset to the progress
+// callback and/or the frame statistics while they are still in the cache,
+// one call per pass of an interlaced frame. Returns the offset at which to
+// report again (after iInterval more rows or at the end of the pass), or
+// -1 if the callback stopped decoding.
 //
-int DGifSlurp(GifFileType * gif)
+static int GIFReportProgress(GIFPROGRESS *pProgress, int iOffset)
 {
-    GIFPRIVATE *pPrivate = NULL;
-    int err = GIF_OK;
-    unsigned char *p;
+    GIFPRIVATE *pPrivate = (GIFPRIVATE *)pProgress->gif->Private;
+    SavedImage *pPage = pProgress->pPage;
+    int iWidth = pPage->ImageDesc.Width;
+    int iHeight = pPage->ImageDesc.Height;
+    int iRow, iEnd, iPass, y, iStep, iNext;
 
-    if (gif == NULL || gif->Private == NULL)
-        return D_GIF_ERR_READ_FAILED;
-    pPrivate = (GIFPRIVATE *)gif->Private;
-    if (pPrivate->iHandle <= 0)
-        return D_GIF_ERR_NOT_READABLE;
-    
-    gif->ExtensionBlocks = NULL;
-    gif->ExtensionBlockCount = 0;
-    
-    // Read the file data all at once. This will use a lot more RAM
-    // but the gain in speed is significant vs reading it in small chunks
-    pPrivate->iFileSize = (int)lseek(pPrivate->iHandle, 0, SEEK_END);
-    lseek(pPrivate->iHandle, 0, SEEK_SET);
-    if (pPrivate->iFileSize > 0) {
-        pPrivate->pSymbols = malloc(3 * 4096 * sizeof(uint32_t)); // symbol memory
-        if (pPrivate->pSymbols == NULL) {
-            err = D_GIF_ERR_NOT_ENOUGH_MEM;
-            goto slurp_error;
-        }
-        p = pPrivate->pFileData = (unsigned char *)malloc(pPrivate->iFileSize);
-        if (pPrivate->pFileData == NULL) {
-            err = D_GIF_ERR_NOT_ENOUGH_MEM;
-            goto slurp_error;
-        }
-        read(pPrivate->iHandle, pPrivate->pFileData, pPrivate->iFileSize); // read the whole file into memory
+    iRow = (iWidth > 0) ? iOffset / iWidth : iHeight;
+    if (iRow > iHeight)
+        iRow = iHeight;
+    while (pProgress->iRowsDone < iRow)
+    {
+        iEnd = iHeight;
+        y = pProgress->iRowsDone;
+        iStep = 1;
+        if (pPage->ImageDesc.Interlace)
+        {
+            iEnd = GIFPassEnd(pProgress->iRowsDone, iHeight, &iPass);
+            y = GIFInterlacedRow(pProgress->iRowsDone, iHeight);
+            iStep = cGIFPass[iPass * 2];
+        }
+        if (iEnd > iRow)
+            iEnd = iRow;
+        if (pProgress->pStats != NULL)
+            GIFStatsAddRows(pProgress->pStats, &pPage->RasterBits[pProgress->iRowsDone * iWidth], iWidth,
+                            y, iEnd - pProgress->iRowsDone, iStep);
+        if (pPrivate->pfnProgress != NULL &&
+            (*pPrivate->pfnProgress)(pProgress->gif, pPage, y, iEnd - pProgress->iRowsDone, iStep,
+                                     &pPage->RasterBits[pProgress->iRowsDone * iWidth]) != GIF_OK)
+            return -1;
+        pProgress->iRowsDone = iEnd;
+    }
+    if (iRow >= iHeight)
+        return 0x7fffffff; // all done
+    iNext = iRow + pProgress->iInterval;
+    if (pPage->ImageDesc.Interlace)
+    {
+        iEnd = GIFPassEnd(iRow, iHeight, &iPass);
+        if (iNext > iEnd)
+            iNext = iEnd; // report each pass as soon as it's complete
+    }
+    if (iNext > iHeight)
+        iNext = iHeight;
+    return iNext * iWidth;
+} /* GIFReportProgress() */
+//
+// DecodeLZW
+//
+// Decode one frame's de-chunked LZW data into its RasterBits and collect
+// its statistics in pStats (if not NULL). pSymbols is the symbol table to
+// use (normally the handle's) and pCounters where to count for GifGetStats()
+// (see GIF_COUNTERS). Returns GIF_ERROR if the progress callback stopped it.
+//
+int DecodeLZW(GifFileType *gif, SavedImage *pPage, uint8_t ucCodeStart, uint8_t *pLZW, int iLZWSize, GifFrameStats *pStats, uint32_t *pSymbols, GifCodecStats *pCounters)
+{
+    GIFPRIVATE *pPrivate = (GIFPRIVATE *)gif->Private;
+    GIFPROGRESS progress, *pProgress = NULL;
+    int iLen, err;
+
+    if (GIF_FRAME_TOO_BIG(pPage->ImageDesc.Width, pPage->ImageDesc.Height)) // the callers reject these first
+        return D_GIF_ERR_DATA_TOO_BIG;
+    iLen = (int)((int64_t)pPage->ImageDesc.Width * pPage->ImageDesc.Height);
+    if (pStats != NULL)
+        GIFStatsStart(pStats, pPage);
+    if (ucCodeStart > 8) { // not a valid GIF (and the root symbols wouldn't fit in the padding)
+        if (pStats != NULL)
+            GIFStatsFinish(pStats);
+        return D_GIF_ERR_IMAGE_DEFECT;
+    }
+    if (pfnGIFDecodeLZW == NULL)
+        GIFSelectKernels();
+    if (pPrivate->pfnProgress != NULL || pStats != NULL) {
+        progress.gif = gif;
+        progress.pPage = pPage;
+        progress.pStats = pStats;
+        progress.iRowsDone = 0;
+        if (pPrivate->pfnProgress != NULL)
+            progress.iInterval = pPrivate->iProgressRows;
+        else // statistics only: about 64K pixels at a time
+            progress.iInterval = 65536 / (pPage->ImageDesc.Width + 1) + 1;
+        pProgress = &progress;
+    }
+    GIF_TRACE(pPrivate, gif, GIF_PHASE_DECODE, true, pPrivate->iTraceFrame);
+    err = (*pfnGIFDecodeLZW)(pPage->RasterBits, iLen, pSymbols, ucCodeStart, pLZW, iLZWSize, pProgress, pCounters);
+    GIF_TRACE(pPrivate, gif, GIF_PHASE_DECODE, false, pPrivate->iTraceFrame);
+    if (pProgress != NULL && err != GIF_ERROR && GIFReportProgress(pProgress, iLen) < 0) // the rest of the rows
+        err = GIF_ERROR;
+    if (pStats != NULL)
+        GIFStatsFinish(pStats);
+    return err;
+} /* DecodeLZW() */
+//
+// GIFStatsSlot
+//
+// Return where to collect the statistics of frame iFrame, or NULL if
+// GIF_OPT_STATS is off (or there's no memory for them)
+//
+static GifFrameStats *GIFStatsSlot(GifFileType *gif, int iFrame)
+{
+    GIFPRIVATE *pPrivate = (GIFPRIVATE *)gif->Private;
+    GifFrameStats *pNew;
+    int iCount;
+
+    if (!(pPrivate->iOptions & GIF_OPT_STATS))
+        return NULL;
+    if (iFrame >= pPrivate->iFrameStatsCount) {
+        iCount = (iFrame < 4) ? 8 : iFrame * 2;
+        pNew = GIFHandleRealloc(pPrivate, pPrivate->pFrameStats, iCount * sizeof(GifFrameStats));
+        if (pNew == NULL)
+            return NULL;
+        memset(&pNew[pPrivate->iFrameStatsCount], 0, (iCount - pPrivate->iFrameStatsCount) * sizeof(GifFrameStats));
+        pPrivate->pFrameStats = pNew;
+        pPrivate->iFrameStatsCount = iCount;
+    }
+    return &pPrivate->pFrameStats[iFrame];
+} /* GIFStatsSlot() */
+//
+// DGifSetProgressFunc
+//
+// Have pfnProgress called with the rows of each frame as soon as they are
+// decoded (at least iRows at a time, < 1 = 16), e.g. to show a preview of a
+// large frame before it's complete. The rows of an interlaced frame are
+// reported per pass in the order they're stored (every 8th row first...),
+// each pass as soon as it's complete. Applies to DGifSlurp() and
+// DGifNextFrame[Into](); NULL turns it off.
+//
+int DGifSetProgressFunc(GifFileType *gif, GifProgressFunc pfnProgress, int iRows)
+{
+    GIFPRIVATE *pPrivate;
+
+    if (gif == NULL || gif->Private == NULL)
+        return GIF_ERROR;
+    pPrivate = (GIFPRIVATE *)gif->Private;
+    pPrivate->pfnProgress = pfnProgress;
+    pPrivate->iProgressRows = (iRows < 1) ? 16 : iRows;
+    return GIF_OK;
+} /* DGifSetProgressFunc() */
+//
+// DGifGetFrameStats
+//
+// Copy the statistics the decoder collected for a frame while decoding it
+// (needs GIF_OPT_STATS). They are kept for every frame decoded with the
+// handle until it's reopened or closed.
+//
+int DGifGetFrameStats(GifFileType *gif, int iFrame, GifFrameStats *pStats)
+{
+    GIFPRIVATE *pPrivate;
+
+    if (gif == NULL || gif->Private == NULL || pStats == NULL)
+        return GIF_ERROR;
+    pPrivate = (GIFPRIVATE *)gif->Private;
+    if (iFrame < 0 || iFrame >= gif->ImageCount || iFrame >= pPrivate->iFrameStatsCount)
+        return GIF_ERROR;
+    memcpy(pStats, &pPrivate->pFrameStats[iFrame], sizeof(GifFrameStats));
+    return GIF_OK;
+} /* DGifGetFrameStats() */
+//
+// GifGetStats
+//
+// Copy the LZW and allocation counters of a handle. They are only kept by
+// builds with GIF_STATS defined (otherwise this fails), and only the
+// in-memory decoders count codes (not DGifSlurpScanlines).
+//
+int GifGetStats(GifFileType *gif, GifCodecStats *pStats)
+{
+    GIFPRIVATE *pPrivate;
+
+    if (gif == NULL || gif->Private == NULL || pStats == NULL)
+        return GIF_ERROR;
+#ifdef GIF_STATS
+    pPrivate = (GIFPRIVATE *)gif->Private;
+    memcpy(pStats, &pPrivate->Stats, sizeof(GifCodecStats));
+    pStats->AverageStringLength = (pStats->Strings) ? (double)pStats->BytesCopied / (double)pStats->Strings : 0.0;
+    return GIF_OK;
+#else
+    (void)pPrivate;
+    memset(pStats, 0, sizeof(GifCodecStats));
+    return GIF_ERROR;
+#endif
+} /* GifGetStats() */
+//
+// GifSetTraceFunc
+//
+// Have pfnTrace called at the beginning and end of each phase of the work
+// done with a decoder or encoder handle (see GIF_PHASE_*), e.g. to feed a
+// tracing system. NULL turns it off again.
+//
+int GifSetTraceFunc(GifFileType *gif, GifTraceFunc pfnTrace, void *pUser)
+{
+    GIFPRIVATE *pPrivate;
+
+    if (gif == NULL || gif->Private == NULL)
+        return GIF_ERROR;
+    pPrivate = (GIFPRIVATE *)gif->Private;
+    pPrivate->pfnTrace = pfnTrace;
+    pPrivate->pTraceUser = pUser;
+    return GIF_OK;
+} /* GifSetTraceFunc() */
+//
+// GifPhaseName
+//
+const char *GifPhaseName(int iPhase)
+{
+    static const char *szPhases[GIF_PHASE_COUNT] = {"read", "scan", "decode", "deinterlace", "encode", "chunk", "write"};
+
+    if (iPhase < 0 || iPhase >= GIF_PHASE_COUNT)
+        return NULL;
+    return szPhases[iPhase];
+} /* GifPhaseName() */
+//
+// GifComputeFrameStats
+//
+// Collect the statistics of an already decoded frame in one pass over its
+// RasterBits (without GIF_OPT_STATS, or for frames built by the caller).
+// The frame must hold 8-bit pixels; GIF_OPT_STATS also works for packed frames
+// since it sees the pixels before they are packed.
+//
+int GifComputeFrameStats(const SavedImage *pImage, GifFrameStats *pStats)
+{
+    if (pImage == NULL || pImage->RasterBits == NULL || pStats == NULL)
+        return GIF_ERROR;
+    GIFStatsStart(pStats, pImage);
+    GIFStatsAddRows(pStats, pImage->RasterBits, pImage->ImageDesc.Width, 0, pImage->ImageDesc.Height, 1);
+    GIFStatsFinish(pStats);
+    return GIF_OK;
+} /* GifComputeFrameStats() */
+//
+// DecodeLZWWindow
+//
+// Bounded-memory variant of DecodeLZW() for images too large to keep in memory.
+//
+// Only a sliding window of the most recent output is kept (iWindowSize must be
+// at least 2 rows + MAXMAXCODE + 8 bytes). Every code
+// remembers the last place its string was written; while that place is still
+// inside the window the string is copied from there like in DecodeLZW(). When
+// it has already slid out, the string is rebuilt from a traditional
+// prefix/suffix table instead. Finished rows are passed to pfnLine as soon
+// as they are complete (in file order, with the true y for interlaced frames).
+//
+// pSymbols usage: SYM_OFFSETS = output offset of the string relative to
+// iEpoch, SYM_LENGTHS = string length | (prefix code << 16), SYM_EXTRAS =
+// last pixel. A frame can hold up to 65535*65535 pixels, so the offsets are
+// 64-bit and iEpoch moves up with the window to keep the stored ones in 32
+// bits.
+//
+static int DecodeLZWWindow(GifFileType *gif, SavedImage *pPage, uint8_t ucCodeStart, uint8_t *pLZW, int iLZWSize, GifLineFunc pfnLine, uint8_t *pWindow, int iWindowSize)
+{
+int i, bitnum;
+int iWidth, iLen, iColors;
+uint32_t code, oldcode, codesize, nextcode, nextlim;
+uint32_t cc, eoi, sMask, u32;
+unsigned char *p, *pEnd, *d, codestart;
+BIGUINT ulBits;
+int64_t iUncompressedLen, iOffset, iBase, iKeep, iLimit, iOldOffset, iEpoch, iStart;
+int64_t iRowEnd;
+int iRow, y, iGifPass;
+int iErr = GIF_OK;
+GIFPRIVATE *pPrivate = gif->Private;
+uint32_t *pSymbols = pPrivate->pSymbols;
+
+    p = pLZW;
+    pEnd = pLZW + iLZWSize;
+    ulBits = INTELLONG(p);
+    bitnum = 0;
+    codestart = ucCodeStart;
+    if (codestart > 8) // can't be a valid 8-bit GIF
+        return D_GIF_ERR_IMAGE_DEFECT;
+    iColors = 1 << codestart;
+    cc = iColors; /* Clear code */
+    eoi = cc + 1;
+    iWidth = pPage->ImageDesc.Width;
+    iUncompressedLen = (int64_t)iWidth * pPage->ImageDesc.Height;
+    // Slide the window once the longest string might not fit anymore; keep
+    // half of it as history so that the memmove cost is amortized
+    iLimit = iWindowSize - MAXMAXCODE - 8;
+    iKeep = iLimit / 2;
+    iBase = iOffset = iOldOffset = iEpoch = 0; // absolute offsets; pWindow[0] = iBase
+    iRow = y = iGifPass = 0;
+    iRowEnd = iWidth;
+
+init_codetable:
+   for (i = 0; i<iColors; i++)
+   {
+       pSymbols[i+SYM_OFFSETS] = 0xffffffff; // root symbols are never in the window
+       pSymbols[i+SYM_LENGTHS] = 1;
+       pSymbols[i+SYM_EXTRAS] = i;
+   }
+   codesize = codestart + 1;
+   sMask = (1 << codesize) - 1;
+   nextcode = cc + 2;
+   nextlim = (1 << codesize);
+   oldcode = code = (uint32_t)-1;
+   while (iOffset < iUncompressedLen) /* Loop through all the data */
+   {
+       if (bitnum > (REGISTER_WIDTH - MAX_CODE_LEN)) // need to read more data
+       {
+           p += (bitnum >> 3);
+           if (p >= pEnd) {
+               iErr = D_GIF_ERR_EOF_TOO_SOON;
+               break;
+           }
+           ulBits = INTELLONG(p); /* Read the next N-bit chunk */
+           bitnum &= 7;
+           ulBits >>= bitnum;
+       }
+       code = ulBits & sMask;
+       ulBits >>= codesize;
+       bitnum += codesize;
+
+       if (code == cc) /* Clear code? */
+       {
+           if (oldcode == 0xffffffff) // no need to reset code table
+               continue;
+           else
+               goto init_codetable;
+       }
+       if (code == eoi)
+           break;
+       if (oldcode == 0xffffffff) { // first code must be a root symbol
+           if (code >= cc) {
+               iErr = D_GIF_ERR_IMAGE_DEFECT;
+               break;
+           }
+       } else if (code > nextcode || (code == nextcode && nextcode >= MAXMAXCODE)) {
+           iErr = D_GIF_ERR_IMAGE_DEFECT;
+           break;
+       }
+       if (iOffset - iBase > iLimit) {
+           iStart = iOffset - iKeep;
+           memmove(pWindow, &pWindow[iStart - iBase], (size_t)(iOffset - iStart));
+           iBase = iStart;
+           if (iOffset - iEpoch >= 0x80000000LL) {
+               // The stored offsets would soon need more than 32 bits; make
+               // them relative to iBase. Strings which already slid out of
+               // the window are rebuilt from the prefix chain from now on.
+               for (u32 = eoi + 1; u32 < nextcode; u32++) {
+                   if (pSymbols[u32 + SYM_OFFSETS] != 0xffffffff) {
+                       if (iEpoch + pSymbols[u32 + SYM_OFFSETS] >= iBase)
+                           pSymbols[u32 + SYM_OFFSETS] = (uint32_t)(iEpoch + pSymbols[u32 + SYM_OFFSETS] - iBase);
+                       else
+                           pSymbols[u32 + SYM_OFFSETS] = 0xffffffff;
+                   }
+               }
+               iEpoch = iBase;
+           }
+       }
+       u32 = (code == nextcode) ? oldcode : code; // KwKwK outputs the old string + its first pixel
+       iLen = pSymbols[u32 + SYM_LENGTHS] & 0xffff;
+       d = &pWindow[iOffset - iBase];
+       if (pSymbols[u32 + SYM_OFFSETS] != 0xffffffff && iEpoch + pSymbols[u32 + SYM_OFFSETS] >= iBase) {
+           memcpy(d, &pWindow[iEpoch + pSymbols[u32 + SYM_OFFSETS] - iBase], iLen);
+       } else { // fell out of the window (or a root); walk the prefix chain backwards
+           d += iLen;
+           while (u32 > eoi) {
+               *--d = (uint8_t)pSymbols[u32 + SYM_EXTRAS];
+               u32 = pSymbols[u32 + SYM_LENGTHS] >> 16;
+           }
+           *--d = (uint8_t)u32;
+       }
+       d = &pWindow[iOffset - iBase];
+       if (code == nextcode) {
+           d[iLen] = d[0];
+           iLen++;
+       }
+       if (code < nextcode && code > eoi)
+           pSymbols[code + SYM_OFFSETS] = (uint32_t)(iOffset - iEpoch); // most recent copy stays in the window longest
+       if (oldcode != 0xffffffff) {
+           if (nextcode < MAXMAXCODE) // deferred clear code = stop adding new codes
+           {
+               if (code == nextcode)
+                   pSymbols[nextcode + SYM_OFFSETS] = (uint32_t)(iOffset - iEpoch);
+               else // the previous string may be from before the last move of iEpoch
+                   pSymbols[nextcode + SYM_OFFSETS] = (iOldOffset >= iEpoch) ? (uint32_t)(iOldOffset - iEpoch) : 0xffffffff;
+               pSymbols[nextcode + SYM_LENGTHS] = ((pSymbols[oldcode + SYM_LENGTHS] & 0xffff) + 1) | (oldcode << 16);
+               pSymbols[nextcode + SYM_EXTRAS] = d[0];
+               nextcode++;
+               if (nextcode >= nextlim && codesize < MAX_CODE_LEN)
+               {
+                   codesize++;
+                   nextlim <<= 1;
+                   sMask = (sMask << 1) | 1;
+               }
+           }
+       }
+       oldcode = code;
+       iOldOffset = iOffset;
+       iOffset += iLen;
+       while (iOffset >= iRowEnd && iRow < pPage->ImageDesc.Height) // pass the finished row(s) along
+       {
+           if (pfnLine(gif, pPage, y, &pWindow[iRowEnd - iWidth - iBase]) != GIF_OK)
+               return GIF_ERROR;
+           iRow++;
+           iRowEnd += iWidth;
+           y += (pPage->ImageDesc.Interlace) ? cGIFPass[iGifPass * 2] : 1;
+           while (pPage->ImageDesc.Interlace && y >= pPage->ImageDesc.Height && iGifPass < 3)
+           {
+               iGifPass++;
+               y = cGIFPass[iGifPass * 2 + 1];
+           }
+       }
+   }
+   // Rows the data didn't cover are delivered as color 0
+   while (iRow < pPage->ImageDesc.Height)
+   {
+       iStart = iRowEnd - iWidth; // start of the row
+       if (iStart > iBase) { // move the partial row (if any) to the start of the window
+           memmove(pWindow, &pWindow[iStart - iBase], (size_t)(iOffset - iStart));
+           iBase = iStart;
+       }
+       memset(&pWindow[iOffset - iBase], 0, (size_t)(iRowEnd - iOffset));
+       iOffset = iRowEnd;
+       if (pfnLine(gif, pPage, y, &pWindow[iStart - iBase]) != GIF_OK)
+           return GIF_ERROR;
+       iRow++;
+       iRowEnd += iWidth;
+       y += (pPage->ImageDesc.Interlace) ? cGIFPass[iGifPass * 2] : 1;
+       while (pPage->ImageDesc.Interlace && y >= pPage->ImageDesc.Height && iGifPass < 3)
+       {
+           iGifPass++;
+           y = cGIFPass[iGifPass * 2 + 1];
+       }
+   }
+   return iErr;
+} /* DecodeLZWWindow() */
+//
+// ValidateLZW
+//
+// Run the DecodeLZW() state machine over a frame's de-chunked LZW data
+// without producing pixels; only the string length of each code is kept
+// (in pSymbols). Checks that every code is defined, the data reaches the
+// EOI code and it expands to exactly iPixels pixels.
+//
+static int ValidateLZW(uint8_t ucCodeStart, uint8_t *pLZW, int iLZWSize, uint32_t iPixels, uint32_t *pSymbols)
+{
+    uint32_t code, oldcode, codesize, nextcode, nextlim, cc, eoi, sMask;
+    uint32_t iLen, iDone = 0;
+    uint32_t *pLengths = &pSymbols[SYM_LENGTHS];
+    BIGUINT ulBits;
+    int bitnum, iBitsLeft;
+    uint8_t *p = pLZW;
+
+    if (ucCodeStart > 8)
+        return D_GIF_ERR_IMAGE_DEFECT;
+    cc = 1 << ucCodeStart;
+    eoi = cc + 1;
+    for (code = 0; code < cc; code++)
+        pLengths[code] = 1;
+    ulBits = INTELLONG(p);
+    bitnum = 0;
+    iBitsLeft = iLZWSize * 8;
+    codesize = ucCodeStart + 1;
+    sMask = (1 << codesize) - 1;
+    nextcode = cc + 2;
+    nextlim = 1 << codesize;
+    oldcode = 0xffffffff;
+    for (;;)
+    {
+        if (bitnum > (REGISTER_WIDTH - MAX_CODE_LEN)) // need to read more data
+        {
+            p += (bitnum >> 3);
+            ulBits = INTELLONG(p);
+            bitnum &= 7;
+            ulBits >>= bitnum;
+        }
+        if (iBitsLeft < (int)codesize) // data ended before the EOI code
+            return D_GIF_ERR_EOF_TOO_SOON;
+        code = ulBits & sMask;
+        ulBits >>= codesize;
+        bitnum += codesize;
+        iBitsLeft -= codesize;
+        if (code == cc) // start over
+        {
+            codesize = ucCodeStart + 1;
+            sMask = (1 << codesize) - 1;
+            nextcode = cc + 2;
+            nextlim = 1 << codesize;
+            oldcode = 0xffffffff;
+            continue;
+        }
+        if (code == eoi)
+            break;
+        if (oldcode == 0xffffffff) // first code must be a root symbol
+        {
+            if (code > cc)
+                return D_GIF_ERR_IMAGE_DEFECT;
+            iLen = 1;
+        }
+        else
+        {
+            if (code > nextcode) // not defined (yet)
+                return D_GIF_ERR_IMAGE_DEFECT;
+            iLen = (code == nextcode) ? pLengths[oldcode] + 1 : pLengths[code];
+            if (nextcode < nextlim) // table full = deferred clear, no new entries
+                pLengths[nextcode] = pLengths[oldcode] + 1;
+            nextcode++;
+            if (nextcode >= nextlim && codesize < MAX_CODE_LEN)
+            {
+                codesize++;
+                nextlim <<= 1;
+                sMask = (sMask << 1) | 1;
+            }
+        }
+        if (iLen > iPixels - iDone) // more pixels than the frame has
+            return D_GIF_ERR_IMAGE_DEFECT;
+        iDone += iLen;
+        oldcode = code;
+    }
+    return (iDone == iPixels) ? GIF_OK : D_GIF_ERR_IMAGE_DEFECT;
+} /* ValidateLZW() */
+//
+// GIFDeInterlaceRows
+//
+// Put the rows of an interlaced frame, decoded in the order they're stored,
+// into display order in place. Each row is moved once by following the
+// cycles of the row permutation; the only scratch memory is one row (or
+// a slice of a very wide one) and a bitmap of the rows already placed,
+// both kept in the symbol table, which is idle once the frame is decoded.
+//
+static void GIFDeInterlaceRows(uint8_t *pBuf, int iWidth, int iHeight, uint32_t *pSymbols)
+{
+    uint8_t *pDone, *pTemp;
+    int iDoneSize = (iHeight + 7) >> 3;
+    int iSlice, x, iLen, y, y0, ySrc;
+
+    pDone = (uint8_t *)pSymbols;
+    pTemp = pDone + iDoneSize;
+    iSlice = (int)(3 * 4096 * sizeof(uint32_t)) - iDoneSize;
+    for (x = 0; x < iWidth; x += iSlice) // normally a single pass
+    {
+        iLen = (iWidth - x < iSlice) ? iWidth - x : iSlice;
+        memset(pDone, 0, iDoneSize);
+        for (y0 = 0; y0 < iHeight; y0++)
+        {
+            if (pDone[y0 >> 3] & (1 << (y0 & 7)))
+                continue;
+            // walk the cycle starting at y0, pulling each row into place
+            memcpy(pTemp, &pBuf[y0 * iWidth + x], iLen);
+            y = y0;
+            for (;;)
+            {
+                pDone[y >> 3] |= (uint8_t)(1 << (y & 7));
+                ySrc = GIFStoredRow(y, iHeight);
+                if (ySrc == y0)
+                    break;
+                memcpy(&pBuf[y * iWidth + x], &pBuf[ySrc * iWidth + x], iLen);
+                y = ySrc;
+            }
+            memcpy(&pBuf[y * iWidth + x], pTemp, iLen);
+        }
+    }
+} /* GIFDeInterlaceRows() */
+//
+// GifDeInterlace
+//
+// Put the rows of a decoded interlaced frame in display order
+// (using the handle's symbol table as scratch memory)
+//
+void GifDeInterlace(GifFileType *gif, SavedImage *pPage)
+{
+    GIFPRIVATE *pPrivate = (GIFPRIVATE *)gif->Private;
+
+    GIF_TRACE(pPrivate, gif, GIF_PHASE_DEINTERLACE, true, pPrivate->iTraceFrame);
+    GIFDeInterlaceRows(pPage->RasterBits, pPage->ImageDesc.Width, pPage->ImageDesc.Height, pPrivate->pSymbols);
+    GIF_TRACE(pPrivate, gif, GIF_PHASE_DEINTERLACE, false, pPrivate->iTraceFrame);
+} /* GifDeInterlace() */
+//
+// GIFSpreadRows
+//
+// Move the rows of an image decoded contiguously (pitch = width) in place
+// to their positions in a buffer with a larger pitch. Working from the
+// bottom up, no row overwrites one that still has to be moved.
+//
+static void GIFSpreadRows(uint8_t *pBuf, int iWidth, int iHeight, int iPitch)
+{
+    int y;
+
+    if (iPitch <= iWidth)
+        return;
+    for (y = iHeight-1; y > 0; y--)
+        memmove(&pBuf[y * iPitch], &pBuf[y * iWidth], iWidth);
+} /* GIFSpreadRows() */
+
+//
+// GIFFirstBlock
+//
+// Return the offset of the first block following the header and global color table
+//
+static int GIFFirstBlock(const uint8_t *cBuf)
+{
+    int iOff = 10;
+    uint8_t c = cBuf[iOff];
+
+    iOff += 3;   /* Skip flags, background color & aspect ratio */
+    if (c & 0x80) /* Deal with global color table */
+    {
+        c &= 7;  /* Get the number of colors defined */
+        iOff += (2<<c)*3; /* skip the global color table (we already got it) */
+    }
+    return iOff;
+} /* GIFFirstBlock() */
+//
+// GIFCheckFrame
+//
+// Check the size of frame number iFrame against the handle's limits before
+// any memory is allocated for its pixels; *pu64Pixels is the sum of the
+// earlier frames' pixels and gets this one added.
+// Returns GIF_OK or D_GIF_ERR_LIMIT_EXCEEDED.
+//
+static int GIFCheckFrame(const GIFPRIVATE *pPrivate, int iFrame, int iWidth, int iHeight, uint64_t *pu64Pixels)
+{
+    const GifLimits *pLimits = &pPrivate->Limits;
+
+    *pu64Pixels += (uint64_t)iWidth * iHeight;
+    if ((pLimits->MaxWidth && iWidth > pLimits->MaxWidth) ||
+        (pLimits->MaxHeight && iHeight > pLimits->MaxHeight) ||
+        (pLimits->MaxFrames && iFrame >= pLimits->MaxFrames) ||
+        (pLimits->MaxPixels && *pu64Pixels > pLimits->MaxPixels))
+        return D_GIF_ERR_LIMIT_EXCEEDED;
+    return GIF_OK;
+} /* GIFCheckFrame() */
+//
+// GIFParseFrame
+//
+// Collect the extension blocks and image descriptor of the next frame
+// starting at *piOff and 'de-chunk' its compressed data in place.
+// Fills in everything but the RasterBits of pPage.
+// Returns GIF_ERROR when the end of the file (or corrupt data) was reached
+// before an image descriptor and D_GIF_ERR_LIMIT_EXCEEDED when the frame is
+// beyond the handle's limits.
+//
+static int GIFParseFrame(GifFileType *gif, SavedImage *pPage, int *piOff, uint8_t *pucCodeStart, uint8_t **ppLZW, int *piLZWSize)
+{
+//    int iDelay, iMaxDelay, iMinDelay, iTotalDelay;
+    GIFPRIVATE *pPrivate = gif->Private;
+    int iOff = *piOff;
+    int iDataAvailable = pPrivate->iFileSize;
+    int bExt, iMaxExt = MAX_EXTENSIONS, iErr = GIF_ERROR;
+    uint8_t c, *d, *cBuf, *pStart;
+    ExtensionBlock *pExtensions;
+
+    cBuf = (uint8_t *) pPrivate->pFileData;
+    pPrivate->iTraceFrame = gif->ImageCount; // the callers count it once it's decoded
+    GIF_TRACE(pPrivate, gif, GIF_PHASE_SCAN, true, pPrivate->iTraceFrame);
+    pPage->ImageDesc.ColorMap = NULL; // assume no palette (yet)
+    bExt = 1; // check for extension blocks
+    pPage->ExtensionBlockCount = 0;
+    if (pPrivate->bArena) { // use the space counted by GIFProbeFrames()
+        pExtensions = pPrivate->pArenaExt;
+        if (iMaxExt > pPrivate->iArenaExtLeft)
+            iMaxExt = pPrivate->iArenaExtLeft;
+    } else {
+        // pre-allocate the max # of blocks since they're just a list of pointers/counts
+        // (DGifNextFrame() keeps reusing the same ones)
+        if (pPage->ExtensionBlocks == NULL)
+            pPage->ExtensionBlocks = GIFHandleCalloc(pPrivate, MAX_EXTENSIONS * sizeof(ExtensionBlock));
+        pExtensions = pPage->ExtensionBlocks;
+        if (pExtensions == NULL)
+            goto parse_error;
+    }
+    while (bExt && iOff < iDataAvailable)
+    {
+        switch(cBuf[iOff])
+        {
+            case 0x3b: /* End of file */
+                /* we were fooled into thinking there were more pages */
+                goto parse_error;
+// F9 = Graphic Control Extension (fixed length of 4 bytes)
+// FE = Comment Extension
+// FF = Application Extension
+// 01 = Plain Text Extension
+            case 0x21: /* Extension block */
+                if (pPage->ExtensionBlockCount < iMaxExt) {
+                    pExtensions[pPage->ExtensionBlockCount].Function = cBuf[iOff+1];
+                    pExtensions[pPage->ExtensionBlockCount].ByteCount = cBuf[iOff+2];
+                    pExtensions[pPage->ExtensionBlockCount].Bytes = &cBuf[iOff+3];
+                    pPage->ExtensionBlockCount++;
+                }
+#ifdef FUTURE
+                if (cBuf[iOff+1] == 0xf9 && cBuf[iOff+2] == 4) // Graphic Control Extension
+                {
+                    // DEBUG!!!
+                    pPage->ucHasExtension = 1;
+                    pPage->ucGIFBits = cBuf[iOff+3]; // page disposition flags
+                    pPage->iFrameDelay = cBuf[iOff+4]; // delay low byte
+                    pPage->iFrameDelay |= (cBuf[iOff+5] << 8); // delay high byte
+                    iDelay = pPage->iFrameDelay;
+                    if (iDelay < 2) // too fast, provide a default
+                        iDelay = 2;
+                    iDelay *= 10; // turn JIFFIES into milliseconds
+                    iTotalDelay += iDelay;
+                    if (iDelay > iMaxDelay) iMaxDelay = iDelay;
+                    else if (iDelay < iMinDelay) iMinDelay = iDelay;
+                    pPage->ucTransparent = cBuf[iOff+6]; // transparent color index
+                    printf("ucGIFBits: 0x%02x, ucTrans: 0x%02x\n", pPage->ucGIFBits, pPage->ucTransparent);
+                }
+#endif
+                iOff += 2; /* skip to length */
+                iOff += (int)cBuf[iOff]; /* Skip the data block */
+                iOff++;
+               // block terminator or optional sub blocks
+                c = (iOff < iDataAvailable) ? cBuf[iOff++] : 1; /* Skip any sub-blocks */
+                while (c && iOff < (iDataAvailable - c))
+                {
+                    if (pPage->ExtensionBlockCount < iMaxExt) {
+                        pExtensions[pPage->ExtensionBlockCount].Function = 0; // 0 indicates more data for the previously defined extension
+                        pExtensions[pPage->ExtensionBlockCount].ByteCount = c;
+                        pExtensions[pPage->ExtensionBlockCount].Bytes = &cBuf[iOff];
+                        pPage->ExtensionBlockCount++;
+                    }
+                    iOff += (int)c;
+                    c = cBuf[iOff++];
+                }
+                if (c != 0) // problem, we went past the end
+                    goto parse_error; // possible corrupt data; stop
+                break;
+            case 0x2c: /* Start of image data */
+                bExt = 0; /* Stop doing extension blocks */
+                break;
+            default:
+               /* Corrupt data, stop here */
+                goto parse_error;
+        } // switch
+    } // while
+    if (!pPrivate->bArena) // the reused entries past the count still hold an earlier frame's blocks
+        memset(&pExtensions[pPage->ExtensionBlockCount], 0, (MAX_EXTENSIONS - pPage->ExtensionBlockCount) * sizeof(ExtensionBlock));
+    if (cBuf[iOff] == ',')
+        iOff++;
+    if (iOff + 9 >= iDataAvailable) // problem
+        goto parse_error; // possible corrupt data; stop
+    /* Start of image data */
+// This particular frame's size and position on the main frame (if animated)
+    pPage->ImageDesc.Left = INTELSHORT(&cBuf[iOff]);
+    pPage->ImageDesc.Top = INTELSHORT(&cBuf[iOff+2]);
+    pPage->ImageDesc.Width = INTELSHORT(&cBuf[iOff+4]);
+    pPage->ImageDesc.Height = INTELSHORT(&cBuf[iOff+6]);
+    iOff += 8;
+    if (GIFCheckFrame(pPrivate, gif->ImageCount, pPage->ImageDesc.Width, pPage->ImageDesc.Height, &pPrivate->u64Pixels) != GIF_OK) {
+        iErr = D_GIF_ERR_LIMIT_EXCEEDED;
+        goto parse_error;
+    }
+    /* Image descriptor
+     7 6 5 4 3 2 1 0    M=0 - use global color map, ignore pixel
+     M I 0 0 0 pixel    M=1 - local color map follows, use pixel
+     I=0 - Image in sequential order
+     I=1 - Image in interlaced order
+     pixel+1 = # bits per pixel for this image
+     */
+    c = cBuf[iOff++]; /* Get the flags byte */
+    pPage->ImageDesc.Interlace = c & 0x40;
+    if (c & 0x80) /* Local color table */
+    {
+        if (pPrivate->bArena)
+            pPage->ImageDesc.ColorMap = (ColorMapObject *)GIFArenaAlloc(pPrivate, sizeof(ColorMapObject));
+        else
+            pPage->ImageDesc.ColorMap = (ColorMapObject *)GIFHandleMalloc(pPrivate, sizeof(ColorMapObject));
+        if (pPage->ImageDesc.ColorMap == NULL)
+            goto parse_error;
+        pPage->ImageDesc.ColorMap->ColorCount = (2<<(c & 7));
+        pPage->ImageDesc.ColorMap->BitsPerPixel = (c & 7) + 1;
+        pPage->ImageDesc.ColorMap->SortFlag = (c & 0x20) != 0;
+        pPage->ImageDesc.ColorMap->Colors = (GifColorType *)&cBuf[iOff];
+        iOff += pPage->ImageDesc.ColorMap->ColorCount*3;
+    }
+    if (iOff + 2 >= iDataAvailable)
+        goto parse_error; // truncated file
+    *pucCodeStart = cBuf[iOff++]; /* LZW code size byte */
+    c = cBuf[iOff++]; // first chunk length
+    *ppLZW = &cBuf[iOff-1]; // start of compressed data
+    // remove the chunk markers to make contiguous data
+    d = &cBuf[iOff-1];
+    pStart = d;
+    while (c) /* While there are more data blocks */
+    {
+        if (c > iDataAvailable - iOff) // truncated file, use what's there
+            c = iDataAvailable - iOff;
+        memmove(d, &cBuf[iOff], c);
+        d += c;
+        iOff += c;
+        c = (iOff < iDataAvailable) ? cBuf[iOff++] : 0; /* Get length of next */
+    }
+    *piLZWSize = (int)(d - pStart);
+    GIF_COUNT(pPrivate->Stats.BytesDechunked += *piLZWSize;)
+//        printf(" - compressed size: %d\n", iLZWSize);
+    if (pPrivate->bArena) { // claim the extension blocks we used
+        pPage->ExtensionBlocks = (pPage->ExtensionBlockCount) ? pExtensions : NULL;
+        pPrivate->pArenaExt += pPage->ExtensionBlockCount;
+        pPrivate->iArenaExtLeft -= pPage->ExtensionBlockCount;
+    }
+    *piOff = iOff;
+    GIF_TRACE(pPrivate, gif, GIF_PHASE_SCAN, false, pPrivate->iTraceFrame);
+    return GIF_OK;
+
+parse_error:
+    if (!pPrivate->bArena) { // arena memory is only freed as a whole
+        GIFFree(&pPrivate->Allocator, pPage->ExtensionBlocks);
+        GIFFree(&pPrivate->Allocator, pPage->ImageDesc.ColorMap);
+    }
+    pPage->ExtensionBlocks = NULL;
+    pPage->ExtensionBlockCount = 0;
+    pPage->ImageDesc.ColorMap = NULL;
+    *piOff = iOff;
+    GIF_TRACE(pPrivate, gif, GIF_PHASE_SCAN, false, pPrivate->iTraceFrame);
+    return iErr;
+} /* GIFParseFrame() */
+//
+// GIFNextPage
+//
+// Make room for one more frame in SavedImages and return it (cleared).
+// Slots used by an earlier file on the same handle keep their RasterBits
+// and ExtensionBlocks for reuse.
+//
+static SavedImage *GIFNextPage(GifFileType *gif)
+{
+    GIFPRIVATE *pPrivate = gif->Private;
+    SavedImage *pPage;
+    uint8_t *pRaster;
+    ExtensionBlock *pExt;
+    void *p;
+    int i;
+
+    if (gif->SavedImages != NULL && gif->SavedImages == (SavedImage *)pPrivate->pArena)
+        gif->SavedImages = NULL; // the last file used GIF_OPT_ARENA; start a normal array
+    if (gif->SavedImages == NULL)
+        pPrivate->iFrameMemCount = pPrivate->iFrameSlots = 0;
+    if (gif->ImageCount >= pPrivate->iFrameMemCount) { // need to allocate more memory
+        i = pPrivate->iFrameMemCount + GIF_IMAGE_INCREMENT; // allocate N image structures at a time
+        p = GIFHandleRealloc(pPrivate, gif->SavedImages, i * sizeof(SavedImage));
+        if (p == NULL)
+            return NULL;
+        gif->SavedImages = (SavedImage *)p;
+        p = GIFHandleRealloc(pPrivate, pPrivate->pRasterSizes, i * sizeof(int));
+        if (p == NULL)
+            return NULL;
+        pPrivate->pRasterSizes = (int *)p;
+        pPrivate->iFrameMemCount = i;
+    }
+    pPage = &gif->SavedImages[gif->ImageCount];
+    if (gif->ImageCount < pPrivate->iFrameSlots) { // reuse the buffers
+        pRaster = pPage->RasterBits;
+        pExt = pPage->ExtensionBlocks;
+        memset(pPage, 0, sizeof(SavedImage));
+        pPage->RasterBits = pRaster;
+        pPage->ExtensionBlocks = pExt;
+    } else {
+        memset(pPage, 0, sizeof(SavedImage));
+        pPrivate->pRasterSizes[gif->ImageCount] = 0;
+        pPrivate->iFrameSlots = gif->ImageCount + 1;
+    }
+    return pPage;
+} /* GIFNextPage() */
+//
+// GIFRasterSize
+//
+// Number of bytes to allocate for the RasterBits of a frame (which isn't
+// GIF_FRAME_TOO_BIG)
+//
+static int GIFRasterSize(const SavedImage *pPage)
+{
+    int64_t i = (int64_t)pPage->ImageDesc.Width * pPage->ImageDesc.Height + GIF_DECODE_PADDING;
+    i += 0xffff; // memory seems to fragment if we allocate many blocks
+    i &= ~(int64_t)0xffff; // of odd sizes, so round them to 64K
+    return (int)i;
+} /* GIFRasterSize() */
+//
+// GIFScratchFrame
+//
+// GIF_OPT_PACKED frames are decoded to 8-bit pixels in a scratch buffer
+// owned by the handle, then packed into their RasterBits. Return that
+// buffer, grown to hold the frame and the decoder's padding (the frame
+// isn't GIF_FRAME_TOO_BIG).
+//
+static uint8_t *GIFScratchFrame(GIFPRIVATE *pPrivate, const SavedImage *pPage)
+{
+    int64_t i64Size = (int64_t)pPage->ImageDesc.Width * pPage->ImageDesc.Height + GIF_DECODE_PADDING;
+
+    if (GIFGrowBuffer(pPrivate, &pPrivate->pScratch, &pPrivate->iScratchSize, (int)i64Size) != GIF_OK)
+        return NULL;
+    return pPrivate->pScratch;
+} /* GIFScratchFrame() */
+//
+// GIFProbeFrames
+//
+// Walk the frames without decoding or changing anything to count the
+// frames and extension blocks and the bytes needed for their palettes and
+// pixels. Follows the same rules as GIFParseFrame().
+// Returns GIF_OK, D_GIF_ERR_LIMIT_EXCEEDED when a frame is beyond the
+// handle's limits or D_GIF_ERR_DATA_TOO_BIG when it's too big to decode as
+// a whole (so nothing gets allocated for the file).
+//
+static int GIFProbeFrames(GifFileType *gif, int *piFrames, int *piExtensions, size_t *piSize)
+{
+    GIFPRIVATE *pPrivate = gif->Private;
+    const uint8_t *cBuf = pPrivate->pFileData;
+    int iFileSize = pPrivate->iFileSize;
+    int iOff, iExt, iFrames = 0, iExtensions = 0;
+    int iWidth, iHeight, iBits, iErr = GIF_OK;
+    uint64_t u64Pixels = 0;
+    size_t iSize = 0;
+    uint8_t c;
+
+    iOff = GIFFirstBlock(cBuf);
+    while (iFrames < GIF_MAX_FRAMES && iOff < iFileSize && cBuf[iOff] != 0x3b)
+    {
+        iExt = 0;
+        while (iOff < iFileSize && cBuf[iOff] == 0x21) { // extension block
+            iExt++;
+            iOff += 2; /* skip to length */
+            iOff += (int)cBuf[iOff] + 1; /* Skip the data block */
+            c = (iOff < iFileSize) ? cBuf[iOff++] : 1;
+            while (c && iOff < (iFileSize - c)) { /* sub-blocks */
+                iExt++;
+                iOff += (int)c;
+                c = cBuf[iOff++];
+            }
+            if (c != 0) // went past the end
+                goto probe_done;
+        }
+        if (iOff >= iFileSize || cBuf[iOff] != 0x2c)
+            break;
+        iOff++;
+        if (iOff + 9 >= iFileSize)
+            break;
+        iWidth = INTELSHORT(&cBuf[iOff+4]);
+        iHeight = INTELSHORT(&cBuf[iOff+6]);
+        iErr = GIFCheckFrame(pPrivate, iFrames, iWidth, iHeight, &u64Pixels);
+        if (iErr == GIF_OK && GIF_FRAME_TOO_BIG(iWidth, iHeight))
+            iErr = D_GIF_ERR_DATA_TOO_BIG;
+        if (iErr != GIF_OK)
+            break;
+        c = cBuf[iOff+8];
+        iOff += 9;
+        iBits = (gif->SColorMap != NULL) ? GIFDepthBits(pPrivate->iOptions, gif->SColorMap->BitsPerPixel) : 8;
+        if (c & 0x80) { /* Local color table */
+            iSize += GIF_ARENA_ALIGN(sizeof(ColorMapObject));
+            iOff += (2<<(c & 7))*3;
+            iBits = GIFDepthBits(pPrivate->iOptions, (c & 7) + 1);
+        }
+        if (iOff + 2 >= iFileSize)
+            break;
+        iOff++; /* LZW code size byte */
+        c = cBuf[iOff++];
+        while (c) { /* skip the data blocks */
+            iOff += c;
+            c = (iOff < iFileSize) ? cBuf[iOff++] : 0;
+        }
+        iFrames++;
+        iExtensions += (iExt < MAX_EXTENSIONS) ? iExt : MAX_EXTENSIONS;
+        if (iBits == 8)
+            iSize += GIF_ARENA_ALIGN((size_t)iWidth * iHeight + GIF_DECODE_PADDING);
+        else // decoded elsewhere (see GIFScratchFrame())
+            iSize += GIF_ARENA_ALIGN((size_t)GIF_PACKED_PITCH(iWidth, iBits) * iHeight);
+    }
+probe_done:
+    *piFrames = iFrames;
+    *piExtensions = iExtensions;
+    *piSize = iSize;
+    return iErr;
+} /* GIFProbeFrames() */
+//
+// GIFSlurpArena
+//
+// DGifSlurp() with GIF_OPT_ARENA: size everything with GIFProbeFrames() and
+// place the SavedImages array, the extension blocks, local palettes and
+// pixels of all frames in a single allocation. The arena is kept (and
+// reused) when the handle is reopened and freed as a whole when it's closed.
+//
+static int GIFSlurpArena(GifFileType *gif)
+{
+    GIFPRIVATE *pPrivate = gif->Private;
+    uint8_t ucCodeStart, *pLZW, *cBuf = pPrivate->pFileData;
+    int iOff, iLZWSize, iFrames, iExtensions, iErr;
+    int iBits;
+    size_t iSize, iImages;
+    SavedImage *pPage;
+    uint8_t *pRaster;
+
+    if (gif->SavedImages != NULL && gif->SavedImages != (SavedImage *)pPrivate->pArena)
+        GifFreeImages(gif); // per-frame buffers of an earlier file
+    gif->SavedImages = NULL;
+    gif->ImageCount = 0;
+    pPrivate->iFrameSlots = pPrivate->iFrameMemCount = 0;
+
+    iErr = GIFProbeFrames(gif, &iFrames, &iExtensions, &iSize);
+    if (iErr != GIF_OK)
+        return iErr; // over the limits or too big
+    iImages = GIF_ARENA_ALIGN(iFrames * sizeof(SavedImage));
+    iSize += iImages + GIF_ARENA_ALIGN(iExtensions * sizeof(ExtensionBlock)) + 16;
+    if (iSize > pPrivate->iArenaSize) { // one allocation for everything
+        GIFFree(&pPrivate->Allocator, pPrivate->pArena);
+        pPrivate->pArena = GIFHandleMalloc(pPrivate, iSize);
+        pPrivate->iArenaSize = (pPrivate->pArena != NULL) ? iSize : 0;
+        if (pPrivate->pArena == NULL)
+            return GIFMemError(pPrivate);
+    }
+    memset(pPrivate->pArena, 0, iImages);
+    gif->SavedImages = (SavedImage *)pPrivate->pArena;
+    pPrivate->pArenaExt = (ExtensionBlock *)&pPrivate->pArena[iImages];
+    pPrivate->iArenaExtLeft = iExtensions;
+    pPrivate->pArenaNext = &pPrivate->pArena[iImages + GIF_ARENA_ALIGN(iExtensions * sizeof(ExtensionBlock))];
+    pPrivate->iArenaLeft = pPrivate->iArenaSize - (pPrivate->pArenaNext - pPrivate->pArena);
+    pPrivate->bArena = 1;
+
+    iOff = GIFFirstBlock(cBuf);
+    while (gif->ImageCount < iFrames)
+    {
+        pPage = &gif->SavedImages[gif->ImageCount];
+        if (GIFParseFrame(gif, pPage, &iOff, &ucCodeStart, &pLZW, &iLZWSize) != GIF_OK)
+            break; // end of file or corrupt data; keep what we have
+        iBits = GifPixelBits(gif, pPage);
+        if (iBits == 8) {
+            pPage->RasterBits = pRaster = GIFArenaAlloc(pPrivate, (size_t)pPage->ImageDesc.Width * pPage->ImageDesc.Height + GIF_DECODE_PADDING);
+        } else {
+            pRaster = GIFArenaAlloc(pPrivate, (size_t)GIF_PACKED_PITCH(pPage->ImageDesc.Width, iBits) * pPage->ImageDesc.Height);
+            pPage->RasterBits = GIFScratchFrame(pPrivate, pPage);
+        }
+        if (pRaster == NULL || pPage->RasterBits == NULL) {
+            pPage->RasterBits = NULL;
+            break; // more than the probe found (or no scratch memory)
+        }
+        gif->ImageCount++;
+        iErr = DecodeLZW(gif, pPage, ucCodeStart, pLZW, iLZWSize, GIFStatsSlot(gif, gif->ImageCount - 1), pPrivate->pSymbols, GIF_COUNTERS(pPrivate));
+        if (pPage->ImageDesc.Interlace)
+            GifDeInterlace(gif, pPage);
+        if (iBits != 8) {
+            GIFPackRows(pRaster, GIF_PACKED_PITCH(pPage->ImageDesc.Width, iBits), pPage->RasterBits, pPage->ImageDesc.Width, pPage->ImageDesc.Height, iBits);
+            pPage->RasterBits = pRaster;
+        }
+        if (iErr == GIF_ERROR) // stopped by the progress callback
+            break;
+        if (iOff >= pPrivate->iFileSize || cBuf[iOff] == 0x3b)
+            break; /* End of file has been reached */
+    }
+    pPrivate->bArena = 0;
+    return (iErr == GIF_ERROR) ? GIF_ERROR : GIF_OK;
+} /* GIFSlurpArena() */
+//
+// GIFScanFrame
+//
+// Parse the frame at *piOff into the next SavedImages slot (not counted in
+// ImageCount yet) and give it memory to decode into. *ppRaster is the
+// frame's final RasterBits; for packed frames RasterBits is the unpacked
+// scratch frame until the rows are packed into *ppRaster.
+// Returns GIF_OK, GIF_ERROR at the end of the frames, D_GIF_ERR_NOT_ENOUGH_MEM,
+// D_GIF_ERR_LIMIT_EXCEEDED or D_GIF_ERR_DATA_TOO_BIG.
+//
+static int GIFScanFrame(GifFileType *gif, int *piOff, uint8_t *pucCodeStart, uint8_t **ppLZW, int *piLZWSize, uint8_t **ppRaster)
+{
+    GIFPRIVATE *pPrivate = gif->Private;
+    SavedImage *pPage;
+    int iSize, iBits, iErr;
+
+    pPage = GIFNextPage(gif);
+    if (pPage == NULL)
+        return GIFMemError(pPrivate);
+    iErr = GIFParseFrame(gif, pPage, piOff, pucCodeStart, ppLZW, piLZWSize);
+    if (iErr != GIF_OK)
+        return iErr; // end of file, corrupt data or over the limits
+    if (GIF_FRAME_TOO_BIG(pPage->ImageDesc.Width, pPage->ImageDesc.Height))
+        return D_GIF_ERR_DATA_TOO_BIG;
+    iBits = GifPixelBits(gif, pPage);
+    if (iBits == 8)
+        iSize = GIFRasterSize(pPage);
+    else // packed frames are exact size, they're decoded elsewhere
+        iSize = GIF_PACKED_PITCH(pPage->ImageDesc.Width, iBits) * pPage->ImageDesc.Height + 1;
+    if (iSize > pPrivate->pRasterSizes[gif->ImageCount]) { // (re)allocate
+        GIFFree(&pPrivate->Allocator, pPage->RasterBits);
+        pPage->RasterBits = GIFHandleMalloc(pPrivate, iSize);
+        pPrivate->pRasterSizes[gif->ImageCount] = (pPage->RasterBits != NULL) ? iSize : 0;
+    }
+    if (pPage->RasterBits == NULL)
+        return GIFMemError(pPrivate);
+    *ppRaster = pPage->RasterBits;
+    if (iBits != 8 && (pPage->RasterBits = GIFScratchFrame(pPrivate, pPage)) == NULL) {
+        pPage->RasterBits = *ppRaster;
+        return GIFMemError(pPrivate);
+    }
+    return GIF_OK;
+} /* GIFScanFrame() */
+//
+// GIFPreprocess
+//
+int GIFPreprocess(GifFileType *gif)
+{
+    int iOff;
+    uint8_t ucCodeStart, *pLZW;
+    int iLZWSize, iBits, iErr;
+    SavedImage *pPage;
+    GIFPRIVATE *pPrivate = gif->Private;
+    uint8_t *pRaster, *cBuf = (uint8_t *) pPrivate->pFileData;
+    
+    if (pPrivate->iOptions & GIF_OPT_ARENA)
+        return GIFSlurpArena(gif);
+    gif->ImageCount = 0;
+    iOff = GIFFirstBlock(cBuf);
+    while (gif->ImageCount < GIF_MAX_FRAMES)
+    {
+//        printf("DGifSlurp - frame %d\n", gif->ImageCount);
+        iErr = GIFScanFrame(gif, &iOff, &ucCodeStart, &pLZW, &iLZWSize, &pRaster);
+        if (iErr == GIF_ERROR)
+            break; // end of file or corrupt data; keep what we have
+        if (iErr != GIF_OK)
+            return iErr;
+        /* End of image data, decode it */
+        pPage = &gif->SavedImages[gif->ImageCount++];
+        iBits = GifPixelBits(gif, pPage);
+        iErr = DecodeLZW(gif, pPage, ucCodeStart, pLZW, iLZWSize, GIFStatsSlot(gif, gif->ImageCount - 1), pPrivate->pSymbols, GIF_COUNTERS(pPrivate));
+        if (pPage->ImageDesc.Interlace)
+            GifDeInterlace(gif, pPage);
+        if (iBits != 8) {
+            GIFPackRows(pRaster, GIF_PACKED_PITCH(pPage->ImageDesc.Width, iBits), pPage->RasterBits, pPage->ImageDesc.Width, pPage->ImageDesc.Height, iBits);
+            pPage->RasterBits = pRaster;
+        }
+        if (iErr == GIF_ERROR)
+            return GIF_ERROR; // stopped by the progress callback
+        /* Check for more frames... */
+        if (iOff >= pPrivate->iFileSize || cBuf[iOff] == 0x3b)
+            break; /* End of file has been reached */
+    } /* while more frames */
+    return GIF_OK;
+} /* GIFPreProcess() */
+
+//
+// GIFScreenDesc
+//
+// Check the signature and take the logical screen descriptor from the first
+// 13 bytes of a file. The global color table is allocated once at full size
+// and kept in the private struct so that a reused handle doesn't need a new
+// one per file; the caller fills in its colors.
+//
+static int GIFScreenDesc(GifFileType *gif, const uint8_t *ucTemp)
+{
+GIFPRIVATE *pPrivate = (GIFPRIVATE *)gif->Private;
+unsigned char SortFlag, BitsPerPixel;
+
+    // See if it's a GIF file
+    if (memcmp(ucTemp, GIF87_STAMP, GIF_STAMP_LEN) != 0 && memcmp(ucTemp, GIF89_STAMP, GIF_STAMP_LEN) != 0) {
+        // not a GIF file
+        return D_GIF_ERR_NOT_GIF_FILE;
+    }
+    // Get logical screen descriptor
+    gif->SWidth = INTELSHORT(&ucTemp[6]);
+    gif->SHeight = INTELSHORT(&ucTemp[8]);
+    gif->SColorResolution = (((ucTemp[10] & 0x70) + 1) >> 4) + 1;
+    SortFlag = ucTemp[10] & 0x8;
+    BitsPerPixel = (ucTemp[10] & 7) + 1;
+    gif->SBackGroundColor = ucTemp[11];
+    gif->AspectByte = ucTemp[12];
+    gif->SColorMap = NULL;
+    if (ucTemp[10] & 0x80) { // global color table
+        if (pPrivate->pSColorMap == NULL) {
+            pPrivate->pSColorMap = GIFMakeMapObject(&pPrivate->Allocator, 256, NULL);
+            if (pPrivate->pSColorMap == NULL)
+                return D_GIF_ERR_NOT_ENOUGH_MEM;
+        }
+        gif->SColorMap = pPrivate->pSColorMap;
+        gif->SColorMap->ColorCount = 1 << BitsPerPixel;
+        gif->SColorMap->BitsPerPixel = BitsPerPixel;
+        gif->SColorMap->SortFlag = SortFlag;
+    }
+    return GIF_OK;
+} /* GIFScreenDesc() */
+//
+// GIFReadHeader
+//
+// Read the signature, logical screen descriptor and global color table
+//
+static int GIFReadHeader(GifFileType *gif, int iHandle)
+{
+GIFPRIVATE *pPrivate = (GIFPRIVATE *)gif->Private;
+unsigned char ucTemp[32];
+int i, err;
+
+    pPrivate->iHandle = iHandle; // save for later
+    
+    // Read a bit of the file to get the signature and image descriptor
+    i = (int)read(iHandle, ucTemp, 13);
+    if (i != 13)
+        return D_GIF_ERR_READ_FAILED;
+    err = GIFScreenDesc(gif, ucTemp);
+    if (err != GIF_OK || gif->SColorMap == NULL)
+        return err;
+    // Read the palette entries
+    i = (int)read(iHandle, gif->SColorMap->Colors, gif->SColorMap->ColorCount * 3);
+    if (i != gif->SColorMap->ColorCount * 3)
+        return D_GIF_ERR_READ_FAILED;
+    return GIF_OK;
+} /* GIFReadHeader() */
+//
+// DGifOpenFileHandle
+//
+GifFileType *DGifOpenFileHandle(int iHandle, int *pError)
+{
+    return DGifOpenFileHandleAlloc(iHandle, NULL, pError);
+} /* DGifOpenFileHandle() */
+//
+// DGifOpenFileHandleAlloc
+//
+// Open a decoder which uses the given allocator (NULL = the default one)
+//
+GifFileType *DGifOpenFileHandleAlloc(int iHandle, const GifAllocator *pAlloc, int *pError)
+{
+GifFileType *gif;
+int err;
+    
+    if (pAlloc == NULL)
+        pAlloc = &GIFDefaultAllocator;
+    gif = (GifFileType *)GIFCalloc(pAlloc, sizeof(GifFileType));
+    if (gif == NULL) {
+        if (pError != NULL)
+            *pError = D_GIF_ERR_NOT_ENOUGH_MEM;
+        goto open_error;
+    }
+    
+    gif->Private = GIFCalloc(pAlloc, sizeof(GIFPRIVATE));
+    if (gif->Private == NULL) {
+        if (pError != NULL)
+            *pError = D_GIF_ERR_NOT_ENOUGH_MEM;
+        goto open_error;
+    }
+    ((GIFPRIVATE *)gif->Private)->Allocator = *pAlloc;
+    err = GIFReadHeader(gif, iHandle);
+    if (err != GIF_OK) {
+        if (pError != NULL)
+            *pError = err;
+        goto open_error;
+    }
+    return gif;
+    
+open_error:
+    (void)close(iHandle);
+    if (gif) {
+        if (gif->Private) {
+            GIFPRIVATE *pPrivate = (GIFPRIVATE *)gif->Private;
+            if (pPrivate->pSColorMap)
+                GIFFreeMapObject(pAlloc, pPrivate->pSColorMap);
+            GIFFree(pAlloc, gif->Private);
+        }
+        GIFFree(pAlloc, gif);
+    }
+    return NULL;
+} /* DGifOpenFileHandleAlloc() */
+
+//
+// DGifOpenFileName
+//
+GifFileType *DGifOpenFileName(const char *fname, int *pError)
+{
+int iHandle;
+
+   iHandle = open(fname, O_RDONLY);
+   if (iHandle == -1) {
+       if (pError != NULL)
+           *pError = D_GIF_ERR_OPEN_FAILED;
+       return NULL;
+   }
+   return DGifOpenFileHandle(iHandle, pError);
+} /* DGifOpenFileName() */
+//
+// DGifReopenFileHandle
+//
+// Start decoding a new file with an existing handle. The file buffer, symbol
+// table, frame array, raster buffers and global palette are kept and only
+// grow when the new file needs more; the frames of the previous file are
+// gone after this call. On failure the handle can still be closed or
+// reopened again.
+//
+int DGifReopenFileHandle(GifFileType *gif, int iHandle, int *pError)
+{
+GIFPRIVATE *pPrivate;
+int err;
+
+    if (gif == NULL || gif->Private == NULL) {
+        (void)close(iHandle);
+        if (pError != NULL)
+            *pError = D_GIF_ERR_NOT_READABLE;
+        return GIF_ERROR;
+    }
+    pPrivate = (GIFPRIVATE *)gif->Private;
+    GIFForgetFile(gif);
+    err = GIFReadHeader(gif, iHandle);
+    if (err != GIF_OK) {
+        (void)close(iHandle);
+        pPrivate->iHandle = 0;
+        gif->Error = err;
+        if (pError != NULL)
+            *pError = err;
+        return GIF_ERROR;
+    }
+    return GIF_OK;
+} /* DGifReopenFileHandle() */
+//
+// GIFClearExtensions
+//
+// Empty the (reused) extension block array of a decoder frame
+//
+static void GIFClearExtensions(SavedImage *pPage)
+{
+    if (pPage->ExtensionBlocks != NULL)
+        memset(pPage->ExtensionBlocks, 0, MAX_EXTENSIONS * sizeof(ExtensionBlock));
+    pPage->ExtensionBlockCount = 0;
+} /* GIFClearExtensions() */
+//
+// GIFForgetFile
+//
+// Drop the previous file of a reused handle, keeping its memory
+//
+static void GIFForgetFile(GifFileType *gif)
+{
+GIFPRIVATE *pPrivate = (GIFPRIVATE *)gif->Private;
+int i;
+
+    if (pPrivate->iHandle)
         close(pPrivate->iHandle);
+    pPrivate->iHandle = 0;
+    // the local palettes point into its data
+    for (i=0; i<gif->ImageCount && gif->SavedImages != (SavedImage *)pPrivate->pArena; i++) {
+        GIFFree(&pPrivate->Allocator, gif->SavedImages[i].ImageDesc.ColorMap);
+        gif->SavedImages[i].ImageDesc.ColorMap = NULL;
+    }
+    for (i=0; i<2; i++) {
+        GIFFree(&pPrivate->Allocator, pPrivate->Frames[i].ImageDesc.ColorMap);
+        pPrivate->Frames[i].ImageDesc.ColorMap = NULL;
+    }
+    // and so do the extension blocks of the frame slots that are kept
+    for (i=0; i<pPrivate->iFrameSlots && gif->SavedImages != (SavedImage *)pPrivate->pArena; i++)
+        GIFClearExtensions(&gif->SavedImages[i]);
+    for (i=0; i<2; i++)
+        GIFClearExtensions(&pPrivate->Frames[i]);
+    if (gif->SColorMap != NULL && gif->SColorMap != pPrivate->pSColorMap)
+        GIFFreeMapObject(&pPrivate->Allocator, gif->SColorMap); // replaced by the caller
+    gif->SColorMap = NULL;
+    gif->ImageCount = 0;
+    gif->Error = 0;
+    pPrivate->iFileSize = 0;
+    pPrivate->iFrameOffset = 0;
+    pPrivate->iFrameBuf = 0;
+    pPrivate->iLineLeft = 0;
+} /* GIFForgetFile() */
+//
+// DGifReopenFileName
+//
+int DGifReopenFileName(GifFileType *gif, const char *fname, int *pError)
+{
+int iHandle;
+
+   iHandle = open(fname, O_RDONLY);
+   if (iHandle == -1) {
+       if (pError != NULL)
+           *pError = D_GIF_ERR_OPEN_FAILED;
+       return GIF_ERROR;
+   }
+   return DGifReopenFileHandle(gif, iHandle, pError);
+} /* DGifReopenFileName() */
+//
+// GifSetOptions
+//
+// Set the GIF_OPT_* flags of a handle
+//
+int GifSetOptions(GifFileType *gif, int iOptions)
+{
+    if (gif == NULL || gif->Private == NULL)
+        return GIF_ERROR;
+    ((GIFPRIVATE *)gif->Private)->iOptions = iOptions;
+    return GIF_OK;
+} /* GifSetOptions() */
+//
+// GifSetLimits
+//
+// Set the limits for the files decoded with a handle (NULL = none). They
+// apply to each file on its own, counting from the next time one is read.
+//
+int GifSetLimits(GifFileType *gif, const GifLimits *pLimits)
+{
+    GIFPRIVATE *pPrivate;
+
+    if (gif == NULL || gif->Private == NULL)
+        return GIF_ERROR;
+    pPrivate = (GIFPRIVATE *)gif->Private;
+    if (pLimits != NULL)
+        memcpy(&pPrivate->Limits, pLimits, sizeof(GifLimits));
+    else
+        memset(&pPrivate->Limits, 0, sizeof(GifLimits));
+    return GIF_OK;
+} /* GifSetLimits() */
+//
+// GIFFileBuffer
+//
+// Make room for iFileSize bytes of file data and the symbol table
+//
+static int GIFFileBuffer(GIFPRIVATE *pPrivate)
+{
+    if (pPrivate->pSymbols == NULL) { // kept when the handle is reused
+        pPrivate->pSymbols = GIFHandleMalloc(pPrivate, 3 * 4096 * sizeof(uint32_t)); // symbol memory
+        if (pPrivate->pSymbols == NULL)
+            return GIF_ERROR;
+    }
+    // the LZW bit reader fetches a whole register at a time, so leave
+    // some slack at the end for the last frame's data
+    if (GIFGrowBuffer(pPrivate, &pPrivate->pFileData, &pPrivate->iFileDataSize, pPrivate->iFileSize + sizeof(BIGUINT)) != GIF_OK)
+        return GIF_ERROR;
+    memset(&pPrivate->pFileData[pPrivate->iFileSize], 0, sizeof(BIGUINT));
+    return GIF_OK;
+} /* GIFFileBuffer() */
+//
+// GIFStartFile
+//
+// Reset the per-file counters of a handle and check the logical screen
+// against its limits
+//
+static int GIFStartFile(GifFileType *gif)
+{
+    GIFPRIVATE *pPrivate = (GIFPRIVATE *)gif->Private;
+
+    memset(&pPrivate->Stats, 0, sizeof(pPrivate->Stats)); // GifGetStats() covers one file
+    pPrivate->u64Pixels = pPrivate->u64Allocated = 0; // and so do the limits
+    pPrivate->bOverLimit = 0;
+    if ((pPrivate->Limits.MaxWidth && gif->SWidth > pPrivate->Limits.MaxWidth) ||
+        (pPrivate->Limits.MaxHeight && gif->SHeight > pPrivate->Limits.MaxHeight))
+        return D_GIF_ERR_LIMIT_EXCEEDED;
+    return GIF_OK;
+} /* GIFStartFile() */
+//
+// GIFReadFile
+//
+// Read the file data all at once. This will use a lot more RAM
+// but the gain in speed is significant vs reading it in small chunks
+//
+static int GIFReadFile(GifFileType *gif)
+{
+    GIFPRIVATE *pPrivate = (GIFPRIVATE *)gif->Private;
+    int err;
+
+    if (pPrivate->iHandle <= 0)
+        return D_GIF_ERR_NOT_READABLE;
+    err = GIFStartFile(gif); // the header was read when the file was opened
+    if (err != GIF_OK)
+        return err;
+    pPrivate->iFileSize = (int)lseek(pPrivate->iHandle, 0, SEEK_END);
+    lseek(pPrivate->iHandle, 0, SEEK_SET);
+    if (pPrivate->iFileSize <= 0)
+        return D_GIF_ERR_READ_FAILED;
+    if (GIFFileBuffer(pPrivate) != GIF_OK)
+        return GIFMemError(pPrivate);
+    GIF_TRACE(pPrivate, gif, GIF_PHASE_READ, true, -1);
+    read(pPrivate->iHandle, pPrivate->pFileData, pPrivate->iFileSize); // read the whole file into memory
+    close(pPrivate->iHandle);
+    GIF_TRACE(pPrivate, gif, GIF_PHASE_READ, false, -1);
+    pPrivate->iHandle = 0;
+    return GIF_OK;
+} /* GIFReadFile() */
+//
+// GIFMemoryHeader
+//
+// Take the header from the file data which is already in the file buffer
+// (iFileSize bytes)
+//
+static int GIFMemoryHeader(GifFileType *gif)
+{
+    GIFPRIVATE *pPrivate = (GIFPRIVATE *)gif->Private;
+    int err, iColors;
+
+    if (pPrivate->iFileSize < 13)
+        return D_GIF_ERR_NOT_GIF_FILE;
+    err = GIFScreenDesc(gif, pPrivate->pFileData);
+    if (err == GIF_OK)
+        err = GIFStartFile(gif);
+    if (err != GIF_OK || gif->SColorMap == NULL)
+        return err;
+    iColors = gif->SColorMap->ColorCount * 3;
+    if (13 + iColors > pPrivate->iFileSize)
+        return D_GIF_ERR_READ_FAILED;
+    memcpy(gif->SColorMap->Colors, &pPrivate->pFileData[13], iColors);
+    return GIF_OK;
+} /* GIFMemoryHeader() */
+//
+// GIFReadMemory
+//
+// Copy a GIF held in memory into the file buffer (it is modified in place
+// when the frames are scanned) and take the header from it
+//
+static int GIFReadMemory(GifFileType *gif, const uint8_t *pData, int iSize)
+{
+    GIFPRIVATE *pPrivate = (GIFPRIVATE *)gif->Private;
+
+    pPrivate->iFileSize = iSize;
+    if (GIFFileBuffer(pPrivate) != GIF_OK)
+        return D_GIF_ERR_NOT_ENOUGH_MEM;
+    memcpy(pPrivate->pFileData, pData, iSize);
+    return GIFMemoryHeader(gif);
+} /* GIFReadMemory() */
+//
+// DGifSlurp
+//
+// Read every frame of a GIF file into a list of SavedImage structures
+//
+int DGifSlurp(GifFileType * gif)
+{
+    GIFPRIVATE *pPrivate = NULL;
+    int err;
+
+    if (gif == NULL || gif->Private == NULL)
+        return D_GIF_ERR_READ_FAILED;
+    pPrivate = (GIFPRIVATE *)gif->Private;
+    if (pPrivate->iHandle <= 0)
+        return D_GIF_ERR_NOT_READABLE;
+    
+    gif->ExtensionBlocks = NULL;
+    gif->ExtensionBlockCount = 0;
+    
+    err = GIFReadFile(gif);
+    if (err == GIF_OK) {
+        // Scan the file for images and collect the info
+        // Decode all of the frames
+        err = GIFPreprocess(gif);
+    }
+    if (err != GIF_OK)
+        gif->Error = err;
+    return err;
+} /* DGifSlurp() */
+#ifdef GIF_URING
+//
+// io_uring input (see GifSetInputBackend)
+//
+// A batch worker with a ring keeps reading up to GIF_URING_DEPTH of its
+// files while it decodes the ones already read. Only the read itself goes
+// through the ring; the files are opened and sized with the usual calls.
+//
+#define GIF_URING_DEPTH 8
+typedef struct gif_uring_tag {
+    int iFD; // -1 = no ring
+    unsigned *pSQHead, *pSQTail, *pSQMask, *pSQArray;
+    unsigned *pCQHead, *pCQTail, *pCQMask;
+    struct io_uring_sqe *pSQEs;
+    struct io_uring_cqe *pCQEs;
+    void *pSQRing, *pCQRing;
+    size_t iSQRingSize, iCQRingSize, iSQEsSize;
+    unsigned iQueued; // SQEs not submitted yet
+} GIFURING;
+//
+// GIFURingFree
+//
+static void GIFURingFree(GIFURING *pRing)
+{
+    if (pRing->pSQEs != NULL)
+        munmap(pRing->pSQEs, pRing->iSQEsSize);
+    if (pRing->pCQRing != NULL && pRing->pCQRing != pRing->pSQRing)
+        munmap(pRing->pCQRing, pRing->iCQRingSize);
+    if (pRing->pSQRing != NULL)
+        munmap(pRing->pSQRing, pRing->iSQRingSize);
+    if (pRing->iFD >= 0)
+        close(pRing->iFD);
+    memset(pRing, 0, sizeof(GIFURING));
+    pRing->iFD = -1;
+} /* GIFURingFree() */
+//
+// GIFURingSetup
+//
+// Create a ring with room for iEntries reads. Returns GIF_ERROR if the
+// kernel is too old (IORING_OP_READ came with IORING_FEAT_RW_CUR_POS in
+// 5.6) or io_uring isn't allowed (seccomp, kernel.io_uring_disabled).
+//
+static int GIFURingSetup(GIFURING *pRing, unsigned iEntries)
+{
+    struct io_uring_params params;
+    uint8_t *pSQ, *pCQ;
+
+    memset(pRing, 0, sizeof(GIFURING));
+    memset(&params, 0, sizeof(params));
+    pRing->iFD = (int)syscall(__NR_io_uring_setup, iEntries, &params);
+    if (pRing->iFD < 0 || !(params.features & IORING_FEAT_RW_CUR_POS)) {
+        GIFURingFree(pRing);
+        return GIF_ERROR;
+    }
+    pRing->iSQRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    pRing->iCQRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if ((params.features & IORING_FEAT_SINGLE_MMAP) && pRing->iCQRingSize > pRing->iSQRingSize)
+        pRing->iSQRingSize = pRing->iCQRingSize; // both rings are in one mapping
+    pRing->pSQRing = mmap(NULL, pRing->iSQRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, pRing->iFD, IORING_OFF_SQ_RING);
+    if (pRing->pSQRing == MAP_FAILED)
+        pRing->pSQRing = NULL;
+    else if (params.features & IORING_FEAT_SINGLE_MMAP)
+        pRing->pCQRing = pRing->pSQRing;
+    else if ((pRing->pCQRing = mmap(NULL, pRing->iCQRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, pRing->iFD, IORING_OFF_CQ_RING)) == MAP_FAILED)
+        pRing->pCQRing = NULL;
+    pRing->iSQEsSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    pRing->pSQEs = (struct io_uring_sqe *)mmap(NULL, pRing->iSQEsSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, pRing->iFD, IORING_OFF_SQES);
+    if (pRing->pSQEs == MAP_FAILED)
+        pRing->pSQEs = NULL;
+    if (pRing->pSQRing == NULL || pRing->pCQRing == NULL || pRing->pSQEs == NULL) {
+        GIFURingFree(pRing);
+        return GIF_ERROR;
+    }
+    pSQ = (uint8_t *)pRing->pSQRing;
+    pCQ = (uint8_t *)pRing->pCQRing;
+    pRing->pSQHead = (unsigned *)(pSQ + params.sq_off.head);
+    pRing->pSQTail = (unsigned *)(pSQ + params.sq_off.tail);
+    pRing->pSQMask = (unsigned *)(pSQ + params.sq_off.ring_mask);
+    pRing->pSQArray = (unsigned *)(pSQ + params.sq_off.array);
+    pRing->pCQHead = (unsigned *)(pCQ + params.cq_off.head);
+    pRing->pCQTail = (unsigned *)(pCQ + params.cq_off.tail);
+    pRing->pCQMask = (unsigned *)(pCQ + params.cq_off.ring_mask);
+    pRing->pCQEs = (struct io_uring_cqe *)(pCQ + params.cq_off.cqes);
+    return GIF_OK;
+} /* GIFURingSetup() */
+//
+// GIFURingRead
+//
+// Queue a read of iLen bytes at iOffset of a file (submitted by GIFURingEnter)
+//
+static void GIFURingRead(GIFURING *pRing, int iHandle, void *pBuf, unsigned iLen, uint64_t iOffset, uint64_t iUser)
+{
+    unsigned iTail = *pRing->pSQTail;
+    unsigned i = iTail & *pRing->pSQMask;
+    struct io_uring_sqe *pSQE = &pRing->pSQEs[i];
+
+    memset(pSQE, 0, sizeof(struct io_uring_sqe));
+    pSQE->opcode = IORING_OP_READ;
+    pSQE->fd = iHandle;
+    pSQE->addr = (uint64_t)(uintptr_t)pBuf;
+    pSQE->len = iLen;
+    pSQE->off = iOffset;
+    pSQE->user_data = iUser;
+    pRing->pSQArray[i] = i;
+    __atomic_store_n(pRing->pSQTail, iTail + 1, __ATOMIC_RELEASE); // the kernel may see it now
+    pRing->iQueued++;
+} /* GIFURingRead() */
+//
+// GIFURingEnter
+//
+// Submit the queued reads and wait until at least iWait of them are done
+//
+static int GIFURingEnter(GIFURING *pRing, unsigned iWait)
+{
+    long i;
+
+    for (;;) {
+        i = syscall(__NR_io_uring_enter, pRing->iFD, pRing->iQueued, iWait, iWait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+        if (i >= 0) {
+            pRing->iQueued -= (unsigned)i;
+            return GIF_OK;
+        }
+        if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+            return GIF_ERROR;
+    }
+} /* GIFURingEnter() */
+//
+// GIFURingReap
+//
+// Take the next completed read, if any
+//
+static int GIFURingReap(GIFURING *pRing, uint64_t *piUser, int *piResult)
+{
+    unsigned iHead = *pRing->pCQHead;
+    struct io_uring_cqe *pCQE;
+
+    if (iHead == __atomic_load_n(pRing->pCQTail, __ATOMIC_ACQUIRE))
+        return GIF_ERROR;
+    pCQE = &pRing->pCQEs[iHead & *pRing->pCQMask];
+    *piUser = pCQE->user_data;
+    *piResult = pCQE->res;
+    __atomic_store_n(pRing->pCQHead, iHead + 1, __ATOMIC_RELEASE);
+    return GIF_OK;
+} /* GIFURingReap() */
+#endif // GIF_URING
+//
+// Batch decoding (see DGifDecodeBatch)
+//
+// Each worker has a deque of tasks: whole files, seeded round-robin, and
+// the frames of a big animation the worker has scanned. The owner takes
+// tasks from the tail of its own deque and idle workers steal from the
+// head of the others. One lock guards all of the deques; it is only held
+// to move a task, never while decoding.
+//
+#define GIF_BATCH_SPLIT_PIXELS (1 << 20) // decode the frames of bigger animations in parallel
+typedef struct gif_batch_file_tag {
+    GifFileType *gif;
+    int iFramesLeft; // frame tasks not finished yet
+} GIFBATCHFILE;
+typedef struct gif_batch_task_tag {
+    int iItem; // index of the GifBatchItem
+    int iFrame; // frame of pFile, -1 = the whole item
+    GIFBATCHFILE *pFile;
+    uint8_t ucCodeStart;
+    uint8_t *pLZW;
+    int iLZWSize;
+} GIFBATCHTASK;
+typedef struct gif_batch_load_tag { // a file being read through the ring
+    int iItem; // -1 = free
+    int iHandle;
+    uint8_t *pData; // swapped with the handle's file buffer when it's decoded
+    int iDataSize; // allocated
+    int iSize, iDone; // bytes in the file and read so far
+    int iErr;
+    bool bReading;
+} GIFBATCHLOAD;
+typedef struct gif_batch_worker_tag {
+    struct gif_batch_tag *pBatch;
+    GifFileType *gif; // reused for each file this worker loads
+    GIFBATCHTASK *pTasks; // deque, iHead <= i < iTail
+    int iHead, iTail, iTaskSize;
+    GIFBATCHTASK *pFrames; // frames of the file being scanned
+    int iFrameSize;
+#ifdef GIF_URING
+    GIFURING Ring; // iFD = -1 = read the files with read()
+    GIFBATCHLOAD Loads[GIF_URING_DEPTH];
+    int iLoads; // slots in use
+#endif
+#ifndef GIF_NO_THREADS
+    pthread_t tid;
+#endif
+} GIFBATCHWORKER;
+typedef struct gif_batch_tag {
+    const GifBatchItem *pItems;
+    GifBatchFunc pfnDone;
+    GIFBATCHWORKER *pWorkers;
+    int iWorkers;
+    int iFilesLeft; // items not finished yet
+#ifndef GIF_NO_THREADS
+    pthread_mutex_t mutex;
+    pthread_cond_t cond; // a task was queued or finished
+#endif
+} GIFBATCH;
+#ifndef GIF_NO_THREADS
+#define GIF_BATCH_LOCK(b) pthread_mutex_lock(&(b)->mutex)
+#define GIF_BATCH_UNLOCK(b) pthread_mutex_unlock(&(b)->mutex)
+#define GIF_BATCH_WAIT(b) pthread_cond_wait(&(b)->cond, &(b)->mutex)
+#define GIF_BATCH_WAKE(b) pthread_cond_broadcast(&(b)->cond)
+#else // a single worker never has to wait for another one
+#define GIF_BATCH_LOCK(b) (void)(b)
+#define GIF_BATCH_UNLOCK(b) (void)(b)
+#define GIF_BATCH_WAIT(b) (void)(b)
+#define GIF_BATCH_WAKE(b) (void)(b)
+#endif
+//
+// GIFBatchPush
+//
+// Add a task to the tail of a worker's deque (lock held)
+//
+static int GIFBatchPush(GIFBATCHWORKER *pWorker, const GIFBATCHTASK *pTask)
+{
+    GIFBATCHTASK *p;
+    int iCount;
+
+    if (pWorker->iTail >= pWorker->iTaskSize && pWorker->iHead > 0) { // slide down the tasks still queued
+        iCount = pWorker->iTail - pWorker->iHead;
+        memmove(pWorker->pTasks, &pWorker->pTasks[pWorker->iHead], iCount * sizeof(GIFBATCHTASK));
+        pWorker->iHead = 0;
+        pWorker->iTail = iCount;
+    }
+    if (pWorker->iTail >= pWorker->iTaskSize) {
+        p = (GIFBATCHTASK *)GIFHandleRealloc(NULL, pWorker->pTasks, (pWorker->iTaskSize + 64) * 2 * sizeof(GIFBATCHTASK));
+        if (p == NULL)
+            return GIF_ERROR;
+        pWorker->pTasks = p;
+        pWorker->iTaskSize = (pWorker->iTaskSize + 64) * 2;
+    }
+    pWorker->pTasks[pWorker->iTail++] = *pTask;
+    return GIF_OK;
+} /* GIFBatchPush() */
+//
+// GIFBatchTake
+//
+// Get the next task for a worker (lock held): the newest one of its own,
+// else the oldest one of another worker. Waits while other workers are
+// still busy; returns GIF_ERROR once every item is done.
+//
+static int GIFBatchTake(GIFBATCH *pBatch, GIFBATCHWORKER *pWorker, GIFBATCHTASK *pTask)
+{
+    GIFBATCHWORKER *pVictim;
+    int i;
+
+    for (;;) {
+        if (pWorker->iTail > pWorker->iHead) {
+            *pTask = pWorker->pTasks[--pWorker->iTail];
+            return GIF_OK;
+        }
+        for (i = 1; i < pBatch->iWorkers; i++) {
+            pVictim = &pBatch->pWorkers[(pWorker - pBatch->pWorkers + i) % pBatch->iWorkers];
+            // frames need the symbol table of this worker's handle
+            if (pVictim->iTail > pVictim->iHead && (pWorker->gif != NULL || pVictim->pTasks[pVictim->iHead].iFrame < 0)) {
+                *pTask = pVictim->pTasks[pVictim->iHead++];
+                return GIF_OK;
+            }
+        }
+        if (pBatch->iFilesLeft == 0)
+            return GIF_ERROR;
+        GIF_BATCH_WAIT(pBatch);
+    }
+} /* GIFBatchTake() */
+//
+// GIFBatchFrame
+//
+// Decode one frame of a file scanned by another worker (or by this one),
+// using this worker's symbol table
+//
+static void GIFBatchFrame(GIFBATCHWORKER *pWorker, const GIFBATCHTASK *pTask)
+{
+    GIFBATCH *pBatch = pWorker->pBatch;
+    GifFileType *gif = pTask->pFile->gif;
+    SavedImage *pPage = &gif->SavedImages[pTask->iFrame];
+    uint32_t *pSymbols = ((GIFPRIVATE *)pWorker->gif->Private)->pSymbols;
+    GifCodecStats *pCounts = NULL;
+#ifdef GIF_STATS
+    GifCodecStats cs; // added to the file's counters under the lock
+
+    memset(&cs, 0, sizeof(cs));
+    pCounts = &cs;
+#endif
+    (void)DecodeLZW(gif, pPage, pTask->ucCodeStart, pTask->pLZW, pTask->iLZWSize, NULL, pSymbols, pCounts);
+    if (pPage->ImageDesc.Interlace)
+        GIFDeInterlaceRows(pPage->RasterBits, pPage->ImageDesc.Width, pPage->ImageDesc.Height, pSymbols);
+    GIF_BATCH_LOCK(pBatch);
+    GIF_COUNT(GIFAddCounters(&((GIFPRIVATE *)gif->Private)->Stats, pCounts);)
+    if (--pTask->pFile->iFramesLeft == 0)
+        GIF_BATCH_WAKE(pBatch);
+    GIF_BATCH_UNLOCK(pBatch);
+} /* GIFBatchFrame() */
+//
+// GIFBatchHandle
+//
+// Create the handle (and symbol table) a worker reuses for its files
+//
+static int GIFBatchHandle(GIFBATCHWORKER *pWorker)
+{
+    GifFileType *gif;
+    GIFPRIVATE *pPrivate;
+
+    if (pWorker->gif != NULL)
+        return GIF_OK;
+    gif = (GifFileType *)GIFHandleCalloc(NULL, sizeof(GifFileType));
+    if (gif == NULL)
+        return GIF_ERROR;
+    pPrivate = (GIFPRIVATE *)GIFHandleCalloc(NULL, sizeof(GIFPRIVATE));
+    if (pPrivate != NULL) {
+        pPrivate->Allocator = GIFDefaultAllocator;
+        pPrivate->pSymbols = GIFHandleMalloc(pPrivate, 3 * 4096 * sizeof(uint32_t));
+    }
+    gif->Private = pPrivate;
+    if (pPrivate == NULL || pPrivate->pSymbols == NULL) {
+        DGifCloseFile(gif, NULL);
+        return GIF_ERROR;
+    }
+    pWorker->gif = gif;
+    return GIF_OK;
+} /* GIFBatchHandle() */
+//
+// GIFBatchLoad
+//
+// Read an item into the worker's handle, or take it from the ring (pLoad)
+//
+static int GIFBatchLoad(GIFBATCHWORKER *pWorker, const GifBatchItem *pItem, GIFBATCHLOAD *pLoad)
+{
+    GifFileType *gif = pWorker->gif;
+    GIFPRIVATE *pPrivate = (GIFPRIVATE *)gif->Private;
+    uint8_t *pData;
+    int iHandle, iDataSize, err = GIF_OK;
+
+    if (pLoad != NULL) {
+        GIFForgetFile(gif);
+        err = pLoad->iErr;
+        if (err == GIF_OK) { // the buffers trade places, nothing is copied
+            pData = pPrivate->pFileData;
+            iDataSize = pPrivate->iFileDataSize;
+            pPrivate->pFileData = pLoad->pData;
+            pPrivate->iFileDataSize = pLoad->iDataSize;
+            pPrivate->iFileSize = pLoad->iSize;
+            pLoad->pData = pData;
+            pLoad->iDataSize = iDataSize;
+            err = GIFMemoryHeader(gif);
+        }
+    } else if (pItem->Data != NULL && pItem->FileName == NULL) {
+        if (pItem->DataSize > INT32_MAX - sizeof(BIGUINT))
+            return D_GIF_ERR_DATA_TOO_BIG;
+        GIFForgetFile(gif);
+        err = GIFReadMemory(gif, pItem->Data, (int)pItem->DataSize);
+    } else {
+        if (pItem->FileName != NULL) {
+            iHandle = open(pItem->FileName, O_RDONLY);
+            if (iHandle == -1)
+                return D_GIF_ERR_OPEN_FAILED;
+        } else {
+            iHandle = pItem->FileHandle;
+        }
+        if (DGifReopenFileHandle(gif, iHandle, &err) == GIF_OK)
+            err = GIFReadFile(gif);
+    }
+    gif->ExtensionBlocks = NULL;
+    gif->ExtensionBlockCount = 0;
+    return err;
+} /* GIFBatchLoad() */
+//
+// GIFBatchDecode
+//
+// Decode all of the frames of the file in the worker's handle. The frames
+// are scanned first; a big animation then has its frames queued as tasks,
+// which this worker works on too until the last one is done.
+//
+static int GIFBatchDecode(GIFBATCHWORKER *pWorker)
+{
+    GIFBATCH *pBatch = pWorker->pBatch;
+    GifFileType *gif = pWorker->gif;
+    GIFPRIVATE *pPrivate = (GIFPRIVATE *)gif->Private;
+    uint8_t *pRaster, *cBuf = pPrivate->pFileData;
+    GIFBATCHTASK *pTask, task;
+    GIFBATCHFILE file;
+    SavedImage *pPage;
+    int i, iOff, iErr;
+    int64_t iPixels = 0;
+
+    gif->ImageCount = 0;
+    iOff = GIFFirstBlock(cBuf);
+    while (gif->ImageCount < GIF_MAX_FRAMES)
+    {
+        if (gif->ImageCount >= pWorker->iFrameSize) {
+            pTask = (GIFBATCHTASK *)GIFHandleRealloc(NULL, pWorker->pFrames, (pWorker->iFrameSize + GIF_IMAGE_INCREMENT) * sizeof(GIFBATCHTASK));
+            if (pTask == NULL)
+                return D_GIF_ERR_NOT_ENOUGH_MEM;
+            pWorker->pFrames = pTask;
+            pWorker->iFrameSize += GIF_IMAGE_INCREMENT;
+        }
+        pTask = &pWorker->pFrames[gif->ImageCount];
+        iErr = GIFScanFrame(gif, &iOff, &pTask->ucCodeStart, &pTask->pLZW, &pTask->iLZWSize, &pRaster);
+        if (iErr == GIF_ERROR)
+            break; // end of file or corrupt data; keep what we have
+        if (iErr != GIF_OK)
+            return iErr;
+        pPage = &gif->SavedImages[gif->ImageCount];
+        iPixels += (int64_t)pPage->ImageDesc.Width * pPage->ImageDesc.Height;
+        pTask->iFrame = gif->ImageCount++;
+        pTask->pFile = &file;
+        if (iOff >= pPrivate->iFileSize || cBuf[iOff] == 0x3b)
+            break; /* End of file has been reached */
+    }
+    file.gif = gif;
+    if (pBatch->iWorkers < 2 || gif->ImageCount < 2 || iPixels < GIF_BATCH_SPLIT_PIXELS) {
+        for (i = 0; i < gif->ImageCount; i++) {
+            pTask = &pWorker->pFrames[i];
+            pPage = &gif->SavedImages[i];
+            (void)DecodeLZW(gif, pPage, pTask->ucCodeStart, pTask->pLZW, pTask->iLZWSize, NULL, pPrivate->pSymbols, GIF_COUNTERS(pPrivate));
+            if (pPage->ImageDesc.Interlace)
+                GIFDeInterlaceRows(pPage->RasterBits, pPage->ImageDesc.Width, pPage->ImageDesc.Height, pPrivate->pSymbols);
+        }
+        return GIF_OK;
+    }
+    GIF_BATCH_LOCK(pBatch);
+    file.iFramesLeft = 0;
+    // pushed backwards: this worker pops the first frames from the tail,
+    // thieves take its queued files from the head and then the last frames
+    for (i = gif->ImageCount - 1; i >= 0; i--) {
+        if (GIFBatchPush(pWorker, &pWorker->pFrames[i]) != GIF_OK)
+            break;
+        file.iFramesLeft++;
+    }
+    GIF_BATCH_WAKE(pBatch);
+    iErr = (i < 0) ? GIF_OK : D_GIF_ERR_NOT_ENOUGH_MEM;
+    while (file.iFramesLeft > 0) {
+        // only help with this file; its frames are the newest tasks of this worker
+        if (pWorker->iTail > pWorker->iHead && pWorker->pTasks[pWorker->iTail - 1].pFile == &file) {
+            task = pWorker->pTasks[--pWorker->iTail];
+            GIF_BATCH_UNLOCK(pBatch);
+            GIFBatchFrame(pWorker, &task);
+            GIF_BATCH_LOCK(pBatch);
+        } else {
+            GIF_BATCH_WAIT(pBatch);
+        }
+    }
+    GIF_BATCH_UNLOCK(pBatch);
+    return iErr;
+} /* GIFBatchDecode() */
+//
+// GIFBatchFile
+//
+// Load, decode and hand over one item
+//
+static void GIFBatchFile(GIFBATCHWORKER *pWorker, int iItem, GIFBATCHLOAD *pLoad)
+{
+    GIFBATCH *pBatch = pWorker->pBatch;
+    const GifBatchItem *pItem = &pBatch->pItems[iItem];
+    int err;
+
+    if (GIFBatchHandle(pWorker) != GIF_OK) {
+        err = D_GIF_ERR_NOT_ENOUGH_MEM;
+        if (pLoad == NULL && pItem->FileName == NULL && pItem->Data == NULL)
+            close(pItem->FileHandle);
+    } else {
+        err = GIFBatchLoad(pWorker, pItem, pLoad);
+        if (err == GIF_OK)
+            err = GIFBatchDecode(pWorker);
+        pWorker->gif->Error = (err == GIF_OK) ? 0 : err;
+    }
+    (*pBatch->pfnDone)((err == GIF_OK) ? pWorker->gif : NULL, iItem, err, pItem->UserData);
+    GIF_BATCH_LOCK(pBatch);
+    if (--pBatch->iFilesLeft == 0)
+        GIF_BATCH_WAKE(pBatch);
+    GIF_BATCH_UNLOCK(pBatch);
+} /* GIFBatchFile() */
+#ifdef GIF_URING
+//
+// GIFBatchReadable
+//
+// Items which are read through the ring (not the ones already in memory)
+//
+static bool GIFBatchReadable(const GIFBATCH *pBatch, const GIFBATCHTASK *pTask)
+{
+    const GifBatchItem *pItem = &pBatch->pItems[pTask->iItem];
+
+    return pTask->iFrame < 0 && (pItem->FileName != NULL || pItem->Data == NULL);
+} /* GIFBatchReadable() */
+//
+// GIFBatchEndRead
+//
+// The file of a load slot is read (or failed)
+//
+static void GIFBatchEndRead(GIFBATCHLOAD *pLoad, int iErr)
+{
+    if (pLoad->iHandle >= 0)
+        close(pLoad->iHandle);
+    pLoad->iHandle = -1;
+    pLoad->iErr = iErr;
+    pLoad->bReading = false;
+    if (iErr == GIF_OK) // the LZW bit reader's slack (see GIFFileBuffer)
+        memset(&pLoad->pData[pLoad->iSize], 0, sizeof(BIGUINT));
+} /* GIFBatchEndRead() */
+//
+// GIFBatchStartLoad
+//
+// Open an item in a free load slot and queue the read of all of it
+//
+static void GIFBatchStartLoad(GIFBATCHWORKER *pWorker, int iItem)
+{
+    const GifBatchItem *pItem = &pWorker->pBatch->pItems[iItem];
+    GIFBATCHLOAD *pLoad;
+    struct stat st;
+    int i;
+
+    for (i = 0; pWorker->Loads[i].iItem >= 0; i++) {
+    } // the caller made sure that there's one
+    pLoad = &pWorker->Loads[i];
+    pLoad->iItem = iItem;
+    pLoad->iDone = 0;
+    pLoad->bReading = true;
+    pWorker->iLoads++;
+    pLoad->iHandle = (pItem->FileName != NULL) ? open(pItem->FileName, O_RDONLY) : pItem->FileHandle;
+    if (pLoad->iHandle < 0) {
+        GIFBatchEndRead(pLoad, (pItem->FileName != NULL) ? D_GIF_ERR_OPEN_FAILED : D_GIF_ERR_READ_FAILED);
+        return;
+    }
+    if (fstat(pLoad->iHandle, &st) != 0 || st.st_size <= 0) {
+        GIFBatchEndRead(pLoad, D_GIF_ERR_READ_FAILED);
+        return;
+    }
+    if (st.st_size > INT32_MAX - (int)sizeof(BIGUINT)) {
+        GIFBatchEndRead(pLoad, D_GIF_ERR_DATA_TOO_BIG);
+        return;
+    }
+    pLoad->iSize = (int)st.st_size;
+    if (pLoad->iDataSize < pLoad->iSize + (int)sizeof(BIGUINT)) {
+        GIFFree(&GIFDefaultAllocator, pLoad->pData);
+        pLoad->pData = (uint8_t *)GIFHandleMalloc(NULL, pLoad->iSize + sizeof(BIGUINT));
+        pLoad->iDataSize = (pLoad->pData != NULL) ? pLoad->iSize + (int)sizeof(BIGUINT) : 0;
+        if (pLoad->pData == NULL) {
+            GIFBatchEndRead(pLoad, D_GIF_ERR_NOT_ENOUGH_MEM);
+            return;
+        }
+    }
+    GIFURingRead(&pWorker->Ring, pLoad->iHandle, pLoad->pData, pLoad->iSize, 0, i);
+} /* GIFBatchStartLoad() */
+//
+// GIFBatchNextLoad
+//
+// Return a load slot whose file is read, waiting for the ring if none is.
+// Files are decoded in the order their reads finish.
+//
+static GIFBATCHLOAD *GIFBatchNextLoad(GIFBATCHWORKER *pWorker)
+{
+    GIFBATCHLOAD *pLoad;
+    uint64_t iUser;
+    int i, iResult;
+
+    if (pWorker->Ring.iQueued != 0) // start the reads before anything else
+        (void)GIFURingEnter(&pWorker->Ring, 0);
+    for (;;) {
+        while (GIFURingReap(&pWorker->Ring, &iUser, &iResult) == GIF_OK) {
+            pLoad = &pWorker->Loads[iUser];
+            if (iResult == -EAGAIN || iResult == -EINTR)
+                iResult = 0; // try the rest again
+            else if (iResult < 0) {
+                GIFBatchEndRead(pLoad, D_GIF_ERR_READ_FAILED);
+                continue;
+            } else if (iResult == 0) { // the file got shorter
+                pLoad->iSize = pLoad->iDone;
+                GIFBatchEndRead(pLoad, (pLoad->iSize > 0) ? GIF_OK : D_GIF_ERR_READ_FAILED);
+                continue;
+            }
+            pLoad->iDone += iResult;
+            if (pLoad->iDone < pLoad->iSize) // a short read
+                GIFURingRead(&pWorker->Ring, pLoad->iHandle, &pLoad->pData[pLoad->iDone], pLoad->iSize - pLoad->iDone, pLoad->iDone, iUser);
+            else
+                GIFBatchEndRead(pLoad, GIF_OK);
+        }
+        for (i = 0; i < GIF_URING_DEPTH; i++) {
+            if (pWorker->Loads[i].iItem >= 0 && !pWorker->Loads[i].bReading)
+                return &pWorker->Loads[i];
+        }
+        if (GIFURingEnter(&pWorker->Ring, 1) != GIF_OK) {
+            // the ring is broken; stop using it once the reads in flight are done
+            for (i = 0; i < GIF_URING_DEPTH; i++) {
+                if (pWorker->Loads[i].iItem >= 0 && pWorker->Loads[i].bReading)
+                    GIFBatchEndRead(&pWorker->Loads[i], D_GIF_ERR_READ_FAILED);
+            }
+        }
+    }
+} /* GIFBatchNextLoad() */
+#endif // GIF_URING
+//
+// GIFBatchWorker
+//
+// Run tasks until every item is done
+//
+static void *GIFBatchWorker(void *pArg)
+{
+    GIFBATCHWORKER *pWorker = (GIFBATCHWORKER *)pArg;
+    GIFBATCH *pBatch = pWorker->pBatch;
+    GIFBATCHTASK task;
+#ifdef GIF_URING
+    GIFBATCHLOAD *pLoad;
+    int i;
+#endif
+
+    if (GIFBatchHandle(pWorker) != GIF_OK && pWorker != pBatch->pWorkers)
+        return NULL; // not enough memory; the other workers take its items
+#ifdef GIF_URING
+    pWorker->Ring.iFD = -1;
+    if (iGIFInputBackend == GIF_INPUT_URING)
+        (void)GIFURingSetup(&pWorker->Ring, GIF_URING_DEPTH);
+    for (i = 0; i < GIF_URING_DEPTH; i++)
+        pWorker->Loads[i].iItem = -1;
+#endif
+    GIF_BATCH_LOCK(pBatch);
+    for (;;) {
+#ifdef GIF_URING
+        if (pWorker->Ring.iFD >= 0) {
+            // keep the next files of this worker's deque being read
+            while (pWorker->iLoads < GIF_URING_DEPTH && pWorker->iTail > pWorker->iHead && GIFBatchReadable(pBatch, &pWorker->pTasks[pWorker->iTail - 1])) {
+                task = pWorker->pTasks[--pWorker->iTail];
+                GIF_BATCH_UNLOCK(pBatch);
+                GIFBatchStartLoad(pWorker, task.iItem);
+                GIF_BATCH_LOCK(pBatch);
+            }
+            if (pWorker->iLoads > 0) { // decode one while the others are read
+                GIF_BATCH_UNLOCK(pBatch);
+                pLoad = GIFBatchNextLoad(pWorker);
+                GIFBatchFile(pWorker, pLoad->iItem, pLoad);
+                pLoad->iItem = -1;
+                pWorker->iLoads--;
+                GIF_BATCH_LOCK(pBatch);
+                continue;
+            }
+        }
+#endif
+        if (GIFBatchTake(pBatch, pWorker, &task) != GIF_OK)
+            break;
+        GIF_BATCH_UNLOCK(pBatch);
+        if (task.iFrame >= 0)
+            GIFBatchFrame(pWorker, &task);
+#ifdef GIF_URING
+        else if (pWorker->Ring.iFD >= 0 && GIFBatchReadable(pBatch, &task))
+            GIFBatchStartLoad(pWorker, task.iItem); // decoded once it's read
+#endif
+        else
+            GIFBatchFile(pWorker, task.iItem, NULL);
+        GIF_BATCH_LOCK(pBatch);
+    }
+    GIF_BATCH_UNLOCK(pBatch);
+#ifdef GIF_URING
+    GIFURingFree(&pWorker->Ring);
+    for (i = 0; i < GIF_URING_DEPTH; i++)
+        GIFFree(&GIFDefaultAllocator, pWorker->Loads[i].pData);
+#endif
+    return NULL;
+} /* GIFBatchWorker() */
+//
+// GifSetInputBackend
+//
+// Choose how DGifDecodeBatch() reads files (GIF_INPUT_*). Returns GIF_ERROR
+// if the build or the running kernel can't use it.
+//
+int GifSetInputBackend(int iBackend)
+{
+#ifdef GIF_URING
+    GIFURING ring;
+#endif
+
+    switch (iBackend) {
+    case GIF_INPUT_POSIX:
+        break;
+#ifdef GIF_URING
+    case GIF_INPUT_URING:
+        if (GIFURingSetup(&ring, GIF_URING_DEPTH) != GIF_OK)
+            return GIF_ERROR;
+        GIFURingFree(&ring);
+        break;
+#endif
+    default:
+        return GIF_ERROR;
+    }
+    iGIFInputBackend = iBackend;
+    return GIF_OK;
+} /* GifSetInputBackend() */
+//
+// GifGetInputBackend
+//
+// Return the GIF_INPUT_* backend of DGifDecodeBatch()
+//
+int GifGetInputBackend(void)
+{
+    if (iGIFInputBackend < 0 && GifSetInputBackend(GIF_INPUT_URING) != GIF_OK)
+        iGIFInputBackend = GIF_INPUT_POSIX;
+    return iGIFInputBackend;
+} /* GifGetInputBackend() */
+//
+// DGifDecodeBatch
+//
+// Decode a list of files on a pool of worker threads (Threads <= 0 = one
+// per CPU; the calling thread is one of them) and call DoneFunc for each
+// one as soon as it is done, in no particular order and possibly from
+// several threads at once. Each worker reuses one handle and its buffers
+// for all of its files. The frames of a big animation are decoded by
+// several workers. The handles use the default options and allocator.
+// With io_uring (see GifSetInputBackend), each worker keeps reading its
+// next files while it decodes.
+// Returns GIF_OK once every item is done, or GIF_ERROR if the arguments
+// are invalid or there's not enough memory to start.
+//
+int DGifDecodeBatch(const GifBatchItem *Items, int ItemCount, int Threads, GifBatchFunc DoneFunc)
+{
+    GIFBATCH batch;
+    GIFBATCHTASK task;
+    int i, err = GIF_OK;
+#ifndef GIF_NO_THREADS
+    int iStarted = 1; // the calling thread is worker 0
+#endif
+
+    if ((Items == NULL && ItemCount > 0) || ItemCount < 0 || DoneFunc == NULL)
+        return GIF_ERROR;
+    if (ItemCount == 0)
+        return GIF_OK;
+#ifndef GIF_NO_THREADS
+    if (Threads <= 0)
+        Threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (Threads < 1)
+        Threads = 1;
+#else
+    Threads = 1;
+#endif
+    if (pfnGIFDecodeLZW == NULL) // before the workers can race for them
+        GIFSelectKernels();
+    (void)GifGetInputBackend();
+    memset(&batch, 0, sizeof(batch));
+    batch.pItems = Items;
+    batch.pfnDone = DoneFunc;
+    batch.iWorkers = Threads;
+    batch.iFilesLeft = ItemCount;
+    batch.pWorkers = (GIFBATCHWORKER *)GIFHandleCalloc(NULL, Threads * sizeof(GIFBATCHWORKER));
+    if (batch.pWorkers == NULL)
+        return GIF_ERROR;
+    for (i = 0; i < Threads; i++)
+        batch.pWorkers[i].pBatch = &batch;
+    task.iFrame = -1;
+    task.pFile = NULL;
+    for (i = ItemCount - 1; i >= 0 && err == GIF_OK; i--) { // pushed backwards so each worker starts with its first item
+        task.iItem = i;
+        err = GIFBatchPush(&batch.pWorkers[i % Threads], &task);
+    }
+#ifndef GIF_NO_THREADS
+    if (err == GIF_OK) {
+        pthread_mutex_init(&batch.mutex, NULL);
+        pthread_cond_init(&batch.cond, NULL);
+        for (; iStarted < Threads; iStarted++) { // without a thread, a worker's items get stolen
+            if (pthread_create(&batch.pWorkers[iStarted].tid, NULL, GIFBatchWorker, &batch.pWorkers[iStarted]) != 0)
+                break;
+        }
+    }
+#endif
+    if (err == GIF_OK)
+        GIFBatchWorker(&batch.pWorkers[0]);
+#ifndef GIF_NO_THREADS
+    if (err == GIF_OK) {
+        for (i = 1; i < iStarted; i++)
+            pthread_join(batch.pWorkers[i].tid, NULL);
+        pthread_cond_destroy(&batch.cond);
+        pthread_mutex_destroy(&batch.mutex);
     }
-    // Scan the file for images and collect the info
-    GIFPreprocess(gif);
-    // Decode all of the frames
-slurp_error:
+#endif
+    for (i = 0; i < Threads; i++) {
+        if (batch.pWorkers[i].gif != NULL)
+            DGifCloseFile(batch.pWorkers[i].gif, NULL);
+        GIFFree(&GIFDefaultAllocator, batch.pWorkers[i].pTasks);
+        GIFFree(&GIFDefaultAllocator, batch.pWorkers[i].pFrames);
+    }
+    GIFFree(&GIFDefaultAllocator, batch.pWorkers);
     return err;
-} /* DGifSlurp() */
+} /* DGifDecodeBatch() */
+//
+// DGifValidate
+//
+// Check that a file is well formed without decoding it: the blocks are
+// complete, each frame has a palette and LZW data which only uses defined
+// codes, ends with an EOI code and expands to exactly Width * Height pixels.
+// No pixels are written and no frame memory is allocated; ImageCount is
+// set to the number of frames checked. Returns GIF_OK or the first defect
+// (D_GIF_ERR_IMAGE_DEFECT, D_GIF_ERR_EOF_TOO_SOON...). Like DGifSlurp(),
+// this reads the file, so the handle has to be reopened to decode it.
+//
+int DGifValidate(GifFileType *gif)
+{
+    GIFPRIVATE *pPrivate;
+    uint8_t *cBuf, *d, *pLZW, c, ucCodeStart;
+    int iOff, iFileSize, err, bLocalMap;
+    uint32_t iPixels;
+
+    if (gif == NULL || gif->Private == NULL)
+        return D_GIF_ERR_READ_FAILED;
+    pPrivate = (GIFPRIVATE *)gif->Private;
+    gif->ImageCount = 0;
+    err = GIFReadFile(gif);
+    if (err != GIF_OK)
+        goto validate_exit;
+    cBuf = pPrivate->pFileData;
+    iFileSize = pPrivate->iFileSize;
+    iOff = GIFFirstBlock(cBuf);
+    err = D_GIF_ERR_EOF_TOO_SOON; // unless we reach the trailer
+    while (iOff < iFileSize && gif->ImageCount < GIF_MAX_FRAMES)
+    {
+        c = cBuf[iOff++];
+        if (c == 0x3b) { // trailer, all done
+            err = GIF_OK;
+            break;
+        }
+        if (c == 0x21) { // extension: function code, then sub-blocks
+            iOff++;
+            while (iOff < iFileSize && cBuf[iOff] != 0)
+                iOff += cBuf[iOff] + 1;
+            if (iOff >= iFileSize)
+                break;
+            iOff++; // block terminator
+            continue;
+        }
+        if (c != 0x2c) {
+            err = D_GIF_ERR_WRONG_RECORD;
+            break;
+        }
+        if (iOff + 9 > iFileSize)
+            break;
+        iPixels = (uint32_t)INTELSHORT(&cBuf[iOff+4]) * INTELSHORT(&cBuf[iOff+6]);
+        c = cBuf[iOff+8];
+        bLocalMap = (c & 0x80) != 0;
+        iOff += 9;
+        if (bLocalMap)
+            iOff += (2<<(c & 7))*3;
+        if (!bLocalMap && gif->SColorMap == NULL) {
+            err = D_GIF_ERR_NO_COLOR_MAP;
+            break;
+        }
+        if (iOff + 2 > iFileSize)
+            break;
+        ucCodeStart = cBuf[iOff++];
+        // de-chunk the data in place like GIFParseFrame(), but a truncated
+        // chunk is an error here
+        pLZW = d = &cBuf[iOff];
+        while (iOff < iFileSize && cBuf[iOff] != 0 && cBuf[iOff] < iFileSize - iOff) {
+            c = cBuf[iOff];
+            memmove(d, &cBuf[iOff+1], c);
+            d += c;
+            iOff += c + 1;
+        }
+        if (iOff >= iFileSize || cBuf[iOff] != 0)
+            break;
+        iOff++; // block terminator
+        err = ValidateLZW(ucCodeStart, pLZW, (int)(d - pLZW), iPixels, pPrivate->pSymbols);
+        if (err != GIF_OK)
+            break;
+        err = D_GIF_ERR_EOF_TOO_SOON;
+        gif->ImageCount++;
+    }
+validate_exit:
+    if (err != GIF_OK)
+        gif->Error = err;
+    return err;
+} /* DGifValidate() */
+//
+// DGifSlurpScanlines
+//
+// Like DGifSlurp(), but instead of keeping every frame in RasterBits,
+// the finished rows of each frame are passed to pfnLine and only a window of
+// (about) iWindowLines * 2 rows is kept in memory. The SavedImages array is
+// still filled in with the frame descriptors, palettes and extensions, but
+// RasterBits stays NULL. During the callback, the frame being decoded is
+// GifFile->ImageCount-1. A larger window makes it less likely that old
+// dictionary strings have to be rebuilt from the prefix/suffix table.
+//
+int DGifSlurpScanlines(GifFileType *gif, GifLineFunc pfnLine, int iWindowLines)
+{
+    GIFPRIVATE *pPrivate;
+    int err, iOff, iLZWSize, iSize;
+    int iWindowSize = 0;
+    int64_t i64Size;
+    uint8_t ucCodeStart, *pLZW, *cBuf, *pWindow = NULL;
+    SavedImage *pPage;
+
+    if (gif == NULL || gif->Private == NULL || pfnLine == NULL)
+        return D_GIF_ERR_READ_FAILED;
+    pPrivate = (GIFPRIVATE *)gif->Private;
+    if (iWindowLines < 1)
+        iWindowLines = 1;
+    gif->ExtensionBlocks = NULL;
+    gif->ExtensionBlockCount = 0;
+    err = GIFReadFile(gif);
+    if (err != GIF_OK) {
+        gif->Error = err;
+        return err;
+    }
+    cBuf = pPrivate->pFileData;
+    gif->ImageCount = 0;
+    iOff = GIFFirstBlock(cBuf);
+    while (gif->ImageCount < GIF_MAX_FRAMES)
+    {
+        pPage = GIFNextPage(gif);
+        if (pPage == NULL) {
+            err = GIFMemError(pPrivate);
+            break;
+        }
+        if (pPage->RasterBits != NULL) { // left over from an earlier DGifSlurp()
+            GIFFree(&pPrivate->Allocator, pPage->RasterBits);
+            pPage->RasterBits = NULL;
+            pPrivate->pRasterSizes[gif->ImageCount] = 0;
+        }
+        err = GIFParseFrame(gif, pPage, &iOff, &ucCodeStart, &pLZW, &iLZWSize);
+        if (err != GIF_OK) {
+            if (err == GIF_ERROR)
+                err = GIF_OK; // end of file or corrupt data
+            break;
+        }
+        gif->ImageCount++;
+        i64Size = 2 * (int64_t)iWindowLines * pPage->ImageDesc.Width + MAXMAXCODE + 8;
+        if (i64Size > INT32_MAX - 8) { // DecodeLZWWindow() keeps int sized windows
+            err = D_GIF_ERR_DATA_TOO_BIG;
+            break;
+        }
+        iSize = (int)i64Size;
+        if (iSize > iWindowSize) { // grow the window for wider frames
+            GIFFree(&pPrivate->Allocator, pWindow);
+            iWindowSize = iSize;
+            pWindow = GIFHandleMalloc(pPrivate, iWindowSize + 8);
+            if (pWindow == NULL) {
+                err = GIFMemError(pPrivate);
+                break;
+            }
+        }
+        GIF_TRACE(pPrivate, gif, GIF_PHASE_DECODE, true, pPrivate->iTraceFrame);
+        err = DecodeLZWWindow(gif, pPage, ucCodeStart, pLZW, iLZWSize, pfnLine, pWindow, iWindowSize);
+        GIF_TRACE(pPrivate, gif, GIF_PHASE_DECODE, false, pPrivate->iTraceFrame);
+        if (err != GIF_OK)
+            break;
+        if (iOff >= pPrivate->iFileSize || cBuf[iOff] == 0x3b)
+            break; /* End of file has been reached */
+    }
+    GIFFree(&pPrivate->Allocator, pWindow);
+    if (err != GIF_OK)
+        gif->Error = err;
+    return err;
+} /* DGifSlurpScanlines() */
+//
+// GIFFirstRecord
+//
+// Read the file on the first call of the frame iterator or the record API
+//
+static int GIFFirstRecord(GifFileType *gif)
+{
+    GIFPRIVATE *pPrivate = (GIFPRIVATE *)gif->Private;
+    int err;
+
+    if (pPrivate->iFrameOffset != 0)
+        return GIF_OK;
+    err = GIFReadFile(gif);
+    if (err != GIF_OK)
+        return err;
+    pPrivate->iFrameOffset = GIFFirstBlock(pPrivate->pFileData);
+    pPrivate->iLineLeft = 0;
+    gif->ImageCount = 0;
+    return GIF_OK;
+} /* GIFFirstRecord() */
+//
+// GIFNextFrame
+//
+// Common code of DGifNextFrame() and DGifNextFrameInto(); decodes into
+// pDest if given, otherwise into the handle's frame buffers
+//
+static SavedImage *GIFNextFrame(GifFileType *gif, uint8_t *pDest, int iPitch, size_t iDestSize)
+{
+    GIFPRIVATE *pPrivate;
+    SavedImage *pPage;
+    uint8_t ucCodeStart, *pLZW, *cBuf;
+    int err, iLZWSize, iSize, iBuf, iBits;
+
+    if (gif == NULL || gif->Private == NULL)
+        return NULL;
+    pPrivate = (GIFPRIVATE *)gif->Private;
+    err = GIFFirstRecord(gif);
+    if (err != GIF_OK) {
+        gif->Error = err;
+        return NULL;
+    }
+    cBuf = pPrivate->pFileData;
+    gif->Error = D_GIF_SUCCEEDED;
+    if (pPrivate->iFrameOffset >= pPrivate->iFileSize || cBuf[pPrivate->iFrameOffset] == 0x3b || gif->ImageCount >= GIF_MAX_FRAMES)
+        return NULL; // no more frames
+    iBuf = pPrivate->iFrameBuf ^= 1; // alternate between the 2 buffers
+    pPage = &pPrivate->Frames[iBuf];
+    if (pPage->ImageDesc.ColorMap) {
+        GIFFree(&pPrivate->Allocator, pPage->ImageDesc.ColorMap);
+        pPage->ImageDesc.ColorMap = NULL;
+    }
+    err = GIFParseFrame(gif, pPage, &pPrivate->iFrameOffset, &ucCodeStart, &pLZW, &iLZWSize);
+    if (err == GIF_OK && GIF_FRAME_TOO_BIG(pPage->ImageDesc.Width, pPage->ImageDesc.Height))
+        err = D_GIF_ERR_DATA_TOO_BIG;
+    if (err != GIF_OK) {
+        gif->Error = (err == GIF_ERROR) ? D_GIF_ERR_WRONG_RECORD : err;
+        return NULL;
+    }
+    iBits = GifPixelBits(gif, pPage);
+    if (pDest != NULL) { // caller's memory
+        if (iPitch <= 0)
+            iPitch = GIF_PACKED_PITCH(pPage->ImageDesc.Width, iBits);
+        if (iPitch < GIF_PACKED_PITCH(pPage->ImageDesc.Width, iBits) || iDestSize < GIF_FRAME_BUFFER_SIZE(iPitch, pPage->ImageDesc.Height)) {
+            gif->Error = D_GIF_ERR_DATA_TOO_BIG;
+            return NULL;
+        }
+    } else {
+        iPitch = GIF_PACKED_PITCH(pPage->ImageDesc.Width, iBits);
+        iSize = (iBits == 8) ? GIFRasterSize(pPage) : iPitch * pPage->ImageDesc.Height + 1;
+        if (iSize > pPrivate->iFrameBufSize[iBuf]) { // grow the buffer
+            GIFFree(&pPrivate->Allocator, pPrivate->pFrameBuf[iBuf]);
+            pPrivate->pFrameBuf[iBuf] = GIFHandleMalloc(pPrivate, iSize);
+            if (pPrivate->pFrameBuf[iBuf] == NULL) {
+                pPrivate->iFrameBufSize[iBuf] = 0;
+                gif->Error = GIFMemError(pPrivate);
+                return NULL;
+            }
+            pPrivate->iFrameBufSize[iBuf] = iSize;
+        }
+        pDest = pPrivate->pFrameBuf[iBuf];
+    }
+    pPage->RasterBits = (iBits == 8) ? pDest : GIFScratchFrame(pPrivate, pPage);
+    if (pPage->RasterBits == NULL) {
+        gif->Error = GIFMemError(pPrivate);
+        return NULL;
+    }
+    err = DecodeLZW(gif, pPage, ucCodeStart, pLZW, iLZWSize, GIFStatsSlot(gif, gif->ImageCount), pPrivate->pSymbols, GIF_COUNTERS(pPrivate));
+    if (err != GIF_OK) {
+        pPage->RasterBits = pDest;
+        gif->Error = err;
+        return NULL;
+    }
+    if (pPage->ImageDesc.Interlace)
+        GifDeInterlace(gif, pPage);
+    if (iBits == 8) {
+        GIFSpreadRows(pDest, pPage->ImageDesc.Width, pPage->ImageDesc.Height, iPitch);
+    } else { // GIF_OPT_PACKED
+        GIFPackRows(pDest, iPitch, pPage->RasterBits, pPage->ImageDesc.Width, pPage->ImageDesc.Height, iBits);
+        pPage->RasterBits = pDest;
+    }
+    gif->Image = pPage->ImageDesc;
+    gif->ImageCount++;
+    return pPage;
+} /* GIFNextFrame() */
+//
+// DGifNextFrame
+//
+// Frame iterator; decodes the next frame of the file and returns it, or
+// returns NULL when there are no more frames (GifFile->Error is
+// D_GIF_SUCCEEDED at the normal end of the file, otherwise the reason).
+// Instead of keeping every frame in SavedImages, the frames are decoded into
+// 2 buffers owned by the handle which are used alternately. This way the
+// previous frame stays intact (e.g. for compositing) while the memory use is
+// only proportional to a single frame. A returned frame is valid until the
+// second call after the one that returned it (or DGifCloseFile()).
+// Don't mix this with DGifSlurp() on the same handle.
+//
+SavedImage *DGifNextFrame(GifFileType *gif)
+{
+    return GIFNextFrame(gif, NULL, 0, 0);
+} /* DGifNextFrame() */
+//
+// DGifNextFrameInto
+//
+// Same as DGifNextFrame(), but the pixels are decoded straight into the
+// caller's buffer, with row y of the frame at Dest + y*Pitch. The buffer must
+// hold at least GIF_FRAME_BUFFER_SIZE(Pitch, Height) bytes; the decoder uses
+// the tail padding as scratch space. Bytes past the Width of each row and in
+// the padding are undefined afterwards. With GIF_OPT_PACKED, Pitch only has
+// to cover the packed row (GIF_PACKED_PITCH). Pitch <= 0 means rows as long
+// as the frame's (Width, or its packed pitch), for callers that don't know the
+// frame size up front. If the frame doesn't fit, NULL is returned with
+// GifFile->Error = D_GIF_ERR_DATA_TOO_BIG. The returned frame's RasterBits
+// point to Dest.
+//
+SavedImage *DGifNextFrameInto(GifFileType *gif, GifByteType *Dest, int Pitch, size_t DestSize)
+{
+    if (Dest == NULL) {
+        if (gif != NULL)
+            gif->Error = D_GIF_ERR_NOT_ENOUGH_MEM;
+        return NULL;
+    }
+    return GIFNextFrame(gif, Dest, Pitch, DestSize);
+} /* DGifNextFrameInto() */
+//
+// DGifGetRecordType
+//
+// Record-at-a-time API of upstream giflib. The file is read into memory on
+// the first call like with DGifNextFrame() and these functions walk through
+// it; don't mix them with the other decoding functions on the same handle.
+// The type of the next record is returned without consuming it. A file
+// which ends without a trailer ends with a TERMINATE_RECORD_TYPE too.
+//
+int DGifGetRecordType(GifFileType *gif, GifRecordType *pType)
+{
+    GIFPRIVATE *pPrivate;
+    int err;
+
+    if (gif == NULL || gif->Private == NULL || pType == NULL)
+        return GIF_ERROR;
+    pPrivate = (GIFPRIVATE *)gif->Private;
+    err = GIFFirstRecord(gif);
+    if (err != GIF_OK) {
+        gif->Error = err;
+        return GIF_ERROR;
+    }
+    if (pPrivate->iFrameOffset >= pPrivate->iFileSize) {
+        *pType = TERMINATE_RECORD_TYPE;
+        return GIF_OK;
+    }
+    switch (pPrivate->pFileData[pPrivate->iFrameOffset])
+    {
+        case 0x2c: // ','
+            *pType = IMAGE_DESC_RECORD_TYPE;
+            break;
+        case 0x21: // '!'
+            *pType = EXTENSION_RECORD_TYPE;
+            break;
+        case 0x3b: // ';'
+            *pType = TERMINATE_RECORD_TYPE;
+            break;
+        default:
+            *pType = UNDEFINED_RECORD_TYPE;
+            gif->Error = D_GIF_ERR_WRONG_RECORD;
+            return GIF_ERROR;
+    }
+    return GIF_OK;
+} /* DGifGetRecordType() */
+//
+// DGifGetImageDesc
+//
+// Take the image descriptor (and local palette) of the next frame into
+// GifFile->Image and count it in ImageCount. Its pixels are read with
+// DGifGetLine(); they can also be left out, the next record comes after them.
+// Image.ColorMap belongs to the handle and is valid until the next frame.
+//
+int DGifGetImageDesc(GifFileType *gif)
+{
+    GIFPRIVATE *pPrivate;
+    SavedImage *pPage;
+    int err;
+
+    if (gif == NULL || gif->Private == NULL)
+        return GIF_ERROR;
+    pPrivate = (GIFPRIVATE *)gif->Private;
+    err = GIFFirstRecord(gif);
+    if (err == GIF_OK && gif->ImageCount >= GIF_MAX_FRAMES)
+        err = D_GIF_ERR_DATA_TOO_BIG;
+    if (err != GIF_OK) {
+        gif->Error = err;
+        return GIF_ERROR;
+    }
+    pPage = &pPrivate->Frames[0];
+    GIFFree(&pPrivate->Allocator, pPage->ImageDesc.ColorMap);
+    pPage->ImageDesc.ColorMap = NULL;
+    pPrivate->iLineLeft = 0;
+    err = GIFParseFrame(gif, pPage, &pPrivate->iFrameOffset, &pPrivate->ucLineCodeStart, &pPrivate->pLineLZW, &pPrivate->iLineLZWSize);
+    if (err == GIF_OK && GIF_FRAME_TOO_BIG(pPage->ImageDesc.Width, pPage->ImageDesc.Height))
+        err = D_GIF_ERR_DATA_TOO_BIG; // DGifGetLine() decodes the whole frame
+    if (err != GIF_OK) {
+        gif->Error = (err == GIF_ERROR) ? D_GIF_ERR_NO_IMAG_DSCR : err;
+        return GIF_ERROR;
+    }
+    pPage->ExtensionBlockCount = 0; // read separately with DGifGetExtension()
+    pPrivate->iLinePos = -1; // decoded by the first DGifGetLine()
+    pPrivate->iLineLeft = (int)((int64_t)pPage->ImageDesc.Width * pPage->ImageDesc.Height);
+    gif->Image = pPage->ImageDesc;
+    gif->ImageCount++;
+    return GIF_OK;
+} /* DGifGetImageDesc() */
+//
+// DGifGetLine
+//
+// Copy the next LineLen pixels of the current frame (usually a row) in
+// file order, i.e. interlaced frames are not deinterlaced. The decoder can't
+// stop in the middle of a frame, so the first call decodes all of it into a
+// buffer of the handle and the rest of the calls just hand out the rows.
+//
+int DGifGetLine(GifFileType *gif, GifPixelType *pLine, int iLineLen)
+{
+    GIFPRIVATE *pPrivate;
+    SavedImage *pPage;
+    int err, iSize;
+
+    if (gif == NULL || gif->Private == NULL || pLine == NULL)
+        return GIF_ERROR;
+    pPrivate = (GIFPRIVATE *)gif->Private;
+    if (iLineLen <= 0 || iLineLen > pPrivate->iLineLeft) {
+        gif->Error = D_GIF_ERR_DATA_TOO_BIG;
+        return GIF_ERROR;
+    }
+    pPage = &pPrivate->Frames[0];
+    if (pPrivate->iLinePos < 0) { // first row of the frame
+        iSize = GIFRasterSize(pPage);
+        if (iSize > pPrivate->iFrameBufSize[0]) { // grow the buffer
+            GIFFree(&pPrivate->Allocator, pPrivate->pFrameBuf[0]);
+            pPrivate->pFrameBuf[0] = GIFHandleMalloc(pPrivate, iSize);
+            if (pPrivate->pFrameBuf[0] == NULL) {
+                pPrivate->iFrameBufSize[0] = 0;
+                gif->Error = GIFMemError(pPrivate);
+                return GIF_ERROR;
+            }
+            pPrivate->iFrameBufSize[0] = iSize;
+        }
+        pPage->RasterBits = pPrivate->pFrameBuf[0];
+        err = DecodeLZW(gif, pPage, pPrivate->ucLineCodeStart, pPrivate->pLineLZW, pPrivate->iLineLZWSize, GIFStatsSlot(gif, gif->ImageCount - 1), pPrivate->pSymbols, GIF_COUNTERS(pPrivate));
+        if (err != GIF_OK) {
+            pPrivate->iLineLeft = 0;
+            gif->Error = err;
+            return GIF_ERROR;
+        }
+        pPrivate->iLinePos = 0;
+    }
+    memcpy(pLine, &pPrivate->pFrameBuf[0][pPrivate->iLinePos], iLineLen);
+    pPrivate->iLinePos += iLineLen;
+    pPrivate->iLineLeft -= iLineLen;
+    return GIF_OK;
+} /* DGifGetLine() */
+//
+// GIFExtensionBlock
+//
+// Hand out the data sub-block at the current record position (length byte
+// first, like upstream giflib) or NULL for the block terminator
+//
+static int GIFExtensionBlock(GifFileType *gif, GifByteType **ppExtension)
+{
+    GIFPRIVATE *pPrivate = (GIFPRIVATE *)gif->Private;
+    int iOff = pPrivate->iFrameOffset;
+    uint8_t c;
+
+    if (iOff >= pPrivate->iFileSize) {
+        gif->Error = D_GIF_ERR_EOF_TOO_SOON;
+        return GIF_ERROR;
+    }
+    c = pPrivate->pFileData[iOff];
+    if (c == 0) {
+        *ppExtension = NULL;
+    } else {
+        if (c >= pPrivate->iFileSize - iOff) { // truncated sub-block
+            gif->Error = D_GIF_ERR_EOF_TOO_SOON;
+            return GIF_ERROR;
+        }
+        *ppExtension = &pPrivate->pFileData[iOff];
+    }
+    pPrivate->iFrameOffset = iOff + c + 1;
+    return GIF_OK;
+} /* GIFExtensionBlock() */
+//
+// DGifGetExtension
+//
+// Take the function code and first data sub-block of the extension record
+// at the current position. Extension[0] is the length of the data which
+// follows it; the data points into the file buffer and stays valid until
+// the handle is reopened or closed. NULL = no (more) sub-blocks.
+//
+int DGifGetExtension(GifFileType *gif, int *pExtCode, GifByteType **ppExtension)
+{
+    GIFPRIVATE *pPrivate;
+    int err;
+
+    if (gif == NULL || gif->Private == NULL || pExtCode == NULL || ppExtension == NULL)
+        return GIF_ERROR;
+    pPrivate = (GIFPRIVATE *)gif->Private;
+    err = GIFFirstRecord(gif);
+    if (err != GIF_OK) {
+        gif->Error = err;
+        return GIF_ERROR;
+    }
+    if (pPrivate->iFrameOffset + 2 >= pPrivate->iFileSize || pPrivate->pFileData[pPrivate->iFrameOffset] != 0x21) {
+        gif->Error = D_GIF_ERR_WRONG_RECORD;
+        return GIF_ERROR;
+    }
+    *pExtCode = pPrivate->pFileData[pPrivate->iFrameOffset + 1];
+    pPrivate->iFrameOffset += 2;
+    return GIFExtensionBlock(gif, ppExtension);
+} /* DGifGetExtension() */
+//
+// DGifGetExtensionNext
+//
+// Take the next data sub-block of the current extension record (NULL after
+// the last one)
+//
+int DGifGetExtensionNext(GifFileType *gif, GifByteType **ppExtension)
+{
+    if (gif == NULL || gif->Private == NULL || ppExtension == NULL)
+        return GIF_ERROR;
+    return GIFExtensionBlock(gif, ppExtension);
+} /* DGifGetExtensionNext() */
 
 //
 // DGifOpen
@@ -1629,17 +5240,25 @@ GifFileType *DGifOpen(void *userPtr, InputFunc readFunc, int *Error)
 //
 void GifFreeImages(GifFileType *gif) {
     if (gif != NULL) {
-        for (int i=0; i<gif->ImageCount; i++) {
+        int iCount = gif->ImageCount;
+        GIFPRIVATE *pPrivate = (GIFPRIVATE *)gif->Private;
+        const GifAllocator *pAlloc = GIFGetAllocator(gif);
+        if (pPrivate != NULL && pPrivate->pArena != NULL && gif->SavedImages == (SavedImage *)pPrivate->pArena) {
+            // GIF_OPT_ARENA: everything is in one block
+            GIFFree(pAlloc, pPrivate->pArena);
+            pPrivate->pArena = NULL;
+            pPrivate->iArenaSize = 0;
+            return;
+        }
+        if (pPrivate != NULL && pPrivate->iFrameSlots > iCount)
+            iCount = pPrivate->iFrameSlots; // include buffers kept from earlier files
+        for (int i=0; i<iCount; i++) {
             SavedImage *pSI = &gif->SavedImages[i];
-            if (pSI->RasterBits)
-                free(pSI->RasterBits);
-            if (pSI->ExtensionBlocks)
-                free(pSI->ExtensionBlocks);
-            if (pSI->ImageDesc.ColorMap) {
-                free(pSI->ImageDesc.ColorMap);
-            }
+            GIFFree(pAlloc, pSI->RasterBits);
+            GIFFree(pAlloc, pSI->ExtensionBlocks);
+            GIFFree(pAlloc, pSI->ImageDesc.ColorMap);
         }
-        free(gif->SavedImages);
+        GIFFree(pAlloc, gif->SavedImages);
     }
 } /* GifFreeImages() */
 //
@@ -1648,25 +5267,33 @@ void GifFreeImages(GifFileType *gif) {
 int DGifCloseFile(GifFileType * gif, int *ErrorCode)
 {
     if (gif != NULL) {
+        GifAllocator Alloc = *GIFGetAllocator(gif); // the handle itself is freed with it too
+        if (gif->SavedImages) {
+            GifFreeImages(gif); // needs the private data for the slot count
+        }
         if (gif->Private) {
             GIFPRIVATE *pPrivate = (GIFPRIVATE *)gif->Private;
             if (pPrivate->iHandle)
                 close(pPrivate->iHandle);
-            if (pPrivate->pFileData)
-                free(pPrivate->pFileData);
-            if (pPrivate->pSymbols)
-                free(pPrivate->pSymbols);
-            free(gif->Private);
+            GIFFree(&Alloc, pPrivate->pFileData);
+            GIFFree(&Alloc, pPrivate->pSymbols);
+            for (int i=0; i<2; i++) { // DGifNextFrame() buffers
+                GIFFree(&Alloc, pPrivate->pFrameBuf[i]);
+                GIFFree(&Alloc, pPrivate->Frames[i].ExtensionBlocks);
+                GIFFree(&Alloc, pPrivate->Frames[i].ImageDesc.ColorMap);
+            }
+            GIFFree(&Alloc, pPrivate->pRasterSizes);
+            GIFFree(&Alloc, pPrivate->pArena);
+            GIFFree(&Alloc, pPrivate->pFrameStats);
+            GIFFree(&Alloc, pPrivate->pScratch);
+            if (pPrivate->pSColorMap && pPrivate->pSColorMap != gif->SColorMap)
+                GIFFreeMapObject(&Alloc, pPrivate->pSColorMap);
+            GIFFree(&Alloc, gif->Private);
         }
         if (gif->SColorMap) {
-            if (gif->SColorMap->Colors)
-                free(gif->SColorMap->Colors); // the only color table explicitly allocated
-            free(gif->SColorMap);
-        }
-        if (gif->SavedImages) {
-            GifFreeImages(gif);
+            GIFFreeMapObject(&Alloc, gif->SColorMap); // the only color table explicitly allocated
         }
-        free(gif);
+        GIFFree(&Alloc, gif);
         return D_GIF_SUCCEEDED;
     }
     return D_GIF_ERR_CLOSE_FAILED;
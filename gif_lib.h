@@ -73,10 +73,44 @@ extern "C" {
 #define GIF87_STAMP "GIF87a"        /* First chars in file - GIF stamp.  */
 #define GIF89_STAMP "GIF89a"        /* First chars in file - GIF stamp.  */
 
+// The LZW decoder copies strings in blocks of up to GIF_COPY_WIDTH bytes
+// (vector registers), so it can write up to GIF_COPY_WIDTH-1 bytes past the
+// end of the image. Its 256 root symbols follow that, and they are read in
+// blocks too. Any buffer it decodes into needs this much extra space after
+// the Width * Height pixels. The size doesn't depend on the build's
+// instruction set.
+#define GIF_COPY_WIDTH 32
+#define GIF_DECODE_PADDING (GIF_COPY_WIDTH + 256 + GIF_COPY_WIDTH)
+// Minimum size of a caller provided buffer for DGifNextFrameInto()
+#define GIF_FRAME_BUFFER_SIZE(pitch, height) ((size_t)(pitch) * (height) + GIF_DECODE_PADDING)
+
 // Number of frames of image structures to be allocated at a time
 #define GIF_IMAGE_INCREMENT 100
 // Arbitrary number to keep it from getting stuck in an infinite loop
 #define GIF_MAX_FRAMES 20000
+// GifSetOptions() flags
+#define GIF_OPT_ARENA 0x0001 // DGifSlurp() puts all frames in one allocation
+#define GIF_OPT_STATS 0x0002 // the decoder collects GifFrameStats while decoding
+#define GIF_OPT_PACKED 0x0004 // RasterBits of frames with small palettes hold 1/2/4 bits per pixel (decoder and encoder)
+// Bytes per row of a frame with Bits per pixel (see GifPixelBits); packed
+// rows start on a byte boundary with the leftmost pixel in the high bits
+#define GIF_PACKED_PITCH(width, bits) (((width) * (bits) + 7) >> 3)
+// LZW kernel variants (see GifGetCpuVariant)
+#define GIF_CPU_GENERIC 0 // portable C (SSE2 on x86-64, NEON on ARM64)
+#define GIF_CPU_BMI2    1 // x86-64 with SSE4.2 and BMI2
+#define GIF_CPU_AVX2    2 // x86-64 with AVX2 and BMI2
+// How DGifDecodeBatch() reads files (see GifGetInputBackend)
+#define GIF_INPUT_POSIX 0 // open() and read(), one file at a time
+#define GIF_INPUT_URING 1 // Linux io_uring, reading ahead while decoding
+// Phases reported to a GifTraceFunc (see GifSetTraceFunc)
+#define GIF_PHASE_READ        0 // reading the whole file into memory
+#define GIF_PHASE_SCAN        1 // parsing a frame's blocks and de-chunking its LZW data
+#define GIF_PHASE_DECODE      2 // LZW decoding of a frame
+#define GIF_PHASE_DEINTERLACE 3 // putting the rows of an interlaced frame in display order
+#define GIF_PHASE_ENCODE      4 // LZW encoding of a frame
+#define GIF_PHASE_CHUNK       5 // splitting a frame's LZW data into sub-blocks
+#define GIF_PHASE_WRITE       6 // writing a frame (or the trailer) to the file
+#define GIF_PHASE_COUNT       7
 
 typedef unsigned char GifPixelType;
 typedef unsigned char *GifRowType;
@@ -152,6 +186,100 @@ typedef int (*InputFunc) (GifFileType *, GifByteType *, int);
  */
 typedef int (*OutputFunc) (GifFileType *, const GifByteType *, int);
 
+/* func type to receive the finished rows of a frame from DGifSlurpScanlines().
+ * Gets the frame, the row's y (within the frame) and its pixels.
+ * Return GIF_OK to continue or GIF_ERROR to stop decoding.
+ */
+typedef int (*GifLineFunc) (GifFileType *, const SavedImage *, int, const GifPixelType *);
+
+/* func type to follow the decoding of a frame (see DGifSetProgressFunc()).
+ * Gets the frame, the y of the first finished row, the number of rows, the
+ * distance between them (1, or 8/8/4/2 for the passes of an interlaced frame)
+ * and their pixels, stored one row after the other. The pixels are only
+ * valid during the call. Return GIF_OK to continue or GIF_ERROR to stop.
+ */
+typedef int (*GifProgressFunc) (GifFileType *, const SavedImage *, int, int, int, const GifPixelType *);
+
+/* func type to time the work of a handle (see GifSetTraceFunc()).
+ * Called when a phase (GIF_PHASE_*) begins (true) and ends (false), with the
+ * index of the frame (-1 for the whole file), a CLOCK_MONOTONIC time in
+ * nanoseconds and the UserData given to GifSetTraceFunc().
+ */
+typedef void (*GifTraceFunc) (GifFileType *, int, bool, int, uint64_t, void *);
+
+/* One file for DGifDecodeBatch(): a path, an open file descriptor (which the
+ * library closes) or a GIF held in memory, whichever is set first in that
+ * order (FileName != NULL, Data != NULL, else FileHandle).
+ */
+typedef struct GifBatchItem {
+    const char *FileName;
+    int FileHandle;
+    const GifByteType *Data;
+    size_t DataSize;
+    void *UserData;          /* passed to the GifBatchFunc */
+} GifBatchItem;
+
+/* func type called by DGifDecodeBatch() when a file is done, on the worker
+ * thread which loaded it. Gets the handle with all of the frames decoded
+ * (NULL if the error isn't GIF_OK), the index of the item, the error and the
+ * item's UserData. The handle is reused for the worker's next file, so it
+ * and its frames are only valid during the call.
+ */
+typedef void (*GifBatchFunc) (GifFileType *, int, int, void *);
+
+/* Memory allocator used for everything the library allocates.
+ * All 3 functions are required; UserData is passed back to each of them.
+ */
+typedef struct GifAllocator {
+    void *(*Malloc) (size_t Size, void *UserData);
+    void *(*Realloc) (void *Ptr, size_t Size, void *UserData);
+    void (*Free) (void *Ptr, void *UserData);
+    void *UserData;
+} GifAllocator;
+
+/* Statistics of a frame's pixels (see GifComputeFrameStats()) */
+typedef struct GifFrameStats {
+    uint32_t Histogram[256]; /* number of pixels of each color index */
+    int ColorsUsed;          /* indices which occur at all */
+    int TransparentColor;    /* from the frame's graphics control block, or NO_TRANSPARENT_COLOR */
+    bool TransparentUsed;    /* the transparent index occurs */
+    int Left, Top, Width, Height; /* box around the non-transparent pixels, within the frame (0 size if none) */
+} GifFrameStats;
+
+/* Counters of the LZW coders and allocations of a handle (see GifGetStats()) */
+typedef struct GifCodecStats {
+    /* decoder */
+    uint64_t Codes;          /* LZW codes read, including clear codes */
+    uint64_t ClearCodes;     /* clear codes which reset the code table */
+    uint64_t DeferredClears; /* times the code table filled up without a clear code */
+    uint64_t Strings;        /* strings copied from earlier output */
+    uint64_t BytesCopied;    /* pixels written by those copies */
+    int MaxStringLength;
+    double AverageStringLength; /* BytesCopied / Strings */
+    uint64_t BytesDechunked; /* LZW data bytes with the sub-block lengths removed */
+    /* encoder */
+    uint64_t EncodeCodes;    /* LZW codes written, including clear codes */
+    uint64_t EncodeClears;   /* code table resets */
+    uint64_t HashLookups;    /* string table lookups (one per pixel after the first) */
+    uint64_t HashProbes;     /* extra slots visited after a collision */
+    int MaxHashProbe;        /* longest probe sequence of a single lookup */
+    /* memory */
+    uint64_t Allocations;    /* calls to the handle's allocator (Malloc and Realloc) */
+    uint64_t AllocatedBytes; /* bytes requested by those calls */
+} GifCodecStats;
+
+/* Limits for decoding one file with a handle (see GifSetLimits()); 0 = no
+ * limit. A file which exceeds one fails with D_GIF_ERR_LIMIT_EXCEEDED; the
+ * sizes are checked against the screen and image descriptors before the
+ * memory for the pixels is allocated.
+ */
+typedef struct GifLimits {
+    int MaxWidth, MaxHeight; /* of the logical screen and of each frame */
+    int MaxFrames;           /* frames decoded */
+    uint64_t MaxPixels;      /* sum of Width * Height of the frames */
+    uint64_t MaxMemory;      /* bytes allocated by the handle for the file */
+} GifLimits;
+
 /******************************************************************************
  GIF89 structures
 ******************************************************************************/
@@ -173,15 +301,34 @@ extern const char *GifErrorString(int ErrorCode);
 // Decoder
 GifFileType *DGifOpenFileName(const char *GifFileName, int *Error);
 GifFileType *DGifOpenFileHandle(int GifFileHandle, int *Error);
+GifFileType *DGifOpenFileHandleAlloc(int GifFileHandle, const GifAllocator *Allocator, int *Error);
+int DGifReopenFileHandle(GifFileType *GifFile, int GifFileHandle, int *Error); /* reuse a handle */
+int DGifReopenFileName(GifFileType *GifFile, const char *GifFileName, int *Error);
 int DGifSlurp(GifFileType * GifFile);
+int DGifSlurpScanlines(GifFileType *GifFile, GifLineFunc LineFunc, int WindowLines);
+int DGifValidate(GifFileType *GifFile); /* check the file without decoding pixels */
+int DGifDecodeBatch(const GifBatchItem *Items, int ItemCount, int Threads, GifBatchFunc DoneFunc); /* Threads <= 0 = one per CPU */
+SavedImage *DGifNextFrame(GifFileType *GifFile); /* frame iterator, use instead of DGifSlurp */
+SavedImage *DGifNextFrameInto(GifFileType *GifFile, GifByteType *Dest, int Pitch, size_t DestSize);
+// Upstream giflib's record-at-a-time API on top of the same decoder
+int DGifGetRecordType(GifFileType *GifFile, GifRecordType *GifType);
+int DGifGetImageDesc(GifFileType *GifFile);
+int DGifGetLine(GifFileType *GifFile, GifPixelType *GifLine, int GifLineLen);
+int DGifGetExtension(GifFileType *GifFile, int *GifExtCode, GifByteType **GifExtension);
+int DGifGetExtensionNext(GifFileType *GifFile, GifByteType **GifExtension);
+int DGifSetProgressFunc(GifFileType *GifFile, GifProgressFunc ProgressFunc, int Rows); /* for progressive display */
+int DGifGetFrameStats(GifFileType *GifFile, int ImageIndex, GifFrameStats *Stats); /* with GIF_OPT_STATS */
 GifFileType *DGifOpen(void *userPtr, InputFunc readFunc, int *Error);    /* new one (TVT) */
     int DGifCloseFile(GifFileType * GifFile, int *ErrorCode);
 
 // Encoder
 GifFileType *EGifOpenFileName(const char *GifFileName, const bool GifTestExistence, int *Error);
 GifFileType *EGifOpenFileHandle(const int GifFileHandle, int *Error);
+GifFileType *EGifOpenFileHandleAlloc(const int GifFileHandle, const GifAllocator *Allocator, int *Error);
 GifFileType *EGifOpen(void *userPtr, OutputFunc writeFunc, int *Error);
 int EGifSpew(GifFileType * GifFile);
+int EGifSpewKeep(GifFileType *GifFile); /* EGifSpew() without closing the handle */
+int EGifReopenFileHandle(GifFileType *GifFile, const int GifFileHandle, int *Error);
 const char *EGifGetGifVersion(GifFileType *GifFile); /* new in 5.x */
 int EGifCloseFile(GifFileType *GifFile, int *ErrorCode);
 void EGifSetGifVersion(GifFileType *GifFile, const bool gif89);
@@ -196,6 +343,27 @@ int EGifPutLine(GifFileType *GifFile, GifPixelType *GifLine,
 int EGifPutPixel(GifFileType *GifFile, GifPixelType Pixel);
 
 // Common
+// Set the allocator used by handles opened afterwards and by the functions
+// which don't take a handle (NULL = malloc/realloc/free). Each handle keeps
+// the allocator it was opened with and frees everything it owns with it,
+// including color maps and frames attached to it by the caller.
+int GifSetAllocator(const GifAllocator *Allocator);
+int GifSetOptions(GifFileType *GifFile, int Options); /* GIF_OPT_* flags */
+int GifSetLimits(GifFileType *GifFile, const GifLimits *Limits); /* NULL = none */
+// Counters since the handle was opened (or a decoder handle was reopened);
+// only collected when the library is built with GIF_STATS defined
+int GifGetStats(GifFileType *GifFile, GifCodecStats *Stats);
+// Report the phases of decoding or encoding with this handle (NULL = off)
+int GifSetTraceFunc(GifFileType *GifFile, GifTraceFunc TraceFunc, void *UserData);
+const char *GifPhaseName(int Phase);
+// The LZW kernels are chosen for the running CPU when the library loads;
+// GifSetCpuVariant() overrides that (not while other threads are coding)
+int GifGetCpuVariant(void);
+int GifSetCpuVariant(int Variant); /* GIF_CPU_* */
+// DGifDecodeBatch() uses io_uring when the kernel allows it;
+// GifSetInputBackend() overrides that (not while a batch is running)
+int GifGetInputBackend(void);
+int GifSetInputBackend(int Backend); /* GIF_INPUT_* */
 ColorMapObject *GifMakeMapObject(int ColorCount, const GifColorType *ColorMap);
 ColorMapObject *GifUnionColorMap(const ColorMapObject *ColorIn1,
                                      const ColorMapObject *ColorIn2,
@@ -204,6 +372,11 @@ void GifFreeMapObject(ColorMapObject *Object);
 SavedImage *GifMakeSavedImage(GifFileType *GifFile,
                                   const SavedImage *CopyFrom);
 void GifFreeSavedImages(GifFileType *GifFile);
+int GifComputeFrameStats(const SavedImage *Image, GifFrameStats *Stats); /* one pass over 8-bit RasterBits */
+int GifPixelBits(const GifFileType *GifFile, const SavedImage *Image); /* 1, 2, 4 with GIF_OPT_PACKED, else 8 */
+// Move (not copy) all decoded frames, their palettes and extensions from
+// a decoder handle to an empty encoder handle
+int GifMoveSavedImages(GifFileType *GifOut, GifFileType *GifIn);
 int DGifExtensionToGCB(const size_t GifExtensionLength,
                const GifByteType *GifExtension,
                GraphicsControlBlock *GCB);
@@ -232,6 +405,7 @@ int EGifGCBToSavedExtension(const GraphicsControlBlock *GCB,
 #define D_GIF_ERR_NOT_READABLE   111
 #define D_GIF_ERR_IMAGE_DEFECT   112
 #define D_GIF_ERR_EOF_TOO_SOON   113
+#define D_GIF_ERR_LIMIT_EXCEEDED 114
 
 // Encoder error constants
 #define E_GIF_SUCCEEDED          0
@@ -256,6 +430,45 @@ typedef struct gif_private
     int iBitsPerPixel;
     int iPixelCount; // pixels remaining in current image being written
     unsigned char *pFileData;
+    int iFileDataSize; // allocated size of pFileData (kept across files)
+    int iFrameMemCount; // number of SavedImages allocated
+    int iFrameSlots; // number of SavedImages holding reusable buffers
+    int *pRasterSizes; // allocated size of each SavedImage's RasterBits
+    ColorMapObject *pSColorMap; // global palette allocated by the decoder (256 entries)
+    uint8_t *pLZWBuf, *pChunkBuf; // encoder work buffers
+    int iLZWBufSize, iChunkBufSize;
+    int iFrameOffset; // file offset of the next frame (or record) for DGifNextFrame()
+    int iFrameBuf; // which of the 2 frame buffers was used last
+    int iFrameBufSize[2];
+    uint8_t *pFrameBuf[2];
+    SavedImage Frames[2]; // frames handed out by DGifNextFrame()
+    uint8_t *pLineLZW; // compressed data of the frame read with DGifGetLine()
+    int iLineLZWSize;
+    uint8_t ucLineCodeStart;
+    int iLinePos, iLineLeft; // next pixel handed out (-1 = not decoded yet), pixels left
+    GifAllocator Allocator; // used for all memory owned by this handle
+    int iOptions; // GIF_OPT_* flags
+    uint8_t *pArena; // one block holding all frames (GIF_OPT_ARENA)
+    size_t iArenaSize;
+    int bArena; // frames are being placed in the arena
+    ExtensionBlock *pArenaExt; // next free extension block in the arena
+    int iArenaExtLeft;
+    uint8_t *pArenaNext; // next free byte for palettes and pixels
+    size_t iArenaLeft;
+    GifProgressFunc pfnProgress; // called as rows of a frame are finished
+    int iProgressRows; // minimum rows per call
+    GifFrameStats *pFrameStats; // per frame, with GIF_OPT_STATS
+    int iFrameStatsCount;
+    uint8_t *pScratch; // one unpacked frame/row for GIF_OPT_PACKED
+    int iScratchSize;
+    GifCodecStats Stats; // counters for GifGetStats() (GIF_STATS builds)
+    GifTraceFunc pfnTrace; // called at the beginning and end of each phase
+    void *pTraceUser;
+    int iTraceFrame; // frame the decoder is working on, for pfnTrace
+    GifLimits Limits; // see GifSetLimits()
+    uint64_t u64Pixels; // pixels of the frames parsed so far
+    uint64_t u64Allocated; // bytes allocated for the current file
+    int bOverLimit; // an allocation was refused because of Limits.MaxMemory
 } GIFPRIVATE;
 
 #ifdef __cplusplus
@@ -0,0 +1,414 @@
+//
+// GIFLIB-turbo
+//
+// Copyright (c) 2021 BitBank Software, Inc.
+// written by Larry Bank
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Optional header-only C++17 layer over gif_lib.h: movable RAII decoder and
+// encoder handles, frames as views over the library's own memory and a lazy
+// frame range on top of DGifNextFrame(). Nothing is copied or allocated on
+// top of what the C functions do; errors are thrown as gif::Error.
+//
+#ifndef _GIF_LIB_HPP_
+#define _GIF_LIB_HPP_
+
+#include "gif_lib.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <stdexcept>
+#include <utility>
+#include <fcntl.h>
+#include <unistd.h>
+#if __has_include(<span>) && __cplusplus >= 202002L
+#include <span>
+#endif
+#if __has_include(<memory_resource>) && __cplusplus >= 201703L
+#include <memory_resource>
+#endif
+
+namespace gif {
+
+// std::span with C++20, otherwise just enough of it for the frame views
+#if defined(__cpp_lib_span)
+template <class T> using Span = std::span<T>;
+#else
+template <class T> class Span {
+public:
+    constexpr Span() noexcept = default;
+    constexpr Span(T *pData, std::size_t iSize) noexcept : m_pData(pData), m_iSize(iSize) {}
+    constexpr T *data() const noexcept { return m_pData; }
+    constexpr std::size_t size() const noexcept { return m_iSize; }
+    constexpr bool empty() const noexcept { return m_iSize == 0; }
+    constexpr T *begin() const noexcept { return m_pData; }
+    constexpr T *end() const noexcept { return m_pData + m_iSize; }
+    constexpr T &operator[](std::size_t i) const noexcept { return m_pData[i]; }
+    constexpr Span subspan(std::size_t iOffset, std::size_t iCount) const noexcept { return Span(m_pData + iOffset, iCount); }
+private:
+    T *m_pData = nullptr;
+    std::size_t m_iSize = 0;
+};
+#endif
+
+//
+// Error
+//
+// A D_GIF_ERR_* / E_GIF_ERR_* code with its GifErrorString() text
+//
+class Error : public std::runtime_error {
+public:
+    explicit Error(int iCode)
+        : std::runtime_error(GifErrorString(iCode) ? GifErrorString(iCode) : "GIF error"), m_iCode(iCode) {}
+    int code() const noexcept { return m_iCode; }
+private:
+    int m_iCode;
+};
+
+//
+// Frame
+//
+// View of a decoded frame; valid as long as the memory it came from (see the
+// Decoder function which returned it). pixels() covers Height rows of
+// pitch() bytes, which hold 1/2/4 bits per pixel with GIF_OPT_PACKED.
+//
+class Frame {
+public:
+    Frame() noexcept = default;
+    Frame(const GifFileType *pGif, const SavedImage *pImage) noexcept
+        : m_pImage(pImage), m_iBits(GifPixelBits(pGif, pImage)) {}
+    const SavedImage *get() const noexcept { return m_pImage; }
+    const GifImageDesc &desc() const noexcept { return m_pImage->ImageDesc; }
+    int left() const noexcept { return desc().Left; }
+    int top() const noexcept { return desc().Top; }
+    int width() const noexcept { return desc().Width; }
+    int height() const noexcept { return desc().Height; }
+    bool interlaced() const noexcept { return desc().Interlace; }
+    int bits() const noexcept { return m_iBits; }
+    int pitch() const noexcept { return GIF_PACKED_PITCH(width(), m_iBits); }
+    const ColorMapObject *colorMap() const noexcept { return desc().ColorMap; } // local palette or nullptr
+    Span<const std::uint8_t> pixels() const noexcept {
+        return Span<const std::uint8_t>(m_pImage->RasterBits, (std::size_t)pitch() * height());
+    }
+    Span<const std::uint8_t> row(int y) const noexcept {
+        return pixels().subspan((std::size_t)y * pitch(), pitch());
+    }
+    Span<const ExtensionBlock> extensions() const noexcept {
+        return Span<const ExtensionBlock>(m_pImage->ExtensionBlocks, m_pImage->ExtensionBlocks ? m_pImage->ExtensionBlockCount : 0);
+    }
+private:
+    const SavedImage *m_pImage = nullptr;
+    int m_iBits = 8;
+};
+
+#if defined(__cpp_lib_memory_resource)
+//
+// ResourceAllocator
+//
+// Lets a handle take its memory from a std::pmr::memory_resource. GifAllocator
+// frees without a size, so each block keeps its size in front of it.
+//
+class ResourceAllocator {
+public:
+    explicit ResourceAllocator(std::pmr::memory_resource *pResource = std::pmr::get_default_resource()) noexcept
+        : m_Alloc{Malloc, Realloc, Free, pResource} {}
+    const GifAllocator *get() const noexcept { return &m_Alloc; }
+private:
+    static constexpr std::size_t HEADER = alignof(std::max_align_t);
+    static void *Malloc(std::size_t iSize, void *pUser) {
+        try {
+            auto *p = static_cast<unsigned char *>(static_cast<std::pmr::memory_resource *>(pUser)->allocate(iSize + HEADER, HEADER));
+            *reinterpret_cast<std::size_t *>(p) = iSize;
+            return p + HEADER;
+        } catch (...) {
+            return nullptr; // the C side expects NULL
+        }
+    }
+    static void Free(void *p, void *pUser) {
+        if (p == nullptr)
+            return;
+        auto *pBlock = static_cast<unsigned char *>(p) - HEADER;
+        static_cast<std::pmr::memory_resource *>(pUser)->deallocate(pBlock, *reinterpret_cast<std::size_t *>(pBlock) + HEADER, HEADER);
+    }
+    static void *Realloc(void *p, std::size_t iSize, void *pUser) {
+        void *pNew = Malloc(iSize, pUser);
+        if (pNew != nullptr && p != nullptr) {
+            std::size_t iOld = *reinterpret_cast<std::size_t *>(static_cast<unsigned char *>(p) - HEADER);
+            std::copy_n(static_cast<unsigned char *>(p), (iOld < iSize) ? iOld : iSize, static_cast<unsigned char *>(pNew));
+            Free(p, pUser);
+        }
+        return pNew;
+    }
+    GifAllocator m_Alloc;
+};
+#endif
+
+//
+// Decoder
+//
+// Owns a decoder handle (DGifCloseFile() on destruction). The allocator
+// overloads use it for everything the handle allocates; it must outlive the
+// Decoder.
+//
+class Decoder {
+public:
+    Decoder() noexcept = default;
+    explicit Decoder(const char *szName, const GifAllocator *pAlloc = nullptr) : Decoder(Open(szName), pAlloc) {}
+    // the file handle belongs to the Decoder from here on (even on failure)
+    explicit Decoder(int iHandle, const GifAllocator *pAlloc = nullptr) {
+        int iErr = D_GIF_ERR_OPEN_FAILED;
+        m_pGif = DGifOpenFileHandleAlloc(iHandle, pAlloc, &iErr);
+        if (m_pGif == nullptr)
+            throw Error(iErr);
+    }
+    // take over a handle opened with the C functions
+    static Decoder adopt(GifFileType *pGif) noexcept { Decoder d; d.m_pGif = pGif; return d; }
+    Decoder(Decoder &&other) noexcept : m_pGif(std::exchange(other.m_pGif, nullptr)) {}
+    Decoder &operator=(Decoder &&other) noexcept {
+        if (this != &other) {
+            close();
+            m_pGif = std::exchange(other.m_pGif, nullptr);
+        }
+        return *this;
+    }
+    Decoder(const Decoder &) = delete;
+    Decoder &operator=(const Decoder &) = delete;
+    ~Decoder() { close(); }
+
+    GifFileType *get() const noexcept { return m_pGif; }
+    GifFileType *release() noexcept { return std::exchange(m_pGif, nullptr); }
+    explicit operator bool() const noexcept { return m_pGif != nullptr; }
+    void close() noexcept {
+        if (m_pGif != nullptr) {
+            int iErr;
+            DGifCloseFile(m_pGif, &iErr);
+            m_pGif = nullptr;
+        }
+    }
+    // point the handle at the next file, keeping its memory
+    void reopen(const char *szName) {
+        int iErr;
+        if (DGifReopenFileName(m_pGif, szName, &iErr) != GIF_OK)
+            throw Error(iErr);
+    }
+    void reopen(int iHandle) {
+        int iErr;
+        if (DGifReopenFileHandle(m_pGif, iHandle, &iErr) != GIF_OK)
+            throw Error(iErr);
+    }
+
+    int width() const noexcept { return m_pGif->SWidth; }
+    int height() const noexcept { return m_pGif->SHeight; }
+    const ColorMapObject *colorMap() const noexcept { return m_pGif->SColorMap; }
+    void setOptions(int iOptions) { GifSetOptions(m_pGif, iOptions); }
+    void setLimits(const GifLimits &limits) { GifSetLimits(m_pGif, &limits); }
+
+    // DGifSlurp(); the frames stay valid until the handle is reopened or closed
+    void slurp() {
+        int iErr = DGifSlurp(m_pGif);
+        if (iErr != GIF_OK)
+            throw Error(iErr);
+    }
+    int frameCount() const noexcept { return m_pGif->ImageCount; }
+    Frame frame(int i) const noexcept { return Frame(m_pGif, &m_pGif->SavedImages[i]); }
+
+    // Frames decoded by slurp()
+    class SlurpedFrames {
+    public:
+        class iterator {
+        public:
+            using iterator_category = std::random_access_iterator_tag;
+            using value_type = Frame;
+            using difference_type = std::ptrdiff_t;
+            using pointer = void;
+            using reference = Frame;
+            iterator(const GifFileType *pGif, int i) noexcept : m_pGif(pGif), m_i(i) {}
+            Frame operator*() const noexcept { return Frame(m_pGif, &m_pGif->SavedImages[m_i]); }
+            Frame operator[](difference_type n) const noexcept { return *(*this + n); }
+            iterator &operator++() noexcept { ++m_i; return *this; }
+            iterator operator++(int) noexcept { iterator it = *this; ++m_i; return it; }
+            iterator &operator--() noexcept { --m_i; return *this; }
+            iterator operator--(int) noexcept { iterator it = *this; --m_i; return it; }
+            iterator &operator+=(difference_type n) noexcept { m_i += (int)n; return *this; }
+            iterator &operator-=(difference_type n) noexcept { m_i -= (int)n; return *this; }
+            friend iterator operator+(iterator it, difference_type n) noexcept { return it += n; }
+            friend iterator operator-(iterator it, difference_type n) noexcept { return it -= n; }
+            friend difference_type operator-(const iterator &a, const iterator &b) noexcept { return a.m_i - b.m_i; }
+            friend bool operator==(const iterator &a, const iterator &b) noexcept { return a.m_i == b.m_i; }
+            friend bool operator!=(const iterator &a, const iterator &b) noexcept { return a.m_i != b.m_i; }
+            friend bool operator<(const iterator &a, const iterator &b) noexcept { return a.m_i < b.m_i; }
+        private:
+            const GifFileType *m_pGif;
+            int m_i;
+        };
+        explicit SlurpedFrames(const GifFileType *pGif) noexcept : m_pGif(pGif) {}
+        iterator begin() const noexcept { return iterator(m_pGif, 0); }
+        iterator end() const noexcept { return iterator(m_pGif, m_pGif->ImageCount); }
+        std::size_t size() const noexcept { return (std::size_t)m_pGif->ImageCount; }
+        Frame operator[](std::size_t i) const noexcept { return begin()[(std::ptrdiff_t)i]; }
+    private:
+        const GifFileType *m_pGif;
+    };
+    SlurpedFrames frames() const noexcept { return SlurpedFrames(m_pGif); }
+
+    // Lazy single-pass range: each step decodes one frame with DGifNextFrame(),
+    // so a Frame is only valid until the iterator has advanced twice more.
+    // Don't mix with slurp() on the same handle.
+    class LazyFrames {
+    public:
+        class iterator {
+        public:
+            using iterator_category = std::input_iterator_tag;
+            using value_type = Frame;
+            using difference_type = std::ptrdiff_t;
+            using pointer = void;
+            using reference = Frame;
+            iterator() noexcept = default;
+            explicit iterator(GifFileType *pGif) : m_pGif(pGif) { next(); }
+            Frame operator*() const noexcept { return m_frame; }
+            iterator &operator++() { next(); return *this; }
+            void operator++(int) { next(); }
+            friend bool operator==(const iterator &a, const iterator &b) noexcept { return a.m_pGif == b.m_pGif; }
+            friend bool operator!=(const iterator &a, const iterator &b) noexcept { return a.m_pGif != b.m_pGif; }
+        private:
+            void next() {
+                SavedImage *pImage = DGifNextFrame(m_pGif);
+                if (pImage == nullptr) {
+                    int iErr = m_pGif->Error;
+                    m_pGif = nullptr; // == end()
+                    if (iErr != D_GIF_SUCCEEDED)
+                        throw Error(iErr);
+                    return;
+                }
+                m_frame = Frame(m_pGif, pImage);
+            }
+            GifFileType *m_pGif = nullptr;
+            Frame m_frame;
+        };
+        explicit LazyFrames(GifFileType *pGif) noexcept : m_pGif(pGif) {}
+        iterator begin() const { return iterator(m_pGif); }
+        iterator end() const noexcept { return iterator(); }
+    private:
+        GifFileType *m_pGif;
+    };
+    LazyFrames lazyFrames() const noexcept { return LazyFrames(m_pGif); }
+
+private:
+    static int Open(const char *szName) {
+        int iHandle = ::open(szName, O_RDONLY);
+        if (iHandle < 0)
+            throw Error(D_GIF_ERR_OPEN_FAILED);
+        return iHandle;
+    }
+    GifFileType *m_pGif = nullptr;
+};
+
+//
+// Encoder
+//
+// Owns an encoder handle (EGifCloseFile() on destruction)
+//
+class Encoder {
+public:
+    Encoder() noexcept = default;
+    explicit Encoder(const char *szName, const GifAllocator *pAlloc = nullptr) : Encoder(Create(szName), pAlloc, true) {}
+    // the file handle stays the caller's if this fails
+    explicit Encoder(int iHandle, const GifAllocator *pAlloc = nullptr) : Encoder(iHandle, pAlloc, false) {}
+    static Encoder adopt(GifFileType *pGif) noexcept { Encoder e; e.m_pGif = pGif; return e; }
+    Encoder(Encoder &&other) noexcept : m_pGif(std::exchange(other.m_pGif, nullptr)) {}
+    Encoder &operator=(Encoder &&other) noexcept {
+        if (this != &other) {
+            reset();
+            m_pGif = std::exchange(other.m_pGif, nullptr);
+        }
+        return *this;
+    }
+    Encoder(const Encoder &) = delete;
+    Encoder &operator=(const Encoder &) = delete;
+    ~Encoder() { reset(); }
+
+    GifFileType *get() const noexcept { return m_pGif; }
+    GifFileType *release() noexcept { return std::exchange(m_pGif, nullptr); }
+    explicit operator bool() const noexcept { return m_pGif != nullptr; }
+    // finish the file and free the handle
+    void close() {
+        int iErr = E_GIF_SUCCEEDED;
+        if (m_pGif != nullptr && EGifCloseFile(std::exchange(m_pGif, nullptr), &iErr) != GIF_OK)
+            throw Error(iErr);
+    }
+    void reopen(int iHandle) {
+        int iErr;
+        if (EGifReopenFileHandle(m_pGif, iHandle, &iErr) != GIF_OK)
+            throw Error(iErr);
+    }
+    void setOptions(int iOptions) { GifSetOptions(m_pGif, iOptions); }
+
+    void putScreenDesc(int iWidth, int iHeight, int iColorRes, int iBackground, const ColorMapObject *pColorMap) {
+        Check(EGifPutScreenDesc(m_pGif, iWidth, iHeight, iColorRes, iBackground, pColorMap));
+    }
+    void putImageDesc(int iLeft, int iTop, int iWidth, int iHeight, bool bInterlace = false, const ColorMapObject *pColorMap = nullptr) {
+        Check(EGifPutImageDesc(m_pGif, iLeft, iTop, iWidth, iHeight, bInterlace, pColorMap));
+    }
+    void putLine(Span<const GifPixelType> line) {
+        Check(EGifPutLine(m_pGif, const_cast<GifPixelType *>(line.data()), (int)line.size()));
+    }
+    void putExtension(int iCode, Span<const std::uint8_t> data) {
+        Check(EGifPutExtension(m_pGif, iCode, (int)data.size(), data.data()));
+    }
+    // hand the frames of a slurped decoder over without copying them (both
+    // handles need the same allocator)
+    void takeFrames(Decoder &decoder) {
+        Check(GifMoveSavedImages(m_pGif, decoder.get()));
+    }
+    // write the frames in SavedImages and close the file (EGifSpewKeep());
+    // the handle can be reopened for the next file
+    void spew() {
+        int iErr = EGifSpewKeep(m_pGif); // GIF_OK or E_GIF_ERR_*
+        if (iErr != GIF_OK)
+            throw Error(iErr);
+    }
+
+private:
+    void Check(int iResult) {
+        if (iResult != GIF_OK)
+            throw Error(m_pGif->Error ? m_pGif->Error : E_GIF_ERR_WRITE_FAILED);
+    }
+    void reset() noexcept {
+        if (m_pGif != nullptr) {
+            int iErr;
+            EGifCloseFile(m_pGif, &iErr);
+            m_pGif = nullptr;
+        }
+    }
+    static int Create(const char *szName) {
+        int iHandle = ::open(szName, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if (iHandle < 0)
+            throw Error(E_GIF_ERR_OPEN_FAILED);
+        return iHandle;
+    }
+    Encoder(int iHandle, const GifAllocator *pAlloc, bool bOwnHandle) {
+        int iErr = E_GIF_ERR_NOT_ENOUGH_MEM;
+        m_pGif = EGifOpenFileHandleAlloc(iHandle, pAlloc, &iErr);
+        if (m_pGif == nullptr) {
+            if (bOwnHandle)
+                ::close(iHandle);
+            throw Error(iErr);
+        }
+    }
+    GifFileType *m_pGif = nullptr;
+};
+
+} // namespace gif
+
+#endif // _GIF_LIB_HPP_
@@ -0,0 +1,2028 @@
+//
+// GIFLIB regression tests
+//
+// Builds small GIF files byte by byte (plus a few with huge frames), runs
+// them through the decoder and the encoder and checks the results. Each test
+// prints one line, "ok <name>", "skip <name>: <reason>" (when this build or
+// system can't run it) or "FAIL <name>: <reason>"; the exit code is the
+// number of failed tests, which is what ctest looks at.
+//
+// usage: gif_regress [test name ...]
+//  with names, only those tests are run
+//        gif_regress -c dir
+//  writes the small corpus gif_compare is tested with into dir
+//
+#define _POSIX_C_SOURCE 200809L // mkdtemp()
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "gif_lib.h"
+
+static char szTempDir[256];
+
+// A growing byte buffer for the files under construction
+typedef struct {
+    uint8_t *p;
+    int iLen, iSize;
+} GIFBUF;
+
+// LZW encoder which only emits root codes, keeping the code size in step
+// with the decoder; good enough to make valid files of any size
+typedef struct {
+    GIFBUF *pBuf;
+    uint8_t ucBlock[256]; // sub-block being filled
+    int iBlockLen;
+    uint64_t u64Bits;
+    int iBitCount;
+    int iCodeStart, iCodeSize, iNextCode;
+    bool bFirst; // first code after a clear code adds no string
+} LZWWRITER;
+
+// What a handle allocated through CountingAllocator
+typedef struct {
+    size_t iLargest; // largest single request
+    uint64_t u64Total;
+} ALLOCCOUNT;
+
+typedef int (*TESTFUNC)(void);
+
+#define TEST_SKIPPED -1 // returned by a test instead of GIF_OK or GIF_ERROR
+
+static int Skip(const char *szName, const char *szReason)
+{
+    printf("skip %s: %s\n", szName, szReason);
+    return TEST_SKIPPED;
+} /* Skip() */
+
+static int Fail(const char *szName, const char *szReason)
+{
+    printf("FAIL %s: %s\n", szName, szReason);
+    return GIF_ERROR;
+} /* Fail() */
+
+static const char *TempPath(const char *szName)
+{
+    static char szPath[4][512];
+    static int iNext = 0;
+
+    iNext = (iNext + 1) & 3; // a few names can be in use at the same time
+    snprintf(szPath[iNext], sizeof(szPath[0]), "%s/%s", szTempDir, szName);
+    return szPath[iNext];
+} /* TempPath() */
+
+static void BufPut(GIFBUF *pBuf, const void *pData, int iLen)
+{
+    if (pBuf->iLen + iLen > pBuf->iSize) {
+        pBuf->iSize = (pBuf->iLen + iLen) * 2 + 256;
+        pBuf->p = (uint8_t *)realloc(pBuf->p, pBuf->iSize);
+        if (pBuf->p == NULL) {
+            printf("out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    memcpy(&pBuf->p[pBuf->iLen], pData, iLen);
+    pBuf->iLen += iLen;
+} /* BufPut() */
+
+static void BufByte(GIFBUF *pBuf, int c)
+{
+    uint8_t uc = (uint8_t)c;
+    BufPut(pBuf, &uc, 1);
+} /* BufByte() */
+
+static void BufWord(GIFBUF *pBuf, int w)
+{
+    BufByte(pBuf, w & 0xff);
+    BufByte(pBuf, w >> 8);
+} /* BufWord() */
+
+// Data as sub-blocks followed by the terminator
+static void BufSubBlocks(GIFBUF *pBuf, const uint8_t *pData, int iLen)
+{
+    int iChunk;
+
+    while (iLen > 0) {
+        iChunk = (iLen > 255) ? 255 : iLen;
+        BufByte(pBuf, iChunk);
+        BufPut(pBuf, pData, iChunk);
+        pData += iChunk;
+        iLen -= iChunk;
+    }
+    BufByte(pBuf, 0);
+} /* BufSubBlocks() */
+
+// Palette of 1 << iBits entries; entry i = (i, 255 - i, i * 7)
+static void BufPalette(GIFBUF *pBuf, int iBits)
+{
+    int i;
+
+    for (i = 0; i < (1 << iBits); i++) {
+        BufByte(pBuf, i);
+        BufByte(pBuf, 255 - i);
+        BufByte(pBuf, i * 7);
+    }
+} /* BufPalette() */
+
+// Header and logical screen with a global palette of 1 << iBits entries
+// (none if iBits == 0) and a color resolution of 8 bits, like most encoders
+// write
+static void BufScreen(GIFBUF *pBuf, int iWidth, int iHeight, int iBits)
+{
+    BufPut(pBuf, "GIF89a", 6);
+    BufWord(pBuf, iWidth);
+    BufWord(pBuf, iHeight);
+    BufByte(pBuf, iBits ? (0xf0 | (iBits - 1)) : 0x70);
+    BufByte(pBuf, 0); // background
+    BufByte(pBuf, 0); // aspect ratio
+    if (iBits)
+        BufPalette(pBuf, iBits);
+} /* BufScreen() */
+
+static void BufExtension(GIFBUF *pBuf, int iFunction, const uint8_t *pData, int iLen)
+{
+    BufByte(pBuf, 0x21);
+    BufByte(pBuf, iFunction);
+    BufSubBlocks(pBuf, pData, iLen);
+} /* BufExtension() */
+
+static void BufGCB(GIFBUF *pBuf, int iDelay, int iTransparent)
+{
+    uint8_t ucGCB[4];
+
+    ucGCB[0] = (iTransparent >= 0) ? 1 : 0;
+    ucGCB[1] = (uint8_t)iDelay;
+    ucGCB[2] = (uint8_t)(iDelay >> 8);
+    ucGCB[3] = (iTransparent >= 0) ? (uint8_t)iTransparent : 0;
+    BufExtension(pBuf, GRAPHICS_EXT_FUNC_CODE, ucGCB, 4);
+} /* BufGCB() */
+
+static void LZWFlushBlock(LZWWRITER *pLZW)
+{
+    if (pLZW->iBlockLen) {
+        BufByte(pLZW->pBuf, pLZW->iBlockLen);
+        BufPut(pLZW->pBuf, pLZW->ucBlock, pLZW->iBlockLen);
+        pLZW->iBlockLen = 0;
+    }
+} /* LZWFlushBlock() */
+
+static void LZWPutCode(LZWWRITER *pLZW, int iCode)
+{
+    int cc = 1 << pLZW->iCodeStart;
+
+    pLZW->u64Bits |= (uint64_t)iCode << pLZW->iBitCount;
+    pLZW->iBitCount += pLZW->iCodeSize;
+    while (pLZW->iBitCount >= 8) {
+        pLZW->ucBlock[pLZW->iBlockLen++] = (uint8_t)pLZW->u64Bits;
+        pLZW->u64Bits >>= 8;
+        pLZW->iBitCount -= 8;
+        if (pLZW->iBlockLen == 255)
+            LZWFlushBlock(pLZW);
+    }
+    // the same code table bookkeeping as the decoder
+    if (iCode == cc) {
+        pLZW->iCodeSize = pLZW->iCodeStart + 1;
+        pLZW->iNextCode = cc + 2;
+        pLZW->bFirst = true;
+    } else if (iCode != cc + 1) {
+        if (!pLZW->bFirst && pLZW->iNextCode < 4096) {
+            pLZW->iNextCode++;
+            if (pLZW->iNextCode >= (1 << pLZW->iCodeSize) && pLZW->iCodeSize < 12)
+                pLZW->iCodeSize++;
+        }
+        pLZW->bFirst = false;
+    }
+} /* LZWPutCode() */
+
+static void LZWStart(LZWWRITER *pLZW, GIFBUF *pBuf, int iCodeStart)
+{
+    memset(pLZW, 0, sizeof(LZWWRITER));
+    pLZW->pBuf = pBuf;
+    pLZW->iCodeStart = iCodeStart;
+    pLZW->iCodeSize = iCodeStart + 1;
+    BufByte(pBuf, iCodeStart);
+    LZWPutCode(pLZW, 1 << iCodeStart); // clear code
+} /* LZWStart() */
+
+static void LZWFinish(LZWWRITER *pLZW)
+{
+    LZWPutCode(pLZW, (1 << pLZW->iCodeStart) + 1); // EOI
+    if (pLZW->iBitCount)
+        pLZW->ucBlock[pLZW->iBlockLen++] = (uint8_t)pLZW->u64Bits;
+    LZWFlushBlock(pLZW);
+    BufByte(pLZW->pBuf, 0);
+} /* LZWFinish() */
+
+static void BufDescriptor(GIFBUF *pBuf, int iLeft, int iTop, int iWidth, int iHeight, int iFlags)
+{
+    BufByte(pBuf, 0x2c);
+    BufWord(pBuf, iLeft);
+    BufWord(pBuf, iTop);
+    BufWord(pBuf, iWidth);
+    BufWord(pBuf, iHeight);
+    BufByte(pBuf, iFlags);
+} /* BufDescriptor() */
+
+// LZW data of iCount pixels, all < 1 << iCodeStart
+static void BufPixels(GIFBUF *pBuf, int iCodeStart, const uint8_t *pPixels, int iCount)
+{
+    LZWWRITER lzw;
+    int i;
+
+    LZWStart(&lzw, pBuf, iCodeStart);
+    for (i = 0; i < iCount; i++)
+        LZWPutCode(&lzw, pPixels[i]);
+    LZWFinish(&lzw);
+} /* BufPixels() */
+
+// Image descriptor, optional local palette (iLocalBits != 0) and the pixels
+// (iWidth * iHeight bytes, all < 1 << iCodeStart)
+static void BufImage(GIFBUF *pBuf, int iLeft, int iTop, int iWidth, int iHeight, int iLocalBits, int iCodeStart, const uint8_t *pPixels)
+{
+    BufDescriptor(pBuf, iLeft, iTop, iWidth, iHeight, iLocalBits ? (0x80 | (iLocalBits - 1)) : 0);
+    if (iLocalBits)
+        BufPalette(pBuf, iLocalBits);
+    BufPixels(pBuf, iCodeStart, pPixels, iWidth * iHeight);
+} /* BufImage() */
+
+// A frame of any size whose LZW data ends right away; the decoder fills it
+// with color 0, but has to allocate all of it first
+static void BufEmptyImage(GIFBUF *pBuf, int iWidth, int iHeight)
+{
+    LZWWRITER lzw;
+
+    BufDescriptor(pBuf, 0, 0, iWidth, iHeight, 0);
+    LZWStart(&lzw, pBuf, 2);
+    LZWFinish(&lzw);
+} /* BufEmptyImage() */
+
+static int BufWrite(GIFBUF *pBuf, const char *szPath)
+{
+    FILE *f = fopen(szPath, "wb");
+    int rc = GIF_ERROR;
+
+    if (f != NULL) {
+        if (fwrite(pBuf->p, 1, pBuf->iLen, f) == (size_t)pBuf->iLen)
+            rc = GIF_OK;
+        fclose(f);
+    }
+    free(pBuf->p);
+    memset(pBuf, 0, sizeof(GIFBUF));
+    return rc;
+} /* BufWrite() */
+
+// Decode szIn and write its frames to szOut with EGifSpew(). With szFirst,
+// the decoder handle decodes that file first and is then reopened for szIn.
+static int Respew(const char *szFirst, const char *szIn, const char *szOut, int iOptions)
+{
+    GifFileType *gifIn, *gifOut;
+    int iErr;
+
+    gifIn = DGifOpenFileName(szFirst ? szFirst : szIn, &iErr);
+    if (gifIn == NULL)
+        return GIF_ERROR;
+    GifSetOptions(gifIn, iOptions);
+    if (szFirst != NULL && (DGifSlurp(gifIn) != GIF_OK || DGifReopenFileName(gifIn, szIn, &iErr) != GIF_OK)) {
+        DGifCloseFile(gifIn, &iErr);
+        return GIF_ERROR;
+    }
+    if (DGifSlurp(gifIn) != GIF_OK) {
+        DGifCloseFile(gifIn, &iErr);
+        return GIF_ERROR;
+    }
+    gifOut = EGifOpenFileName(szOut, false, &iErr);
+    if (gifOut == NULL) {
+        DGifCloseFile(gifIn, &iErr);
+        return GIF_ERROR;
+    }
+    gifOut->SWidth = gifIn->SWidth;
+    gifOut->SHeight = gifIn->SHeight;
+    gifOut->SColorResolution = gifIn->SColorResolution;
+    gifOut->SBackGroundColor = gifIn->SBackGroundColor;
+    if (GifMoveSavedImages(gifOut, gifIn) != GIF_OK) {
+        EGifCloseFile(gifOut, &iErr);
+        DGifCloseFile(gifIn, &iErr);
+        return GIF_ERROR;
+    }
+    DGifCloseFile(gifIn, &iErr);
+    return (EGifSpew(gifOut) == GIF_OK) ? GIF_OK : GIF_ERROR;
+} /* Respew() */
+
+// Frames, pixels and extension blocks of two decoded files must match
+static int SameFrames(GifFileType *gif1, GifFileType *gif2)
+{
+    int i, j;
+    SavedImage *p1, *p2;
+
+    if (gif1->ImageCount != gif2->ImageCount || gif1->SWidth != gif2->SWidth || gif1->SHeight != gif2->SHeight)
+        return GIF_ERROR;
+    for (i = 0; i < gif1->ImageCount; i++) {
+        p1 = &gif1->SavedImages[i];
+        p2 = &gif2->SavedImages[i];
+        if (p1->ImageDesc.Left != p2->ImageDesc.Left || p1->ImageDesc.Top != p2->ImageDesc.Top ||
+            p1->ImageDesc.Width != p2->ImageDesc.Width || p1->ImageDesc.Height != p2->ImageDesc.Height ||
+            p1->ImageDesc.Interlace != p2->ImageDesc.Interlace)
+            return GIF_ERROR;
+        if (memcmp(p1->RasterBits, p2->RasterBits, p1->ImageDesc.Width * p1->ImageDesc.Height) != 0)
+            return GIF_ERROR;
+        if (p1->ExtensionBlockCount != p2->ExtensionBlockCount)
+            return GIF_ERROR;
+        for (j = 0; j < p1->ExtensionBlockCount; j++) {
+            ExtensionBlock *e1 = &p1->ExtensionBlocks[j], *e2 = &p2->ExtensionBlocks[j];
+            if (e1->Function != e2->Function || e1->ByteCount != e2->ByteCount || memcmp(e1->Bytes, e2->Bytes, e1->ByteCount) != 0)
+                return GIF_ERROR;
+        }
+    }
+    return GIF_OK;
+} /* SameFrames() */
+
+static int SameFiles(const char *szPath1, const char *szPath2)
+{
+    GifFileType *gif1, *gif2;
+    int iErr, rc = GIF_ERROR;
+
+    gif1 = DGifOpenFileName(szPath1, &iErr);
+    gif2 = DGifOpenFileName(szPath2, &iErr);
+    if (gif1 != NULL && gif2 != NULL && DGifSlurp(gif1) == GIF_OK && DGifSlurp(gif2) == GIF_OK)
+        rc = SameFrames(gif1, gif2);
+    DGifCloseFile(gif1, &iErr);
+    DGifCloseFile(gif2, &iErr);
+    return rc;
+} /* SameFiles() */
+
+static void *CountMalloc(size_t iSize, void *pUser)
+{
+    ALLOCCOUNT *pCount = (ALLOCCOUNT *)pUser;
+
+    if (iSize > pCount->iLargest)
+        pCount->iLargest = iSize;
+    pCount->u64Total += iSize;
+    return malloc(iSize);
+}
+static void *CountRealloc(void *p, size_t iSize, void *pUser)
+{
+    ALLOCCOUNT *pCount = (ALLOCCOUNT *)pUser;
+
+    if (iSize > pCount->iLargest)
+        pCount->iLargest = iSize;
+    pCount->u64Total += iSize;
+    return realloc(p, iSize);
+}
+static void CountFree(void *p, void *pUser)
+{
+    (void)pUser;
+    free(p);
+}
+
+// Open szPath with an allocator which counts into pCount (reset after the
+// open, so only the decoding is counted)
+static GifFileType *OpenCounting(const char *szPath, ALLOCCOUNT *pCount, int iOptions, const GifLimits *pLimits)
+{
+    GifAllocator alloc = {CountMalloc, CountRealloc, CountFree, pCount};
+    GifFileType *gif;
+    int iErr;
+
+    GifSetAllocator(&alloc);
+    gif = DGifOpenFileName(szPath, &iErr);
+    GifSetAllocator(NULL);
+    if (gif != NULL) {
+        GifSetOptions(gif, iOptions);
+        GifSetLimits(gif, pLimits);
+    }
+    memset(pCount, 0, sizeof(ALLOCCOUNT));
+    return gif;
+} /* OpenCounting() */
+
+//
+// TestSpewExtensions
+//
+// A tiny frame with more extension bytes than pixels and a full extension
+// array; the encoder has to make room for all of them and mustn't look past
+// the last one (GIF_OPT_ARENA packs the arrays of all frames)
+//
+static int TestSpewExtensions(void)
+{
+    const char *szName = "spew_extensions";
+    GIFBUF buf = {0};
+    uint8_t ucComment[255], ucPixels[8 * 4];
+    int i;
+
+    BufScreen(&buf, 8, 4, 1);
+    for (i = 0; i < MAX_EXTENSIONS; i++) { // comments of the largest sub-block
+        memset(ucComment, 'a' + (i % 26), sizeof(ucComment));
+        BufExtension(&buf, COMMENT_EXT_FUNC_CODE, ucComment, sizeof(ucComment));
+    }
+    for (i = 0; i < 8 * 4; i++)
+        ucPixels[i] = (i ^ (i >> 3)) & 1;
+    BufImage(&buf, 0, 0, 8, 4, 0, 2, ucPixels);
+    BufByte(&buf, 0x3b);
+    if (BufWrite(&buf, TempPath("ext_in.gif")) != GIF_OK)
+        return Fail(szName, "can't write the input file");
+    if (Respew(NULL, TempPath("ext_in.gif"), TempPath("ext_out.gif"), 0) != GIF_OK ||
+        Respew(NULL, TempPath("ext_in.gif"), TempPath("ext_arena.gif"), GIF_OPT_ARENA) != GIF_OK)
+        return Fail(szName, "decoding or encoding failed");
+    if (SameFiles(TempPath("ext_in.gif"), TempPath("ext_out.gif")) != GIF_OK ||
+        SameFiles(TempPath("ext_in.gif"), TempPath("ext_arena.gif")) != GIF_OK)
+        return Fail(szName, "the output doesn't match the input");
+    return GIF_OK;
+} /* TestSpewExtensions() */
+
+//
+// TestSpewLongExtension
+//
+// An extension block built by the caller can be longer than a sub-block;
+// the encoder splits it
+//
+static int TestSpewLongExtension(void)
+{
+    const char *szName = "spew_long_extension";
+    GifFileType *gif;
+    SavedImage *pSI;
+    ColorMapObject *pMap;
+    GifRecordType type;
+    GifByteType *pExt;
+    int i, iErr, iCode, iTotal = 0;
+    bool bSame = true;
+
+    gif = EGifOpenFileName(TempPath("long_ext.gif"), false, &iErr);
+    if (gif == NULL)
+        return Fail(szName, "can't create the output file");
+    pMap = GifMakeMapObject(2, NULL);
+    EGifPutScreenDesc(gif, 8, 4, 1, 0, pMap);
+    GifFreeMapObject(pMap);
+    pSI = GifMakeSavedImage(gif, NULL);
+    if (pSI == NULL) {
+        EGifCloseFile(gif, &iErr);
+        return Fail(szName, "GifMakeSavedImage() failed");
+    }
+    pSI->ImageDesc.Width = 8;
+    pSI->ImageDesc.Height = 4;
+    pSI->RasterBits = (GifByteType *)calloc(1, 8 * 4);
+    pSI->ExtensionBlocks = (ExtensionBlock *)calloc(MAX_EXTENSIONS, sizeof(ExtensionBlock)); // like GifMakeSavedImage()
+    pSI->ExtensionBlockCount = 1;
+    pSI->ExtensionBlocks[0].Function = COMMENT_EXT_FUNC_CODE;
+    pSI->ExtensionBlocks[0].ByteCount = 10000;
+    pSI->ExtensionBlocks[0].Bytes = (GifByteType *)malloc(10000);
+    for (i = 0; i < 10000; i++)
+        pSI->ExtensionBlocks[0].Bytes[i] = (GifByteType)(i * 13);
+    if (EGifSpew(gif) != GIF_OK)
+        return Fail(szName, "EGifSpew() failed");
+
+    // read the comment back one sub-block at a time
+    gif = DGifOpenFileName(TempPath("long_ext.gif"), &iErr);
+    if (gif == NULL)
+        return Fail(szName, "can't open the output file");
+    if (DGifGetRecordType(gif, &type) != GIF_OK || type != EXTENSION_RECORD_TYPE ||
+        DGifGetExtension(gif, &iCode, &pExt) != GIF_OK || iCode != COMMENT_EXT_FUNC_CODE) {
+        DGifCloseFile(gif, &iErr);
+        return Fail(szName, "the comment is missing");
+    }
+    while (pExt != NULL) {
+        for (i = 0; i < pExt[0]; i++)
+            bSame &= (pExt[1 + i] == (GifByteType)((iTotal + i) * 13));
+        iTotal += pExt[0];
+        if (DGifGetExtensionNext(gif, &pExt) != GIF_OK)
+            break;
+    }
+    bSame &= (DGifGetRecordType(gif, &type) == GIF_OK && type == IMAGE_DESC_RECORD_TYPE);
+    DGifCloseFile(gif, &iErr);
+    if (iTotal != 10000 || !bSame)
+        return Fail(szName, "the comment doesn't match");
+    return GIF_OK;
+} /* TestSpewLongExtension() */
+
+//
+// TestArenaSpew
+//
+// Frames decoded with GIF_OPT_ARENA, handed to the encoder with
+// GifMoveSavedImages() and written with EGifSpew(). In the arena the pixels
+// of the first frame follow the packed extension blocks; its third row is
+// blank so that reading past the last block finds a continuation block.
+//
+static int TestArenaSpew(void)
+{
+    const char *szName = "arena_spew";
+    GIFBUF buf = {0};
+    uint8_t ucPixels[8 * 4];
+    int i, iFrame;
+
+    BufScreen(&buf, 8, 4, 2);
+    for (iFrame = 0; iFrame < 2; iFrame++) {
+        for (i = 0; i < 8 * 4; i++)
+            ucPixels[i] = (iFrame == 0 && i / 8 == 2) ? 0 : (((i + iFrame) & 3) | 1);
+        BufGCB(&buf, 5 + iFrame, iFrame ? 2 : -1);
+        BufImage(&buf, 0, 0, 8, 4, 0, 2, ucPixels);
+    }
+    BufByte(&buf, 0x3b);
+    if (BufWrite(&buf, TempPath("arena_in.gif")) != GIF_OK)
+        return Fail(szName, "can't write the input file");
+    if (Respew(NULL, TempPath("arena_in.gif"), TempPath("arena_out.gif"), GIF_OPT_ARENA) != GIF_OK)
+        return Fail(szName, "decoding or encoding failed");
+    if (SameFiles(TempPath("arena_in.gif"), TempPath("arena_out.gif")) != GIF_OK)
+        return Fail(szName, "the output doesn't match the input");
+    return GIF_OK;
+} /* TestArenaSpew() */
+
+//
+// TestReopenSpew
+//
+// A reopened decoder handle reuses the extension arrays of its frames; the
+// blocks of the first file must not come back with the second one
+//
+static int TestReopenSpew(void)
+{
+    const char *szName = "reopen_spew";
+    GIFBUF buf = {0};
+    uint8_t ucComment[555], ucPixels[8 * 4];
+    int i;
+
+    for (i = 0; i < 8 * 4; i++)
+        ucPixels[i] = (i * 3) & 3;
+    for (i = 0; i < (int)sizeof(ucComment); i++)
+        ucComment[i] = (uint8_t)i;
+    BufScreen(&buf, 8, 4, 2);
+    BufExtension(&buf, COMMENT_EXT_FUNC_CODE, ucComment, sizeof(ucComment)); // 255 + 255 + 45 bytes
+    BufImage(&buf, 0, 0, 8, 4, 0, 2, ucPixels);
+    BufByte(&buf, 0x3b);
+    if (BufWrite(&buf, TempPath("reopen_a.gif")) != GIF_OK)
+        return Fail(szName, "can't write the first file");
+    BufScreen(&buf, 8, 4, 2);
+    BufGCB(&buf, 10, 1);
+    BufImage(&buf, 0, 0, 8, 4, 0, 2, ucPixels);
+    BufByte(&buf, 0x3b);
+    if (BufWrite(&buf, TempPath("reopen_b.gif")) != GIF_OK)
+        return Fail(szName, "can't write the second file");
+    if (Respew(TempPath("reopen_a.gif"), TempPath("reopen_b.gif"), TempPath("reopen_out.gif"), 0) != GIF_OK)
+        return Fail(szName, "decoding or encoding failed");
+    if (SameFiles(TempPath("reopen_b.gif"), TempPath("reopen_out.gif")) != GIF_OK)
+        return Fail(szName, "the output doesn't match the second file");
+    return GIF_OK;
+} /* TestReopenSpew() */
+
+//
+// TestPackedLocalPalette
+//
+// EGifPutLine() with GIF_OPT_PACKED into a frame whose local palette is
+// deeper than the global one; the raster has to use the local depth
+//
+static int TestPackedLocalPalette(void)
+{
+    const char *szName = "packed_local_palette";
+    GifFileType *gif;
+    ColorMapObject *pGlobal, *pLocal;
+    GifPixelType ucLine[8];
+    int x, y, iErr, rc = GIF_OK;
+
+    gif = EGifOpenFileName(TempPath("packed.gif"), false, &iErr);
+    if (gif == NULL)
+        return Fail(szName, "can't create the output file");
+    GifSetOptions(gif, GIF_OPT_PACKED);
+    pGlobal = GifMakeMapObject(2, NULL);
+    pLocal = GifMakeMapObject(256, NULL);
+    for (x = 0; x < 256; x++)
+        pLocal->Colors[x].Red = pLocal->Colors[x].Green = pLocal->Colors[x].Blue = (GifByteType)x;
+    if (EGifPutScreenDesc(gif, 8, 4, 8, 0, pGlobal) != GIF_OK ||
+        EGifPutImageDesc(gif, 0, 0, 8, 4, false, pLocal) != GIF_OK)
+        rc = GIF_ERROR;
+    GifFreeMapObject(pGlobal);
+    GifFreeMapObject(pLocal);
+    for (y = 0; y < 4 && rc == GIF_OK; y++) { // the last line writes the file
+        for (x = 0; x < 8; x++)
+            ucLine[x] = (GifPixelType)(255 - y * 8 - x);
+        rc = EGifPutLine(gif, ucLine, 8);
+    }
+    EGifCloseFile(gif, &iErr);
+    if (rc != GIF_OK)
+        return Fail(szName, "encoding failed");
+
+    gif = DGifOpenFileName(TempPath("packed.gif"), &iErr);
+    if (gif == NULL)
+        return Fail(szName, "can't open the output file");
+    if (DGifSlurp(gif) != GIF_OK || gif->ImageCount != 1 || gif->SavedImages[0].ImageDesc.ColorMap == NULL ||
+        gif->SavedImages[0].ImageDesc.ColorMap->ColorCount != 256)
+        rc = GIF_ERROR;
+    for (y = 0; y < 4 * 8 && rc == GIF_OK; y++) {
+        if (gif->SavedImages[0].RasterBits[y] != 255 - y)
+            rc = GIF_ERROR;
+    }
+    DGifCloseFile(gif, &iErr);
+    if (rc != GIF_OK)
+        return Fail(szName, "the pixels or the local palette don't match");
+    return GIF_OK;
+} /* TestPackedLocalPalette() */
+
+//
+// TestNextFrameIntoWide
+//
+// DGifNextFrameInto() with Pitch = 0 on a frame wider than the screen; the
+// rows are as long as the frame's
+//
+static int TestNextFrameIntoWide(void)
+{
+    const char *szName = "next_frame_into_wide";
+    GIFBUF buf = {0};
+    GifFileType *gif;
+    SavedImage *pPage;
+    uint8_t ucPixels[300 * 3], *pDest;
+    int i, iErr, rc = GIF_OK;
+
+    for (i = 0; i < 300 * 3; i++)
+        ucPixels[i] = (uint8_t)((i * 7) & 3);
+    BufScreen(&buf, 40, 10, 2);
+    BufImage(&buf, 5, 2, 300, 3, 0, 2, ucPixels);
+    BufByte(&buf, 0x3b);
+    if (BufWrite(&buf, TempPath("wide.gif")) != GIF_OK)
+        return Fail(szName, "can't write the input file");
+    gif = DGifOpenFileName(TempPath("wide.gif"), &iErr);
+    if (gif == NULL)
+        return Fail(szName, "can't open the input file");
+    pDest = (uint8_t *)malloc(GIF_FRAME_BUFFER_SIZE(300, 3));
+    pPage = DGifNextFrameInto(gif, pDest, 0, GIF_FRAME_BUFFER_SIZE(300, 3));
+    if (pPage == NULL || pPage->ImageDesc.Width != 300 || memcmp(pDest, ucPixels, sizeof(ucPixels)) != 0)
+        rc = GIF_ERROR;
+    DGifCloseFile(gif, &iErr);
+    free(pDest);
+    if (rc != GIF_OK)
+        return Fail(szName, "the frame wasn't decoded correctly");
+    return GIF_OK;
+} /* TestNextFrameIntoWide() */
+
+// Row callback of TestScanlinesHugeFrame(); every row must be color 0
+static int iHugeRows;
+static bool bHugeOK;
+static int HugeFrameLine(GifFileType *gif, const SavedImage *pPage, int y, const GifPixelType *pLine)
+{
+    int i, iWidth = pPage->ImageDesc.Width;
+
+    (void)gif;
+    if (y != iHugeRows || pLine[0] != 0 || pLine[iWidth - 1] != 0)
+        bHugeOK = false;
+    if ((y & 255) == 0) { // check a few rows completely
+        for (i = 0; i < iWidth; i++)
+            bHugeOK &= (pLine[i] == 0);
+    }
+    iHugeRows++;
+    return GIF_OK;
+} /* HugeFrameLine() */
+
+//
+// TestScanlinesHugeFrame
+//
+// DGifSlurpScanlines() on a 65288x65535 frame, more than 2^31 pixels. The
+// LZW data repeats the longest string of a full code table until it has
+// produced 0x90000000 pixels; the rest of the frame is missing and filled in
+// with color 0.
+//
+static int TestScanlinesHugeFrame(void)
+{
+    const char *szName = "scanlines_huge_frame";
+    GIFBUF buf = {0};
+    LZWWRITER lzw;
+    GifFileType *gif;
+    int iErr, rc, iLen;
+    int64_t i64Pixels;
+
+    BufScreen(&buf, 65288, 65535, 1);
+    BufDescriptor(&buf, 0, 0, 65288, 65535, 0);
+    LZWStart(&lzw, &buf, 2);
+    LZWPutCode(&lzw, 0);
+    i64Pixels = iLen = 1;
+    while (lzw.iNextCode < 4096) { // each new string is the last one + 0
+        LZWPutCode(&lzw, lzw.iNextCode);
+        i64Pixels += ++iLen;
+    }
+    while (i64Pixels + iLen <= 0x90000000LL) {
+        LZWPutCode(&lzw, 4095);
+        i64Pixels += iLen;
+    }
+    LZWFinish(&lzw);
+    BufByte(&buf, 0x3b);
+    if (BufWrite(&buf, TempPath("huge.gif")) != GIF_OK)
+        return Fail(szName, "can't write the input file");
+
+    gif = DGifOpenFileName(TempPath("huge.gif"), &iErr);
+    if (gif == NULL)
+        return Fail(szName, "can't open the input file");
+    iHugeRows = 0;
+    bHugeOK = true;
+    rc = DGifSlurpScanlines(gif, HugeFrameLine, 2);
+    DGifCloseFile(gif, &iErr);
+    if (rc != GIF_OK || iHugeRows != 65535 || !bHugeOK)
+        return Fail(szName, "the frame wasn't decoded correctly");
+
+    // a window which can't be allocated is an error, not a crash
+    gif = DGifOpenFileName(TempPath("huge.gif"), &iErr);
+    if (gif == NULL)
+        return Fail(szName, "can't open the input file");
+    iHugeRows = 0;
+    rc = DGifSlurpScanlines(gif, HugeFrameLine, 20000);
+    DGifCloseFile(gif, &iErr);
+    if (rc != D_GIF_ERR_DATA_TOO_BIG || iHugeRows != 0)
+        return Fail(szName, "a 20000 line window was accepted");
+    return GIF_OK;
+} /* TestScanlinesHugeFrame() */
+
+//
+// TestLimits
+//
+// GifSetLimits() with a frame beyond MaxPixels or MaxMemory: the file fails
+// with D_GIF_ERR_LIMIT_EXCEEDED and the frame's pixels are never allocated,
+// with and without GIF_OPT_ARENA and with DGifNextFrame()
+//
+static int TestLimits(void)
+{
+    const char *szName = "limits";
+    GIFBUF buf = {0};
+    GifFileType *gif;
+    GifLimits limits;
+    ALLOCCOUNT count;
+    uint8_t ucPixels[8 * 8];
+    int iErr, iPass, rc;
+
+    memset(ucPixels, 1, sizeof(ucPixels));
+    BufScreen(&buf, 4000, 4000, 2);
+    BufImage(&buf, 0, 0, 8, 8, 0, 2, ucPixels);
+    BufEmptyImage(&buf, 4000, 4000); // 16M pixels in a few bytes
+    BufByte(&buf, 0x3b);
+    if (BufWrite(&buf, TempPath("limits.gif")) != GIF_OK)
+        return Fail(szName, "can't write the input file");
+
+    for (iPass = 0; iPass < 4; iPass++) {
+        memset(&limits, 0, sizeof(limits));
+        if (iPass & 1)
+            limits.MaxMemory = 1 << 20;
+        else
+            limits.MaxPixels = 1000000;
+        gif = OpenCounting(TempPath("limits.gif"), &count, (iPass & 2) ? GIF_OPT_ARENA : 0, &limits);
+        if (gif == NULL)
+            return Fail(szName, "can't open the input file");
+        rc = DGifSlurp(gif);
+        iErr = gif->Error;
+        DGifCloseFile(gif, &iErr);
+        if (rc == GIF_OK || iErr != D_GIF_ERR_LIMIT_EXCEEDED)
+            return Fail(szName, (iPass & 1) ? "MaxMemory wasn't applied" : "MaxPixels wasn't applied");
+        if (count.iLargest >= 4000 * 4000 || (limits.MaxMemory && count.u64Total > limits.MaxMemory))
+            return Fail(szName, "the frame was allocated before it was refused");
+    }
+
+    // frame by frame, the first one still comes out
+    memset(&limits, 0, sizeof(limits));
+    limits.MaxPixels = 1000000;
+    gif = OpenCounting(TempPath("limits.gif"), &count, 0, &limits);
+    if (gif == NULL)
+        return Fail(szName, "can't open the input file");
+    rc = (DGifNextFrame(gif) != NULL && DGifNextFrame(gif) == NULL && gif->Error == D_GIF_ERR_LIMIT_EXCEEDED);
+    DGifCloseFile(gif, &iErr);
+    if (!rc || count.iLargest >= 4000 * 4000)
+        return Fail(szName, "DGifNextFrame() didn't stop at the limit");
+
+    // and without limits the file is fine
+    gif = OpenCounting(TempPath("limits.gif"), &count, 0, NULL);
+    if (gif == NULL)
+        return Fail(szName, "can't open the input file");
+    rc = (DGifSlurp(gif) == GIF_OK && gif->ImageCount == 2);
+    DGifCloseFile(gif, &iErr);
+    if (!rc)
+        return Fail(szName, "the file can't be decoded without limits");
+    return GIF_OK;
+} /* TestLimits() */
+
+//
+// TestHugeDescriptor
+//
+// A 65535x65535 frame has more pixels than fit an int. The whole-frame
+// decoders refuse it with D_GIF_ERR_DATA_TOO_BIG (no limits set) instead of
+// computing a wrapped size.
+//
+static int TestHugeDescriptor(void)
+{
+    const char *szName = "huge_descriptor";
+    GIFBUF buf = {0};
+    GifFileType *gif;
+    ALLOCCOUNT count;
+    int iErr, iPass, rc;
+
+    BufScreen(&buf, 65535, 65535, 2);
+    BufEmptyImage(&buf, 65535, 65535);
+    BufByte(&buf, 0x3b);
+    if (BufWrite(&buf, TempPath("huge_desc.gif")) != GIF_OK)
+        return Fail(szName, "can't write the input file");
+    for (iPass = 0; iPass < 3; iPass++) {
+        gif = OpenCounting(TempPath("huge_desc.gif"), &count, (iPass == 1) ? GIF_OPT_ARENA : 0, NULL);
+        if (gif == NULL)
+            return Fail(szName, "can't open the input file");
+        if (iPass < 2)
+            rc = (DGifSlurp(gif) != GIF_OK && gif->Error == D_GIF_ERR_DATA_TOO_BIG);
+        else
+            rc = (DGifNextFrame(gif) == NULL && gif->Error == D_GIF_ERR_DATA_TOO_BIG);
+        DGifCloseFile(gif, &iErr);
+        if (!rc)
+            return Fail(szName, "the frame wasn't refused");
+        if (count.iLargest >= 0x7fffffff)
+            return Fail(szName, "the frame was allocated");
+    }
+    return GIF_OK;
+} /* TestHugeDescriptor() */
+
+// Write the file in pBuf and run DGifValidate() on it; returns its result
+// (-1 if the file can't be written or opened) and the frames it checked
+static int ValidateBuf(GIFBUF *pBuf, int *piFrames)
+{
+    GifFileType *gif;
+    int iErr, rc;
+
+    *piFrames = -1;
+    if (BufWrite(pBuf, TempPath("validate.gif")) != GIF_OK)
+        return -1;
+    gif = DGifOpenFileName(TempPath("validate.gif"), &iErr);
+    if (gif == NULL)
+        return -1;
+    rc = DGifValidate(gif);
+    *piFrames = gif->ImageCount;
+    DGifCloseFile(gif, &iErr);
+    return rc;
+} /* ValidateBuf() */
+
+//
+// TestValidate
+//
+// DGifValidate() accepts a well formed animation and points out the usual
+// defects of broken uploads: truncated sub-blocks, a missing EOI code, too
+// many or too few pixels and a missing trailer
+//
+static int TestValidate(void)
+{
+    const char *szName = "validate";
+    GIFBUF buf = {0};
+    LZWWRITER lzw;
+    GifFileType *gif;
+    uint8_t ucPixels[8 * 4 + 1], ucComment[300];
+    int i, iFrames, iErr, iLen, rc;
+
+    for (i = 0; i < 8 * 4 + 1; i++)
+        ucPixels[i] = (uint8_t)((i * 5) & 3);
+    memset(ucComment, 'v', sizeof(ucComment));
+
+    // an animation with a comment, a local palette and an interlaced frame
+    BufScreen(&buf, 8, 4, 2);
+    BufExtension(&buf, COMMENT_EXT_FUNC_CODE, ucComment, sizeof(ucComment));
+    BufGCB(&buf, 10, -1);
+    BufImage(&buf, 0, 0, 8, 4, 0, 2, ucPixels);
+    BufGCB(&buf, 10, 3);
+    BufImage(&buf, 2, 1, 4, 2, 3, 3, ucPixels);
+    BufGCB(&buf, 20, -1);
+    BufDescriptor(&buf, 0, 0, 8, 4, 0x40); // interlaced, the same pixels in row order
+    BufPixels(&buf, 2, ucPixels, 8 * 4);
+    BufByte(&buf, 0x3b);
+    rc = ValidateBuf(&buf, &iFrames);
+    if (rc != GIF_OK || iFrames != 3)
+        return Fail(szName, "a valid animation was refused");
+    gif = DGifOpenFileName(TempPath("validate.gif"), &iErr); // and really is valid
+    rc = (gif != NULL && DGifSlurp(gif) == GIF_OK && gif->ImageCount == 3);
+    DGifCloseFile(gif, &iErr);
+    if (!rc)
+        return Fail(szName, "the valid animation doesn't decode");
+
+    // the file ends in the middle of a sub-block of the second frame
+    BufScreen(&buf, 8, 4, 2);
+    BufImage(&buf, 0, 0, 8, 4, 0, 2, ucPixels);
+    iLen = buf.iLen;
+    BufImage(&buf, 0, 0, 8, 4, 0, 2, ucPixels);
+    buf.iLen = iLen + 10 + 1 + 5; // descriptor, code size, sub-block length and 4 of its bytes
+    rc = ValidateBuf(&buf, &iFrames);
+    if (rc != D_GIF_ERR_EOF_TOO_SOON || iFrames != 1)
+        return Fail(szName, "a truncated sub-block wasn't found");
+
+    // an extension cut short
+    BufScreen(&buf, 8, 4, 2);
+    BufExtension(&buf, COMMENT_EXT_FUNC_CODE, ucComment, sizeof(ucComment));
+    buf.iLen -= 100;
+    rc = ValidateBuf(&buf, &iFrames);
+    if (rc != D_GIF_ERR_EOF_TOO_SOON || iFrames != 0)
+        return Fail(szName, "a truncated extension wasn't found");
+
+    // all of the pixels, but no EOI code
+    BufScreen(&buf, 8, 4, 2);
+    BufDescriptor(&buf, 0, 0, 8, 4, 0);
+    LZWStart(&lzw, &buf, 2);
+    for (i = 0; i < 8 * 4; i++)
+        LZWPutCode(&lzw, ucPixels[i]);
+    if (lzw.iBitCount)
+        lzw.ucBlock[lzw.iBlockLen++] = (uint8_t)lzw.u64Bits;
+    LZWFlushBlock(&lzw);
+    BufByte(&buf, 0);
+    BufByte(&buf, 0x3b);
+    rc = ValidateBuf(&buf, &iFrames); // the padding bits of the last byte may read as one more code
+    if ((rc != D_GIF_ERR_EOF_TOO_SOON && rc != D_GIF_ERR_IMAGE_DEFECT) || iFrames != 0)
+        return Fail(szName, "a missing EOI code wasn't found");
+
+    // one pixel too few and one too many
+    for (i = 0; i < 2; i++) {
+        BufScreen(&buf, 8, 4, 2);
+        BufDescriptor(&buf, 0, 0, 8, 4, 0);
+        BufPixels(&buf, 2, ucPixels, i ? 33 : 31);
+        BufByte(&buf, 0x3b);
+        rc = ValidateBuf(&buf, &iFrames);
+        if (rc != D_GIF_ERR_IMAGE_DEFECT || iFrames != 0)
+            return Fail(szName, i ? "extra pixels weren't found" : "missing pixels weren't found");
+    }
+
+    // no trailer after the last frame
+    BufScreen(&buf, 8, 4, 2);
+    BufImage(&buf, 0, 0, 8, 4, 0, 2, ucPixels);
+    rc = ValidateBuf(&buf, &iFrames);
+    if (rc != D_GIF_ERR_EOF_TOO_SOON || iFrames != 1)
+        return Fail(szName, "a missing trailer wasn't found");
+    return GIF_OK;
+} /* TestValidate() */
+
+//
+// TestRecordWalk
+//
+// Walk an animation with multi-block extensions, a local palette and two
+// interlaced frames with the record-at-a-time API, one row per DGifGetLine(),
+// and compare every record with what DGifSlurp() makes of the same file.
+// DGifGetLine() hands out the rows in file order, so the interlaced frames
+// are put back in row order here first.
+//
+static int TestRecordWalk(void)
+{
+    const char *szName = "record_walk";
+    static const int iPassStart[4] = {0, 4, 2, 1}, iPassStep[4] = {8, 8, 4, 2};
+    static const struct {
+        int iLeft, iTop, iWidth, iHeight, iLocalBits;
+        bool bInterlace;
+    } frames[4] = {{0, 0, 20, 11, 0, false}, {3, 2, 7, 5, 4, false}, {0, 0, 20, 11, 0, true}, {1, 1, 5, 3, 0, true}};
+    GIFBUF buf = {0};
+    GifFileType *gif, *gifRef;
+    GifRecordType type;
+    GifByteType *pExt;
+    SavedImage *pPage;
+    ExtensionBlock *pEB;
+    uint8_t ucPixels[20 * 11], ucRows[20 * 11], ucComment[300], ucLoop[3] = {1, 0, 0};
+    int i, x, y, iPass, iFrame, iBlock, iCode, iErr, rc = GIF_OK;
+
+    memset(ucComment, 'r', sizeof(ucComment));
+    BufScreen(&buf, 20, 11, 3);
+    BufExtension(&buf, APPLICATION_EXT_FUNC_CODE, (const uint8_t *)"NETSCAPE2.0", 11);
+    buf.iLen--; // a second sub-block with the loop count
+    BufSubBlocks(&buf, ucLoop, sizeof(ucLoop));
+    for (i = 0; i < 4; i++) {
+        for (x = 0; x < frames[i].iWidth * frames[i].iHeight; x++)
+            ucPixels[x] = (uint8_t)((x + 3 * (x / frames[i].iWidth) + i) & 7); // rows differ
+        if (i == 3)
+            BufExtension(&buf, COMMENT_EXT_FUNC_CODE, ucComment, sizeof(ucComment));
+        BufGCB(&buf, 10 * i, (i & 1) ? 2 : -1);
+        if (frames[i].bInterlace) { // the pixels in row order are stored as they are
+            BufDescriptor(&buf, frames[i].iLeft, frames[i].iTop, frames[i].iWidth, frames[i].iHeight, 0x40);
+            BufPixels(&buf, 3, ucPixels, frames[i].iWidth * frames[i].iHeight);
+        } else {
+            BufImage(&buf, frames[i].iLeft, frames[i].iTop, frames[i].iWidth, frames[i].iHeight, frames[i].iLocalBits, 3, ucPixels);
+        }
+    }
+    BufByte(&buf, 0x3b);
+    if (BufWrite(&buf, TempPath("walk.gif")) != GIF_OK)
+        return Fail(szName, "can't write the input file");
+    gifRef = DGifOpenFileName(TempPath("walk.gif"), &iErr);
+    if (gifRef == NULL || DGifSlurp(gifRef) != GIF_OK || gifRef->ImageCount != 4) {
+        DGifCloseFile(gifRef, &iErr);
+        return Fail(szName, "DGifSlurp() failed");
+    }
+    gif = DGifOpenFileName(TempPath("walk.gif"), &iErr);
+    if (gif == NULL) {
+        DGifCloseFile(gifRef, &iErr);
+        return Fail(szName, "can't open the file");
+    }
+    iFrame = iBlock = 0;
+    do {
+        if (DGifGetRecordType(gif, &type) != GIF_OK) {
+            rc = Fail(szName, "DGifGetRecordType() failed");
+            break;
+        }
+        if (type == EXTENSION_RECORD_TYPE) {
+            if (iFrame >= 4) {
+                rc = Fail(szName, "an extension after the last frame");
+                break;
+            }
+            pPage = &gifRef->SavedImages[iFrame];
+            if (DGifGetExtension(gif, &iCode, &pExt) != GIF_OK) {
+                rc = Fail(szName, "DGifGetExtension() failed");
+                break;
+            }
+            // the same blocks as DGifSlurp(), continuation sub-blocks with Function 0
+            while (pExt != NULL && rc == GIF_OK) {
+                pEB = &pPage->ExtensionBlocks[iBlock];
+                if (iBlock >= pPage->ExtensionBlockCount || pEB->Function != iCode || pEB->ByteCount != pExt[0] ||
+                    memcmp(pEB->Bytes, &pExt[1], pExt[0]) != 0)
+                    rc = Fail(szName, "an extension sub-block differs");
+                iBlock++;
+                iCode = CONTINUE_EXT_FUNC_CODE;
+                if (rc == GIF_OK && DGifGetExtensionNext(gif, &pExt) != GIF_OK)
+                    rc = Fail(szName, "DGifGetExtensionNext() failed");
+            }
+        } else if (type == IMAGE_DESC_RECORD_TYPE) {
+            if (iFrame >= 4 || DGifGetImageDesc(gif) != GIF_OK) {
+                rc = Fail(szName, "DGifGetImageDesc() failed");
+                break;
+            }
+            pPage = &gifRef->SavedImages[iFrame];
+            if (iBlock != pPage->ExtensionBlockCount)
+                rc = Fail(szName, "an extension sub-block is missing");
+            else if (gif->ImageCount != iFrame + 1 || gif->Image.Left != pPage->ImageDesc.Left || gif->Image.Top != pPage->ImageDesc.Top ||
+                gif->Image.Width != pPage->ImageDesc.Width || gif->Image.Height != pPage->ImageDesc.Height ||
+                gif->Image.Interlace != pPage->ImageDesc.Interlace || (gif->Image.ColorMap == NULL) != (pPage->ImageDesc.ColorMap == NULL))
+                rc = Fail(szName, "the image descriptor differs");
+            else if (gif->Image.ColorMap != NULL && (gif->Image.ColorMap->ColorCount != pPage->ImageDesc.ColorMap->ColorCount ||
+                memcmp(gif->Image.ColorMap->Colors, pPage->ImageDesc.ColorMap->Colors, gif->Image.ColorMap->ColorCount * sizeof(GifColorType)) != 0))
+                rc = Fail(szName, "the local palette differs");
+            // one row at a time, put where it belongs
+            iPass = 0;
+            y = gif->Image.Interlace ? iPassStart[0] : 0;
+            for (i = 0; i < gif->Image.Height && rc == GIF_OK; i++) {
+                while (gif->Image.Interlace && y >= gif->Image.Height)
+                    y = iPassStart[++iPass];
+                if (DGifGetLine(gif, &ucRows[y * gif->Image.Width], gif->Image.Width) != GIF_OK)
+                    rc = Fail(szName, "DGifGetLine() failed");
+                y += gif->Image.Interlace ? iPassStep[iPass] : 1;
+            }
+            if (rc == GIF_OK && DGifGetLine(gif, ucRows, 1) == GIF_OK)
+                rc = Fail(szName, "DGifGetLine() read past the frame");
+            if (rc == GIF_OK && memcmp(ucRows, pPage->RasterBits, gif->Image.Width * gif->Image.Height) != 0)
+                rc = Fail(szName, "the pixels differ");
+            iFrame++;
+            iBlock = 0;
+        }
+    } while (type != TERMINATE_RECORD_TYPE && rc == GIF_OK);
+    if (rc == GIF_OK && iFrame != 4)
+        rc = Fail(szName, "frames are missing");
+    DGifCloseFile(gif, &iErr);
+    DGifCloseFile(gifRef, &iErr);
+    return rc;
+} /* TestRecordWalk() */
+
+// What DGifDecodeBatch() should give for one item, and what it gave
+typedef struct {
+    GifFileType *gifRef; // the same file decoded by DGifSlurp(); NULL = must fail
+    int iCalls;
+    bool bSame;
+} BATCHCHECK;
+
+static void BatchDone(GifFileType *gif, int iItem, int iErr, void *pUser)
+{
+    BATCHCHECK *pCheck = (BATCHCHECK *)pUser;
+
+    (void)iItem;
+    pCheck->iCalls++;
+    if (pCheck->gifRef == NULL)
+        pCheck->bSame = (gif == NULL && iErr != GIF_OK);
+    else
+        pCheck->bSame = (gif != NULL && iErr == GIF_OK && SameFrames(pCheck->gifRef, gif) == GIF_OK);
+} /* BatchDone() */
+
+// An animation of iFrames frames of iWidth x iHeight which differ from each
+// other, with a local palette on the second frame and the third one interlaced
+static void BufAnimation(GIFBUF *pBuf, int iWidth, int iHeight, int iFrames, int iSeed)
+{
+    uint8_t *pPixels = (uint8_t *)malloc(iWidth * iHeight);
+    int i, x, y;
+
+    BufScreen(pBuf, iWidth, iHeight, 8);
+    for (i = 0; i < iFrames; i++) {
+        for (y = 0; y < iHeight; y++)
+            for (x = 0; x < iWidth; x++)
+                pPixels[y * iWidth + x] = (uint8_t)(x * 3 + y * 5 + (i + iSeed) * 7 + ((x * y) >> 4));
+        BufGCB(pBuf, 4 + i, (i & 1) ? i : -1);
+        if (i == 1) {
+            BufImage(pBuf, 0, 0, iWidth, iHeight, 8, 8, pPixels);
+        } else if (i == 2) {
+            BufDescriptor(pBuf, 0, 0, iWidth, iHeight, 0x40);
+            BufPixels(pBuf, 8, pPixels, iWidth * iHeight);
+        } else {
+            BufImage(pBuf, 0, 0, iWidth, iHeight, 0, 8, pPixels);
+        }
+    }
+    BufByte(pBuf, 0x3b);
+    free(pPixels);
+} /* BufAnimation() */
+
+//
+// BatchMatchesSlurp
+//
+// Decode a mix of big animations (whose frames are shared out among the
+// workers), small files and a missing one with DGifDecodeBatch() on
+// iThreads threads, by name, by file handle and from memory, and check
+// each result against DGifSlurp()
+//
+#define BATCH_ITEMS 14
+static int BatchMatchesSlurp(const char *szName, int iThreads)
+{
+    GifBatchItem items[BATCH_ITEMS];
+    BATCHCHECK checks[BATCH_ITEMS];
+    GIFBUF buf = {0}, bufs[BATCH_ITEMS];
+    char szFile[32], szPaths[BATCH_ITEMS][512]; // TempPath() only keeps a few
+    int i, iErr, rc = GIF_OK;
+
+    memset(items, 0, sizeof(items));
+    memset(checks, 0, sizeof(checks));
+    memset(bufs, 0, sizeof(bufs));
+    for (i = 0; i < BATCH_ITEMS; i++)
+        items[i].FileHandle = -1;
+    for (i = 0; i < BATCH_ITEMS && rc == GIF_OK; i++) {
+        snprintf(szFile, sizeof(szFile), "batch%d.gif", i);
+        items[i].UserData = &checks[i];
+        snprintf(szPaths[i], sizeof(szPaths[i]), "%s", TempPath(szFile));
+        items[i].FileName = szPaths[i];
+        if (i == BATCH_ITEMS - 1)
+            break; // doesn't exist
+        if ((i % 4) == 0) // 5 frames of 512x480, over GIF_BATCH_SPLIT_PIXELS
+            BufAnimation(&buf, 512, 480, 5, i);
+        else
+            BufAnimation(&buf, 8 + i, 3 + i, 1 + (i % 3), i);
+        if ((i % 3) == 1) { // from memory; keep a copy
+            BufPut(&bufs[i], buf.p, buf.iLen);
+            items[i].Data = bufs[i].p;
+            items[i].DataSize = bufs[i].iLen;
+        }
+        if (BufWrite(&buf, items[i].FileName) != GIF_OK)
+            rc = Fail(szName, "can't write an input file");
+        checks[i].gifRef = DGifOpenFileName(items[i].FileName, &iErr);
+        if (checks[i].gifRef == NULL || DGifSlurp(checks[i].gifRef) != GIF_OK)
+            rc = Fail(szName, "DGifSlurp() failed");
+        if (items[i].Data != NULL) {
+            items[i].FileName = NULL;
+        } else if ((i % 3) == 2) { // by handle, which the library closes
+            items[i].FileHandle = open(items[i].FileName, O_RDONLY);
+            items[i].FileName = NULL;
+        }
+    }
+    if (rc == GIF_OK) {
+        if (DGifDecodeBatch(items, BATCH_ITEMS, iThreads, BatchDone) != GIF_OK)
+            rc = Fail(szName, "DGifDecodeBatch() failed");
+        for (i = 0; i < BATCH_ITEMS && rc == GIF_OK; i++) {
+            if (checks[i].iCalls != 1)
+                rc = Fail(szName, "an item wasn't reported exactly once");
+            else if (!checks[i].bSame)
+                rc = Fail(szName, "an item doesn't match DGifSlurp()");
+        }
+    } else {
+        for (i = 0; i < BATCH_ITEMS; i++)
+            if (items[i].FileHandle >= 0)
+                close(items[i].FileHandle); // never handed to the library
+    }
+    for (i = 0; i < BATCH_ITEMS; i++) {
+        DGifCloseFile(checks[i].gifRef, &iErr);
+        free(bufs[i].p);
+    }
+    return rc;
+} /* BatchMatchesSlurp() */
+
+//
+// TestBatch
+//
+// DGifDecodeBatch() with plain reads, on one and on several threads
+//
+static int TestBatch(void)
+{
+    const char *szName = "batch";
+
+    if (GifSetInputBackend(GIF_INPUT_POSIX) != GIF_OK)
+        return Fail(szName, "can't select GIF_INPUT_POSIX");
+    if (BatchMatchesSlurp(szName, 1) != GIF_OK || BatchMatchesSlurp(szName, 4) != GIF_OK)
+        return GIF_ERROR;
+    return GIF_OK;
+} /* TestBatch() */
+
+//
+// TestBatchURing
+//
+// The same batch read through io_uring; skipped where the build or the
+// kernel doesn't have it (ENOSYS, or EPERM in a sandbox)
+//
+static int TestBatchURing(void)
+{
+    const char *szName = "batch_uring";
+    int rc;
+
+    if (GifSetInputBackend(GIF_INPUT_URING) != GIF_OK)
+        return Skip(szName, "io_uring isn't available");
+    rc = BatchMatchesSlurp(szName, 1);
+    if (rc == GIF_OK)
+        rc = BatchMatchesSlurp(szName, 4);
+    GifSetInputBackend(GIF_INPUT_POSIX);
+    return rc;
+} /* TestBatchURing() */
+
+// Write a file of one frame (pPixels in row order, all < 1 << iBits) with
+// EGifSpew(); the color resolution is the encoder's LZW code size
+static int SpewFrame(const char *szPath, int iWidth, int iHeight, bool bInterlace, int iBits, uint8_t *pPixels)
+{
+    GifFileType *gif;
+    GifColorType colors[256];
+    SavedImage image;
+    int i, iErr;
+
+    gif = EGifOpenFileName(szPath, false, &iErr);
+    if (gif == NULL)
+        return GIF_ERROR;
+    for (i = 0; i < 256; i++)
+        colors[i].Red = colors[i].Green = colors[i].Blue = (GifByteType)i;
+    gif->SWidth = iWidth;
+    gif->SHeight = iHeight;
+    gif->SColorResolution = iBits;
+    gif->SColorMap = GifMakeMapObject(1 << iBits, colors);
+    memset(&image, 0, sizeof(image));
+    image.ImageDesc.Width = iWidth;
+    image.ImageDesc.Height = iHeight;
+    image.ImageDesc.Interlace = bInterlace;
+    image.RasterBits = pPixels;
+    if (gif->SColorMap == NULL || GifMakeSavedImage(gif, &image) == NULL) {
+        EGifCloseFile(gif, &iErr);
+        return GIF_ERROR;
+    }
+    return (EGifSpew(gif) == GIF_OK) ? GIF_OK : GIF_ERROR;
+} /* SpewFrame() */
+
+// Row y of an interlaced frame of iHeight rows in the order they're stored
+static int PassRow(int y, int iHeight)
+{
+    static const int iPassStart[4] = {0, 4, 2, 1}, iPassStep[4] = {8, 8, 4, 2};
+    int iPass, iRows;
+
+    for (iPass = 0; iPass < 4; iPass++) {
+        iRows = (iHeight - iPassStart[iPass] + iPassStep[iPass] - 1) / iPassStep[iPass];
+        if (iRows < 0)
+            iRows = 0;
+        if (y < iRows)
+            return iPassStart[iPass] + y * iPassStep[iPass];
+        y -= iRows;
+    }
+    return -1;
+} /* PassRow() */
+
+//
+// TestInterlaceRoundTrip
+//
+// Interlaced frames of 1 to 9 rows (every mix of empty and partial passes),
+// a tall frame 1 pixel wide and one wider than the scratch row of
+// GIFDeInterlaceRows() are encoded and decoded again by DGifSlurp() (plain
+// and GIF_OPT_ARENA) and DGifNextFrame(). DGifGetLine() checks that the
+// encoder stored the rows in pass order, so the two can't both be wrong.
+//
+static int TestInterlaceRoundTrip(void)
+{
+    const char *szName = "interlace_round_trip";
+    static const int iSizes[][2] = {{5, 1}, {5, 2}, {5, 3}, {5, 4}, {5, 5}, {5, 6}, {5, 7}, {5, 8}, {5, 9},
+                                    {1, 65535}, {3, 1001}, {60000, 11}};
+    GifFileType *gif;
+    SavedImage *pPage;
+    uint8_t *pPixels, *pRow;
+    const char *szWhy = NULL;
+    char szReason[128];
+    int i, x, y, iWidth, iHeight, iPass, iErr;
+
+    for (i = 0; i < (int)(sizeof(iSizes) / sizeof(iSizes[0])) && szWhy == NULL; i++) {
+        iWidth = iSizes[i][0];
+        iHeight = iSizes[i][1];
+        pPixels = (uint8_t *)malloc((size_t)iWidth * iHeight);
+        pRow = (uint8_t *)malloc(iWidth);
+        for (y = 0; y < iHeight; y++)
+            for (x = 0; x < iWidth; x++)
+                pPixels[(size_t)y * iWidth + x] = (uint8_t)(y * 13 + (y >> 8) * 5 + x);
+        if (SpewFrame(TempPath("interlace.gif"), iWidth, iHeight, true, 8, pPixels) != GIF_OK)
+            szWhy = "EGifSpew() failed";
+        for (iPass = 0; iPass < 4 && szWhy == NULL; iPass++) {
+            gif = DGifOpenFileName(TempPath("interlace.gif"), &iErr);
+            if (gif == NULL) {
+                szWhy = "can't open the file";
+                break;
+            }
+            pPage = NULL;
+            if (iPass == 0 || iPass == 1) {
+                GifSetOptions(gif, iPass ? GIF_OPT_ARENA : 0);
+                if (DGifSlurp(gif) == GIF_OK && gif->ImageCount == 1)
+                    pPage = &gif->SavedImages[0];
+            } else if (iPass == 2) {
+                pPage = DGifNextFrame(gif);
+            } else { // the stored order, one row at a time
+                GifRecordType type;
+                if (DGifGetRecordType(gif, &type) != GIF_OK || type != IMAGE_DESC_RECORD_TYPE || DGifGetImageDesc(gif) != GIF_OK)
+                    szWhy = "DGifGetImageDesc() failed";
+                for (y = 0; y < iHeight && szWhy == NULL; y++) {
+                    if (DGifGetLine(gif, pRow, iWidth) != GIF_OK)
+                        szWhy = "DGifGetLine() failed";
+                    else if (memcmp(pRow, &pPixels[(size_t)PassRow(y, iHeight) * iWidth], iWidth) != 0)
+                        szWhy = "the rows weren't stored in pass order";
+                }
+            }
+            if (iPass < 3 && szWhy == NULL) {
+                if (pPage == NULL || !pPage->ImageDesc.Interlace || pPage->ImageDesc.Width != iWidth || pPage->ImageDesc.Height != iHeight)
+                    szWhy = "the frame didn't decode";
+                else if (memcmp(pPage->RasterBits, pPixels, (size_t)iWidth * iHeight) != 0)
+                    szWhy = "the rows came back in the wrong order";
+            }
+            DGifCloseFile(gif, &iErr);
+        }
+        free(pPixels);
+        free(pRow);
+    }
+    if (szWhy != NULL) {
+        snprintf(szReason, sizeof(szReason), "%s (%d x %d)", szWhy, iWidth, iHeight);
+        return Fail(szName, szReason);
+    }
+    return GIF_OK;
+} /* TestInterlaceRoundTrip() */
+
+// Test image of one of these kinds (IMAGE_*); the noise comes from *pSeed
+#define IMAGE_FLAT 0 // flat bands with a few specks
+#define IMAGE_NOISE 1
+#define IMAGE_2COLORS 2
+#define IMAGE_RUNS 3 // short runs of 16 colors
+static void FillImage(uint8_t *pPixels, int iWidth, int iHeight, int iKind, uint32_t *pSeed)
+{
+    int x, y;
+    uint8_t *d = pPixels;
+
+    for (y = 0; y < iHeight; y++) {
+        for (x = 0; x < iWidth; x++) {
+            *pSeed = *pSeed * 1103515245 + 12345;
+            if (iKind == IMAGE_FLAT)
+                *d++ = (uint8_t)((((*pSeed >> 16) & 255) < 2) ? (*pSeed >> 8) : (y / 37));
+            else if (iKind == IMAGE_NOISE)
+                *d++ = (uint8_t)(*pSeed >> 16);
+            else if (iKind == IMAGE_2COLORS)
+                *d++ = (uint8_t)(((x / 3) ^ (y / 2)) & 1);
+            else
+                *d++ = (uint8_t)((x / 7 + y) & 15);
+        }
+    }
+} /* FillImage() */
+
+// Decode the one frame of szPath into a copy (NULL on failure)
+static uint8_t *DecodeFrame(const char *szPath, int iSize)
+{
+    GifFileType *gif;
+    uint8_t *pPixels = NULL;
+    int iErr;
+
+    gif = DGifOpenFileName(szPath, &iErr);
+    if (gif != NULL && DGifSlurp(gif) == GIF_OK && gif->ImageCount == 1 &&
+        gif->SavedImages[0].ImageDesc.Width * gif->SavedImages[0].ImageDesc.Height == iSize) {
+        pPixels = (uint8_t *)malloc(iSize);
+        memcpy(pPixels, gif->SavedImages[0].RasterBits, iSize);
+    }
+    DGifCloseFile(gif, &iErr);
+    return pPixels;
+} /* DecodeFrame() */
+
+//
+// TestCpuVariants
+//
+// Every LZW kernel variant this build and CPU can run (GifSetCpuVariant)
+// must decode the same pixels as GIF_CPU_GENERIC, and what it encodes must
+// decode to the source. The images have long flat runs (long strings for
+// LZWCopyBytes), noise (a full code table), a 2-color pattern with 2-bit
+// codes and an interlaced frame with 4-bit codes.
+//
+#define CPU_IMAGES 4
+static int TestCpuVariants(void)
+{
+    const char *szName = "cpu_variants";
+    static const int iSizes[CPU_IMAGES][2] = {{640, 480}, {301, 257}, {123, 45}, {200, 99}};
+    static const int iBits[CPU_IMAGES] = {8, 8, 2, 4}; // 8 has kernels of its own
+    uint8_t *pImages[CPU_IMAGES], *pGeneric[CPU_IMAGES], *pPixels;
+    const char *szWhy = NULL;
+    char szFile[32], szReason[128];
+    int i, iSize, iVariant, iOriginal, iTried = 0;
+    uint32_t u32Seed = 12345;
+
+    iOriginal = GifGetCpuVariant();
+    for (i = 0; i < CPU_IMAGES; i++) {
+        pImages[i] = (uint8_t *)malloc(iSizes[i][0] * iSizes[i][1]);
+        FillImage(pImages[i], iSizes[i][0], iSizes[i][1], i, &u32Seed);
+    }
+    // the reference: encoded and decoded by the generic kernels
+    if (GifSetCpuVariant(GIF_CPU_GENERIC) != GIF_OK)
+        szWhy = "GIF_CPU_GENERIC can't be selected";
+    for (i = 0; i < CPU_IMAGES; i++) {
+        snprintf(szFile, sizeof(szFile), "cpu%d.gif", i);
+        iSize = iSizes[i][0] * iSizes[i][1];
+        pGeneric[i] = NULL;
+        if (szWhy == NULL && SpewFrame(TempPath(szFile), iSizes[i][0], iSizes[i][1], i == 3, iBits[i], pImages[i]) != GIF_OK)
+            szWhy = "EGifSpew() failed";
+        if (szWhy == NULL && (pGeneric[i] = DecodeFrame(TempPath(szFile), iSize)) == NULL)
+            szWhy = "the generic kernels can't decode the file";
+        if (szWhy == NULL && memcmp(pGeneric[i], pImages[i], iSize) != 0)
+            szWhy = "the generic kernels don't round-trip";
+    }
+    for (iVariant = GIF_CPU_GENERIC + 1; iVariant <= GIF_CPU_AVX2 && szWhy == NULL; iVariant++) {
+        if (GifSetCpuVariant(iVariant) != GIF_OK)
+            continue; // not in this build or on this CPU
+        iTried++;
+        for (i = 0; i < CPU_IMAGES && szWhy == NULL; i++) {
+            iSize = iSizes[i][0] * iSizes[i][1];
+            snprintf(szFile, sizeof(szFile), "cpu%d.gif", i);
+            pPixels = DecodeFrame(TempPath(szFile), iSize);
+            if (pPixels == NULL || memcmp(pPixels, pGeneric[i], iSize) != 0)
+                szWhy = "it doesn't decode like GIF_CPU_GENERIC";
+            free(pPixels);
+            snprintf(szFile, sizeof(szFile), "cpu%d_%d.gif", i, iVariant);
+            if (szWhy == NULL && SpewFrame(TempPath(szFile), iSizes[i][0], iSizes[i][1], i == 3, iBits[i], pImages[i]) != GIF_OK)
+                szWhy = "EGifSpew() failed";
+            GifSetCpuVariant(GIF_CPU_GENERIC); // its file is read back by the reference
+            pPixels = (szWhy == NULL) ? DecodeFrame(TempPath(szFile), iSize) : NULL;
+            if (szWhy == NULL && (pPixels == NULL || memcmp(pPixels, pImages[i], iSize) != 0))
+                szWhy = "what it encodes doesn't decode to the source";
+            free(pPixels);
+            GifSetCpuVariant(iVariant);
+        }
+        if (szWhy != NULL) {
+            snprintf(szReason, sizeof(szReason), "variant %d, image %d: %s", iVariant, i - 1, szWhy);
+            szWhy = szReason;
+        }
+    }
+    GifSetCpuVariant(iOriginal);
+    for (i = 0; i < CPU_IMAGES; i++) {
+        free(pImages[i]);
+        free(pGeneric[i]);
+    }
+    if (szWhy != NULL)
+        return Fail(szName, szWhy);
+    if (iTried == 0)
+        return Skip(szName, "only GIF_CPU_GENERIC is available");
+    return GIF_OK;
+} /* TestCpuVariants() */
+
+// What the progress callback told TestProgress() about each frame; the
+// frames are counted off as their rows add up to the frame's height
+#define PROGRESS_FRAMES 8
+typedef struct {
+    int iFrame; // frame being reported
+    int iRows[PROGRESS_FRAMES]; // rows reported so far
+    uint8_t *pPixels[PROGRESS_FRAMES]; // the reported rows in display order
+    const char *szWhy; // the first problem
+} PROGRESSCHECK;
+
+static int ProgressRows(GifFileType *gif, const SavedImage *pPage, int y, int iRows, int iStep, const GifPixelType *pPixels)
+{
+    PROGRESSCHECK *pCheck = (PROGRESSCHECK *)gif->UserData;
+    int i, iRow, iDone, iFrame = pCheck->iFrame;
+    int iWidth = pPage->ImageDesc.Width, iHeight = pPage->ImageDesc.Height;
+
+    if (iFrame >= PROGRESS_FRAMES) {
+        pCheck->szWhy = "rows of too many frames were reported";
+        return GIF_ERROR;
+    }
+    if (pCheck->pPixels[iFrame] == NULL)
+        pCheck->pPixels[iFrame] = (uint8_t *)calloc((size_t)iWidth * iHeight, 1);
+    iDone = pCheck->iRows[iFrame];
+    if (iRows < 1 || iDone + iRows > iHeight) {
+        pCheck->szWhy = "more rows than the frame has were reported";
+        return GIF_ERROR;
+    }
+    for (i = 0; i < iRows; i++) { // the rows are reported in the order they're stored
+        iRow = y + i * iStep;
+        if (iRow != (pPage->ImageDesc.Interlace ? PassRow(iDone + i, iHeight) : iDone + i)) {
+            pCheck->szWhy = "a row was reported out of order";
+            return GIF_ERROR;
+        }
+        memcpy(&pCheck->pPixels[iFrame][(size_t)iRow * iWidth], &pPixels[(size_t)i * iWidth], iWidth);
+    }
+    pCheck->iRows[iFrame] += iRows;
+    if (pCheck->iRows[iFrame] == iHeight)
+        pCheck->iFrame++;
+    return GIF_OK;
+} /* ProgressRows() */
+
+// Check what was reported for a frame against the decoded frame
+static void ProgressFrame(PROGRESSCHECK *pCheck, int iFrame, const SavedImage *pPage)
+{
+    if (pCheck->szWhy != NULL)
+        return;
+    if (iFrame >= PROGRESS_FRAMES || pCheck->iRows[iFrame] != pPage->ImageDesc.Height)
+        pCheck->szWhy = "the rows reported don't add up to the frame's height";
+    else if (memcmp(pCheck->pPixels[iFrame], pPage->RasterBits, (size_t)pPage->ImageDesc.Width * pPage->ImageDesc.Height) != 0)
+        pCheck->szWhy = "the rows reported differ from the decoded frame";
+} /* ProgressFrame() */
+
+//
+// TestProgress
+//
+// DGifSetProgressFunc() with DGifSlurp() (plain and GIF_OPT_ARENA) and
+// DGifNextFrame(), a few row counts per call and interlaced frames of 1 to 9
+// rows and more: every row of every frame is reported exactly once, in the
+// order it's stored, with the pixels it ends up with.
+//
+static int TestProgress(void)
+{
+    const char *szName = "progress";
+    static const int iSizes[][2] = {{5, 1}, {5, 2}, {5, 3}, {5, 4}, {5, 5}, {5, 6}, {5, 7}, {5, 8}, {5, 9}, {3, 1001}, {200, 99}};
+    static const int iRowCounts[] = {1, 0, 7, 100000}; // 0 = the default
+    GIFBUF buf = {0};
+    PROGRESSCHECK check;
+    GifFileType *gif;
+    SavedImage *pPage;
+    uint8_t *pPixels;
+    const char *szWhy = NULL;
+    char szFile[32], szReason[160];
+    uint32_t u32Seed = 99;
+    int i, j, iFile, iRows, iMode, iFrames, iErr;
+    int iFiles = (int)(sizeof(iSizes) / sizeof(iSizes[0])) + 1;
+
+    BufAnimation(&buf, 61, 45, 4, 3); // file 0, its third frame is interlaced
+    if (BufWrite(&buf, TempPath("progress0.gif")) != GIF_OK)
+        return Fail(szName, "can't write the input file");
+    for (i = 1; i < iFiles; i++) {
+        pPixels = (uint8_t *)malloc(iSizes[i - 1][0] * iSizes[i - 1][1]);
+        FillImage(pPixels, iSizes[i - 1][0], iSizes[i - 1][1], IMAGE_NOISE, &u32Seed);
+        snprintf(szFile, sizeof(szFile), "progress%d.gif", i);
+        iErr = SpewFrame(TempPath(szFile), iSizes[i - 1][0], iSizes[i - 1][1], i < iFiles - 1, 8, pPixels);
+        free(pPixels);
+        if (iErr != GIF_OK)
+            return Fail(szName, "EGifSpew() failed");
+    }
+    for (iFile = 0; iFile < iFiles && szWhy == NULL; iFile++) {
+        snprintf(szFile, sizeof(szFile), "progress%d.gif", iFile);
+        for (j = 0; j < (int)(sizeof(iRowCounts) / sizeof(iRowCounts[0])) && szWhy == NULL; j++) {
+            iRows = iRowCounts[j];
+            for (iMode = 0; iMode < 3 && szWhy == NULL; iMode++) { // slurp, arena, next frame
+                memset(&check, 0, sizeof(check));
+                gif = DGifOpenFileName(TempPath(szFile), &iErr);
+                if (gif == NULL) {
+                    szWhy = "can't open the file";
+                    break;
+                }
+                gif->UserData = &check;
+                DGifSetProgressFunc(gif, ProgressRows, iRows);
+                iFrames = 0;
+                if (iMode < 2) {
+                    GifSetOptions(gif, (iMode == 1) ? GIF_OPT_ARENA : 0);
+                    if (DGifSlurp(gif) != GIF_OK)
+                        check.szWhy = (check.szWhy != NULL) ? check.szWhy : "DGifSlurp() failed";
+                    for (iFrames = 0; iFrames < gif->ImageCount; iFrames++)
+                        ProgressFrame(&check, iFrames, &gif->SavedImages[iFrames]);
+                } else {
+                    while ((pPage = DGifNextFrame(gif)) != NULL)
+                        ProgressFrame(&check, iFrames++, pPage);
+                }
+                if (check.szWhy == NULL && (iFrames != ((iFile == 0) ? 4 : 1) || check.iFrame != iFrames))
+                    check.szWhy = "the wrong number of frames was reported";
+                DGifCloseFile(gif, &iErr);
+                for (i = 0; i < PROGRESS_FRAMES; i++)
+                    free(check.pPixels[i]);
+                if (check.szWhy != NULL) {
+                    snprintf(szReason, sizeof(szReason), "%s (file %d, %d rows, mode %d)", check.szWhy, iFile, iRows, iMode);
+                    szWhy = szReason;
+                }
+            }
+        }
+    }
+    if (szWhy != NULL)
+        return Fail(szName, szWhy);
+    return GIF_OK;
+} /* TestProgress() */
+
+static bool SameStats(const GifFrameStats *pStats1, const GifFrameStats *pStats2)
+{
+    return memcmp(pStats1->Histogram, pStats2->Histogram, sizeof(pStats1->Histogram)) == 0 &&
+           pStats1->ColorsUsed == pStats2->ColorsUsed && pStats1->TransparentColor == pStats2->TransparentColor &&
+           pStats1->TransparentUsed == pStats2->TransparentUsed && pStats1->Left == pStats2->Left &&
+           pStats1->Top == pStats2->Top && pStats1->Width == pStats2->Width && pStats1->Height == pStats2->Height;
+} /* SameStats() */
+
+// Stands in for a progress callback, so the statistics are collected in its steps
+static int ProgressNothing(GifFileType *gif, const SavedImage *pPage, int y, int iRows, int iStep, const GifPixelType *pPixels)
+{
+    (void)gif;
+    (void)pPage;
+    (void)y;
+    (void)iRows;
+    (void)iStep;
+    (void)pPixels;
+    return GIF_OK;
+} /* ProgressNothing() */
+
+//
+// TestFrameStats
+//
+// The statistics GIF_OPT_STATS collects while decoding (DGifGetFrameStats)
+// must be the same as GifComputeFrameStats() on the decoded frames, with
+// DGifSlurp() (plain and GIF_OPT_ARENA) and DGifNextFrame(), with and without
+// a progress callback. The frames have transparent borders around an opaque
+// box, interlaced and not, no opaque pixels at all, no graphics control
+// block and a local palette.
+//
+static int TestFrameStats(void)
+{
+    const char *szName = "frame_stats";
+    GIFBUF buf = {0};
+    GifFileType *gif;
+    SavedImage *pPages[8], *pPage;
+    GifFrameStats fused, computed;
+    uint8_t *pPixels;
+    const char *szWhy = NULL, *szFile;
+    char szReason[160];
+    uint32_t u32Seed = 7;
+    int i, x, y, iFile, iMode, iFrames, iErr;
+
+    pPixels = (uint8_t *)malloc(50 * 40);
+    for (y = 0; y < 40; y++)
+        for (x = 0; x < 50; x++)
+            pPixels[y * 50 + x] = (x >= 7 && x < 20 && y >= 5 && y < 13) ? (uint8_t)(x + y) : 3;
+    pPixels[30 * 50 + 49] = 1; // the box reaches the right edge
+    BufScreen(&buf, 50, 40, 8);
+    BufGCB(&buf, 0, 3);
+    BufDescriptor(&buf, 0, 0, 50, 40, 0x40); // interlaced
+    BufPixels(&buf, 8, pPixels, 50 * 40);
+    BufGCB(&buf, 0, 3);
+    BufImage(&buf, 0, 0, 50, 40, 0, 8, pPixels);
+    memset(pPixels, 3, 50 * 40);
+    BufGCB(&buf, 0, 3); // nothing but transparent pixels
+    BufImage(&buf, 0, 0, 50, 40, 0, 8, pPixels);
+    FillImage(pPixels, 50, 40, IMAGE_RUNS, &u32Seed);
+    BufImage(&buf, 0, 0, 50, 40, 0, 8, pPixels); // no graphics control block
+    BufByte(&buf, 0x3b);
+    free(pPixels);
+    if (BufWrite(&buf, TempPath("stats0.gif")) != GIF_OK)
+        return Fail(szName, "can't write the input file");
+    BufAnimation(&buf, 61, 45, 4, 5);
+    if (BufWrite(&buf, TempPath("stats1.gif")) != GIF_OK)
+        return Fail(szName, "can't write the input file");
+
+    for (iFile = 0; iFile < 2 && szWhy == NULL; iFile++) {
+        szFile = TempPath(iFile ? "stats1.gif" : "stats0.gif");
+        for (iMode = 0; iMode < 6 && szWhy == NULL; iMode++) { // slurp, arena, next frame; then with progress
+            gif = DGifOpenFileName(szFile, &iErr);
+            if (gif == NULL) {
+                szWhy = "can't open the file";
+                break;
+            }
+            GifSetOptions(gif, GIF_OPT_STATS | (((iMode % 3) == 1) ? GIF_OPT_ARENA : 0));
+            if (iMode >= 3)
+                DGifSetProgressFunc(gif, ProgressNothing, 1);
+            iFrames = 0;
+            if ((iMode % 3) < 2) {
+                if (DGifSlurp(gif) != GIF_OK)
+                    szWhy = "DGifSlurp() failed";
+                for (iFrames = 0; iFrames < gif->ImageCount && iFrames < 8; iFrames++)
+                    pPages[iFrames] = &gif->SavedImages[iFrames];
+            }
+            for (i = 0; i < 4 && szWhy == NULL; i++) {
+                if ((iMode % 3) == 2) { // each frame is only valid until the next one is decoded
+                    if ((pPage = DGifNextFrame(gif)) == NULL) {
+                        szWhy = "DGifNextFrame() failed";
+                        break;
+                    }
+                    iFrames++;
+                } else {
+                    pPage = (i < iFrames) ? pPages[i] : NULL;
+                }
+                if (pPage == NULL || DGifGetFrameStats(gif, i, &fused) != GIF_OK || GifComputeFrameStats(pPage, &computed) != GIF_OK) {
+                    szWhy = "no statistics";
+                    break;
+                }
+                if (!SameStats(&fused, &computed)) {
+                    szWhy = "the statistics differ from GifComputeFrameStats()";
+                    break;
+                }
+            }
+            if (szWhy == NULL && iFrames != 4)
+                szWhy = "the wrong number of frames was decoded";
+            DGifCloseFile(gif, &iErr);
+            if (szWhy != NULL) {
+                snprintf(szReason, sizeof(szReason), "%s (file %d, mode %d, frame %d)", szWhy, iFile, iMode, i);
+                szWhy = szReason;
+            }
+        }
+    }
+    if (szWhy != NULL)
+        return Fail(szName, szWhy);
+    return GIF_OK;
+} /* TestFrameStats() */
+
+//
+// TestCodecStats
+//
+// GifGetStats() after encoding a noisy frame (which fills the code table)
+// and a flat one with EGifSpewKeep() and after decoding the file again with
+// DGifSlurp(): the counters of the work that was done can't be 0, there's
+// one hash lookup per pixel after the first of each frame and the decoder
+// counts the codes the encoder wrote. Builds without GIF_STATS skip it; ctest
+// runs it from gif_regress_stats, which is built with the counters.
+//
+static int TestCodecStats(void)
+{
+    const char *szName = "codec_stats";
+    static const int iKinds[2] = {IMAGE_NOISE, IMAGE_FLAT};
+    GifFileType *gif;
+    GifColorType colors[256];
+    GifCodecStats encoded, decoded;
+    SavedImage image;
+    uint8_t *pPixels[2];
+    const char *szWhy = NULL;
+    uint32_t u32Seed = 31;
+    int i, iErr;
+
+    gif = EGifOpenFileName(TempPath("codec_stats.gif"), false, &iErr);
+    if (gif == NULL)
+        return Fail(szName, "can't create the file");
+    if (GifGetStats(gif, &encoded) != GIF_OK) {
+        EGifCloseFile(gif, &iErr);
+        return Skip(szName, "this build has no counters (GIF_STATS)");
+    }
+    for (i = 0; i < 256; i++)
+        colors[i].Red = colors[i].Green = colors[i].Blue = (GifByteType)i;
+    gif->SWidth = 200;
+    gif->SHeight = 100;
+    gif->SColorResolution = 8;
+    gif->SColorMap = GifMakeMapObject(256, colors);
+    for (i = 0; i < 2; i++) {
+        pPixels[i] = (uint8_t *)malloc(200 * 100);
+        FillImage(pPixels[i], 200, 100, iKinds[i], &u32Seed);
+        memset(&image, 0, sizeof(image));
+        image.ImageDesc.Width = 200;
+        image.ImageDesc.Height = 100;
+        image.RasterBits = pPixels[i];
+        if (GifMakeSavedImage(gif, &image) == NULL)
+            szWhy = "GifMakeSavedImage() failed";
+    }
+    if (szWhy == NULL && EGifSpewKeep(gif) != GIF_OK)
+        szWhy = "EGifSpewKeep() failed";
+    GifGetStats(gif, &encoded);
+    EGifCloseFile(gif, &iErr);
+    for (i = 0; i < 2; i++)
+        free(pPixels[i]);
+    if (szWhy != NULL)
+        return Fail(szName, szWhy);
+    if (encoded.EncodeCodes == 0 || encoded.EncodeClears == 0 || encoded.HashLookups != 2 * (200 * 100 - 1) ||
+        encoded.HashProbes < (uint64_t)encoded.MaxHashProbe || encoded.Allocations == 0 || encoded.AllocatedBytes == 0)
+        return Fail(szName, "the encoder's counters are wrong");
+
+    gif = DGifOpenFileName(TempPath("codec_stats.gif"), &iErr);
+    if (gif == NULL)
+        return Fail(szName, "can't open the file");
+    if (DGifSlurp(gif) != GIF_OK || gif->ImageCount != 2)
+        szWhy = "DGifSlurp() failed";
+    GifGetStats(gif, &decoded);
+    DGifCloseFile(gif, &iErr);
+    if (szWhy != NULL)
+        return Fail(szName, szWhy);
+    if (decoded.Codes == 0 || decoded.Strings == 0 || decoded.BytesCopied < decoded.Strings || decoded.MaxStringLength < 2 ||
+        decoded.AverageStringLength <= 0.0 || decoded.BytesDechunked == 0 || decoded.Allocations == 0 || decoded.AllocatedBytes == 0)
+        return Fail(szName, "the decoder's counters are wrong");
+    // the decoder stops at the last pixel, before each frame's end code, and
+    // counts the clear code at the start of each frame as well
+    if (decoded.Codes + 2 != encoded.EncodeCodes || decoded.ClearCodes != encoded.EncodeClears + 2)
+        return Fail(szName, "the decoder didn't count the codes the encoder wrote");
+    return GIF_OK;
+} /* TestCodecStats() */
+
+// What TestTrace()'s trace callback saw of each phase
+typedef struct {
+    int iBegins[GIF_PHASE_COUNT];
+    bool bOpen[GIF_PHASE_COUNT]; // between its begin and end
+    int iFrame[GIF_PHASE_COUNT]; // of the last begin
+    uint64_t u64Begin[GIF_PHASE_COUNT];
+    const char *szWhy; // the first problem
+} TRACECHECK;
+
+static void TraceCheck(GifFileType *gif, int iPhase, bool bBegin, int iFrame, uint64_t u64Time, void *pUser)
+{
+    TRACECHECK *pCheck = (TRACECHECK *)pUser;
+
+    (void)gif;
+    if (pCheck->szWhy != NULL)
+        return;
+    if (iPhase < 0 || iPhase >= GIF_PHASE_COUNT || GifPhaseName(iPhase) == NULL) {
+        pCheck->szWhy = "an unknown phase was reported";
+    } else if (bBegin) {
+        if (pCheck->bOpen[iPhase])
+            pCheck->szWhy = "a phase began again before it ended";
+        pCheck->bOpen[iPhase] = true;
+        pCheck->iFrame[iPhase] = iFrame;
+        pCheck->u64Begin[iPhase] = u64Time;
+        pCheck->iBegins[iPhase]++;
+    } else {
+        if (!pCheck->bOpen[iPhase])
+            pCheck->szWhy = "a phase ended which hadn't begun";
+        else if (iFrame != pCheck->iFrame[iPhase])
+            pCheck->szWhy = "a phase ended with another frame than it began with";
+        else if (u64Time < pCheck->u64Begin[iPhase])
+            pCheck->szWhy = "a phase ended before it began";
+        pCheck->bOpen[iPhase] = false;
+    }
+} /* TraceCheck() */
+
+// Nothing to do with the rows of TestTrace()'s DGifSlurpScanlines()
+static int TraceLine(GifFileType *gif, const SavedImage *pPage, int y, const GifPixelType *pLine)
+{
+    (void)gif;
+    (void)pPage;
+    (void)y;
+    (void)pLine;
+    return GIF_OK;
+} /* TraceLine() */
+
+//
+// TestTrace
+//
+// GifSetTraceFunc() on the decoders (DGifSlurp() plain and with
+// GIF_OPT_ARENA, DGifNextFrame() and DGifSlurpScanlines()) and on the
+// encoder: every phase which begins ends again, with the same frame, before
+// it begins again, also when a truncated file makes the decoder fail
+// halfway. The phases of the work which was done must all be reported.
+//
+static int TestTrace(void)
+{
+    const char *szName = "trace";
+    GIFBUF buf = {0};
+    TRACECHECK check;
+    GifFileType *gif, *gifOut;
+    const char *szWhy = NULL;
+    char szFile[32], szReason[160];
+    int i, iFile, iMode, iFrames = 0, iErr;
+
+    BufAnimation(&buf, 61, 45, 4, 9); // its third frame is interlaced
+    if (BufWrite(&buf, TempPath("trace0.gif")) != GIF_OK)
+        return Fail(szName, "can't write the input file");
+    BufAnimation(&buf, 61, 45, 4, 9);
+    buf.iLen = buf.iLen * 3 / 5; // cut off in the third frame's pixels
+    if (BufWrite(&buf, TempPath("trace1.gif")) != GIF_OK)
+        return Fail(szName, "can't write the input file");
+    BufAnimation(&buf, 61, 45, 2, 9);
+    buf.iLen--; // the trailer
+    BufDescriptor(&buf, 0, 0, 61, 45, 0x87); // a local palette which is cut off
+    BufPalette(&buf, 4);
+    if (BufWrite(&buf, TempPath("trace2.gif")) != GIF_OK)
+        return Fail(szName, "can't write the input file");
+
+    for (iFile = 0; iFile < 3 && szWhy == NULL; iFile++) {
+        snprintf(szFile, sizeof(szFile), "trace%d.gif", iFile);
+        for (iMode = 0; iMode < 5 && szWhy == NULL; iMode++) { // slurp, arena, next frame, scanlines, encoder
+            memset(&check, 0, sizeof(check));
+            gif = DGifOpenFileName(TempPath(szFile), &iErr);
+            if (gif == NULL) {
+                szWhy = "can't open the file";
+                break;
+            }
+            if (iMode != 4)
+                GifSetTraceFunc(gif, TraceCheck, &check);
+            if (iMode == 1)
+                GifSetOptions(gif, GIF_OPT_ARENA);
+            if (iMode == 2) {
+                for (iFrames = 0; DGifNextFrame(gif) != NULL; iFrames++) {}
+            } else if (iMode == 3) {
+                iErr = DGifSlurpScanlines(gif, TraceLine, 2);
+            } else {
+                iErr = DGifSlurp(gif);
+                iFrames = gif->ImageCount;
+            }
+            if (iMode == 4 && iErr == GIF_OK) { // write the frames again
+                gifOut = EGifOpenFileName(TempPath("trace_out.gif"), false, &iErr);
+                if (gifOut == NULL) {
+                    szWhy = "can't create the output file";
+                } else {
+                    gifOut->SWidth = gif->SWidth;
+                    gifOut->SHeight = gif->SHeight;
+                    gifOut->SColorResolution = gif->SColorResolution;
+                    GifMoveSavedImages(gifOut, gif);
+                    GifSetTraceFunc(gifOut, TraceCheck, &check);
+                    if (EGifSpew(gifOut) != GIF_OK)
+                        szWhy = "EGifSpew() failed";
+                }
+            }
+            DGifCloseFile(gif, &iErr);
+            if (szWhy != NULL)
+                break;
+            for (i = 0; i < GIF_PHASE_COUNT && check.szWhy == NULL; i++) {
+                if (check.bOpen[i])
+                    check.szWhy = "a phase never ended";
+            }
+            if (check.szWhy == NULL && iFile == 0) { // what must have been reported
+                if (iMode == 4 && (check.iBegins[GIF_PHASE_ENCODE] != 4 || check.iBegins[GIF_PHASE_CHUNK] != 4 ||
+                                   check.iBegins[GIF_PHASE_WRITE] == 0))
+                    check.szWhy = "the encoder's phases are missing";
+                else if (iMode < 4 && (iFrames != 4 && iMode != 3))
+                    check.szWhy = "the file didn't decode";
+                else if (iMode < 4 && (check.iBegins[GIF_PHASE_READ] == 0 || check.iBegins[GIF_PHASE_SCAN] == 0 ||
+                                       check.iBegins[GIF_PHASE_DECODE] != 4 || (iMode != 3 && check.iBegins[GIF_PHASE_DEINTERLACE] == 0)))
+                    check.szWhy = "the decoder's phases are missing";
+            }
+            if (check.szWhy != NULL) {
+                snprintf(szReason, sizeof(szReason), "%s (file %d, mode %d)", check.szWhy, iFile, iMode);
+                szWhy = szReason;
+            }
+        }
+    }
+    if (szWhy != NULL)
+        return Fail(szName, szWhy);
+    return GIF_OK;
+} /* TestTrace() */
+
+static const struct {
+    const char *szName;
+    TESTFUNC pfnTest;
+} tests[] = {
+    {"spew_extensions", TestSpewExtensions},
+    {"spew_long_extension", TestSpewLongExtension},
+    {"arena_spew", TestArenaSpew},
+    {"reopen_spew", TestReopenSpew},
+    {"packed_local_palette", TestPackedLocalPalette},
+    {"next_frame_into_wide", TestNextFrameIntoWide},
+    {"scanlines_huge_frame", TestScanlinesHugeFrame},
+    {"limits", TestLimits},
+    {"huge_descriptor", TestHugeDescriptor},
+    {"validate", TestValidate},
+    {"batch", TestBatch},
+    {"batch_uring", TestBatchURing},
+    {"record_walk", TestRecordWalk},
+    {"interlace_round_trip", TestInterlaceRoundTrip},
+    {"cpu_variants", TestCpuVariants},
+    {"progress", TestProgress},
+    {"frame_stats", TestFrameStats},
+    {"codec_stats", TestCodecStats},
+    {"trace", TestTrace},
+};
+
+//
+// WriteCorpus
+//
+// Write a few files into szDir for gif_compare to check (see CORPUS_FILES in
+// CMakeLists.txt): an animation with extensions, a local palette and an
+// interlaced frame, and single frames written by the encoder
+//
+static int WriteCorpus(const char *szDir)
+{
+    static const struct {
+        const char *szFile;
+        int iWidth, iHeight, iKind, iBits;
+        bool bInterlace;
+    } frames[] = {{"flat.gif", 320, 200, IMAGE_FLAT, 8, false}, {"noise.gif", 97, 61, IMAGE_NOISE, 8, false},
+                  {"pattern.gif", 150, 40, IMAGE_2COLORS, 2, false}, {"runs_interlaced.gif", 77, 53, IMAGE_RUNS, 4, true}};
+    GIFBUF buf = {0};
+    uint8_t *pPixels;
+    uint32_t u32Seed = 1;
+    int i, rc;
+
+    snprintf(szTempDir, sizeof(szTempDir), "%s", szDir);
+    mkdir(szTempDir, 0777); // may exist already
+    BufAnimation(&buf, 64, 48, 4, 1);
+    rc = BufWrite(&buf, TempPath("anim.gif"));
+    for (i = 0; i < (int)(sizeof(frames) / sizeof(frames[0])) && rc == GIF_OK; i++) {
+        pPixels = (uint8_t *)malloc(frames[i].iWidth * frames[i].iHeight);
+        FillImage(pPixels, frames[i].iWidth, frames[i].iHeight, frames[i].iKind, &u32Seed);
+        rc = SpewFrame(TempPath(frames[i].szFile), frames[i].iWidth, frames[i].iHeight, frames[i].bInterlace, frames[i].iBits, pPixels);
+        free(pPixels);
+    }
+    if (rc != GIF_OK)
+        printf("can't write the corpus in %s\n", szDir);
+    return (rc == GIF_OK) ? EXIT_SUCCESS : EXIT_FAILURE;
+} /* WriteCorpus() */
+
+static void RemoveTempDir(void)
+{
+    DIR *pDir = opendir(szTempDir);
+    struct dirent *pEntry;
+
+    if (pDir != NULL) {
+        while ((pEntry = readdir(pDir)) != NULL) {
+            if (pEntry->d_name[0] != '.')
+                unlink(TempPath(pEntry->d_name));
+        }
+        closedir(pDir);
+    }
+    rmdir(szTempDir);
+} /* RemoveTempDir() */
+
+int main(int argc, char *argv[])
+{
+    int i, j, rc, iFailed = 0;
+    bool bRun;
+
+    if (argc == 3 && strcmp(argv[1], "-c") == 0)
+        return WriteCorpus(argv[2]);
+    strcpy(szTempDir, "/tmp/gif_regress_XXXXXX");
+    if (mkdtemp(szTempDir) == NULL) {
+        printf("can't create a temporary directory\n");
+        return EXIT_FAILURE;
+    }
+    for (i = 0; i < (int)(sizeof(tests) / sizeof(tests[0])); i++) {
+        bRun = (argc < 2);
+        for (j = 1; j < argc; j++)
+            bRun |= (strcmp(argv[j], tests[i].szName) == 0);
+        if (!bRun)
+            continue;
+        rc = (*tests[i].pfnTest)();
+        if (rc == GIF_OK)
+            printf("ok %s\n", tests[i].szName);
+        else if (rc != TEST_SKIPPED)
+            iFailed++;
+        fflush(stdout);
+    }
+    RemoveTempDir();
+    return iFailed;
+} /* main() */
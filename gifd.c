@@ -0,0 +1,506 @@
+//
+// gifd - GIF decode/encode daemon (Linux)
+//
+// Serves decode and encode requests from other processes on the same host
+// over a Unix domain socket (see gifd.h for the protocol and the client
+// library). It's meant for callers which would otherwise pay for a fresh
+// process, a cold handle and cold caches on every image (CGI/PHP workers,
+// scripts): the worker threads keep their decoder and encoder handles, with
+// their symbol tables and work buffers, from one request to the next.
+//
+// The data doesn't go through the socket. A decode request passes the
+// descriptor of the GIF file; the frames are decoded straight into a memfd
+// which is sealed and passed back for the client to map. An encode request
+// passes a memfd holding the palette and the pixels, which is read into the
+// worker's buffer and compressed from there; the GIF file is written to a
+// memfd passed back.
+//
+// usage: gifd [-s socket] [-t threads] [-c result MB] [-p max pixels] [-m max memory MB]
+//  -s  path of the socket (default /tmp/gifd.sock)
+//  -t  worker threads (default: one per CPU); each one serves a connection
+//      at a time, further connections wait in the listen queue
+//  -c  largest decode result in MB (default 4096); the memfd is sparse so
+//      this only reserves address space
+//  -p  GifLimits.MaxPixels of each decoded file and of each frame to encode
+//      (default: no limit)
+//  -m  GifLimits.MaxMemory of each decoded file in MB, and the most an
+//      encode request may copy (default: no limit)
+//
+#define _GNU_SOURCE // memfd_create(), accept4(), F_ADD_SEALS
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "gifd.h"
+
+#define GIFD_ALIGN(x, n) (((x) + (n) - 1) & ~(uint64_t)((n) - 1))
+#define GIFD_ENCODE_PADDING 4096 // zeros after the pixels for the encoder's reads ahead
+#define GIFD_REQUEST_KEEP (64 << 20) // larger request copies are freed after the encode
+
+typedef struct gifd_worker {
+    pthread_t tid;
+    GifAllocator Allocator;  // the handles' allocator, see GifdFree()
+    GifFileType *pDecoder;   // warm handles, created by GifdWarmUp()
+    GifFileType *pEncoder;
+    const uint8_t *pKeep;    // pixels of the encode request being served;
+    size_t iKeepSize;        // the encoder releases them but mustn't free them
+    uint8_t *pRequest;       // copy of the encode request (palette + pixels)
+    size_t iRequestSize;
+    GifdFrame *pFrames;      // frame table of the decode being served
+    int iFrameMax;
+} GIFD_WORKER;
+
+static int iListen = -1;
+static const char *szSocket = GIFD_DEFAULT_SOCKET;
+static uint64_t u64ResultMax = 4096ULL << 20;
+static GifLimits gifdLimits;
+
+static void *GifdMalloc(size_t iSize, void *pUser)
+{
+    (void)pUser;
+    return malloc(iSize);
+}
+static void *GifdRealloc(void *p, size_t iSize, void *pUser)
+{
+    (void)pUser;
+    return realloc(p, iSize);
+}
+//
+// GifdFree
+//
+// The encoder frees the RasterBits of its frames after writing them; those
+// of an encode request are the worker's copy made by GifdServeEncode()
+//
+static void GifdFree(void *p, void *pUser)
+{
+    GIFD_WORKER *pWorker = (GIFD_WORKER *)pUser;
+
+    if ((const uint8_t *)p >= pWorker->pKeep && (const uint8_t *)p < pWorker->pKeep + pWorker->iKeepSize)
+        return;
+    free(p);
+} /* GifdFree() */
+//
+// GifdSeal
+//
+// Make a result immutable before handing it to the client
+//
+static int GifdSeal(int iFD)
+{
+    return (fcntl(iFD, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) == 0) ? GIF_OK : GIF_ERROR;
+} /* GifdSeal() */
+//
+// GifdFrameInfo
+//
+// Fill in a frame table entry from the decoded frame and its graphics
+// control block
+//
+static void GifdFrameInfo(GifdFrame *pInfo, const SavedImage *pPage, int iPitch, uint64_t u64Pixels)
+{
+    const ExtensionBlock *pEB;
+    const ColorMapObject *pMap = pPage->ImageDesc.ColorMap;
+    int i;
+
+    memset(pInfo, 0, sizeof(GifdFrame));
+    pInfo->Left = pPage->ImageDesc.Left;
+    pInfo->Top = pPage->ImageDesc.Top;
+    pInfo->Width = pPage->ImageDesc.Width;
+    pInfo->Height = pPage->ImageDesc.Height;
+    pInfo->Pitch = iPitch;
+    pInfo->Interlace = pPage->ImageDesc.Interlace;
+    pInfo->Pixels = u64Pixels;
+    pInfo->TransparentColor = NO_TRANSPARENT_COLOR;
+    pInfo->DisposalMode = DISPOSAL_UNSPECIFIED;
+    for (i = 0; i < pPage->ExtensionBlockCount; i++) {
+        pEB = &pPage->ExtensionBlocks[i];
+        if (pEB->Function == GRAPHICS_EXT_FUNC_CODE && pEB->ByteCount >= 4) {
+            pInfo->DisposalMode = (pEB->Bytes[0] >> 2) & 7;
+            pInfo->DelayTime = pEB->Bytes[1] | (pEB->Bytes[2] << 8);
+            if (pEB->Bytes[0] & 1)
+                pInfo->TransparentColor = pEB->Bytes[3];
+            break;
+        }
+    }
+    if (pMap != NULL && pMap->ColorCount > 0 && pMap->ColorCount <= 256) {
+        pInfo->ColorCount = pMap->ColorCount;
+        memcpy(pInfo->Colors, pMap->Colors, pMap->ColorCount * sizeof(GifColorType));
+    }
+} /* GifdFrameInfo() */
+//
+// GifdServeDecode
+//
+// Decode the GIF file iFD (taken over) into a new memfd: a GifdImage, the
+// frames and their GifdFrame table. Returns 0 and the sealed memfd or the
+// error.
+//
+static int GifdServeDecode(GIFD_WORKER *pWorker, int iFD, int *piResult, uint64_t *pu64Size)
+{
+    GifFileType *gif;
+    SavedImage *pPage;
+    GifdImage *pImage;
+    GifdFrame *pNew;
+    uint8_t *pMap;
+    uint64_t u64Off, u64Table, u64Size;
+    int iResult, iPitch, iCount, err = D_GIF_SUCCEEDED;
+
+    *piResult = -1;
+    lseek(iFD, 0, SEEK_SET); // the client may have just written it
+    if (pWorker->pDecoder == NULL) {
+        pWorker->pDecoder = DGifOpenFileHandleAlloc(iFD, &pWorker->Allocator, &err);
+        if (pWorker->pDecoder == NULL)
+            return err;
+        GifSetLimits(pWorker->pDecoder, &gifdLimits);
+    } else if (DGifReopenFileHandle(pWorker->pDecoder, iFD, &err) != GIF_OK) {
+        return err;
+    }
+    gif = pWorker->pDecoder;
+    iResult = memfd_create("gifd-image", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (iResult < 0)
+        return D_GIF_ERR_NOT_ENOUGH_MEM;
+    if (ftruncate(iResult, (off_t)u64ResultMax) != 0 ||
+        (pMap = mmap(NULL, u64ResultMax, PROT_READ | PROT_WRITE, MAP_SHARED, iResult, 0)) == MAP_FAILED) {
+        close(iResult);
+        return D_GIF_ERR_NOT_ENOUGH_MEM;
+    }
+    pImage = (GifdImage *)pMap;
+    pImage->Magic = GIFD_MAGIC;
+    pImage->Width = gif->SWidth;
+    pImage->Height = gif->SHeight;
+    pImage->BackgroundColor = gif->SBackGroundColor;
+    if (gif->SColorMap != NULL && gif->SColorMap->ColorCount > 0 && gif->SColorMap->ColorCount <= 256) {
+        pImage->ColorCount = gif->SColorMap->ColorCount;
+        memcpy(pImage->Colors, gif->SColorMap->Colors, pImage->ColorCount * sizeof(GifColorType));
+    }
+    u64Off = GIFD_ALIGN(sizeof(GifdImage), 64);
+    iCount = 0;
+    while (u64Off < u64ResultMax) {
+        // each frame's rows are as long as its own (they can be wider than
+        // the screen); the pitch isn't known until the frame is parsed
+        pPage = DGifNextFrameInto(gif, &pMap[u64Off], 0, (size_t)(u64ResultMax - u64Off));
+        if (pPage == NULL)
+            break;
+        iPitch = pPage->ImageDesc.Width;
+        if (iCount == pWorker->iFrameMax) {
+            pNew = realloc(pWorker->pFrames, (iCount + 64) * sizeof(GifdFrame));
+            if (pNew == NULL) {
+                gif->Error = D_GIF_ERR_NOT_ENOUGH_MEM;
+                break;
+            }
+            pWorker->pFrames = pNew;
+            pWorker->iFrameMax = iCount + 64;
+        }
+        GifdFrameInfo(&pWorker->pFrames[iCount++], pPage, iPitch, u64Off);
+        u64Off = GIFD_ALIGN(u64Off + (uint64_t)iPitch * pPage->ImageDesc.Height, 64);
+    }
+    err = gif->Error;
+    u64Table = GIFD_ALIGN(u64Off, 8);
+    u64Size = u64Table + (uint64_t)iCount * sizeof(GifdFrame);
+    if (err == D_GIF_SUCCEEDED && u64Size > u64ResultMax)
+        err = D_GIF_ERR_DATA_TOO_BIG;
+    if (err == D_GIF_SUCCEEDED) {
+        memcpy(&pMap[u64Table], pWorker->pFrames, (size_t)iCount * sizeof(GifdFrame));
+        pImage->FrameCount = iCount;
+        pImage->FrameTable = u64Table;
+    }
+    munmap(pMap, u64ResultMax); // F_SEAL_WRITE needs the writable mapping gone
+    if (err == D_GIF_SUCCEEDED && (ftruncate(iResult, (off_t)u64Size) != 0 || GifdSeal(iResult) != GIF_OK))
+        err = D_GIF_ERR_NOT_ENOUGH_MEM;
+    if (err != D_GIF_SUCCEEDED) {
+        close(iResult);
+        return err;
+    }
+    *piResult = iResult;
+    *pu64Size = u64Size;
+    return 0;
+} /* GifdServeDecode() */
+//
+// GifdServeEncode
+//
+// Compress the frame in the memfd iFD (palette + pixels, see
+// GifdFrameBuffer) into a GIF file in a new memfd. Returns 0 and the sealed
+// memfd or the error.
+//
+static int GifdServeEncode(GIFD_WORKER *pWorker, const GifdRequest *pReq, int iFD, int *piResult, uint64_t *pu64Size)
+{
+    GifFileType *gif;
+    ColorMapObject map;
+    SavedImage *pSI;
+    struct stat st;
+    uint8_t *pNew, *pPixels, ucOr;
+    size_t i, iPixels, iNeed;
+    ssize_t iRead;
+    int iResult = -1, iOut, iBits, err = E_GIF_ERR_NOT_ENOUGH_MEM;
+
+    *piResult = -1;
+    if (pReq->Width <= 0 || pReq->Height <= 0 || pReq->Width > 65535 || pReq->Height > 65535 ||
+        pReq->ColorCount < 2 || pReq->ColorCount > 256 || (pReq->ColorCount & (pReq->ColorCount - 1)))
+        return E_GIF_ERR_DATA_TOO_BIG;
+    iPixels = (size_t)pReq->Width * pReq->Height;
+    iNeed = pReq->ColorCount * sizeof(GifColorType) + iPixels;
+    if ((gifdLimits.MaxPixels && iPixels > gifdLimits.MaxPixels) ||
+        (gifdLimits.MaxMemory && iNeed + GIFD_ENCODE_PADDING > gifdLimits.MaxMemory))
+        return D_GIF_ERR_LIMIT_EXCEEDED;
+    // only copy what the client has really written, not what it claims
+    if (fstat(iFD, &st) != 0 || st.st_size < 0 || (uint64_t)st.st_size < iNeed)
+        return E_GIF_ERR_OPEN_FAILED;
+    // The client can still write to the memfd, so the pixels are checked and
+    // compressed from a copy; checking its memory in place would leave it
+    // free to put values the code size can't hold there afterwards
+    if (iNeed + GIFD_ENCODE_PADDING > pWorker->iRequestSize) {
+        pNew = realloc(pWorker->pRequest, iNeed + GIFD_ENCODE_PADDING);
+        if (pNew == NULL)
+            return E_GIF_ERR_NOT_ENOUGH_MEM;
+        pWorker->pRequest = pNew;
+        pWorker->iRequestSize = iNeed + GIFD_ENCODE_PADDING;
+    }
+    for (i = 0; i < iNeed; i += (size_t)iRead) {
+        iRead = pread(iFD, &pWorker->pRequest[i], iNeed - i, (off_t)i);
+        if (iRead < 0 && errno == EINTR) {
+            iRead = 0;
+        } else if (iRead <= 0) { // error or truncated meanwhile
+            err = E_GIF_ERR_OPEN_FAILED;
+            goto encode_exit;
+        }
+    }
+    memset(&pWorker->pRequest[iNeed], 0, GIFD_ENCODE_PADDING);
+    pPixels = &pWorker->pRequest[pReq->ColorCount * sizeof(GifColorType)];
+    for (iBits = 1; (1 << iBits) < pReq->ColorCount; iBits++)
+        ;
+    ucOr = 0;
+    for (i = 0; i < iPixels; i++)
+        ucOr |= pPixels[i];
+    if (ucOr >= pReq->ColorCount) { // wouldn't fit the LZW code size
+        err = E_GIF_ERR_DATA_TOO_BIG;
+        goto encode_exit;
+    }
+    iResult = memfd_create("gifd-gif", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    iOut = (iResult >= 0) ? dup(iResult) : -1; // the encoder closes its copy
+    if (iOut < 0)
+        goto encode_exit;
+    if (pWorker->pEncoder == NULL) {
+        pWorker->pEncoder = EGifOpenFileHandleAlloc(iOut, &pWorker->Allocator, &err);
+        if (pWorker->pEncoder == NULL) {
+            close(iOut);
+            goto encode_exit;
+        }
+    } else if (EGifReopenFileHandle(pWorker->pEncoder, iOut, &err) != GIF_OK) {
+        close(iOut);
+        goto encode_exit;
+    }
+    gif = pWorker->pEncoder;
+    map.ColorCount = pReq->ColorCount;
+    map.BitsPerPixel = iBits;
+    map.SortFlag = false;
+    map.Colors = (GifColorType *)pWorker->pRequest;
+    // the code size of the frame is the color resolution, at least 2
+    if (EGifPutScreenDesc(gif, pReq->Width, pReq->Height, (iBits < 2) ? 2 : iBits, 0, &map) != GIF_OK) {
+        err = gif->Error;
+        goto encode_exit;
+    }
+    pSI = &gif->SavedImages[0];
+    pSI->ImageDesc.Width = pReq->Width;
+    pSI->ImageDesc.Height = pReq->Height;
+    pSI->RasterBits = pPixels;
+    gif->ImageCount = 1;
+    pWorker->pKeep = pWorker->pRequest;
+    pWorker->iKeepSize = pWorker->iRequestSize;
+    err = EGifSpewKeep(gif); // GIF_OK or an E_GIF_ERR_* code
+    if (gif->SavedImages != NULL) // not released after an error
+        gif->SavedImages[0].RasterBits = NULL;
+    pWorker->pKeep = NULL;
+    pWorker->iKeepSize = 0;
+    if (err == GIF_OK) {
+        if (fstat(iResult, &st) == 0 && GifdSeal(iResult) == GIF_OK) {
+            *piResult = iResult;
+            *pu64Size = (uint64_t)st.st_size;
+            iResult = -1;
+            err = 0;
+        } else {
+            err = E_GIF_ERR_WRITE_FAILED;
+        }
+    }
+encode_exit:
+    if (pWorker->iRequestSize > GIFD_REQUEST_KEEP) { // don't hold on to a huge frame
+        free(pWorker->pRequest);
+        pWorker->pRequest = NULL;
+        pWorker->iRequestSize = 0;
+    }
+    if (iResult >= 0)
+        close(iResult);
+    return err;
+} /* GifdServeEncode() */
+//
+// GifdServe
+//
+// Answer the requests of a connection until it's closed
+//
+static void GifdServe(GIFD_WORKER *pWorker, int iConn)
+{
+    GifdRequest req;
+    GifdReply reply;
+    int iFD, iResult;
+
+    while (GifdRecvMsg(iConn, &req, sizeof(req), &iFD) == GIF_OK) {
+        memset(&reply, 0, sizeof(reply));
+        reply.Magic = GIFD_MAGIC;
+        iResult = -1;
+        if (req.Magic != GIFD_MAGIC || iFD < 0) {
+            reply.Error = GIFD_ERR_PROTOCOL;
+        } else if (req.Op == GIFD_OP_DECODE) {
+            reply.Error = GifdServeDecode(pWorker, iFD, &iResult, &reply.Size);
+            iFD = -1; // the decoder took it
+        } else if (req.Op == GIFD_OP_ENCODE) {
+            reply.Error = GifdServeEncode(pWorker, &req, iFD, &iResult, &reply.Size);
+        } else {
+            reply.Error = GIFD_ERR_PROTOCOL;
+        }
+        if (iFD >= 0)
+            close(iFD);
+        if (GifdSendMsg(iConn, &reply, sizeof(reply), iResult) != GIF_OK) {
+            if (iResult >= 0)
+                close(iResult);
+            break;
+        }
+        if (iResult >= 0)
+            close(iResult); // the client has its own reference now
+    }
+} /* GifdServe() */
+//
+// GifdWarmUp
+//
+// Create the worker's handles by encoding and decoding a tiny image, so the
+// first real requests don't pay for them
+//
+static void GifdWarmUp(GIFD_WORKER *pWorker)
+{
+    GifdRequest req;
+    uint64_t u64Size;
+    int iFD, iGif, iImage;
+
+    memset(&req, 0, sizeof(req));
+    req.Width = req.Height = 1;
+    req.ColorCount = 2;
+    iFD = memfd_create("gifd-warmup", MFD_CLOEXEC);
+    if (iFD < 0)
+        return;
+    if (ftruncate(iFD, 2 * sizeof(GifColorType) + 1) == 0 &&
+        GifdServeEncode(pWorker, &req, iFD, &iGif, &u64Size) == 0) {
+        if (GifdServeDecode(pWorker, iGif, &iImage, &u64Size) == 0) // takes iGif
+            close(iImage);
+    }
+    close(iFD);
+} /* GifdWarmUp() */
+//
+// GifdWorker
+//
+static void *GifdWorker(void *pArg)
+{
+    GIFD_WORKER *pWorker = (GIFD_WORKER *)pArg;
+    int iConn;
+
+    GifdWarmUp(pWorker);
+    for (;;) {
+        iConn = accept4(iListen, NULL, NULL, SOCK_CLOEXEC);
+        if (iConn < 0) {
+            if (errno == EINTR || errno == ECONNABORTED || errno == EMFILE || errno == ENFILE)
+                continue;
+            perror("gifd: accept");
+            break;
+        }
+        GifdServe(pWorker, iConn);
+        close(iConn);
+    }
+    return NULL;
+} /* GifdWorker() */
+//
+// GifdStop
+//
+static void GifdStop(int iSignal)
+{
+    (void)iSignal;
+    unlink(szSocket);
+    _exit(0);
+} /* GifdStop() */
+
+int main(int argc, char *argv[])
+{
+    struct sockaddr_un addr;
+    GIFD_WORKER *pWorkers;
+    int i, opt, iThreads = 0;
+
+    while ((opt = getopt(argc, argv, "s:t:c:p:m:")) != -1) {
+        switch (opt) {
+            case 's':
+                szSocket = optarg;
+                break;
+            case 't':
+                iThreads = atoi(optarg);
+                break;
+            case 'c':
+                u64ResultMax = strtoull(optarg, NULL, 10) << 20;
+                break;
+            case 'p':
+                gifdLimits.MaxPixels = strtoull(optarg, NULL, 10);
+                break;
+            case 'm':
+                gifdLimits.MaxMemory = strtoull(optarg, NULL, 10) << 20;
+                break;
+            default:
+                fprintf(stderr, "usage: gifd [-s socket] [-t threads] [-c result MB] [-p max pixels] [-m max memory MB]\n");
+                return 1;
+        }
+    }
+    if (iThreads <= 0)
+        iThreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (iThreads <= 0)
+        iThreads = 1;
+    if (u64ResultMax < 4096)
+        u64ResultMax = 4096;
+    if (strlen(szSocket) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "gifd: socket path too long\n");
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, GifdStop);
+    signal(SIGTERM, GifdStop);
+    iListen = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (iListen < 0) {
+        perror("gifd: socket");
+        return 1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, szSocket);
+    unlink(szSocket); // left over from an earlier run
+    if (bind(iListen, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(iListen, 128) != 0) {
+        perror("gifd: bind");
+        return 1;
+    }
+    pWorkers = calloc(iThreads, sizeof(GIFD_WORKER));
+    if (pWorkers == NULL)
+        return 1;
+    for (i = 0; i < iThreads; i++) {
+        pWorkers[i].Allocator.Malloc = GifdMalloc;
+        pWorkers[i].Allocator.Realloc = GifdRealloc;
+        pWorkers[i].Allocator.Free = GifdFree;
+        pWorkers[i].Allocator.UserData = &pWorkers[i];
+        if (pthread_create(&pWorkers[i].tid, NULL, GifdWorker, &pWorkers[i]) != 0) {
+            perror("gifd: pthread_create");
+            GifdStop(0);
+        }
+    }
+    fprintf(stderr, "gifd: listening on %s with %d workers\n", szSocket, iThreads);
+    for (i = 0; i < iThreads; i++)
+        pthread_join(pWorkers[i].tid, NULL);
+    unlink(szSocket);
+    return 0;
+} /* main() */
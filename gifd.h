@@ -0,0 +1,125 @@
+//
+// gifd - GIF decode/encode service
+//
+// Copyright (c) 2021 BitBank Software, Inc.
+// written by Larry Bank
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Protocol and client library of gifd (Linux only). The daemon keeps worker
+// threads with warm decoder/encoder handles behind a Unix domain
+// (SOCK_SEQPACKET) socket. Every request is one GifdRequest message with the
+// input attached as a file descriptor (SCM_RIGHTS); the reply is one
+// GifdReply with the result attached as a sealed memfd, which the client
+// maps. Neither the input nor the output travels through the socket.
+//
+#ifndef _GIFD_H_
+#define _GIFD_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "gif_lib.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#define GIFD_MAGIC 0x44464947 // "GIFD"
+#define GIFD_DEFAULT_SOCKET "/tmp/gifd.sock"
+
+#define GIFD_OP_DECODE 1 // fd = GIF file; result = GifdImage
+#define GIFD_OP_ENCODE 2 // fd = palette + pixels (see GifdFrameBuffer); result = GIF file
+
+// errors of the transport (the others are D_GIF_ERR_* / E_GIF_ERR_*)
+#define GIFD_ERR_IO       200 // the daemon can't be reached or hung up
+#define GIFD_ERR_PROTOCOL 201 // malformed message or result
+#define GIFD_ERR_SYSTEM   202 // memfd/mmap failed
+
+typedef struct GifdRequest {
+    uint32_t Magic;
+    uint32_t Op; // GIFD_OP_*
+    int32_t Width, Height; // encode: size of the frame
+    int32_t ColorCount;    // encode: palette entries (2, 4, ... 256)
+    int32_t Reserved;
+} GifdRequest;
+
+typedef struct GifdReply {
+    uint32_t Magic;
+    int32_t Error; // 0 = success, the result memfd is attached
+    uint64_t Size; // bytes in the result memfd
+} GifdReply;
+
+// Decode result: a GifdImage at offset 0, the pixels of the frames and
+// FrameCount GifdFrames at FrameTable. Frames are deinterlaced, 8 bits per
+// pixel, with rows Pitch bytes apart (Pitch is the frame's own width, which
+// may be larger than the screen's).
+typedef struct GifdFrame {
+    int32_t Left, Top, Width, Height, Pitch;
+    int32_t DelayTime;        // from the graphics control block (1/100 s)
+    int32_t TransparentColor; // or NO_TRANSPARENT_COLOR
+    int32_t DisposalMode;     // DISPOSAL_UNSPECIFIED etc.
+    int32_t ColorCount;       // local palette entries (0 = use the global one)
+    int32_t Interlace;        // stored interlaced in the file (the pixels aren't)
+    uint64_t Pixels;          // offset of the first row
+    GifColorType Colors[256];
+} GifdFrame;
+
+typedef struct GifdImage {
+    uint32_t Magic;
+    int32_t Width, Height; // logical screen
+    int32_t BackgroundColor;
+    int32_t ColorCount;    // global palette entries (0 = none)
+    int32_t FrameCount;
+    uint64_t FrameTable;   // offset of the GifdFrames
+    GifColorType Colors[256];
+} GifdImage;
+
+// A result mapped by the client (read only)
+typedef struct GifdResult {
+    int Error;
+    int Fd;
+    size_t Size;
+    const uint8_t *Data;
+} GifdResult;
+
+// Shared memory for a frame to encode, filled in by the caller
+typedef struct GifdFrameBuffer {
+    int Fd;
+    int Width, Height, ColorCount;
+    size_t Size;
+    uint8_t *Map;
+    GifColorType *Colors; // ColorCount entries
+    GifPixelType *Pixels; // Width * Height, no padding
+} GifdFrameBuffer;
+
+// Client; the functions return GIF_OK or GIF_ERROR with Result->Error set
+int GifdConnect(const char *SocketPath); // socket or -1
+void GifdDisconnect(int Sock);
+int GifdDecodeFd(int Sock, int GifFd, GifdResult *Result); /* GifFd stays the caller's */
+int GifdDecodeFile(int Sock, const char *FileName, GifdResult *Result);
+int GifdDecodeMemory(int Sock, const void *Data, size_t Size, GifdResult *Result);
+int GifdFrameBufferCreate(GifdFrameBuffer *Buffer, int Width, int Height, int ColorCount);
+void GifdFrameBufferFree(GifdFrameBuffer *Buffer);
+int GifdEncode(int Sock, const GifdFrameBuffer *Buffer, GifdResult *Result); /* Result->Data = GIF file */
+const GifdImage *GifdResultImage(const GifdResult *Result);
+const GifdFrame *GifdResultFrame(const GifdResult *Result, int Index);
+const GifPixelType *GifdFramePixels(const GifdResult *Result, const GifdFrame *Frame);
+void GifdRelease(GifdResult *Result);
+
+// Message transport shared by the daemon and the client; *Fd = -1 when no
+// descriptor came with the message
+int GifdSendMsg(int Sock, const void *Msg, size_t Size, int Fd);
+int GifdRecvMsg(int Sock, void *Msg, size_t Size, int *Fd);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+#endif /* _GIFD_H_ */
@@ -0,0 +1,387 @@
+//
+// gifd client library
+//
+// Copyright (c) 2021 BitBank Software, Inc.
+// written by Larry Bank
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Talks to gifd (see gifd.h). Results are mapped straight from the memfd
+// the daemon filled in; the only copy made here is by GifdDecodeMemory(),
+// which has to put the caller's bytes into a descriptor first.
+//
+#define _GNU_SOURCE // memfd_create()
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "gifd.h"
+
+//
+// GifdSendMsg
+//
+// Send one message with an optional file descriptor (Fd < 0 = none)
+//
+int GifdSendMsg(int iSock, const void *pMsg, size_t iSize, int iFD)
+{
+    struct msghdr msg;
+    struct iovec iov;
+    union { // aligned room for one descriptor
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } ctl;
+    struct cmsghdr *pCmsg;
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = (void *)pMsg;
+    iov.iov_len = iSize;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (iFD >= 0) {
+        memset(&ctl, 0, sizeof(ctl));
+        msg.msg_control = ctl.buf;
+        msg.msg_controllen = sizeof(ctl.buf);
+        pCmsg = CMSG_FIRSTHDR(&msg);
+        pCmsg->cmsg_level = SOL_SOCKET;
+        pCmsg->cmsg_type = SCM_RIGHTS;
+        pCmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(pCmsg), &iFD, sizeof(int));
+    }
+    return (sendmsg(iSock, &msg, MSG_NOSIGNAL) == (ssize_t)iSize) ? GIF_OK : GIF_ERROR;
+} /* GifdSendMsg() */
+//
+// GifdRecvMsg
+//
+// Receive one message of exactly iSize bytes and the descriptor sent with
+// it, if any (extra descriptors are closed)
+//
+int GifdRecvMsg(int iSock, void *pMsg, size_t iSize, int *piFD)
+{
+    struct msghdr msg;
+    struct iovec iov;
+    union {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(4 * sizeof(int))];
+    } ctl;
+    struct cmsghdr *pCmsg;
+    ssize_t iLen;
+    int i, iCount, iFD;
+
+    *piFD = -1;
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = pMsg;
+    iov.iov_len = iSize;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctl.buf;
+    msg.msg_controllen = sizeof(ctl.buf);
+    iLen = recvmsg(iSock, &msg, MSG_CMSG_CLOEXEC);
+    for (pCmsg = CMSG_FIRSTHDR(&msg); pCmsg != NULL; pCmsg = CMSG_NXTHDR(&msg, pCmsg)) {
+        if (pCmsg->cmsg_level != SOL_SOCKET || pCmsg->cmsg_type != SCM_RIGHTS)
+            continue;
+        iCount = (int)((pCmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+        for (i = 0; i < iCount; i++) {
+            memcpy(&iFD, CMSG_DATA(pCmsg) + i * sizeof(int), sizeof(int));
+            if (*piFD < 0)
+                *piFD = iFD;
+            else
+                close(iFD);
+        }
+    }
+    if (iLen != (ssize_t)iSize || (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC))) {
+        if (*piFD >= 0)
+            close(*piFD);
+        *piFD = -1;
+        return GIF_ERROR;
+    }
+    return GIF_OK;
+} /* GifdRecvMsg() */
+//
+// GifdConnect
+//
+int GifdConnect(const char *szPath)
+{
+    struct sockaddr_un addr;
+    int iSock;
+
+    if (szPath == NULL)
+        szPath = GIFD_DEFAULT_SOCKET;
+    if (strlen(szPath) >= sizeof(addr.sun_path))
+        return -1;
+    iSock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (iSock < 0)
+        return -1;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, szPath);
+    if (connect(iSock, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        close(iSock);
+        return -1;
+    }
+    return iSock;
+} /* GifdConnect() */
+//
+// GifdDisconnect
+//
+void GifdDisconnect(int iSock)
+{
+    if (iSock >= 0)
+        close(iSock);
+} /* GifdDisconnect() */
+//
+// GifdRequestResult
+//
+// Send a request with its input descriptor and map the result
+//
+static int GifdRequestResult(int iSock, const GifdRequest *pReq, int iFD, GifdResult *pResult)
+{
+    GifdReply reply;
+    struct stat st;
+    void *p;
+    int iResult;
+
+    memset(pResult, 0, sizeof(GifdResult));
+    pResult->Fd = -1;
+    if (GifdSendMsg(iSock, pReq, sizeof(GifdRequest), iFD) != GIF_OK ||
+        GifdRecvMsg(iSock, &reply, sizeof(reply), &iResult) != GIF_OK) {
+        pResult->Error = GIFD_ERR_IO;
+        return GIF_ERROR;
+    }
+    if (reply.Magic != GIFD_MAGIC || (reply.Error == 0 && iResult < 0)) {
+        if (iResult >= 0)
+            close(iResult);
+        pResult->Error = GIFD_ERR_PROTOCOL;
+        return GIF_ERROR;
+    }
+    if (reply.Error != 0) {
+        if (iResult >= 0)
+            close(iResult);
+        pResult->Error = reply.Error;
+        return GIF_ERROR;
+    }
+    // trust the memfd's size rather than the message
+    if (fstat(iResult, &st) != 0 || (uint64_t)st.st_size != reply.Size || st.st_size == 0) {
+        close(iResult);
+        pResult->Error = GIFD_ERR_PROTOCOL;
+        return GIF_ERROR;
+    }
+    p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, iResult, 0);
+    if (p == MAP_FAILED) {
+        close(iResult);
+        pResult->Error = GIFD_ERR_SYSTEM;
+        return GIF_ERROR;
+    }
+    pResult->Fd = iResult;
+    pResult->Size = (size_t)st.st_size;
+    pResult->Data = (const uint8_t *)p;
+    return GIF_OK;
+} /* GifdRequestResult() */
+//
+// GifdCheckImage
+//
+// Make sure a decode result only points inside itself
+//
+static int GifdCheckImage(GifdResult *pResult)
+{
+    const GifdImage *pImage = (const GifdImage *)pResult->Data;
+    const GifdFrame *pFrame;
+    uint64_t u64End;
+    int i;
+
+    if (pResult->Size < sizeof(GifdImage) || pImage->Magic != GIFD_MAGIC || pImage->FrameCount < 0 ||
+        pImage->FrameTable > pResult->Size ||
+        (pResult->Size - pImage->FrameTable) / sizeof(GifdFrame) < (uint64_t)pImage->FrameCount)
+        return GIF_ERROR;
+    for (i = 0; i < pImage->FrameCount; i++) {
+        pFrame = GifdResultFrame(pResult, i);
+        if (pFrame->Width < 0 || pFrame->Height < 0 || pFrame->Pitch < pFrame->Width)
+            return GIF_ERROR;
+        u64End = pFrame->Pixels + (uint64_t)pFrame->Pitch * pFrame->Height;
+        if (pFrame->Pixels > pResult->Size || u64End > pResult->Size)
+            return GIF_ERROR;
+    }
+    return GIF_OK;
+} /* GifdCheckImage() */
+//
+// GifdDecodeFd
+//
+// Decode the GIF file behind GifFd (a file or e.g. a memfd; it's read from
+// the start). The frames are in Result, see GifdResultImage().
+//
+int GifdDecodeFd(int iSock, int iGifFD, GifdResult *pResult)
+{
+    GifdRequest req;
+
+    memset(&req, 0, sizeof(req));
+    req.Magic = GIFD_MAGIC;
+    req.Op = GIFD_OP_DECODE;
+    if (GifdRequestResult(iSock, &req, iGifFD, pResult) != GIF_OK)
+        return GIF_ERROR;
+    if (GifdCheckImage(pResult) != GIF_OK) {
+        GifdRelease(pResult);
+        pResult->Error = GIFD_ERR_PROTOCOL;
+        return GIF_ERROR;
+    }
+    return GIF_OK;
+} /* GifdDecodeFd() */
+//
+// GifdDecodeFile
+//
+int GifdDecodeFile(int iSock, const char *szName, GifdResult *pResult)
+{
+    int iFD, rc;
+
+    iFD = open(szName, O_RDONLY | O_CLOEXEC);
+    if (iFD < 0) {
+        memset(pResult, 0, sizeof(GifdResult));
+        pResult->Fd = -1;
+        pResult->Error = D_GIF_ERR_OPEN_FAILED;
+        return GIF_ERROR;
+    }
+    rc = GifdDecodeFd(iSock, iFD, pResult);
+    close(iFD);
+    return rc;
+} /* GifdDecodeFile() */
+//
+// GifdDecodeMemory
+//
+// Decode a GIF held in memory (copied into a memfd to send it)
+//
+int GifdDecodeMemory(int iSock, const void *pData, size_t iSize, GifdResult *pResult)
+{
+    int iFD, rc;
+    const uint8_t *p = (const uint8_t *)pData;
+    ssize_t iLen;
+
+    memset(pResult, 0, sizeof(GifdResult));
+    pResult->Fd = -1;
+    iFD = memfd_create("gifd-input", MFD_CLOEXEC);
+    if (iFD < 0) {
+        pResult->Error = GIFD_ERR_SYSTEM;
+        return GIF_ERROR;
+    }
+    while (iSize > 0) {
+        iLen = write(iFD, p, iSize);
+        if (iLen <= 0) {
+            close(iFD);
+            pResult->Error = GIFD_ERR_SYSTEM;
+            return GIF_ERROR;
+        }
+        p += iLen;
+        iSize -= (size_t)iLen;
+    }
+    rc = GifdDecodeFd(iSock, iFD, pResult);
+    close(iFD);
+    return rc;
+} /* GifdDecodeMemory() */
+//
+// GifdFrameBufferCreate
+//
+// Create shared memory for a frame to encode; the caller fills in Colors
+// and Pixels and passes it to GifdEncode() (as often as it likes)
+//
+int GifdFrameBufferCreate(GifdFrameBuffer *pBuf, int iWidth, int iHeight, int iColors)
+{
+    void *p;
+
+    memset(pBuf, 0, sizeof(GifdFrameBuffer));
+    pBuf->Fd = -1;
+    if (iWidth <= 0 || iHeight <= 0 || iWidth > 65535 || iHeight > 65535 || iColors < 2 || iColors > 256 || (iColors & (iColors - 1)))
+        return GIF_ERROR;
+    pBuf->Size = (size_t)iColors * sizeof(GifColorType) + (size_t)iWidth * iHeight;
+    pBuf->Fd = memfd_create("gifd-frame", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (pBuf->Fd < 0)
+        return GIF_ERROR;
+    // the daemon reads it into its own memory, so it may be reused (and
+    // written to) as soon as GifdEncode() returns; the size stays fixed
+    if (ftruncate(pBuf->Fd, (off_t)pBuf->Size) != 0 || fcntl(pBuf->Fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW) != 0 ||
+        (p = mmap(NULL, pBuf->Size, PROT_READ | PROT_WRITE, MAP_SHARED, pBuf->Fd, 0)) == MAP_FAILED) {
+        close(pBuf->Fd);
+        pBuf->Fd = -1;
+        return GIF_ERROR;
+    }
+    pBuf->Width = iWidth;
+    pBuf->Height = iHeight;
+    pBuf->ColorCount = iColors;
+    pBuf->Map = (uint8_t *)p;
+    pBuf->Colors = (GifColorType *)p;
+    pBuf->Pixels = &pBuf->Map[iColors * sizeof(GifColorType)];
+    return GIF_OK;
+} /* GifdFrameBufferCreate() */
+//
+// GifdFrameBufferFree
+//
+void GifdFrameBufferFree(GifdFrameBuffer *pBuf)
+{
+    if (pBuf->Map != NULL)
+        munmap(pBuf->Map, pBuf->Size);
+    if (pBuf->Fd >= 0)
+        close(pBuf->Fd);
+    memset(pBuf, 0, sizeof(GifdFrameBuffer));
+    pBuf->Fd = -1;
+} /* GifdFrameBufferFree() */
+//
+// GifdEncode
+//
+// Compress a frame buffer into a GIF file; Result->Data / Size are its bytes
+//
+int GifdEncode(int iSock, const GifdFrameBuffer *pBuf, GifdResult *pResult)
+{
+    GifdRequest req;
+
+    memset(&req, 0, sizeof(req));
+    req.Magic = GIFD_MAGIC;
+    req.Op = GIFD_OP_ENCODE;
+    req.Width = pBuf->Width;
+    req.Height = pBuf->Height;
+    req.ColorCount = pBuf->ColorCount;
+    return GifdRequestResult(iSock, &req, pBuf->Fd, pResult);
+} /* GifdEncode() */
+//
+// GifdResultImage / GifdResultFrame / GifdFramePixels
+//
+// Views of a decode result (valid until GifdRelease())
+//
+const GifdImage *GifdResultImage(const GifdResult *pResult)
+{
+    return (const GifdImage *)pResult->Data;
+}
+const GifdFrame *GifdResultFrame(const GifdResult *pResult, int iIndex)
+{
+    const GifdImage *pImage = GifdResultImage(pResult);
+
+    if (iIndex < 0 || iIndex >= pImage->FrameCount)
+        return NULL;
+    return (const GifdFrame *)&pResult->Data[pImage->FrameTable] + iIndex;
+}
+const GifPixelType *GifdFramePixels(const GifdResult *pResult, const GifdFrame *pFrame)
+{
+    return &pResult->Data[pFrame->Pixels];
+}
+//
+// GifdRelease
+//
+void GifdRelease(GifdResult *pResult)
+{
+    if (pResult->Data != NULL)
+        munmap((void *)pResult->Data, pResult->Size);
+    if (pResult->Fd >= 0)
+        close(pResult->Fd);
+    pResult->Data = NULL;
+    pResult->Size = 0;
+    pResult->Fd = -1;
+} /* GifdRelease() */
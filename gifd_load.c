@@ -0,0 +1,464 @@
+//
+// gifd load test
+//
+// Runs the same requests against a running gifd and in-process, from a
+// number of client threads, and reports the throughput of each as JSON
+// lines like gif_bench:
+//
+// {"op":"decode","mode":"daemon","clients":4,"requests":4000,"seconds":1.25,...}
+//
+// Modes: "cold" opens and closes a handle for every request (what a process
+// started per image pays, minus exec), "warm" reuses one handle per thread
+// (DGifReopenFileName / EGifReopenFileHandle) and "daemon" sends the
+// request to gifd over its socket, one connection per thread. Each decoded
+// frame is summed by the client in every mode, so the pixels are touched
+// the same way whether they come from the daemon's memfd or the library's
+// buffers. Before timing, the daemon's results are checked against the
+// in-process ones.
+//
+// usage: gifd_load [-s socket] [-c clients] [-n requests] [-e] file.gif ...
+//  -s  socket of the daemon (default /tmp/gifd.sock)
+//  -c  client threads (default 4)
+//  -n  requests per client thread and mode (default 200); the files are
+//      used round robin
+//  -e  also encode the first frame of each file
+//
+#define _GNU_SOURCE // memfd_create()
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "gifd.h"
+
+#define LOAD_COLD   0
+#define LOAD_WARM   1
+#define LOAD_DAEMON 2
+
+typedef struct load_frame { // first frame of a file, input of the encode test
+    int iWidth, iHeight, iColors;
+    GifColorType colors[256];
+    GifPixelType *pPixels;
+} LOAD_FRAME;
+
+typedef struct load_file {
+    const char *szName;
+    uint64_t u64Sum;      // checksum of the decoded frames (see LoadSumFrame)
+    uint64_t u64Pixels;   // pixels of all frames
+    LOAD_FRAME frame;     // iWidth = 0 if it can't be encoded
+} LOAD_FILE;
+
+typedef struct load_thread {
+    pthread_t tid;
+    int iMode;
+    bool bEncode;
+    int iErrors;
+    uint64_t u64Pixels;
+    uint64_t u64Sum;      // keeps the sums from being optimized away
+} LOAD_THREAD;
+
+static LOAD_FILE *pFiles;
+static int iFileCount;
+static int iRequests = 200;
+static const char *szSocket = GIFD_DEFAULT_SOCKET;
+static const char *szModes[] = {"cold", "warm", "daemon"};
+
+static double LoadNow(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+} /* LoadNow() */
+//
+// LoadSumFrame
+//
+// The client's work on a decoded frame: sum its pixels
+//
+static uint64_t LoadSumFrame(const GifPixelType *p, int iWidth, int iHeight, int iPitch)
+{
+    uint64_t u64Sum = (uint64_t)iWidth * 65537 + iHeight;
+    int x, y;
+
+    for (y = 0; y < iHeight; y++, p += iPitch)
+        for (x = 0; x < iWidth; x++)
+            u64Sum += p[x];
+    return u64Sum;
+} /* LoadSumFrame() */
+//
+// LoadDecodeLocal
+//
+// Decode a file in-process with an open handle; returns GIF_OK and its checksum
+//
+static int LoadDecodeLocal(GifFileType *gif, uint64_t *pu64Sum, uint64_t *pu64Pixels)
+{
+    SavedImage *pPage;
+
+    *pu64Sum = *pu64Pixels = 0;
+    while ((pPage = DGifNextFrame(gif)) != NULL) {
+        *pu64Sum += LoadSumFrame(pPage->RasterBits, pPage->ImageDesc.Width, pPage->ImageDesc.Height, pPage->ImageDesc.Width);
+        *pu64Pixels += (uint64_t)pPage->ImageDesc.Width * pPage->ImageDesc.Height;
+    }
+    return (gif->Error == D_GIF_SUCCEEDED) ? GIF_OK : GIF_ERROR;
+} /* LoadDecodeLocal() */
+//
+// LoadDecodeDaemon
+//
+static int LoadDecodeDaemon(int iSock, const char *szName, uint64_t *pu64Sum, uint64_t *pu64Pixels)
+{
+    GifdResult result;
+    const GifdFrame *pFrame;
+    int i;
+
+    *pu64Sum = *pu64Pixels = 0;
+    if (GifdDecodeFile(iSock, szName, &result) != GIF_OK)
+        return GIF_ERROR;
+    for (i = 0; i < GifdResultImage(&result)->FrameCount; i++) {
+        pFrame = GifdResultFrame(&result, i);
+        *pu64Sum += LoadSumFrame(GifdFramePixels(&result, pFrame), pFrame->Width, pFrame->Height, pFrame->Pitch);
+        *pu64Pixels += (uint64_t)pFrame->Width * pFrame->Height;
+    }
+    GifdRelease(&result);
+    return GIF_OK;
+} /* LoadDecodeDaemon() */
+//
+// LoadEncodeLocal
+//
+// Encode a frame in-process into the file iFD (which is closed). *pGif is
+// the thread's handle (opened here if NULL); unless bKeep, it's closed again.
+//
+static int LoadEncodeLocal(GifFileType **pGif, bool bKeep, int iFD, const LOAD_FRAME *pFrame)
+{
+    GifFileType *gif = *pGif;
+    ColorMapObject map;
+    SavedImage *pSI;
+    size_t iSize;
+    int iBits, err;
+
+    if (gif == NULL) {
+        gif = *pGif = EGifOpenFileHandle(iFD, &err);
+        if (gif == NULL) {
+            close(iFD);
+            return GIF_ERROR;
+        }
+    } else if (EGifReopenFileHandle(gif, iFD, &err) != GIF_OK) {
+        close(iFD);
+        return GIF_ERROR;
+    }
+    for (iBits = 1; (1 << iBits) < pFrame->iColors; iBits++)
+        ;
+    map.ColorCount = pFrame->iColors;
+    map.BitsPerPixel = iBits;
+    map.SortFlag = false;
+    map.Colors = (GifColorType *)pFrame->colors;
+    err = EGifPutScreenDesc(gif, pFrame->iWidth, pFrame->iHeight, (iBits < 2) ? 2 : iBits, 0, &map);
+    if (err == GIF_OK) { // the handle frees the frames it writes, so it gets a copy
+        iSize = (size_t)pFrame->iWidth * pFrame->iHeight;
+        pSI = &gif->SavedImages[0];
+        pSI->ImageDesc.Width = pFrame->iWidth;
+        pSI->ImageDesc.Height = pFrame->iHeight;
+        pSI->RasterBits = malloc(iSize);
+        if (pSI->RasterBits != NULL) {
+            memcpy(pSI->RasterBits, pFrame->pPixels, iSize);
+            gif->ImageCount = 1;
+            err = EGifSpewKeep(gif);
+        } else {
+            err = GIF_ERROR;
+        }
+    }
+    if (!bKeep) {
+        EGifCloseFile(gif, NULL);
+        *pGif = NULL;
+    }
+    return err;
+} /* LoadEncodeLocal() */
+//
+// LoadDecodeBack
+//
+// Check that the GIF file in iFD holds exactly the pixels of the frame
+//
+static int LoadDecodeBack(int iFD, const LOAD_FRAME *pFrame)
+{
+    GifFileType *gif;
+    SavedImage *pPage;
+    int err, rc = GIF_ERROR;
+
+    lseek(iFD, 0, SEEK_SET);
+    gif = DGifOpenFileHandle(iFD, &err); // takes iFD
+    if (gif == NULL)
+        return GIF_ERROR;
+    pPage = DGifNextFrame(gif);
+    if (pPage != NULL && pPage->ImageDesc.Width == pFrame->iWidth && pPage->ImageDesc.Height == pFrame->iHeight &&
+        memcmp(pPage->RasterBits, pFrame->pPixels, (size_t)pFrame->iWidth * pFrame->iHeight) == 0)
+        rc = GIF_OK;
+    DGifCloseFile(gif, NULL);
+    return rc;
+} /* LoadDecodeBack() */
+//
+// LoadPrepare
+//
+// Decode every file in-process for the reference checksums and keep the
+// first frame for the encode test
+//
+static int LoadPrepare(void)
+{
+    GifFileType *gif;
+    SavedImage *pPage;
+    const ColorMapObject *pMap;
+    LOAD_FILE *pFile;
+    uint8_t ucOr;
+    size_t j, iSize;
+    int i, err;
+
+    for (i = 0; i < iFileCount; i++) {
+        pFile = &pFiles[i];
+        gif = DGifOpenFileName(pFile->szName, &err);
+        if (gif == NULL || LoadDecodeLocal(gif, &pFile->u64Sum, &pFile->u64Pixels) != GIF_OK) {
+            fprintf(stderr, "gifd_load: can't decode %s\n", pFile->szName);
+            if (gif != NULL)
+                DGifCloseFile(gif, NULL);
+            return GIF_ERROR;
+        }
+        DGifCloseFile(gif, NULL);
+        gif = DGifOpenFileName(pFile->szName, &err);
+        pPage = (gif != NULL) ? DGifNextFrame(gif) : NULL;
+        if (pPage != NULL) {
+            pMap = (pPage->ImageDesc.ColorMap != NULL) ? pPage->ImageDesc.ColorMap : gif->SColorMap;
+            iSize = (size_t)pPage->ImageDesc.Width * pPage->ImageDesc.Height;
+            for (ucOr = 0, j = 0; j < iSize; j++)
+                ucOr |= pPage->RasterBits[j];
+            // only frames whose pixels fit the palette can be encoded
+            if (pMap != NULL && pMap->ColorCount >= 2 && pMap->ColorCount <= 256 && ucOr < pMap->ColorCount &&
+                iSize > 0 && (pFile->frame.pPixels = malloc(iSize)) != NULL) {
+                pFile->frame.iWidth = pPage->ImageDesc.Width;
+                pFile->frame.iHeight = pPage->ImageDesc.Height;
+                pFile->frame.iColors = pMap->ColorCount;
+                memcpy(pFile->frame.colors, pMap->Colors, pMap->ColorCount * sizeof(GifColorType));
+                memcpy(pFile->frame.pPixels, pPage->RasterBits, iSize);
+            }
+        }
+        if (gif != NULL)
+            DGifCloseFile(gif, NULL);
+    }
+    return GIF_OK;
+} /* LoadPrepare() */
+//
+// LoadVerify
+//
+// Compare the daemon's results with the in-process ones
+//
+static int LoadVerify(bool bEncode)
+{
+    GifdFrameBuffer buf;
+    GifdResult result;
+    uint64_t u64Sum, u64Pixels;
+    int i, iSock, rc = GIF_OK;
+
+    iSock = GifdConnect(szSocket);
+    if (iSock < 0) {
+        fprintf(stderr, "gifd_load: can't connect to %s\n", szSocket);
+        return GIF_ERROR;
+    }
+    for (i = 0; i < iFileCount; i++) {
+        if (LoadDecodeDaemon(iSock, pFiles[i].szName, &u64Sum, &u64Pixels) != GIF_OK || u64Sum != pFiles[i].u64Sum) {
+            fprintf(stderr, "gifd_load: %s decoded by the daemon differs\n", pFiles[i].szName);
+            rc = GIF_ERROR;
+        }
+        if (!bEncode || pFiles[i].frame.iWidth == 0)
+            continue;
+        if (GifdFrameBufferCreate(&buf, pFiles[i].frame.iWidth, pFiles[i].frame.iHeight, pFiles[i].frame.iColors) != GIF_OK) {
+            rc = GIF_ERROR;
+            continue;
+        }
+        memcpy(buf.Colors, pFiles[i].frame.colors, buf.ColorCount * sizeof(GifColorType));
+        memcpy(buf.Pixels, pFiles[i].frame.pPixels, (size_t)buf.Width * buf.Height);
+        if (GifdEncode(iSock, &buf, &result) != GIF_OK || LoadDecodeBack(dup(result.Fd), &pFiles[i].frame) != GIF_OK) {
+            fprintf(stderr, "gifd_load: %s encoded by the daemon differs (%d)\n", pFiles[i].szName, result.Error);
+            rc = GIF_ERROR;
+        }
+        GifdRelease(&result);
+        GifdFrameBufferFree(&buf);
+    }
+    GifdDisconnect(iSock);
+    return rc;
+} /* LoadVerify() */
+//
+// LoadThread
+//
+// One client: iRequests requests of one mode
+//
+static void *LoadThread(void *pArg)
+{
+    LOAD_THREAD *pThread = (LOAD_THREAD *)pArg;
+    GifFileType *gif = NULL;
+    GifdFrameBuffer *pBufs = NULL;
+    GifdResult result;
+    LOAD_FILE *pFile;
+    uint64_t u64Sum, u64Pixels;
+    int i, iFile, iSock = -1, iOut = -1, err, rc;
+
+    if (pThread->iMode == LOAD_DAEMON) {
+        iSock = GifdConnect(szSocket);
+        if (iSock < 0) {
+            pThread->iErrors = iRequests;
+            return NULL;
+        }
+        if (pThread->bEncode) { // the pixels are written to shared memory once
+            pBufs = calloc(iFileCount, sizeof(GifdFrameBuffer));
+            for (i = 0; pBufs != NULL && i < iFileCount; i++) {
+                pBufs[i].Fd = -1;
+                if (pFiles[i].frame.iWidth == 0 ||
+                    GifdFrameBufferCreate(&pBufs[i], pFiles[i].frame.iWidth, pFiles[i].frame.iHeight, pFiles[i].frame.iColors) != GIF_OK)
+                    continue;
+                memcpy(pBufs[i].Colors, pFiles[i].frame.colors, pBufs[i].ColorCount * sizeof(GifColorType));
+                memcpy(pBufs[i].Pixels, pFiles[i].frame.pPixels, (size_t)pBufs[i].Width * pBufs[i].Height);
+            }
+        }
+    }
+    if (pThread->bEncode && pThread->iMode != LOAD_DAEMON)
+        iOut = memfd_create("gifd_load", MFD_CLOEXEC);
+    for (i = 0; i < iRequests; i++) {
+        iFile = i % iFileCount;
+        pFile = &pFiles[iFile];
+        rc = GIF_ERROR;
+        if (pThread->bEncode) {
+            if (pFile->frame.iWidth == 0)
+                continue;
+            if (pThread->iMode == LOAD_DAEMON) {
+                if (pBufs != NULL && pBufs[iFile].Fd >= 0 && GifdEncode(iSock, &pBufs[iFile], &result) == GIF_OK) {
+                    pThread->u64Sum += result.Size;
+                    GifdRelease(&result);
+                    rc = GIF_OK;
+                }
+            } else if (iOut >= 0 && ftruncate(iOut, 0) == 0 && lseek(iOut, 0, SEEK_SET) == 0) {
+                rc = LoadEncodeLocal(&gif, pThread->iMode == LOAD_WARM, dup(iOut), &pFile->frame);
+            }
+            u64Pixels = (uint64_t)pFile->frame.iWidth * pFile->frame.iHeight;
+        } else {
+            if (pThread->iMode == LOAD_DAEMON) {
+                rc = LoadDecodeDaemon(iSock, pFile->szName, &u64Sum, &u64Pixels);
+            } else {
+                if (pThread->iMode == LOAD_COLD || gif == NULL) {
+                    gif = DGifOpenFileName(pFile->szName, &err);
+                } else if (DGifReopenFileName(gif, pFile->szName, &err) != GIF_OK) {
+                    DGifCloseFile(gif, NULL);
+                    gif = NULL;
+                }
+                if (gif != NULL)
+                    rc = LoadDecodeLocal(gif, &u64Sum, &u64Pixels);
+                if (gif != NULL && pThread->iMode == LOAD_COLD) {
+                    DGifCloseFile(gif, NULL);
+                    gif = NULL;
+                }
+            }
+            pThread->u64Sum += u64Sum;
+        }
+        if (rc == GIF_OK)
+            pThread->u64Pixels += u64Pixels;
+        else
+            pThread->iErrors++;
+    }
+    if (gif != NULL) {
+        if (pThread->bEncode)
+            EGifCloseFile(gif, NULL);
+        else
+            DGifCloseFile(gif, NULL);
+    }
+    if (pBufs != NULL) {
+        for (i = 0; i < iFileCount; i++)
+            GifdFrameBufferFree(&pBufs[i]);
+        free(pBufs);
+    }
+    if (iOut >= 0)
+        close(iOut);
+    GifdDisconnect(iSock);
+    return NULL;
+} /* LoadThread() */
+//
+// LoadRun
+//
+// Time one op/mode with iClients threads and print its JSON line
+//
+static int LoadRun(int iClients, int iMode, bool bEncode)
+{
+    LOAD_THREAD *pThreads;
+    uint64_t u64Pixels = 0;
+    double dStart, dTime;
+    int i, iErrors = 0;
+
+    pThreads = calloc(iClients, sizeof(LOAD_THREAD));
+    if (pThreads == NULL)
+        return GIF_ERROR;
+    dStart = LoadNow();
+    for (i = 0; i < iClients; i++) {
+        pThreads[i].iMode = iMode;
+        pThreads[i].bEncode = bEncode;
+        pthread_create(&pThreads[i].tid, NULL, LoadThread, &pThreads[i]);
+    }
+    for (i = 0; i < iClients; i++) {
+        pthread_join(pThreads[i].tid, NULL);
+        u64Pixels += pThreads[i].u64Pixels;
+        iErrors += pThreads[i].iErrors;
+    }
+    dTime = LoadNow() - dStart;
+    printf("{\"op\":\"%s\",\"mode\":\"%s\",\"clients\":%d,\"requests\":%d,\"errors\":%d,\"seconds\":%.4f,"
+           "\"requests_per_s\":%.1f,\"mpixels_per_s\":%.2f}\n",
+           bEncode ? "encode" : "decode", szModes[iMode], iClients, iClients * iRequests, iErrors, dTime,
+           iClients * iRequests / dTime, u64Pixels / dTime / 1e6);
+    fflush(stdout);
+    free(pThreads);
+    return (iErrors == 0) ? GIF_OK : GIF_ERROR;
+} /* LoadRun() */
+
+int main(int argc, char *argv[])
+{
+    int i, opt, iClients = 4, rc = GIF_OK;
+    bool bEncode = false;
+
+    while ((opt = getopt(argc, argv, "s:c:n:e")) != -1) {
+        switch (opt) {
+            case 's':
+                szSocket = optarg;
+                break;
+            case 'c':
+                iClients = atoi(optarg);
+                break;
+            case 'n':
+                iRequests = atoi(optarg);
+                break;
+            case 'e':
+                bEncode = true;
+                break;
+            default:
+                optind = argc + 1;
+                break;
+        }
+    }
+    if (optind >= argc || iClients <= 0 || iRequests <= 0) {
+        fprintf(stderr, "usage: gifd_load [-s socket] [-c clients] [-n requests] [-e] file.gif ...\n");
+        return 1;
+    }
+    iFileCount = argc - optind;
+    pFiles = calloc(iFileCount, sizeof(LOAD_FILE));
+    if (pFiles == NULL)
+        return 1;
+    for (i = 0; i < iFileCount; i++)
+        pFiles[i].szName = argv[optind + i];
+    if (LoadPrepare() != GIF_OK || LoadVerify(bEncode) != GIF_OK)
+        return 1;
+    for (i = LOAD_COLD; i <= LOAD_DAEMON; i++)
+        if (LoadRun(iClients, i, false) != GIF_OK)
+            rc = GIF_ERROR;
+    for (i = LOAD_COLD; bEncode && i <= LOAD_DAEMON; i++)
+        if (LoadRun(iClients, i, true) != GIF_OK)
+            rc = GIF_ERROR;
+    for (i = 0; i < iFileCount; i++)
+        free(pFiles[i].frame.pPixels);
+    free(pFiles);
+    return (rc == GIF_OK) ? 0 : 1;
+} /* main() */
@@ -0,0 +1,517 @@
+//
+// gifd regression tests
+//
+// Starts the gifd given on the command line twice on sockets in a
+// temporary directory, once without limits and once with -p and -m, and
+// sends it decode and encode requests through the client library. The
+// results are checked against the library decoding the same files
+// in-process. Each test prints one line, "ok <name>" or "FAIL <name>:
+// <reason>"; the exit code is the number of failed tests, which is what
+// ctest looks at.
+//
+// usage: gifd_regress path/to/gifd [test name ...]
+//  with names, only those tests are run
+//
+#define _GNU_SOURCE // memfd_create()
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "gifd.h"
+
+#define LIMIT_PIXELS 4096 // -p of the daemon with limits
+
+static char szTempDir[256];
+static char szSocket[2][300]; // without and with limits
+static pid_t pidDaemon[2];
+
+typedef int (*TESTFUNC)(void);
+
+static int Fail(const char *szName, const char *szReason)
+{
+    printf("FAIL %s: %s\n", szName, szReason);
+    return GIF_ERROR;
+} /* Fail() */
+
+static const char *TempPath(const char *szName)
+{
+    static char szPath[4][512];
+    static int iNext = 0;
+
+    iNext = (iNext + 1) & 3;
+    snprintf(szPath[iNext], sizeof(szPath[0]), "%s/%s", szTempDir, szName);
+    return szPath[iNext];
+} /* TempPath() */
+
+//
+// WriteFrames
+//
+// Encode frames with the library: iCount frames of the given boxes on a
+// iWidth x iHeight screen, 4 colors, pixels from the frame index and position
+//
+static int WriteFrames(const char *szPath, int iWidth, int iHeight, const int (*pBoxes)[4], int iCount)
+{
+    GifFileType *gif;
+    SavedImage *pSI;
+    ColorMapObject *pMap;
+    uint8_t *pGCB;
+    int i, j, iErr, iPixels;
+
+    gif = EGifOpenFileName(szPath, false, &iErr);
+    if (gif == NULL)
+        return GIF_ERROR;
+    pMap = GifMakeMapObject(4, NULL);
+    for (i = 0; i < 4; i++)
+        pMap->Colors[i].Red = (GifByteType)(i * 60);
+    EGifPutScreenDesc(gif, iWidth, iHeight, 8, 0, pMap); // the color resolution is the code size
+    GifFreeMapObject(pMap);
+    for (i = 0; i < iCount; i++) {
+        pSI = GifMakeSavedImage(gif, NULL);
+        if (pSI == NULL) {
+            EGifCloseFile(gif, &iErr);
+            return GIF_ERROR;
+        }
+        pSI->ImageDesc.Left = pBoxes[i][0];
+        pSI->ImageDesc.Top = pBoxes[i][1];
+        pSI->ImageDesc.Width = pBoxes[i][2];
+        pSI->ImageDesc.Height = pBoxes[i][3];
+        iPixels = pBoxes[i][2] * pBoxes[i][3];
+        pSI->RasterBits = (GifByteType *)malloc(iPixels);
+        for (j = 0; j < iPixels; j++)
+            pSI->RasterBits[j] = (GifByteType)((j * 5 + j / pBoxes[i][2] + i) & 3);
+        // graphics control block: restore to background, delay 10 + i,
+        // color 3 transparent in odd frames
+        pSI->ExtensionBlocks = (ExtensionBlock *)calloc(MAX_EXTENSIONS, sizeof(ExtensionBlock)); // like GifMakeSavedImage()
+        pSI->ExtensionBlockCount = 1;
+        pSI->ExtensionBlocks[0].Function = GRAPHICS_EXT_FUNC_CODE;
+        pSI->ExtensionBlocks[0].ByteCount = 4;
+        pSI->ExtensionBlocks[0].Bytes = pGCB = (GifByteType *)malloc(4);
+        pGCB[0] = (DISPOSE_BACKGROUND << 2) | (i & 1);
+        pGCB[1] = (uint8_t)(10 + i);
+        pGCB[2] = 0;
+        pGCB[3] = 3;
+    }
+    return (EGifSpew(gif) == GIF_OK) ? GIF_OK : GIF_ERROR;
+} /* WriteFrames() */
+
+//
+// SameAsLibrary
+//
+// A decode result must hold what DGifSlurp() makes of the same file
+//
+static int SameAsLibrary(const GifdResult *pResult, const char *szPath)
+{
+    const GifdImage *pImage = GifdResultImage(pResult);
+    const GifdFrame *pFrame;
+    const SavedImage *pSI;
+    const uint8_t *pGCB;
+    GifFileType *gif;
+    int i, y, iErr, rc = GIF_OK;
+
+    gif = DGifOpenFileName(szPath, &iErr);
+    if (gif == NULL || DGifSlurp(gif) != GIF_OK) {
+        DGifCloseFile(gif, &iErr);
+        return GIF_ERROR;
+    }
+    if (pImage->Width != gif->SWidth || pImage->Height != gif->SHeight || pImage->FrameCount != gif->ImageCount ||
+        pImage->ColorCount != gif->SColorMap->ColorCount ||
+        memcmp(pImage->Colors, gif->SColorMap->Colors, pImage->ColorCount * sizeof(GifColorType)) != 0)
+        rc = GIF_ERROR;
+    for (i = 0; i < gif->ImageCount && rc == GIF_OK; i++) {
+        pFrame = GifdResultFrame(pResult, i);
+        pSI = &gif->SavedImages[i];
+        if (pSI->ExtensionBlockCount < 1 || pSI->ExtensionBlocks[0].Function != GRAPHICS_EXT_FUNC_CODE) {
+            rc = GIF_ERROR;
+            break;
+        }
+        pGCB = pSI->ExtensionBlocks[0].Bytes;
+        if (pFrame == NULL || pFrame->Left != pSI->ImageDesc.Left || pFrame->Top != pSI->ImageDesc.Top ||
+            pFrame->Width != pSI->ImageDesc.Width || pFrame->Height != pSI->ImageDesc.Height ||
+            pFrame->Pitch < pFrame->Width || pFrame->DelayTime != (pGCB[1] | (pGCB[2] << 8)) ||
+            pFrame->TransparentColor != ((pGCB[0] & 1) ? pGCB[3] : NO_TRANSPARENT_COLOR) ||
+            pFrame->DisposalMode != ((pGCB[0] >> 2) & 7)) {
+            rc = GIF_ERROR;
+            break;
+        }
+        for (y = 0; y < pFrame->Height; y++) {
+            if (memcmp(GifdFramePixels(pResult, pFrame) + (size_t)y * pFrame->Pitch,
+                       &pSI->RasterBits[y * pSI->ImageDesc.Width], pFrame->Width) != 0)
+                rc = GIF_ERROR;
+        }
+    }
+    DGifCloseFile(gif, &iErr);
+    return rc;
+} /* SameAsLibrary() */
+
+//
+// EncodeResultIs
+//
+// Decode the GIF file of an encode result; it must have one frame holding
+// the colors and pixels of the frame buffer (or of pPixels if given)
+//
+static int EncodeResultIs(const GifdResult *pResult, const GifdFrameBuffer *pBuf, const uint8_t *pPixels)
+{
+    GifFileType *gif;
+    FILE *f;
+    int iErr, rc = GIF_ERROR;
+
+    f = fopen(TempPath("encoded.gif"), "wb");
+    if (f == NULL)
+        return GIF_ERROR;
+    fwrite(pResult->Data, 1, pResult->Size, f);
+    fclose(f);
+    gif = DGifOpenFileName(TempPath("encoded.gif"), &iErr);
+    if (gif != NULL && DGifSlurp(gif) == GIF_OK && gif->ImageCount == 1 && gif->SWidth == pBuf->Width &&
+        gif->SHeight == pBuf->Height && gif->SColorMap != NULL && gif->SColorMap->ColorCount == pBuf->ColorCount &&
+        memcmp(gif->SColorMap->Colors, pBuf->Colors, pBuf->ColorCount * sizeof(GifColorType)) == 0 &&
+        memcmp(gif->SavedImages[0].RasterBits, pPixels ? pPixels : pBuf->Pixels, (size_t)pBuf->Width * pBuf->Height) == 0)
+        rc = GIF_OK;
+    DGifCloseFile(gif, &iErr);
+    return rc;
+} /* EncodeResultIs() */
+
+//
+// TestDecodeFrames
+//
+// Frames of different sizes, one of them wider and taller than the screen;
+// each comes back with its own pitch and its graphics control block
+//
+static int TestDecodeFrames(void)
+{
+    const char *szName = "decode_frames";
+    static const int iBoxes[3][4] = {{0, 0, 40, 10}, {5, 2, 300, 3}, {3, 1, 17, 25}};
+    GifdResult result;
+    int iSock, rc;
+
+    if (WriteFrames(TempPath("frames.gif"), 40, 10, iBoxes, 3) != GIF_OK)
+        return Fail(szName, "can't write the input file");
+    iSock = GifdConnect(szSocket[0]);
+    if (iSock < 0)
+        return Fail(szName, "can't connect");
+    rc = GifdDecodeFile(iSock, TempPath("frames.gif"), &result);
+    GifdDisconnect(iSock);
+    if (rc != GIF_OK)
+        return Fail(szName, "the daemon couldn't decode the file");
+    rc = SameAsLibrary(&result, TempPath("frames.gif"));
+    GifdRelease(&result);
+    if (rc != GIF_OK)
+        return Fail(szName, "the frames don't match the library's");
+    return GIF_OK;
+} /* TestDecodeFrames() */
+
+//
+// TestEncodeRoundTrip
+//
+// Encode the same frame buffer a few times with different contents
+//
+static int TestEncodeRoundTrip(void)
+{
+    const char *szName = "encode_round_trip";
+    GifdFrameBuffer fb;
+    GifdResult result;
+    int i, iPass, iSock, rc = GIF_OK;
+
+    iSock = GifdConnect(szSocket[0]);
+    if (iSock < 0)
+        return Fail(szName, "can't connect");
+    if (GifdFrameBufferCreate(&fb, 123, 77, 16) != GIF_OK) {
+        GifdDisconnect(iSock);
+        return Fail(szName, "can't create the frame buffer");
+    }
+    for (iPass = 0; iPass < 3 && rc == GIF_OK; iPass++) {
+        for (i = 0; i < 16; i++)
+            fb.Colors[i].Red = fb.Colors[i].Green = fb.Colors[i].Blue = (GifByteType)(i * 16 + iPass);
+        for (i = 0; i < 123 * 77; i++)
+            fb.Pixels[i] = (GifPixelType)((i * 7 + i / 123 + iPass) & 15);
+        if (GifdEncode(iSock, &fb, &result) != GIF_OK)
+            rc = Fail(szName, "the daemon couldn't encode the frame");
+        else if ((rc = EncodeResultIs(&result, &fb, NULL)) != GIF_OK)
+            Fail(szName, "the GIF file doesn't hold the frame");
+        GifdRelease(&result);
+    }
+    // a pixel beyond the palette can't be encoded
+    fb.Pixels[100] = 16;
+    if (rc == GIF_OK && (GifdEncode(iSock, &fb, &result) == GIF_OK || result.Error != E_GIF_ERR_DATA_TOO_BIG)) {
+        GifdRelease(&result);
+        rc = Fail(szName, "a pixel beyond the palette was accepted");
+    }
+    GifdFrameBufferFree(&fb);
+    GifdDisconnect(iSock);
+    return rc;
+} /* TestEncodeRoundTrip() */
+
+// Thread of TestEncodeRewrite(): flips pixels between a valid and an
+// invalid value while the daemon encodes
+static volatile int bRewriting;
+static void *RewritePixels(void *pArg)
+{
+    GifdFrameBuffer *pBuf = (GifdFrameBuffer *)pArg;
+    size_t i, iPixels = (size_t)pBuf->Width * pBuf->Height;
+    int iValue = 1;
+
+    while (bRewriting) {
+        iValue ^= 1 ^ 200;
+        for (i = 0; i < iPixels; i += 4093)
+            ((volatile GifPixelType *)pBuf->Pixels)[i] = (GifPixelType)iValue;
+    }
+    return NULL;
+} /* RewritePixels() */
+
+//
+// TestEncodeRewrite
+//
+// The client keeps writing to the frame buffer during the request. Each
+// result is either refused or exactly the valid frame; the daemon mustn't
+// check one version of the pixels and compress another.
+//
+static int TestEncodeRewrite(void)
+{
+    const char *szName = "encode_rewrite";
+    GifdFrameBuffer fb;
+    GifdResult result;
+    pthread_t tid;
+    uint8_t *pValid;
+    int i, iSock, iPixels = 512 * 512, rc = GIF_OK;
+
+    iSock = GifdConnect(szSocket[0]);
+    if (iSock < 0)
+        return Fail(szName, "can't connect");
+    if (GifdFrameBufferCreate(&fb, 512, 512, 4) != GIF_OK) {
+        GifdDisconnect(iSock);
+        return Fail(szName, "can't create the frame buffer");
+    }
+    pValid = (uint8_t *)malloc(iPixels);
+    for (i = 0; i < 4; i++)
+        fb.Colors[i].Green = (GifByteType)(i * 80);
+    for (i = 0; i < iPixels; i++)
+        pValid[i] = (uint8_t)((i % 4093) ? (i >> 3) & 3 : 1);
+    memcpy(fb.Pixels, pValid, iPixels);
+    bRewriting = 1;
+    if (pthread_create(&tid, NULL, RewritePixels, &fb) != 0) {
+        free(pValid);
+        GifdFrameBufferFree(&fb);
+        GifdDisconnect(iSock);
+        return Fail(szName, "can't start the writer thread");
+    }
+    for (i = 0; i < 50 && rc == GIF_OK; i++) {
+        if (GifdEncode(iSock, &fb, &result) == GIF_OK) {
+            if (EncodeResultIs(&result, &fb, pValid) != GIF_OK)
+                rc = Fail(szName, "the GIF file doesn't hold the valid frame");
+            GifdRelease(&result);
+        } else if (result.Error != E_GIF_ERR_DATA_TOO_BIG) {
+            rc = Fail(szName, "the request failed");
+        }
+    }
+    bRewriting = 0;
+    pthread_join(tid, NULL);
+    free(pValid);
+    GifdFrameBufferFree(&fb);
+    GifdDisconnect(iSock);
+    return rc;
+} /* TestEncodeRewrite() */
+
+//
+// TestEncodeShortRequest
+//
+// A memfd smaller than the frame it claims to hold is refused before the
+// daemon allocates anything for it
+//
+static int TestEncodeShortRequest(void)
+{
+    const char *szName = "encode_short_request";
+    GifdFrameBuffer fb;
+    GifdResult result;
+    int iSock, rc = GIF_OK;
+
+    iSock = GifdConnect(szSocket[0]);
+    if (iSock < 0)
+        return Fail(szName, "can't connect");
+    memset(&fb, 0, sizeof(fb));
+    fb.Fd = memfd_create("gifd-regress", MFD_CLOEXEC);
+    fb.Width = fb.Height = 65535;
+    fb.ColorCount = 256;
+    if (fb.Fd < 0 || ftruncate(fb.Fd, 4096) != 0)
+        rc = Fail(szName, "can't create the memfd");
+    else if (GifdEncode(iSock, &fb, &result) == GIF_OK || result.Error != E_GIF_ERR_OPEN_FAILED)
+        rc = Fail(szName, "the request was accepted");
+    if (fb.Fd >= 0)
+        close(fb.Fd);
+    GifdDisconnect(iSock);
+    return rc;
+} /* TestEncodeShortRequest() */
+
+//
+// TestLimits
+//
+// The daemon's -p and -m apply to encode requests as well as to decoded
+// files
+//
+static int TestLimits(void)
+{
+    const char *szName = "limits";
+    static const int iBig[1][4] = {{0, 0, 100, 100}}, iSmall[1][4] = {{0, 0, 32, 32}};
+    GifdFrameBuffer fb;
+    GifdResult result;
+    int iSock, rc = GIF_OK;
+
+    if (WriteFrames(TempPath("big.gif"), 100, 100, iBig, 1) != GIF_OK ||
+        WriteFrames(TempPath("small.gif"), 32, 32, iSmall, 1) != GIF_OK)
+        return Fail(szName, "can't write the input files");
+    iSock = GifdConnect(szSocket[1]);
+    if (iSock < 0)
+        return Fail(szName, "can't connect");
+    if (GifdDecodeFile(iSock, TempPath("big.gif"), &result) == GIF_OK || result.Error != D_GIF_ERR_LIMIT_EXCEEDED) {
+        GifdRelease(&result);
+        rc = Fail(szName, "a decode over the pixel limit was accepted");
+    }
+    if (rc == GIF_OK && GifdDecodeFile(iSock, TempPath("small.gif"), &result) != GIF_OK)
+        rc = Fail(szName, "a decode within the limits failed");
+    else if (rc == GIF_OK)
+        GifdRelease(&result);
+    if (rc == GIF_OK && GifdFrameBufferCreate(&fb, 100, 100, 2) == GIF_OK) {
+        memset(fb.Colors, 0, 2 * sizeof(GifColorType));
+        memset(fb.Pixels, 1, 100 * 100);
+        if (GifdEncode(iSock, &fb, &result) == GIF_OK || result.Error != D_GIF_ERR_LIMIT_EXCEEDED) {
+            GifdRelease(&result);
+            rc = Fail(szName, "an encode over the pixel limit was accepted");
+        }
+        GifdFrameBufferFree(&fb);
+    }
+    if (rc == GIF_OK && GifdFrameBufferCreate(&fb, 64, 64, 2) == GIF_OK) { // exactly LIMIT_PIXELS
+        memset(fb.Colors, 0, 2 * sizeof(GifColorType));
+        memset(fb.Pixels, 1, 64 * 64);
+        if (GifdEncode(iSock, &fb, &result) != GIF_OK)
+            rc = Fail(szName, "an encode within the limits failed");
+        else
+            GifdRelease(&result);
+        GifdFrameBufferFree(&fb);
+    }
+    GifdDisconnect(iSock);
+    return rc;
+} /* TestLimits() */
+
+static const struct {
+    const char *szName;
+    TESTFUNC pfnTest;
+} tests[] = {
+    {"decode_frames", TestDecodeFrames},
+    {"encode_round_trip", TestEncodeRoundTrip},
+    {"encode_rewrite", TestEncodeRewrite},
+    {"encode_short_request", TestEncodeShortRequest},
+    {"limits", TestLimits},
+};
+
+//
+// StartDaemon
+//
+// Run gifd with 2 workers on szPath and wait until it accepts connections
+//
+static pid_t StartDaemon(const char *szGifd, const char *szPath, const char *szPixels, const char *szMemory)
+{
+    struct timespec ts = {0, 10000000};
+    pid_t pid;
+    int i, iSock;
+
+    pid = fork();
+    if (pid == 0) {
+        if (szPixels != NULL)
+            execl(szGifd, szGifd, "-s", szPath, "-t", "2", "-c", "64", "-p", szPixels, "-m", szMemory, (char *)NULL);
+        else
+            execl(szGifd, szGifd, "-s", szPath, "-t", "2", "-c", "64", (char *)NULL);
+        _exit(127);
+    }
+    if (pid < 0)
+        return -1;
+    for (i = 0; i < 500; i++) { // up to 5 seconds
+        iSock = GifdConnect(szPath);
+        if (iSock >= 0) {
+            GifdDisconnect(iSock);
+            return pid;
+        }
+        if (waitpid(pid, NULL, WNOHANG) == pid)
+            return -1;
+        nanosleep(&ts, NULL);
+    }
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+    return -1;
+} /* StartDaemon() */
+
+static void StopDaemons(void)
+{
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        if (pidDaemon[i] > 0) {
+            kill(pidDaemon[i], SIGTERM);
+            waitpid(pidDaemon[i], NULL, 0);
+        }
+    }
+} /* StopDaemons() */
+
+static void RemoveTempDir(void)
+{
+    DIR *pDir = opendir(szTempDir);
+    struct dirent *pEntry;
+
+    if (pDir != NULL) {
+        while ((pEntry = readdir(pDir)) != NULL) {
+            if (pEntry->d_name[0] != '.')
+                unlink(TempPath(pEntry->d_name));
+        }
+        closedir(pDir);
+    }
+    rmdir(szTempDir);
+} /* RemoveTempDir() */
+
+int main(int argc, char *argv[])
+{
+    char szPixels[32];
+    int i, j, iFailed = 0;
+    bool bRun;
+
+    if (argc < 2) {
+        printf("usage: gifd_regress path/to/gifd [test name ...]\n");
+        return EXIT_FAILURE;
+    }
+    strcpy(szTempDir, "/tmp/gifd_regress_XXXXXX");
+    if (mkdtemp(szTempDir) == NULL) {
+        printf("can't create a temporary directory\n");
+        return EXIT_FAILURE;
+    }
+    snprintf(szSocket[0], sizeof(szSocket[0]), "%s/gifd.sock", szTempDir);
+    snprintf(szSocket[1], sizeof(szSocket[1]), "%s/limits.sock", szTempDir);
+    snprintf(szPixels, sizeof(szPixels), "%d", LIMIT_PIXELS);
+    signal(SIGPIPE, SIG_IGN);
+    pidDaemon[0] = StartDaemon(argv[1], szSocket[0], NULL, NULL);
+    pidDaemon[1] = StartDaemon(argv[1], szSocket[1], szPixels, "1");
+    if (pidDaemon[0] < 0 || pidDaemon[1] < 0) {
+        printf("FAIL can't start %s\n", argv[1]);
+        StopDaemons();
+        RemoveTempDir();
+        return EXIT_FAILURE;
+    }
+    for (i = 0; i < (int)(sizeof(tests) / sizeof(tests[0])); i++) {
+        bRun = (argc < 3);
+        for (j = 2; j < argc; j++)
+            bRun |= (strcmp(argv[j], tests[i].szName) == 0);
+        if (!bRun)
+            continue;
+        if ((*tests[i].pfnTest)() == GIF_OK)
+            printf("ok %s\n", tests[i].szName);
+        else
+            iFailed++;
+        fflush(stdout);
+    }
+    StopDaemons();
+    RemoveTempDir();
+    return iFailed;
+} /* main() */
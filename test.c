@@ -104,7 +104,7 @@ GifFileType *gif_in = NULL, *gif_out = NULL;
 //GifImageDesc image_desc;
 //GifRecordType type;
 int gif_error = GIF_ERROR;
-int i, j;
+int i;
     
     DoGifWedge(argv[1]);
     return 0;
@@ -124,13 +124,8 @@ int i, j;
         gif_out->SHeight = gif_in->SHeight;
         gif_out->SColorResolution = gif_in->SColorResolution;
         gif_out->SBackGroundColor = gif_in->SBackGroundColor;
-        if (gif_in->SColorMap) {
-                gif_out->SColorMap = GifMakeMapObject(gif_in->SColorMap->ColorCount, gif_in->SColorMap->Colors);
-        } else {
-            gif_out->SColorMap = NULL;
-        }
-        for (j = 0; j < gif_in->ImageCount; j++)
-            (void) GifMakeSavedImage(gif_out, &gif_in->SavedImages[j]);
+        // Hand the decoded frames (and global palette) over without copying
+        GifMoveSavedImages(gif_out, gif_in);
 
         EGifSpew(gif_out); // closes file and frees resources
         DGifCloseFile(gif_in, &gif_error);